@@ -0,0 +1,149 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains a command line tool which estimates the bus load and the worst case latencies of a DCF set.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include "BusLoadAnalyzer.h"
+
+namespace
+{
+	void printUsage(const char* name)
+	{
+		std::cerr << "Usage: " << name << " [options] master.dcf" << std::endl
+				  << "  -b <kbit/s>         bit rate (default: 500)" << std::endl
+				  << "  -m <node ID>        node ID of the master (default: 16)" << std::endl
+				  << "  -s <ms>             SYNC period, overrides 0x1006 of the master.dcf" << std::endl
+				  << "  -r <frames/s>       expected rate of event driven PDOs (default: 100)" << std::endl
+				  << "  -e <COB ID>=<frames/s>  expected rate of one event driven PDO" << std::endl
+				  << "  -d <node ID>=<file> additional slave with a textual DCF" << std::endl
+				  << "  -c <node ID>=<file> additional slave with a concise DCF" << std::endl
+				  << "The slaves in 0x1F20 (textual) and 0x1F22 (concise) of the master.dcf are added automatically." << std::endl;
+	}
+
+	/// Splits "<number>=<value>" into both parts.
+	bool splitAssignment(const std::string& argument, unsigned long& number, std::string& value)
+	{
+		auto separator = argument.find('=');
+		if (separator == std::string::npos)
+			return false;
+		number = std::strtoul(argument.substr(0, separator).c_str(), nullptr, 0);
+		value = argument.substr(separator + 1);
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t bitRate = 500000;
+	unsigned long masterNodeID = 16;
+	double syncPeriodMs = 0;
+	double defaultEventRate = 100;
+	std::vector<std::pair<uint32_t, double>> eventRates;
+	std::vector<std::pair<uint8_t, std::string>> textualSlaves;
+	std::vector<std::pair<uint8_t, std::string>> conciseSlaves;
+
+	int option;
+	while ((option = getopt(argc, argv, "b:m:s:r:e:d:c:h")) != -1)
+	{
+		unsigned long number = 0;
+		std::string value;
+		switch (option)
+		{
+		case 'b':
+			bitRate = std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case 'm':
+			masterNodeID = std::strtoul(optarg, nullptr, 0);
+			break;
+		case 's':
+			syncPeriodMs = std::strtod(optarg, nullptr);
+			break;
+		case 'r':
+			defaultEventRate = std::strtod(optarg, nullptr);
+			break;
+		case 'e':
+			if (!splitAssignment(optarg, number, value))
+			{
+				printUsage(argv[0]);
+				return 1;
+			}
+			eventRates.emplace_back(number, std::strtod(value.c_str(), nullptr));
+			break;
+		case 'd':
+		case 'c':
+			if (!splitAssignment(optarg, number, value))
+			{
+				printUsage(argv[0]);
+				return 1;
+			}
+			(option == 'd' ? textualSlaves : conciseSlaves).emplace_back(number, value);
+			break;
+		default:
+			printUsage(argv[0]);
+			return option == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1 || bitRate == 0)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	BusLoadAnalyzer analyzer(bitRate);
+	analyzer.setSyncPeriod(syncPeriodMs);
+	analyzer.setDefaultEventRate(defaultEventRate);
+	for (const auto& eventRate : eventRates)
+		analyzer.setEventRate(eventRate.first, eventRate.second);
+
+	std::error_code error;
+	bool ok = analyzer.addMasterDcf(argv[optind], masterNodeID, error);
+	for (const auto& slave : textualSlaves)
+		ok = ok && analyzer.addSlaveDcf(slave.second, slave.first, error);
+	for (const auto& slave : conciseSlaves)
+		ok = ok && analyzer.addSlaveConciseDcf(slave.second, slave.first, error);
+	if (!ok)
+	{
+		std::cerr << "Cannot read the DCF set: " << error.message() << std::endl;
+		return 1;
+	}
+
+	auto result = analyzer.analyze();
+	std::cout << boost::format("%-10s %-5s %-10s %-10s %-12s %-10s %s") % "COB ID" % "DLC" % "period/ms" % "frame/ms" % "response/ms" % "deadline" % "source" << std::endl;
+	for (const auto& message : result.messages)
+	{
+		std::cout << boost::format("0x%-8x %-5d %-10.3f %-10.3f %-12.3f %-10s %s")
+					 % message.cobID % static_cast<int>(message.dataBytes) % message.periodMs % message.frameTimeMs
+					 % message.responseTimeMs % (message.schedulable ? "ok" : "MISSED") % message.description << std::endl;
+	}
+	std::cout << boost::format("%d messages, %.1f frames/s, bus utilization %.1f %% at %d kbit/s: %s")
+				 % result.messages.size() % result.framesPerSecond % (result.utilization * 100) % (bitRate / 1000)
+				 % (result.schedulable ? "all deadlines met" : "deadlines MISSED") << std::endl;
+
+	return result.schedulable ? 0 : 2;
+}
@@ -0,0 +1,217 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains a command line tool which compares the CPU time of lely::io::CanChannel and BatchedCanChannel.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include <lely/ev/loop.hpp>
+#include <lely/io2/linux/can.hpp>
+#include <lely/io2/posix/poll.hpp>
+
+#include "BatchedCanChannel.h"
+
+namespace
+{
+	const size_t FRAMES_PER_RESULT = 10000;
+	/// The time to wait for a frame before the frames in flight are counted as lost.
+	const std::chrono::milliseconds RECEIVE_TIMEOUT(100);
+
+	void printUsage(const char* name)
+	{
+		std::cerr << "Usage: " << name << " [options]" << std::endl
+				  << "  -i <interface>      CAN interface, a vcan interface avoids the limit of the bit rate (default: vcan0)" << std::endl
+				  << "  -n <frames>         number of frames per run (default: 100000)" << std::endl
+				  << "  -b <frames>         frames written per task of the executor, e.g. the PDOs after a SYNC (default: 64)" << std::endl
+				  << "Sends the frames from one channel to another one through the event loop, like the master does:" << std::endl
+				  << "first with lely::io::CanChannel, then with BatchedCanChannel." << std::endl;
+	}
+
+	double getCpuTime()
+	{
+		timespec time;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+		return time.tv_sec + time.tv_nsec * 1e-9;
+	}
+
+	struct Result
+	{
+		double cpuTime;
+		size_t frames;
+		size_t lostFrames;
+	};
+
+	/**
+	 * @brief run writes the frames in groups of the given size to the sender, each group in one task, and waits until the
+	 * receiver has read them before the next group, so no receive queue overflows. The receiver always has one read pending.
+	 */
+	void run(lely::ev::Loop& loop, lely::io::CanChannelBase& sender, lely::io::CanChannelBase& receiver, size_t frames, size_t groupSize, Result& result)
+	{
+		std::vector<can_msg> txFrames(groupSize, CAN_MSG_INIT);
+		can_msg rxFrame = CAN_MSG_INIT;
+		size_t received = 0;
+		size_t writeErrors = 0;
+		bool receiving = true;
+
+		std::function<void()> read;
+		read = [&]()
+		{
+			receiver.submit_read(&rxFrame, nullptr, nullptr, [&](int readResult, std::error_code ec)
+			{
+				if (!ec && readResult == 1)
+					received++;
+				if (receiving && ec != std::errc::operation_canceled)
+					read();
+			});
+		};
+
+		double start = getCpuTime();
+		read();
+		size_t lostFrames = 0;
+		for (size_t frame = 0; frame < frames; )
+		{
+			size_t count = std::min(groupSize, frames - frame);
+			for (size_t i = 0; i < count; i++)
+			{
+				txFrames[i].id = 0x180 + ((frame + i) & 0x7F);
+				txFrames[i].len = 8;
+				for (size_t byte = 0; byte < 8; byte++)
+					txFrames[i].data[byte] = static_cast<uint8_t>((frame + i) >> (8 * byte));
+				sender.submit_write(txFrames[i], [&writeErrors](std::error_code ec)
+				{
+					if (ec)
+						writeErrors++;
+				});
+			}
+			frame += count;
+
+			while (received + lostFrames + writeErrors < frame)
+			{
+				if (loop.run_one_for(RECEIVE_TIMEOUT) == 0)
+					lostFrames = frame - received - writeErrors;
+			}
+		}
+		result.cpuTime = getCpuTime() - start;
+
+		receiving = false;
+		receiver.cancel();
+		loop.poll();
+		result.frames = frames;
+		result.lostFrames = frames > received ? frames - received : 0;
+	}
+
+	void print(const char* name, const Result& result)
+	{
+		double scale = static_cast<double>(FRAMES_PER_RESULT) / result.frames;
+		std::cout << boost::format("%-20s %12.0f %12zu") % name % (result.cpuTime * 1e6 * scale) % result.lostFrames << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string interface = "vcan0";
+	size_t frames = 100000;
+	size_t groupSize = BatchedCanSocket::MAX_BATCH;
+
+	int option;
+	while ((option = getopt(argc, argv, "i:n:b:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'i':
+			interface = optarg;
+			break;
+		case 'n':
+			frames = std::strtoul(optarg, nullptr, 0);
+			break;
+		case 'b':
+			groupSize = std::strtoul(optarg, nullptr, 0);
+			break;
+		default:
+			printUsage(argv[0]);
+			return option == 'h' ? 0 : 1;
+		}
+	}
+	if (frames == 0 || groupSize == 0 || groupSize > BatchedCanChannel::MAX_QUEUED_FRAMES)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	lely::io::Context ctx;
+	lely::io::Poll poll(ctx);
+	lely::ev::Loop loop(poll.get_poll());
+	auto exec = loop.get_executor();
+
+	Result lelyResult;
+	try
+	{
+		lely::io::CanController controller(interface.c_str());
+		lely::io::CanChannel sender(poll, exec);
+		lely::io::CanChannel receiver(poll, exec);
+		sender.open(controller);
+		receiver.open(controller);
+		run(loop, sender, receiver, frames, groupSize, lelyResult);
+	}
+	catch (const std::system_error& error)
+	{
+		std::cerr << "Cannot open " << interface << ": " << error.what() << std::endl;
+		return 1;
+	}
+
+	Result batchedResult;
+	BatchedCanChannel::Statistics senderStatistics;
+	BatchedCanChannel::Statistics receiverStatistics;
+	{
+		std::error_code error;
+		BatchedCanChannel sender(ctx, poll, exec);
+		BatchedCanChannel receiver(ctx, poll, exec);
+		if (!sender.open(interface, error) || !receiver.open(interface, error))
+		{
+			std::cerr << "Cannot open " << interface << ": " << error.message() << std::endl;
+			return 1;
+		}
+		run(loop, sender.getChannel(), receiver.getChannel(), frames, groupSize, batchedResult);
+		senderStatistics = sender.getStatistics();
+		receiverStatistics = receiver.getStatistics();
+	}
+
+	double scale = static_cast<double>(FRAMES_PER_RESULT) / frames;
+	std::cout << boost::format("Per %u frames on %s, %u frames written per task (CPU time of sending and receiving):") % FRAMES_PER_RESULT % interface % groupSize << std::endl;
+	std::cout << boost::format("%-20s %12s %12s") % "" % "CPU time/us" % "lost frames" << std::endl;
+	print("lely CanChannel", lelyResult);
+	print("BatchedCanChannel", batchedResult);
+	std::cout << boost::format("BatchedCanChannel: %.0f sendmmsg() and %.0f recvmmsg() calls, lely CanChannel: one write() and one read() per frame.")
+				 % (senderStatistics.sendCalls * scale) % (receiverStatistics.receiveCalls * scale) << std::endl;
+	if (lelyResult.cpuTime > 0)
+		std::cout << boost::format("BatchedCanChannel saves %.0f %% of the CPU time.") % (100.0 * (1.0 - batchedResult.cpuTime / lelyResult.cpuTime)) << std::endl;
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a structure-of-arrays table of the axes of a master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The AxisTable class keeps the process data of all axes of a master in contiguous arrays, one array per value
+ * (structure of arrays) instead of one object per axis.
+ *
+ * A question about the whole machine (are all axes idle? is any axis faulted? what is the largest following error?) is then
+ * one pass over one or two small arrays, which the compiler vectorizes, instead of a walk through the driver objects.
+ * DCFConfigMaster fills it from the received PDOs (see DCFConfigMaster::getAxisTable()).
+ *
+ * Written and read on the executor of the master only; other threads use MotorDriver::getSnapshot().
+ */
+class AxisTable
+{
+public:
+	/// The state of the CiA-402 state machine, decoded from the status word.
+	enum Cia402State : uint8_t
+	{
+		UNKNOWN,
+		NOT_READY_TO_SWITCH_ON,
+		SWITCH_ON_DISABLED,
+		READY_TO_SWITCH_ON,
+		SWITCHED_ON,
+		OPERATION_ENABLED,
+		QUICK_STOP_ACTIVE,
+		FAULT_REACTION_ACTIVE,
+		FAULT
+	};
+
+	/// The flags of an axis, the bits of the status word which the queries need.
+	enum Flags : uint8_t
+	{
+		FLAG_STATUS_WORD_RECEIVED = 0x01,
+		FLAG_FAULT                = 0x02,
+		FLAG_WARNING              = 0x04,
+		FLAG_TARGET_REACHED       = 0x08,
+		FLAG_FOLLOWING_ERROR      = 0x10  ///< A following error is received for the axis.
+	};
+
+	static const size_t INVALID_SLOT = static_cast<size_t>(-1);
+
+	AxisTable();
+
+	/// Adds an axis (if not present yet) and returns its slot, the position in the arrays.
+	size_t addAxis(uint8_t nodeID);
+	/// Returns the slot of the axis or INVALID_SLOT.
+	size_t getSlot(uint8_t nodeID) const {return nodeID < 128 && m_slots[nodeID] >= 0 ? static_cast<size_t>(m_slots[nodeID]) : INVALID_SLOT;}
+	size_t size() const {return m_nodeIDs.size();}
+	void clear();
+
+	void setStatusWord(size_t slot, uint16_t statusWord);
+	void setPosition(size_t slot, int32_t position) {m_positions[slot] = position;}
+	void setFollowingError(size_t slot, int32_t followingError);
+
+	uint8_t getNodeID(size_t slot) const {return m_nodeIDs[slot];}
+	uint16_t getStatusWord(size_t slot) const {return m_statusWords[slot];}
+	Cia402State getState(size_t slot) const {return static_cast<Cia402State>(m_states[slot]);}
+	uint8_t getFlags(size_t slot) const {return m_flags[slot];}
+	int32_t getPosition(size_t slot) const {return m_positions[slot];}
+	int32_t getFollowingError(size_t slot) const {return m_followingErrors[slot];}
+
+	/// The arrays themselves, e.g. for custom queries; size() elements each.
+	const uint16_t* getStatusWords() const {return m_statusWords.data();}
+	const uint8_t* getStates() const {return m_states.data();}
+	const uint8_t* getFlags() const {return m_flags.data();}
+	const int32_t* getPositions() const {return m_positions.data();}
+	const int32_t* getFollowingErrors() const {return m_followingErrors.data();}
+
+	/// true if the table has axes and every axis has reported its status word, is switched on or operation enabled, has no fault and has reached its target.
+	bool allIdle() const;
+	bool anyFault() const;
+	size_t countFaults() const;
+	/**
+	 * @brief getMaxFollowingError returns the largest absolute following error of the axes which receive it.
+	 * @param slot Set to the slot of that axis, INVALID_SLOT if no axis receives a following error.
+	 */
+	uint32_t getMaxFollowingError(size_t* slot = nullptr) const;
+
+	static Cia402State decodeState(uint16_t statusWord);
+
+private:
+	std::vector<uint8_t> m_nodeIDs;
+	std::vector<uint16_t> m_statusWords;
+	std::vector<uint8_t> m_states;
+	std::vector<uint8_t> m_flags;
+	std::vector<int32_t> m_positions;
+	std::vector<int32_t> m_followingErrors;
+	/// The slot of each node ID, -1 if the node has no axis.
+	int16_t m_slots[128];
+};
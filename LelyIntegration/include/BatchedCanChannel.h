@@ -0,0 +1,143 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a CAN channel which batches the frames of the master into few system calls.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <lely/ev/exec.hpp>
+#include <lely/io2/posix/poll.hpp>
+#include <lely/io2/sys/timer.hpp>
+#include <lely/io2/user/can.hpp>
+
+#include "BatchedCanSocket.h"
+
+/**
+ * @brief The BatchedCanChannel class is a SocketCAN backend for the master which replaces lely::io::CanChannel.
+ *
+ * lely::io::CanChannel reads and writes one frame per system call. This channel reads all received frames with one recvmmsg()
+ * when the socket becomes readable and collects the frames written during one task of the executor (e.g. all PDOs after a SYNC),
+ * which are then sent with one sendmmsg(). The master uses getChannel() like any other channel, e.g.
+ * @code
+ * BatchedCanChannel channel(ctx, poll, exec);
+ * channel.open("can0", error);
+ * auto master = std::make_shared<DCFConfigMaster>(timer, channel.getChannel(), "master.dcf", exec);
+ * @endcode
+ */
+class BatchedCanChannel
+{
+public:
+	/// The frames which wait for the socket, further frames are rejected.
+	static const size_t MAX_QUEUED_FRAMES = 1024;
+	/// The first delay after the queue of the interface was full (ENOBUFS): about one frame at 500 kbit/s. Doubled up to the maximum.
+	/// The socket is watched again with the same delays while receiving fails, e.g. when the interface is down.
+	static constexpr std::chrono::microseconds MIN_RETRY_DELAY{250};
+	static constexpr std::chrono::microseconds MAX_RETRY_DELAY{10000};
+
+	/**
+	 * @brief Statistics counts the system calls and frames, to check the batching.
+	 */
+	struct Statistics
+	{
+		size_t receiveCalls;
+		size_t receivedFrames;
+		size_t sendCalls;
+		size_t sentFrames;
+		/// The frames rejected because the queue was full.
+		size_t droppedFrames;
+		/**
+		 * The frames dropped by the receive filter since it was set, i.e. the wakeups avoided: the frames of the interface
+		 * which were not received. Only an estimate on a vcan interface, which counts the sent frames as received, too.
+		 */
+		size_t filteredFrames;
+	};
+
+	BatchedCanChannel(lely::io::Context& ctx, io_poll_t* poll, ev_exec_t* exec);
+	~BatchedCanChannel();
+
+	BatchedCanChannel(const BatchedCanChannel&) = delete;
+	BatchedCanChannel& operator=(const BatchedCanChannel&) = delete;
+
+	/// Opens the socket of the interface and starts receiving.
+	bool open(const std::string& interface, std::error_code& error);
+	void close();
+
+	/// The channel to pass to the master.
+	lely::io::CanChannelBase& getChannel() {return m_channel;}
+
+	/**
+	 * @brief setReceiveFilter lets the kernel drop all frames except the given ones (see BatchedCanSocket::setReceiveFilter()).
+	 * Used by DCFConfigMaster::enableReceiveFilter().
+	 */
+	bool setReceiveFilter(const std::vector<uint32_t>& cobIDs, std::error_code& error);
+
+	Statistics getStatistics() const;
+
+private:
+	/// Called by the poll, the watch is the first member.
+	struct PollWatch
+	{
+		struct io_poll_watch base;
+		BatchedCanChannel* channel;
+	};
+
+	static int onWrite(const can_msg* msg, int timeout, void* arg);
+	static void onPollEvent(struct io_poll_watch* watch, int events);
+
+	void receive();
+	void flush();
+	/// Sends the remaining frames after the retry delay, which is doubled for each retry in a row.
+	void retryLater();
+	/// Watches the socket for received frames and, if frames are waiting, for space in the send queue.
+	void watch();
+	/// Calls watch() after the watch delay, which is doubled for each receive error in a row, so a persistent error does not spin.
+	void watchLater();
+
+	io_poll_t* m_poll;
+	lely::ev::Executor m_exec;
+	BatchedCanSocket m_socket;
+	lely::io::UserCanChannel m_channel;
+	PollWatch m_watch;
+	lely::io::Timer m_retryTimer;
+	lely::io::Timer m_watchTimer;
+
+	mutable std::mutex m_mutex;
+	std::vector<can_msg> m_txQueue;
+	bool m_flushPosted = false;
+	bool m_waitingForOutput = false;
+	/// Set while the frames wait for the retry timer, the socket is writable even though the queue of the interface is full.
+	bool m_waitingForRetry = false;
+	std::chrono::microseconds m_retryDelay{0};
+	/// Set while the socket is not watched because of receive errors.
+	bool m_waitingForWatch = false;
+	std::chrono::microseconds m_watchDelay{0};
+	/// The receive errors since the last frame received, only the first one is reported.
+	size_t m_receiveErrors = 0;
+	size_t m_droppedFrames = 0;
+	/// The frames of the interface and of the socket when the receive filter was set.
+	size_t m_interfaceFramesAtFilter = 0;
+	size_t m_receivedFramesAtFilter = 0;
+	bool m_filtered = false;
+};
@@ -0,0 +1,95 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a SocketCAN socket which reads and writes several frames per system call.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <lely/can/msg.h>
+
+/**
+ * @brief The BatchedCanSocket class is a non-blocking SocketCAN raw socket which transfers up to MAX_BATCH frames with one
+ * recvmmsg() / sendmmsg() call, instead of one read() / write() per frame. Used by BatchedCanChannel.
+ */
+class BatchedCanSocket
+{
+public:
+	static const size_t MAX_BATCH = 64;
+	/// The maximum number of receive filters of the kernel (CAN_RAW_FILTER_MAX).
+	static const size_t MAX_FILTERS = 512;
+
+	BatchedCanSocket() = default;
+	~BatchedCanSocket();
+
+	BatchedCanSocket(const BatchedCanSocket&) = delete;
+	BatchedCanSocket& operator=(const BatchedCanSocket&) = delete;
+
+	/**
+	 * @brief open binds the socket to the given interface, e.g. can0 or vcan0.
+	 * @param receiveOwnFrames Set to receive the frames sent by this socket, e.g. for a loopback benchmark.
+	 */
+	bool open(const std::string& interface, std::error_code& error, bool receiveOwnFrames = false);
+	void close();
+	bool isOpen() const {return m_fd >= 0;}
+	/// The socket, e.g. to wait for it with poll().
+	int getHandle() const {return m_fd;}
+
+	/**
+	 * @brief setReceiveFilter lets the kernel drop all frames except the given ones, so they do not wake up the reader.
+	 * @param cobIDs The CAN IDs to receive (data and remote frames), bit 29 set for an extended ID like in CANopen COB IDs.
+	 * All frames are received if the list is empty.
+	 */
+	bool setReceiveFilter(const std::vector<uint32_t>& cobIDs, std::error_code& error);
+
+	/// The frames received by the interface, including the ones dropped by the filter (from sysfs), 0 if unknown.
+	size_t getInterfaceReceivedFrames() const;
+
+	/**
+	 * @brief receive reads the frames which are available without blocking.
+	 * @return The number of frames read, 0 if none is available or on an error.
+	 */
+	size_t receive(can_msg* msgs, size_t count, std::error_code& error);
+
+	/**
+	 * @brief send writes as many of the frames as the socket takes without blocking.
+	 * @return The number of frames sent, the remaining ones have to be sent again once the socket is writable.
+	 * If the queue of the interface is full (ENOBUFS), error is std::errc::no_buffer_space: the socket reports itself writable
+	 * nevertheless, so the frames have to be sent again after a delay instead.
+	 */
+	size_t send(const can_msg* msgs, size_t count, std::error_code& error);
+
+	/// The number of system calls and frames, to compare them.
+	size_t getReceiveCalls() const {return m_receiveCalls;}
+	size_t getReceivedFrames() const {return m_receivedFrames;}
+	size_t getSendCalls() const {return m_sendCalls;}
+	size_t getSentFrames() const {return m_sentFrames;}
+
+private:
+	int m_fd = -1;
+	std::string m_interface;
+	size_t m_receiveCalls = 0;
+	size_t m_receivedFrames = 0;
+	size_t m_sendCalls = 0;
+	size_t m_sentFrames = 0;
+};
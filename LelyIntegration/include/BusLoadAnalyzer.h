@@ -0,0 +1,136 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of an offline bus load and worst case latency estimator for a DCF set.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * @brief The BusLoadAnalyzer class estimates the bus load and the worst case response time of each COB ID of a configuration
+ * before it is deployed.
+ *
+ * The cyclic traffic (PDOs, SYNC, heartbeats) is read from the master.dcf, the slave DCFs it refers to
+ * (0x1F20 textual, 0x1F22 concise DCFs as generated by dcfgen from the YAML file) and additional slave DCFs.
+ * The period of event driven PDOs is taken from the expected event rates, the event timer and the inhibit time;
+ * the period of synchronous PDOs from the SYNC period.
+ * The response times are calculated with the CAN schedulability analysis of Davis et al. (2007):
+ * non-preemptive fixed priority scheduling, the lower the COB ID, the higher the priority.
+ */
+class BusLoadAnalyzer
+{
+public:
+	/**
+	 * @brief Message describes one COB ID on the bus.
+	 */
+	struct Message
+	{
+		uint32_t cobID;
+		bool extended;             ///< 29 bit identifier
+		uint8_t dataBytes;
+		double periodMs;           ///< The minimum time between two frames.
+		double deadlineMs;         ///< 0 = periodMs.
+		std::string description;
+
+		// Calculated by analyze():
+		double frameTimeMs;        ///< Worst case transmission time including the stuff bits.
+		double responseTimeMs;     ///< Worst case time from the queuing until the end of the transmission, infinity if unbounded.
+		bool schedulable;          ///< responseTimeMs <= deadline
+	};
+
+	/**
+	 * @brief Result of the analysis.
+	 */
+	struct Result
+	{
+		std::vector<Message> messages;  ///< Sorted by priority.
+		double framesPerSecond;
+		double utilization;             ///< 1.0 = 100 %
+		bool schedulable;               ///< All messages meet their deadline.
+	};
+
+	/**
+	 * @param bitRate The bit rate of the bus in bit/s, e.g. 500000.
+	 */
+	explicit BusLoadAnalyzer(uint32_t bitRate);
+
+	/// Overrides the SYNC period of the master.dcf (0x1006). Used for synchronous PDOs and the SYNC message itself.
+	void setSyncPeriod(double periodMs) {m_syncPeriodMs = periodMs;}
+	/// The expected rate of event driven PDOs without a specific rate (see setEventRate()). Default: 100 frames/s.
+	void setDefaultEventRate(double framesPerSecond) {m_defaultEventRate = framesPerSecond;}
+	/// The expected rate of the event driven PDO with the given COB ID.
+	void setEventRate(uint32_t cobID, double framesPerSecond) {m_eventRates[cobID & 0x1FFFFFFF] = framesPerSecond;}
+
+	/**
+	 * @brief addMasterDcf adds the PDOs, the SYNC and the heartbeat of the master as well as all slaves configured in the master.dcf.
+	 * Relative file names of slave DCFs are resolved against the directory of the master.dcf.
+	 * @return false if the master.dcf or a slave DCF cannot be read.
+	 */
+	bool addMasterDcf(const std::string& fileName, uint8_t nodeID, std::error_code& error);
+	/// Adds the TPDOs and the heartbeat of a slave with a textual DCF.
+	bool addSlaveDcf(const std::string& fileName, uint8_t nodeID, std::error_code& error);
+	/// Adds the TPDOs and the heartbeat of a slave configured with a concise DCF.
+	bool addSlaveConciseDcf(const std::string& fileName, uint8_t nodeID, std::error_code& error);
+
+	/// Adds any other cyclic message (e.g. an expected SDO load). Only cobID, extended, dataBytes, periodMs, deadlineMs and description are used.
+	void addMessage(const Message& message);
+
+	/**
+	 * @brief analyze calculates the bus load and the response times.
+	 */
+	Result analyze() const;
+
+	/**
+	 * @brief getFrameTime returns the worst case transmission time in seconds of a frame, stuff bits included.
+	 */
+	static double getFrameTime(uint32_t bitRate, uint8_t dataBytes, bool extended);
+
+private:
+	/// The PDO parameters as found in the DCFs; the period is calculated by analyze() since it depends on the rates.
+	struct PdoSource
+	{
+		uint32_t cobID;
+		uint8_t transmissionType;
+		uint16_t inhibitTime;
+		uint16_t eventTimer;
+		uint8_t dataBytes;
+		std::string description;
+		bool producer;  ///< false: the PDO is only known from a consumer (an RPDO), its parameters do not tell when it is sent.
+	};
+
+	void addPdo(const PdoSource& pdo);
+	void addHeartbeat(uint8_t nodeID, uint16_t producerTimeMs, const std::string& description);
+	double getPdoPeriod(const PdoSource& pdo) const;
+	void calculateResponseTimes(std::vector<Message>& messages) const;
+
+	uint32_t m_bitRate;
+	double m_syncPeriodMs = 0;
+	double m_dcfSyncPeriodMs = 0;
+	uint32_t m_syncCobID = 0x80;
+	double m_defaultEventRate = 100;
+	std::map<uint32_t, double> m_eventRates;
+
+	std::vector<PdoSource> m_pdos;
+	std::vector<Message> m_messages;
+};
@@ -0,0 +1,70 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a runtime bus load monitor.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+/**
+ * @brief The BusLoadMonitor class measures the frame rate per COB ID and the resulting bus load at runtime.
+ * The frames are counted in a measurement window which is closed by update(); the results of the last window are returned.
+ * It only knows the frames it is told about (see DCFConfigMaster::enableBusLoadMonitoring()). Not thread safe, DCFConfigMaster
+ * calls countFrame() and update() with its lock held.
+ */
+class BusLoadMonitor
+{
+public:
+	/**
+	 * @param bitRate The bit rate of the bus in bit/s, e.g. 500000.
+	 */
+	explicit BusLoadMonitor(uint32_t bitRate);
+
+	/// Counts one frame of the current measurement window.
+	void countFrame(uint32_t cobID, uint8_t dataBytes);
+
+	/// Closes the current measurement window and starts the next one.
+	void update(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+	/// The bus load of the last window, 1.0 = 100 %.
+	double getBusLoad() const {return m_busLoad;}
+	/// The frames per second of the given COB ID in the last window.
+	double getFrameRate(uint32_t cobID) const;
+	/// The frames per second of all COB IDs seen in the last window.
+	const std::map<uint32_t, double>& getFrameRates() const {return m_frameRates;}
+
+	uint32_t getBitRate() const {return m_bitRate;}
+
+private:
+	struct Counter
+	{
+		uint32_t frames;
+		double busTime;  ///< in s
+	};
+
+	uint32_t m_bitRate;
+	double m_frameTimes[9];  ///< The worst case frame time per DLC.
+	std::chrono::steady_clock::time_point m_windowStartedAt;
+	std::map<uint32_t, Counter> m_counters;
+	std::map<uint32_t, double> m_frameRates;
+	double m_busLoad = 0;
+};
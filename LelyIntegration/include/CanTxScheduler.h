@@ -0,0 +1,151 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a scheduler for the CAN frames sent by the master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <set>
+#include <lely/can/net.h>
+
+/**
+ * @brief The CanTxScheduler class sits between the CAN network of the master and the CAN channel (as send function of the network)
+ * and sends the frames of the master by traffic class instead of in submission order.
+ *
+ * Motion frames (the PDOs, SYNC and NMT) are always sent immediately. The other frames wait in one queue per class while their class
+ * is held back: SDO requests are shaped with a token bucket, so a burst of configuration SDOs cannot fill the transmit buffer
+ * in front of the PDOs, and optionally all non-cyclic frames are confined to the gap after the SYNC window (requires that the
+ * master produces the SYNC). Service frames (heartbeat, EMCY, ...) are sent before SDO requests. The frames of a class keep their order.
+ * The queueing latency is measured per class. Used by DCFConfigMaster (see DCFConfigMaster::enableTxScheduling()),
+ * call it with the lock of the master held.
+ */
+class CanTxScheduler
+{
+public:
+	enum TrafficClass
+	{
+		MOTION,
+		SERVICE,
+		SDO,
+		NUMBER_OF_TRAFFIC_CLASSES
+	};
+
+	/**
+	 * @brief Statistics describes the frames of one traffic class.
+	 */
+	struct Statistics
+	{
+		size_t frames;
+		/// The frames which were not sent immediately.
+		size_t queuedFrames;
+		/// The frames rejected because the queue was full.
+		size_t droppedFrames;
+		std::chrono::microseconds maxLatency;
+		std::chrono::microseconds totalLatency;
+	};
+
+	/// Called with the delay after which release() should be called, because frames are waiting.
+	typedef std::function<void(std::chrono::microseconds)> ReleaseRequest;
+
+	/**
+	 * @brief Installs the scheduler as send function of the network, the previous send function is used to send the frames.
+	 */
+	CanTxScheduler(can_net_t* net, ReleaseRequest releaseRequest);
+	/// Restores the previous send function, the queued frames are lost.
+	~CanTxScheduler();
+
+	CanTxScheduler(const CanTxScheduler&) = delete;
+	CanTxScheduler& operator=(const CanTxScheduler&) = delete;
+
+	/// Frames with this COB ID (bit 29 set for an extended frame) are motion frames. SYNC and NMT are motion frames by default.
+	void addMotionCobID(uint32_t cobID);
+	void clearMotionCobIDs();
+
+	/**
+	 * @brief setSdoRate shapes the SDO requests.
+	 * @param framesPerSecond The long term rate, 0 = unlimited.
+	 * @param burst The number of frames which may be sent at once after a pause.
+	 */
+	void setSdoRate(unsigned framesPerSecond, unsigned burst);
+
+	/**
+	 * @brief setSyncGap confines the non-cyclic frames (service and SDO) to the gap after the SYNC window.
+	 * @param syncCobID The COB ID of the SYNC, the time of the SYNC is taken when the master sends it.
+	 * @param period The communication cycle period (0x1006), 0 disables the confinement.
+	 * @param windowLength The synchronous window length (0x1007).
+	 * @param guardTime Non-cyclic frames are not started later than this before the next SYNC.
+	 */
+	void setSyncGap(uint32_t syncCobID, std::chrono::microseconds period, std::chrono::microseconds windowLength, std::chrono::microseconds guardTime);
+
+	/**
+	 * @brief release sends the waiting frames which are allowed now. Called after the delay requested by the ReleaseRequest.
+	 */
+	void release(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+	Statistics getStatistics(TrafficClass trafficClass) const {return m_statistics[trafficClass];}
+	size_t getQueuedFrames(TrafficClass trafficClass) const {return m_queues[trafficClass].size();}
+
+private:
+	struct QueuedFrame
+	{
+		can_msg msg;
+		std::chrono::steady_clock::time_point queuedAt;
+	};
+
+	static const size_t MAX_QUEUED_FRAMES = 1024;
+
+	static int onSend(const can_msg* msg, void* data);
+	int send(const can_msg& msg);
+	TrafficClass classify(const can_msg& msg) const;
+	/// Returns the time until a frame of the class may be sent, 0 if it may be sent now.
+	std::chrono::microseconds getHoldTime(TrafficClass trafficClass, std::chrono::steady_clock::time_point now);
+	void refillTokens(std::chrono::steady_clock::time_point now);
+	void countLatency(TrafficClass trafficClass, std::chrono::steady_clock::duration latency);
+	void requestRelease(std::chrono::microseconds delay, std::chrono::steady_clock::time_point now);
+
+	can_net_t* m_net;
+	can_send_func_t* m_send = nullptr;
+	void* m_sendData = nullptr;
+	ReleaseRequest m_releaseRequest;
+	bool m_releaseRequested = false;
+	std::chrono::steady_clock::time_point m_releaseDueAt;
+
+	std::bitset<0x800> m_motionCobIDs;
+	std::set<uint32_t> m_extendedMotionCobIDs;
+
+	double m_sdoTokensPerMicrosecond = 0.0;  ///< 0 = unlimited
+	double m_sdoBurst = 0.0;
+	double m_sdoTokens = 0.0;
+	std::chrono::steady_clock::time_point m_tokensRefilledAt;
+
+	uint32_t m_syncCobID = 0x80;
+	std::chrono::microseconds m_syncPeriod{0};
+	std::chrono::microseconds m_syncWindowLength{0};
+	std::chrono::microseconds m_guardTime{0};
+	bool m_syncSeen = false;
+	std::chrono::steady_clock::time_point m_lastSync;
+
+	std::deque<QueuedFrame> m_queues[NUMBER_OF_TRAFFIC_CLASSES];
+	Statistics m_statistics[NUMBER_OF_TRAFFIC_CLASSES];
+};
@@ -0,0 +1,91 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a memory-mapped, shareable concise (binary) DCF image.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * @brief The ConciseDcfImage class holds a concise DCF file (see CiA-302-3, e.g. a node_x.bin generated by dcfgen) in memory.
+ * The file is memory-mapped once and shared (reference counted) by all users of the same file name,
+ * so a (re)configuration of a node does not need any disk I/O.
+ */
+class ConciseDcfImage
+{
+public:
+	/**
+	 * @brief Entry describes one object of the concise DCF. data points into the mapped file.
+	 */
+	struct Entry
+	{
+		uint16_t index;
+		uint8_t subIndex;
+		uint32_t size;
+		const uint8_t* data;
+	};
+
+	/**
+	 * @brief load returns the image for the given file. An already mapped image of the same file is reused.
+	 * @param fileName The concise DCF file to map.
+	 * @param error Set if the file cannot be mapped or is not a valid concise DCF.
+	 * @return The image or nullptr in case of an error.
+	 */
+	static std::shared_ptr<const ConciseDcfImage> load(const std::string& fileName, std::error_code& error);
+
+	~ConciseDcfImage();
+
+	ConciseDcfImage(const ConciseDcfImage&) = delete;
+	ConciseDcfImage& operator=(const ConciseDcfImage&) = delete;
+
+	/// The begin of the raw concise DCF (including the number of entries).
+	const uint8_t* begin() const {return m_data;}
+	/// The end of the raw concise DCF.
+	const uint8_t* end() const {return m_data + m_size;}
+	size_t size() const {return m_size;}
+
+	const std::string& getFileName() const {return m_fileName;}
+	const std::vector<Entry>& getEntries() const {return m_entries;}
+
+	/**
+	 * @brief getPatchedValue returns the value of a 32 bit entry, with node ID dependent COB IDs adapted from fromNodeID to toNodeID.
+	 * Only COB IDs of the predefined connection set (EMCY, PDOs) which contain fromNodeID are changed.
+	 */
+	static uint32_t getPatchedValue(const Entry& entry, uint8_t fromNodeID, uint8_t toNodeID);
+
+	/**
+	 * @brief isEquivalentFor checks if this image, generated for nodeID, results in exactly the given other image
+	 * (generated for otherNodeID) when the node ID dependent COB IDs are patched.
+	 */
+	bool isEquivalentFor(uint8_t nodeID, const ConciseDcfImage& other, uint8_t otherNodeID) const;
+
+private:
+	ConciseDcfImage(const std::string& fileName, const uint8_t* data, size_t size);
+	bool parseEntries();
+
+	std::string m_fileName;
+	const uint8_t* m_data;
+	size_t m_size;
+	std::vector<Entry> m_entries;
+};
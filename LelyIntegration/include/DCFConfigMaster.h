@@ -21,10 +21,28 @@
  */
 
 #pragma once
+#include <chrono>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <vector>
+#include <lely/can/net.h>
 #include <lely/coapp/master.hpp>
+#include <lely/io2/timer.hpp>
+#include "AxisTable.h"
+#include "BusLoadMonitor.h"
+#include "CanTxScheduler.h"
+#include "DCFDriverConfig.h"
+#include "ObjectHandle.h"
+#include "ParameterSnapshot.h"
+#include "SdoReadBatch.h"
+#include "SdoTimeoutPolicy.h"
+#include "TimerWheel.h"
+#include "TpdoRateController.h"
 
+class BatchedCanChannel;
+class ConciseDcfImage;
 class DCFDriver;
 class DCFDriverConfig;
 
@@ -41,6 +59,41 @@ class DCFConfigMaster : public lely::canopen::AsyncMaster
 public:
 	friend DCFDriver;
 
+	/**
+	 * @brief MappedMasterObject references the object of the master which is mapped via PDO to an object of a slave.
+	 */
+	struct MappedMasterObject
+	{
+		uint16_t index;
+		uint8_t subIndex;
+		/// The master TPDO (see TpdoEvent()) which transmits the object or -1 if the object is received by a master RPDO.
+		int tpdo;
+	};
+
+	/**
+	 * @brief HeartbeatStatistics describes the heartbeat losses of one slave detected by the master.
+	 * A loss is reported once the consumer time has elapsed since the last received heartbeat, so the time until the report
+	 * is the consumer time by construction. The timeout jitter is how much later than the consumer time the loss was reported,
+	 * i.e. the delay of the consumer timer and the event loop.
+	 */
+	struct HeartbeatStatistics
+	{
+		unsigned losses;
+		std::chrono::microseconds lastTimeoutJitter;
+		std::chrono::microseconds maxTimeoutJitter;
+		std::chrono::microseconds totalTimeoutJitter;
+	};
+
+	/**
+	 * @brief BackupCompletedCallback is called with the read parameters once all nodes have been read.
+	 */
+	typedef std::function<void(std::shared_ptr<ParameterSnapshot>, const ParameterSnapshot::Statistics&)> BackupCompletedCallback;
+
+	/**
+	 * @brief RestoreCompletedCallback is called once the parameters were written to all nodes, with the first error which occurred.
+	 */
+	typedef std::function<void(std::error_code, const ParameterSnapshot::Statistics&)> RestoreCompletedCallback;
+
 	/**
 	 * @brief Creates a new master.
 	 * @param timer
@@ -51,7 +104,7 @@ public:
 	DCFConfigMaster(lely::io::TimerBase& timer, lely::io::CanChannelBase& chan,	const ::std::string& dcf_txt, ev_exec_t* exec);
 
 	/**
-	 * @brief Configures the drivers given by the master config.
+	 * @brief Configures the drivers given by the master config and preallocates their runtime structures (see RealtimeProfile).
 	 */
 	void configureDrivers();
 
@@ -62,6 +115,237 @@ public:
 	 */
 	void setDriverFactory(DCFDriverFactoryFunction factory) {m_driverFactory = factory;}
 
+	/**
+	 * @brief getExecutor returns the executor of the master. The drivers may run on other executors (see DriverExecutorPool),
+	 * the events of the master are then posted to the executor of each driver.
+	 */
+	ev_exec_t* getExecutor() const {return m_exec;}
+
+	/**
+	 * @brief setAutomaticPdoMapping enables the generation of the master side PDO configuration from the PDO configuration of the textual slave DCFs.
+	 * For each slave PDO, a master PDO with the same COB ID is configured (or an existing one is reused) which maps
+	 * the slave objects to arrays on the master (one array per slave object, sub index = node ID, see doc/manual-PDO-mapping-example.md).
+	 * Has to be called before configureDrivers().
+	 * @param enabled
+	 */
+	void setAutomaticPdoMapping(bool enabled) {m_automaticPdoMapping = enabled;}
+
+	/**
+	 * @brief getMappedMasterObject returns the master object which is mapped to the given slave object by the generated PDO configuration
+	 * or, without setAutomaticPdoMapping(), by a PDO of the master.dcf with the COB ID of the slave PDO (textual slave DCFs only).
+	 * @param nodeID The slave.
+	 * @param slaveIndex The index of the object on the slave.
+	 * @param slaveSubIndex The sub index of the object on the slave.
+	 * @param result The master object.
+	 * @return false if the slave object is not mapped.
+	 */
+	bool getMappedMasterObject(uint8_t nodeID, uint16_t slaveIndex, uint8_t slaveSubIndex, MappedMasterObject& result) const;
+
+	/**
+	 * @brief getRpdoMappedObjects returns the slave objects of the node which are received by a master RPDO, with the master object
+	 * they are written to: the objects of getMappedMasterObject() and the objects of the remote PDO mappings, which lely uses for
+	 * rpdo_mapped (0x5800 / 0x5A00, e.g. generated by dcfgen). Call it after configureDrivers().
+	 */
+	std::vector<std::pair<uint32_t /* slave index << 8 | sub index */, MappedMasterObject>> getRpdoMappedObjects(uint8_t nodeID) const;
+
+	/**
+	 * @brief getObjectDictionary returns the object dictionary of the master, e.g. to resolve an ObjectHandle.
+	 * Do not insert or remove objects after configureDrivers(), this would invalidate the handles.
+	 */
+	co_dev_t* getObjectDictionary() const {return dev();}
+
+	/**
+	 * @brief lockObjectDictionary returns the locked lock of the master, for the access of a driver on another executor
+	 * to the object dictionary through an ObjectHandle (see DCFDriver::lockMasterObjects()).
+	 */
+	std::unique_lock<lely::util::BasicLockable> lockObjectDictionary() {return std::unique_lock<lely::util::BasicLockable>(*this);}
+
+	/**
+	 * @brief sendFrame sends a raw CAN frame on the bus of the master, e.g. a PDO encoded with a PdoLayout, bypassing the object dictionary.
+	 * May be called from the executor of a driver (see DriverExecutorPool), it takes the lock of the master.
+	 * @param cobID The COB ID, bit 29 set for an extended frame.
+	 * @return false if the frame could not be sent.
+	 */
+	bool sendFrame(uint32_t cobID, const uint8_t* data, uint8_t size);
+
+	/**
+	 * @brief submitSdoRequest submits a request (e.g. a pooled one, see SdoRequestPool) to the SDO client of the given node
+	 * with the SDO timeout of the node (see getSdoTimeout()).
+	 * @return false if there is no SDO client for the node.
+	 */
+	bool submitSdoRequest(uint8_t nodeID, lely::canopen::detail::SdoRequestBase& request);
+
+	/**
+	 * @brief enableAdaptiveSdoTimeouts adapts the SDO timeout of every node to its measured round trip time (see SdoTimeoutPolicy),
+	 * instead of using the timeout of the master for all nodes. The timeout of the master (SetTimeout()) is used for nodes
+	 * which have not answered enough requests yet, so it should be set before. Nodes which never answered get minTimeout
+	 * (see SdoTimeoutPolicy::setProbeTimeout()).
+	 * @param minTimeout The lower bound of the timeouts.
+	 * @param maxTimeout The upper bound of the timeouts.
+	 * @param deviationFactor The factor k in mean + k * deviation of the round trip time.
+	 */
+	void enableAdaptiveSdoTimeouts(std::chrono::milliseconds minTimeout, std::chrono::milliseconds maxTimeout, double deviationFactor = 4.0);
+
+	/**
+	 * @brief getSdoTimeout returns the timeout for the next SDO request of the given class to the given node.
+	 */
+	std::chrono::milliseconds getSdoTimeout(uint8_t nodeID, SdoTimeoutPolicy::RequestClass requestClass = SdoTimeoutPolicy::MOTION) const;
+
+	/**
+	 * @brief getSdoTimeoutPolicy returns the round trip statistics of the nodes and the retry policies of the SDO requests,
+	 * e.g. to change the retries of a request class (see SdoTimeoutPolicy::setRetryPolicy()).
+	 */
+	SdoTimeoutPolicy& getSdoTimeoutPolicy() {return m_sdoTimeoutPolicy;}
+	const SdoTimeoutPolicy& getSdoTimeoutPolicy() const {return m_sdoTimeoutPolicy;}
+
+	/**
+	 * @brief enableTimerWheel multiplexes the timers of the drivers (see startTimer()) on a timer wheel driven by the given timer,
+	 * instead of one wait per timer on the timer queue of the master. The timer only expires when the next timer of the wheel is due.
+	 * @param timer A timer which is used for nothing else, e.g. a second lely::io::Timer on the loop of the master.
+	 * @param resolution The tick of the wheel, the delays are rounded up to it.
+	 */
+	void enableTimerWheel(lely::io::TimerBase& timer, std::chrono::milliseconds resolution = std::chrono::milliseconds(1));
+
+	/**
+	 * @brief startTimer calls the callback on the executor of the master once the delay has passed.
+	 * Without enableTimerWheel(), the timer is a wait on the timer queue of the master and cannot be canceled.
+	 * May be called from any thread (see DCFDriver::startTimer() for the drivers on their own executors).
+	 * @return The ID for cancelTimer().
+	 */
+	TimerWheel::TimerID startTimer(std::chrono::milliseconds delay, TimerWheel::Callback callback);
+
+	/**
+	 * @brief cancelTimer stops a timer of startTimer().
+	 * @return false if the timer has already expired or cannot be canceled.
+	 */
+	bool cancelTimer(TimerWheel::TimerID id);
+
+	/**
+	 * @brief enableTxScheduling sends the frames of the master by traffic class (see CanTxScheduler): the PDOs, SYNC and NMT
+	 * are sent immediately, the SDO requests are shaped and the other frames wait while their class is held back.
+	 * The PDOs are taken from the master TPDOs, call it after configureDrivers() or before (then they are updated by it).
+	 * Needs the timer wheel (see enableTimerWheel()) for a release resolution below the timer queue of the master.
+	 * @param sdoFramesPerSecond The long term rate of the SDO requests, 0 = unlimited.
+	 * @param sdoBurst The number of SDO requests which may be sent at once.
+	 * @param confineToSyncGap Non-cyclic frames are only sent in the gap after the synchronous window (0x1006 / 0x1007),
+	 * if the master produces the SYNC.
+	 */
+	void enableTxScheduling(unsigned sdoFramesPerSecond, unsigned sdoBurst = 16, bool confineToSyncGap = false);
+
+	/**
+	 * @brief getTxScheduler returns the scheduler with the queueing latency per traffic class or nullptr if enableTxScheduling() was not called.
+	 */
+	const CanTxScheduler* getTxScheduler() const {return m_txScheduler.get();}
+
+	/**
+	 * @brief enableReceiveFilter installs the COB IDs consumed by the master (see getConsumedCobIDs()) as receive filter
+	 * of the channel, so the kernel drops the other frames of a shared bus instead of waking up the master.
+	 * The filter is updated by configureDrivers(), when a driver is added and when the communication parameters of the master
+	 * are written by SDO; call updateReceiveFilter() after changing them locally. The avoided wakeups are counted by the channel
+	 * (see BatchedCanChannel::Statistics::filteredFrames).
+	 */
+	void enableReceiveFilter(BatchedCanChannel& channel);
+	void updateReceiveFilter();
+
+	/**
+	 * @brief getConsumedCobIDs returns the COB IDs of the frames processed by the master: the RPDOs (and the remote requests
+	 * of the TPDOs), the SDO responses, EMCY, heartbeat / boot-up and node guarding of all slaves, the requests of the SDO servers,
+	 * a consumed SYNC or TIME and the LSS responses (0x7E4). Bit 29 is set for an extended ID.
+	 */
+	std::vector<uint32_t> getConsumedCobIDs();
+
+	/**
+	 * @brief enableBusLoadMonitoring counts the PDOs sent and received by the master and calculates the bus load and the rate per COB ID.
+	 * Other traffic (SDO, NMT, SYNC, PDOs between slaves) is not seen by the master and therefore not included.
+	 * @param bitRate The bit rate of the bus in bit/s.
+	 * @param interval The measurement window.
+	 */
+	void enableBusLoadMonitoring(uint32_t bitRate, std::chrono::milliseconds interval);
+
+	/**
+	 * @brief getBusLoadMonitor returns the measured bus load or nullptr if enableBusLoadMonitoring() was not called.
+	 */
+	const BusLoadMonitor* getBusLoadMonitor() const {return m_busLoadMonitor.get();}
+
+	/**
+	 * @brief enableTpdoRateControl adapts the inhibit times and event timers of the given slave TPDOs to the measured bus load
+	 * (see TpdoRateController). Needs enableBusLoadMonitoring(), whose load contains only the PDOs of the master.
+	 * @param limits The TPDOs which may be throttled, with their bounds and priorities.
+	 * @param throttleAbove The bus load (1.0 = 100 %) above which the TPDOs are throttled.
+	 * @param restoreBelow The bus load below which the TPDOs are restored.
+	 */
+	void enableTpdoRateControl(const std::vector<TpdoRateController::Limit>& limits, double throttleAbove = 0.7, double restoreBelow = 0.5);
+
+	/**
+	 * @brief enableHeartbeatMonitoring configures the heartbeat consumer entries of the master (0x1016) for all slaves and
+	 * the heartbeat producer time of the slaves (0x1017, written by DCFDriver after the DCF), so that a missing slave is
+	 * detected within the given latency. The producer time leaves a margin for the worst case delay of a heartbeat at the
+	 * given bus load (or the measured one, if enableBusLoadMonitoring() was called and it is higher). With the bus load monitoring,
+	 * the producer time is recalculated after each measurement and written to the slaves if the load requires a shorter one
+	 * or allows a clearly longer one.
+	 * A lost heartbeat is reported to the driver of the node (see DCFDriver::OnHeartbeat()).
+	 * Has to be called before configureDrivers().
+	 * @param detectionLatency The heartbeat consumer time.
+	 * @param bitRate The bit rate of the bus in bit/s, e.g. 500000.
+	 * @param expectedBusLoad The expected bus load, 1.0 = 100 %.
+	 */
+	void enableHeartbeatMonitoring(std::chrono::milliseconds detectionLatency, uint32_t bitRate, double expectedBusLoad = 0.5);
+
+	/**
+	 * @brief getHeartbeatProducerTime returns the heartbeat producer time in ms for the slaves, 0 if the heartbeat monitoring is disabled.
+	 */
+	uint16_t getHeartbeatProducerTime() const {return m_heartbeatProducerTime;}
+
+	/**
+	 * @brief getHeartbeatStatistics returns the heartbeat losses detected for the given slave.
+	 * @return false if no heartbeat loss was detected yet.
+	 */
+	bool getHeartbeatStatistics(uint8_t nodeID, HeartbeatStatistics& result) const;
+
+	/**
+	 * @brief getAxisTable returns the status words, positions and following errors of all axes in contiguous arrays, e.g. for
+	 * AxisTable::allIdle() or AxisTable::anyFault(). An axis is every node whose status word (0x6041) is received by a master RPDO
+	 * (see getMappedMasterObject()); the position (0x6064) and the following error (0x60F4) are filled if they are received too.
+	 * Built by configureDrivers() and updated once per received PDO frame, use it on the executor of the master only.
+	 * The other MotorDriver nodes (e.g. with a mapping generated by dcfgen) get an axis too, whose status word is set by the driver
+	 * (see updateAxisStatusWord()).
+	 */
+	const AxisTable& getAxisTable() const {return m_axisTable;}
+	/**
+	 * @brief updateAxisStatusWord sets the status word of an axis which was not received by a generated master PDO, e.g. the one read by
+	 * MotorDriver::OnConfig(), so the table does not wait for the first PDO, or the one received through rpdo_mapped.
+	 * Called by the driver of the node, the table is updated on the executor of the master.
+	 */
+	void updateAxisStatusWord(uint8_t nodeID, uint16_t statusWord);
+
+	/**
+	 * @brief backupParameters reads all readable objects (according to the DCF) of all nodes into a snapshot.
+	 * The nodes are read concurrently, strings and domains by SDO block upload if the node supports it.
+	 * Objects which cannot be read are skipped and counted as failed; a node which does not answer is skipped completely.
+	 * @param callback Called with the snapshot, e.g. to store it with ParameterSnapshot::save().
+	 */
+	void backupParameters(BackupCompletedCallback callback);
+
+	/**
+	 * @brief restoreParameters writes a snapshot back to the nodes, e.g. to a replaced drive.
+	 * The nodes are written concurrently, each node with one concise DCF (see ParameterSnapshot::getRestorableEntries()).
+	 * Nodes of the snapshot without driver are skipped.
+	 * @param snapshot The parameters to write.
+	 * @param onlyDifferences If set, only the objects whose value in the snapshot differs from the DCF of the node are written.
+	 * @param callback Called once all nodes are written.
+	 */
+	void restoreParameters(std::shared_ptr<const ParameterSnapshot> snapshot, bool onlyDifferences, RestoreCompletedCallback callback);
+
+	/**
+	 * @brief submitReads reads the given objects concurrently from their nodes (see SdoReadBatch), e.g. 0x603F of every axis.
+	 * @param requests The objects to read.
+	 * @param maxConcurrentRequests The maximum number of SDO requests on the bus at the same time (at most one per node).
+	 * @param callback Optionally called with the results on the executor of the master.
+	 * @return The results in the order of the requests. Do not wait for it on the executor of the master, use the callback there.
+	 */
+	std::future<std::vector<SdoReadBatch::Result>> submitReads(const std::vector<SdoReadBatch::Request>& requests, size_t maxConcurrentRequests = 8,
+															   SdoReadBatch::CompletedCallback callback = nullptr);
+
 	/**
 	 * @brief Get the driver for the given node ID or nullptr if it was not registered.
 	 * @param nodeID
@@ -120,14 +404,94 @@ protected:
 	void OnCommand(lely::canopen::NmtCommand cs) noexcept override;
 	void OnConfig(uint8_t id) noexcept override;
 	void OnState(uint8_t id, lely::canopen::NmtState st) noexcept override;
+	void OnHeartbeat(uint8_t id, bool occurred) noexcept override;
+	void OnRpdoWrite(uint8_t id, uint16_t idx, uint8_t subidx) noexcept override;
+	void OnRpdo(int num, ::std::error_code ec, const void* p, ::std::size_t n) noexcept override;
+	void OnTpdo(int num, ::std::error_code ec, const void* p, ::std::size_t n) noexcept override;
 
 private:
 	void initializeDevicesFromTextualDCF();
 	void initializeDevicesForBinaryDCF();
 	void registerDriver(std::shared_ptr<DCFDriver> driver);
+	void assignBinaryDcfImage(std::shared_ptr<DCFDriverConfig> driverConfig, const std::string& filename);
+	void generatePdoMapping(const DCFDriverConfig& driverConfig, bool createMissingPdos);
+	void generateMasterPdo(const DCFDriverConfig& driverConfig, const DCFDriverConfig::PdoConfig& slavePdo, bool masterTransmits, bool createMissingPdo);
+	uint16_t getGeneratedMasterObjectIndex(uint16_t slaveIndex, uint8_t slaveSubIndex, bool masterTransmits);
+	void scheduleBusLoadUpdate();
+	uint64_t getTimerWheelTick(std::chrono::steady_clock::time_point now) const;
+	void armTimerWheel(std::chrono::steady_clock::time_point now);
+	void waitForTimerWheelExpiry();
+	void updateTxScheduling();
+	void preallocate();
+	uint32_t getPdoCobID(uint16_t communicationIndex);
+	void collectRpdoMappedObjects();
+	void buildAxisTable();
+	void updateAxisTable(uint16_t index, uint8_t subIndex);
+	void subscribeMasterObject(DCFDriver* driver, uint16_t index, uint8_t subIndex);
+	void forwardMasterObjectChange(uint16_t index, uint8_t subIndex);
+	void runOnDriverExecutor(DCFDriver& driver, std::function<void()> task);
+	void configureHeartbeatConsumers();
+	uint16_t calculateHeartbeatProducerTime(double& busLoad) const;
+	void updateHeartbeatProducerTime();
+	struct ParameterTransfer;
+	void backupNextObject(std::shared_ptr<ParameterTransfer> transfer, uint8_t nodeID, size_t position);
+	void onParameterTransferOfNodeCompleted(std::shared_ptr<ParameterTransfer> transfer);
+	static int onHeartbeatMessage(const can_msg* msg, void* data);
 
 	std::map<uint8_t, std::shared_ptr<DCFDriver>> m_drivers;
 	std::map<uint32_t /* COB ID */, uint8_t /* node ID */> m_firstNodeIDUsing_RPDO_COB_ID;
+	std::vector<std::pair<uint8_t /* node ID */, std::shared_ptr<const ConciseDcfImage>>> m_binaryDcfImages;
+	bool m_automaticPdoMapping = false;
+	std::map<uint8_t /* node ID */, std::map<uint32_t /* slave index << 8 | sub index */, MappedMasterObject>> m_mappedMasterObjects;
+	std::map<uint32_t /* direction << 24 | slave index << 8 | sub index */, uint16_t /* master index */> m_generatedMasterObjectIndices;
+	uint16_t m_nextGeneratedOutputIndex = 0x2000;
+	uint16_t m_nextGeneratedInputIndex = 0x2010;
+	std::shared_ptr<BusLoadMonitor> m_busLoadMonitor;  ///< Shared with m_tpdoRateController.
+	std::chrono::milliseconds m_busLoadMonitoringInterval{0};
+	std::unique_ptr<TpdoRateController> m_tpdoRateController;
+	std::chrono::milliseconds m_heartbeatDetectionLatency{0};
+	uint32_t m_heartbeatBitRate = 0;
+	double m_expectedBusLoad = 0.5;
+	uint16_t m_heartbeatProducerTime = 0;
+	std::map<uint8_t /* node ID */, std::shared_ptr<can_recv_t>> m_heartbeatReceivers;
+	std::map<uint8_t /* node ID */, std::chrono::steady_clock::time_point> m_lastHeartbeats;
+	std::map<uint8_t /* node ID */, HeartbeatStatistics> m_heartbeatStatistics;
+	SdoTimeoutPolicy m_sdoTimeoutPolicy;
+	std::unique_ptr<TimerWheel> m_timerWheel;
+	lely::io::TimerBase* m_timerWheelTimer = nullptr;
+	/// Set while a wait for the timer of the wheel is submitted, there is none while no timers are running.
+	bool m_timerWheelWaiting = false;
+	/// The time of tick 0 of the wheel and the tick the timer is set to.
+	std::chrono::steady_clock::time_point m_timerWheelStartedAt;
+	uint64_t m_timerWheelArmedTick = UINT64_MAX;
+	/// The drivers on other executors start and cancel timers concurrently to the ticks; recursive, since callbacks restart timers.
+	std::recursive_mutex m_timerWheelMutex;
+	std::unique_ptr<CanTxScheduler> m_txScheduler;
+	bool m_confineTxToSyncGap = false;
+	BatchedCanChannel* m_receiveFilterChannel = nullptr;
+	bool m_adaptiveSdoTimeouts = false;
+	/// The master objects written by received PDOs, their changes are forwarded once per frame.
+	std::set<uint32_t /* index << 8 | sub index */> m_rpdoMappedObjects;
+	/// The nodes whose objects were written by the received PDO frame, only their drivers are flushed in OnRpdo().
+	std::vector<uint8_t /* node ID */> m_rpdoWrittenNodes;
+	AxisTable m_axisTable;
+	/**
+	 * @brief AxisTableSource is a master object which fills a column of the axis table.
+	 */
+	struct AxisTableSource
+	{
+		size_t slot;
+		uint16_t slaveIndex;
+		ObjectHandle<uint16_t> statusWord;
+		ObjectHandle<int32_t> value;
+	};
+	std::map<uint32_t /* master index << 8 | sub index */, AxisTableSource> m_axisTableSources;
+	std::vector<std::pair<uint16_t, uint8_t>> m_pendingMasterWrites;
+	std::vector<std::pair<uint16_t, uint8_t>> m_dispatchedMasterWrites;
+	/// The drivers which get the changes of certain master objects only (see DCFDriver::subscribeMasterObject()).
+	std::map<uint32_t /* index << 8 | sub index */, std::set<DCFDriver*>> m_masterObjectSubscribers;
+	/// The drivers without subscriptions, they get all changes.
+	std::map<uint8_t /* node ID */, DCFDriver*> m_broadcastDrivers;
 	std::set<uint8_t> m_devicesToBoot;
 	std::function<void(uint8_t)> m_bootCompletedCallback;
 	DCFDriverFactoryFunction m_driverFactory;
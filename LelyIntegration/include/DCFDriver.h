@@ -21,9 +21,19 @@
  */
 
 #pragma once
+#include <chrono>
+#include <mutex>
+#include <system_error>
+#include <type_traits>
 #include <lely/can/net.hpp>
 #include <lely/coapp/driver.hpp>
+#include <lely/util/mutex.hpp>
 #include "DCFDriverConfig.h"
+#include "ObjectHandle.h"
+#include "RemoteObjectCache.h"
+#include "SdoRequestPool.h"
+#include "SdoTimeoutPolicy.h"
+#include "TimerWheel.h"
 
 class DCFDriverConfig;
 
@@ -53,6 +63,7 @@ enum AdditionalErrorCode: uint16_t
 	NODE_MISSING = 0xAF04,
 	WRTIE_TO_NODE_ERROR = 0xAF05,
 	FIRMWARE_UPDATE_FAILED = 0xAF06,
+	HEARTBEAT_LOST = 0xAF07,
 	OTHER_MOTOR_HAD_ERROR = 0xAFFF
 };
 
@@ -81,6 +92,11 @@ public:
 	 */
 	typedef std::function<void (lely::canopen::NmtState)> NmtStateChangedCallback;
 
+	/**
+	 * @brief WriteConfirmation is called when an SDO write of submitTimedWrite() is completed, like the confirmation of SubmitWrite().
+	 */
+	typedef std::function<void (uint8_t, uint16_t, uint8_t, ::std::error_code)> WriteConfirmation;
+
 	/**
 	 * @brief Creates a new DCFDriver from the given config.
 	 * @param exec The execution stuff to use
@@ -97,8 +113,22 @@ public:
 
 	virtual void OnBoot(lely::canopen::NmtState st, char es, const std::string &what) noexcept override;
 
+	virtual void OnHeartbeat(bool occurred) noexcept override;
+
 	virtual void onSystemBootCompleted() noexcept {}
 
+	/**
+	 * @brief resynchronizeInputs reads the inputs of the node again by SDO, since changes may have been missed,
+	 * e.g. while a TPDO was invalidated by TpdoRateController. Called on the executor of the driver.
+	 */
+	virtual void resynchronizeInputs() noexcept {}
+
+	/**
+	 * @brief preallocate reserves the structures used at runtime, so the motion path does not allocate (see RealtimeProfile).
+	 * Called by DCFConfigMaster::configureDrivers().
+	 */
+	virtual void preallocate();
+
 	/**
 	 * @brief Configures the error callback in case of an error.
 	 * @param callback to call on an error.
@@ -116,6 +146,187 @@ public:
 	 */
 	bool hasCustomClearConfigurationStrategy() const {return m_clearConfigurationStrategy != nullptr;}
 
+	/**
+	 * @brief Returns wether the binary DCF is transferred by this driver from memory (see DCFDriverConfig::setBinaryDcfImage)
+	 */
+	bool hasBinaryDcfImage() const {return m_config->getBinaryDcfImage() != nullptr;}
+
+	/**
+	 * @brief getConfig returns the configuration of the node.
+	 */
+	std::shared_ptr<const DCFDriverConfig> getConfig() const {return m_config;}
+
+	/**
+	 * @brief submitCachedRead works like SubmitRead(), but the value is taken from the mirror of the remote objects
+	 * (fed by the received PDOs and the SDO transfers of submitCachedRead() / submitCachedWrite()) if it is not older than maxAge.
+	 * In this case the confirmation is called immediately. Only for integral types.
+	 */
+	template<class T, class F>
+	void submitCachedRead(uint16_t idx, uint8_t subidx, std::chrono::milliseconds maxAge, F&& con)
+	{
+		static_assert(std::is_integral<T>::value, "Only integral types are cached.");
+		uint64_t value;
+		if (m_remoteObjectCache.lookup(idx, subidx, maxAge, value))
+		{
+			con(id(), idx, subidx, std::error_code(), static_cast<T>(value));
+			return;
+		}
+
+		// Stored in the pooled request without allocation if the confirmation is small (see SdoRequestPool::ReadConfirmation).
+		typename std::decay<F>::type confirmation(std::forward<F>(con));
+		auto pooledConfirmation = [this, idx, subidx, confirmation](std::error_code ec, uint64_t value)
+		{
+			if (!ec)
+				m_remoteObjectCache.update(idx, subidx, value);
+			confirmation(id(), idx, subidx, ec, static_cast<T>(value));
+		};
+		if (m_sdoRequestPool.submitRead(idx, subidx, pooledConfirmation))
+			return;
+
+		m_sdoRequestPool.countAllocatedRequest();
+		auto submitted = std::chrono::steady_clock::now();
+		try
+		{
+			SubmitRead<T>(idx, subidx, [this, confirmation, submitted](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec, T value)
+			{
+				recordSdoResult(submitted, ec);
+				if (!ec)
+					m_remoteObjectCache.update(idx, subidx, static_cast<uint64_t>(value));
+				confirmation(id, idx, subidx, ec, value);
+			}, getSdoTimeout());
+		}
+		catch (const std::system_error& error)
+		{
+			confirmation(id(), idx, subidx, error.code(), T());
+		}
+	}
+
+	/**
+	 * @brief submitCachedWrite works like SubmitWrite() and updates the mirror of the remote objects if the value was written.
+	 */
+	template<class T, class F>
+	void submitCachedWrite(uint16_t idx, uint8_t subidx, T value, F&& con)
+	{
+		static_assert(std::is_integral<T>::value, "Only integral types are cached.");
+		std::function<void(uint8_t, uint16_t, uint8_t, std::error_code)> confirmation(std::forward<F>(con));
+		try
+		{
+			SubmitWrite<T>(idx, subidx, std::forward<T>(value), [this, confirmation, value](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+			{
+				if (!ec)
+					m_remoteObjectCache.update(idx, subidx, static_cast<uint64_t>(value));
+				if (confirmation != nullptr)
+					confirmation(id, idx, subidx, ec);
+			});
+		}
+		catch (const std::system_error& error)
+		{
+			if (confirmation != nullptr)
+				confirmation(id(), idx, subidx, error.code());
+		}
+	}
+
+	/**
+	 * @brief submitPooledWrite works like SubmitWrite(), but takes the request from the SDO request pool of the driver
+	 * if the object is pooled and one of its requests is free (see getSdoRequestPool()).
+	 * Failed writes are retried like motion commands (see SdoTimeoutPolicy::MOTION); a pooled request keeps the number of attempts
+	 * and the callback itself, so the retries do not allocate unless a write fails.
+	 */
+	template<class T>
+	void submitPooledWrite(uint16_t idx, uint8_t subidx, T value, SdoRequestPool::WriteCallback callback, unsigned attempt = 0)
+	{
+		if (m_sdoRequestPool.submitWrite(idx, subidx, value, callback, attempt))
+			return;
+
+		m_sdoRequestPool.countAllocatedRequest();
+		auto submitted = std::chrono::steady_clock::now();
+		try
+		{
+			SubmitWrite<T>(idx, subidx, T(value), [this, idx, subidx, value, callback, attempt, submitted](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec)
+			{
+				recordSdoResult(submitted, ec);
+				if (ec && retrySdo(SdoTimeoutPolicy::MOTION, attempt, ec, [=]() {submitPooledWrite<T>(idx, subidx, value, callback, attempt + 1);}))
+					return;
+				if (callback != nullptr)
+					callback(ec);
+			}, getSdoTimeout());
+		}
+		catch (const std::system_error& error)
+		{
+			if (callback != nullptr)
+				callback(error.code());
+		}
+	}
+
+	/**
+	 * @brief submitTimedWrite works like SubmitWrite(), but with the SDO timeout of the node (see DCFConfigMaster::getSdoTimeout())
+	 * and transient errors are retried according to the retry policy of the request class (see SdoTimeoutPolicy).
+	 * The confirmation is called once, with the result of the last attempt.
+	 */
+	template<class T>
+	void submitTimedWrite(SdoTimeoutPolicy::RequestClass requestClass, uint16_t idx, uint8_t subidx, T value, WriteConfirmation con, unsigned attempt = 0)
+	{
+		auto submitted = std::chrono::steady_clock::now();
+		try
+		{
+			SubmitWrite<T>(idx, subidx, T(value), [this, requestClass, value, con, attempt, submitted](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+			{
+				recordSdoResult(submitted, ec);
+				if (ec && retrySdo(requestClass, attempt, ec, [=]() {submitTimedWrite<T>(requestClass, idx, subidx, value, con, attempt + 1);}))
+					return;
+				if (con != nullptr)
+					con(id, idx, subidx, ec);
+			}, getSdoTimeout(requestClass));
+		}
+		catch (const std::system_error& error)
+		{
+			// Not retried, the node is not configured or has no SDO client.
+			if (con != nullptr)
+				con(id(), idx, subidx, error.code());
+		}
+	}
+
+	/**
+	 * @brief submitTimedRead works like SubmitRead(), with the SDO timeout and the retries of submitTimedWrite().
+	 */
+	template<class T>
+	void submitTimedRead(SdoTimeoutPolicy::RequestClass requestClass, uint16_t idx, uint8_t subidx,
+						 std::function<void (uint8_t, uint16_t, uint8_t, ::std::error_code, T)> con, unsigned attempt = 0)
+	{
+		auto submitted = std::chrono::steady_clock::now();
+		try
+		{
+			SubmitRead<T>(idx, subidx, [this, requestClass, con, attempt, submitted](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec, T value)
+			{
+				recordSdoResult(submitted, ec);
+				if (ec && retrySdo(requestClass, attempt, ec, [=]() {submitTimedRead<T>(requestClass, idx, subidx, con, attempt + 1);}))
+					return;
+				if (con != nullptr)
+					con(id, idx, subidx, ec, value);
+			}, getSdoTimeout(requestClass));
+		}
+		catch (const std::system_error& error)
+		{
+			if (con != nullptr)
+				con(id(), idx, subidx, error.code(), T());
+		}
+	}
+
+	/// The SDO requests of the objects written and read at runtime, with the counters of the pooled and allocated requests.
+	const SdoRequestPool& getSdoRequestPool() const {return m_sdoRequestPool;}
+
+	/**
+	 * @brief flushRpdoWrites dispatches the objects written by the received PDO frame (see onRpdoFrame()).
+	 * Posted to the executor of the driver by DCFConfigMaster once the frame is processed completely.
+	 */
+	void flushRpdoWrites();
+
+	/**
+	 * @brief getRemoteObjectCache returns the mirror of the remote objects, e.g. for its hit rate.
+	 * The objects received by PDO are only mirrored with a DCFConfigMaster, which knows the master objects they are written to.
+	 */
+	const RemoteObjectCache& getRemoteObjectCache() const {return m_remoteObjectCache;}
+
 	/**
 	 * @brief setNmtStateChangedCallback sets a callback which is called when OnState() is called / when the NMT state changes.
 	 * @param callback
@@ -188,11 +399,102 @@ protected:
 	/// Set to true if an EMCY was received.
 	bool m_emergencyOccured;
 
+	/// Set to true while the heartbeat of the node is missing.
+	bool m_heartbeatLost;
+
+	/// The last known values of the objects of the node.
+	RemoteObjectCache m_remoteObjectCache;
+
+	/// Filled by the derived drivers with the objects they write and read at runtime.
+	SdoRequestPool m_sdoRequestPool;
+
 	virtual void OnRpdoWrite (uint16_t idx, uint8_t subidx) noexcept override;
 
+	/**
+	 * @brief onRpdoFrame is called once per received PDO frame, when all objects mapped by it have been updated,
+	 * instead of once per object like OnRpdoWrite(). The default implementation calls the on_rpdo_mapped functions
+	 * and forwards the writes to the followed node (see onFollowerRpdoWrite()).
+	 * @param objects The updated objects (index, sub index) of this node.
+	 */
+	virtual void onRpdoFrame(const std::vector<std::pair<uint16_t, uint8_t>>& objects) noexcept;
+
 	/// Called by OnRpdoWrite() if a write to the follower was detected.
 	virtual void onFollowerRpdoWrite  (uint16_t /* idx */, uint8_t /* subidx */) noexcept {}
 
+	/**
+	 * @brief getMasterObjectHandle resolves an object of the master. The handle is invalid if the master is no DCFConfigMaster.
+	 * Resolve handles at the earliest in OnConfig(), when the object dictionary of the master is complete.
+	 * Access the handle while holding lockMasterObjects().
+	 */
+	template<class T>
+	ObjectHandle<T> getMasterObjectHandle(uint16_t masterIndex, uint8_t masterSubIndex) const
+	{
+		return ObjectHandle<T>(getMasterObjectDictionary(), masterIndex, masterSubIndex);
+	}
+
+	/**
+	 * @brief getMappedObjectHandle resolves the master object which DCFConfigMaster mapped to the given object of a slave
+	 * (see DCFConfigMaster::getMappedMasterObject()). The handle is invalid if the object is not mapped that way,
+	 * e.g. with a mapping generated by dcfgen: use rpdo_mapped / tpdo_mapped then.
+	 */
+	template<class T>
+	ObjectHandle<T> getMappedObjectHandle(uint8_t nodeID, uint16_t slaveIndex, uint8_t slaveSubIndex) const
+	{
+		uint16_t masterIndex = 0;
+		uint8_t masterSubIndex = 0;
+		int tpdo = -1;
+		if (!findMappedMasterObject(nodeID, slaveIndex, slaveSubIndex, masterIndex, masterSubIndex, tpdo))
+			return ObjectHandle<T>(nullptr, slaveIndex, slaveSubIndex);
+		return getMasterObjectHandle<T>(masterIndex, masterSubIndex);
+	}
+
+	/**
+	 * @brief lockMasterObjects locks the master if the driver runs on another executor than the master (see DriverExecutorPool),
+	 * so the object handles can be accessed concurrently to the master thread. On the executor of the master the lock is not taken.
+	 * Do not call functions of the master which lock it themselves (e.g. tpdo_mapped, Write() or TpdoEvent()) while holding it.
+	 */
+	std::unique_lock<lely::util::BasicLockable> lockMasterObjects();
+
+	/// Reads the object of a valid handle with lockMasterObjects().
+	template<class T>
+	T readMasterObject(const ObjectHandle<T>& handle)
+	{
+		auto lock = lockMasterObjects();
+		return handle.read();
+	}
+
+	/**
+	 * @brief subscribeMasterObject limits the calls of onMasterSDOChanged() to the subscribed master objects, instead of all changes.
+	 * Only supported by DCFConfigMaster. On a strand the subscription takes effect once the master executor has run it.
+	 */
+	void subscribeMasterObject(uint16_t masterIndex, uint8_t masterSubIndex);
+
+	/**
+	 * @brief startTimer calls the callback once the delay has passed, e.g. for a watchdog, with the timers of all drivers on the
+	 * timer wheel of the master if it is enabled (see DCFConfigMaster::enableTimerWheel()), else with SubmitWait().
+	 * The callback runs on the executor of the driver, also if it differs from the one of the master (see DriverExecutorPool).
+	 * @return The ID for cancelTimer(), TimerWheel::INVALID_TIMER if the timer cannot be canceled.
+	 */
+	TimerWheel::TimerID startTimer(std::chrono::milliseconds delay, std::function<void()> callback);
+	/// Stops a timer of startTimer(), false if it has already expired.
+	bool cancelTimer(TimerWheel::TimerID id);
+
+	/// The SDO timeout of the node, see DCFConfigMaster::getSdoTimeout().
+	std::chrono::milliseconds getSdoTimeout(SdoTimeoutPolicy::RequestClass requestClass = SdoTimeoutPolicy::MOTION) const;
+	/// Adds the round trip of an SDO request to the statistics of the node, see SdoTimeoutPolicy::addResult().
+	void recordSdoResult(std::chrono::steady_clock::time_point submitted, ::std::error_code error);
+
+	/**
+	 * @brief retrySdo calls the retry function (after the retry delay) if the policy of the request class allows another attempt.
+	 * @param attempt The number of retries so far.
+	 * @return false if the request is not retried, the error has to be reported then.
+	 */
+	bool retrySdo(SdoTimeoutPolicy::RequestClass requestClass, unsigned attempt, ::std::error_code error, std::function<void()> retry);
+
+	/// See DCFConfigMaster::getMappedMasterObject(), false if the master is no DCFConfigMaster.
+	bool findMappedMasterObject(uint8_t nodeID, uint16_t slaveIndex, uint8_t slaveSubIndex, uint16_t& masterIndex, uint8_t& masterSubIndex, int& tpdo) const;
+	co_dev_t* getMasterObjectDictionary() const;
+
 private:
 	// DCF Text File based configuration:
 	void configure(std::function<void (std::error_code)> res);
@@ -204,7 +506,36 @@ private:
 
 	// YAML / DCF BIN File based configuration
 	void configureFollowerRelationship();
+	void writeBinaryDcf(::std::function<void(std::error_code)> onCompletedFunction);
+	void writeHeartbeatProducerTime(::std::function<void(std::error_code)> onCompletedFunction);
+	void writePatchedBinaryDcf(std::shared_ptr<const ConciseDcfImage> image, size_t entryToSend, ::std::function<void(std::error_code)> onCompletedFunction);
+
+	void resolveCachedRpdoObjects();
+	void updateRemoteObjectCache(uint16_t idx, uint8_t subidx);
 
 	ClearConfigurationStrategy m_clearConfigurationStrategy;
 	NmtStateChangedCallback m_nmtStateChangedCallback;
+	/// The objects written by the PDO frame which is currently received.
+	std::vector<std::pair<uint16_t, uint8_t>> m_pendingRpdoWrites;
+	std::vector<std::pair<uint16_t, uint8_t>> m_dispatchedRpdoWrites;
+	/// Only DCFConfigMaster tells the end of a PDO frame, other masters get every object dispatched immediately.
+	bool m_rpdoFramesAreFlushed;
+
+	/**
+	 * @brief CachedRpdoObject is an object of the node received by a master RPDO, read from its master object into the
+	 * remote object cache. Resolved in OnConfig() (see resolveCachedRpdoObjects()).
+	 */
+	struct CachedRpdoObject
+	{
+		uint16_t idx;
+		uint8_t subidx;
+		/// The value of the master object, see ObjectHandle::getAddress().
+		const void* value;
+		/// Reads the value as the type of the master object, sign extended.
+		uint64_t (*read)(const void* value);
+		RemoteObjectCache::Entry* entry;
+	};
+	std::vector<CachedRpdoObject> m_cachedRpdoObjects;
+	/// The objects of a frame are written in the order of their mapping, the next one is searched here first.
+	size_t m_nextCachedRpdoObject = 0;
 };
@@ -24,6 +24,7 @@
 #include <lely/coapp/device.hpp>
 #include <lely/coapp/driver.hpp>
 #include <lely/coapp/sdo.hpp>
+#include "ConciseDcfImage.h"
 
 /**
  * @brief The DCFDriverConfig class contains a configuration for a certain node. This config is read from a dcf file.
@@ -36,6 +37,27 @@ public:
 	 */
 	typedef std::vector<std::tuple<uint16_t, std::vector<uint8_t>>> ObjectsList;
 
+	/**
+	 * @brief PdoConfig represents the communication and mapping parameters of one RPDO or TPDO (see CiA-301).
+	 */
+	struct PdoConfig
+	{
+		/// The index of the communication parameter (0x1400 - 0x15FF or 0x1800 - 0x19FF). The mapping is at communicationIndex + 0x200.
+		uint16_t communicationIndex;
+		/// Sub index 1: the COB ID including the valid bit (bit 31).
+		uint32_t cobID;
+		/// Sub index 2: the transmission type.
+		uint8_t transmissionType;
+		/// Sub index 3 in 100us or 0 if not available.
+		uint16_t inhibitTime;
+		/// Sub index 5 in ms or 0 if not available.
+		uint16_t eventTimer;
+		/// The mapping entries: index << 16 | sub index << 8 | length in bits.
+		std::vector<uint32_t> mapping;
+
+		bool isValid() const {return !(cobID & 0x80000000);}
+	};
+
 	/**
 	 * @brief Creates a new config by reading the given dcf file.
 	 * @param textualDcfFileName The textual DCF file to parse.
@@ -58,6 +80,33 @@ public:
 	 */
 	uint16_t getTypeOfObject(uint16_t sdoIndex, uint8_t sdoSubindex) const;
 
+	/**
+	 * @brief getReadableObjects returns all objects of the DCF which can be read from the node.
+	 */
+	ObjectsList getReadableObjects() const;
+	/**
+	 * @brief isWritable checks if the given object exists in the DCF and can be written to the node.
+	 */
+	bool isWritable(uint16_t sdoIndex, uint8_t sdoSubIndex) const;
+	/**
+	 * @brief isPdoMappable checks if the given object exists in the DCF and can be mapped into a PDO, i.e. it is process data.
+	 */
+	bool isPdoMappable(uint16_t sdoIndex, uint8_t sdoSubIndex) const;
+	/**
+	 * @brief getValue returns the value of the given object in the DCF in the CANopen encoding (little endian, as transferred by SDO).
+	 * @return false if the object does not exist.
+	 */
+	bool getValue(uint16_t sdoIndex, uint8_t sdoSubIndex, std::vector<uint8_t>& value) const;
+
+	/**
+	 * @brief getRpdoConfigs returns the configuration of all RPDOs of the node which exist in the DCF.
+	 */
+	std::vector<PdoConfig> getRpdoConfigs() const;
+	/**
+	 * @brief getTpdoConfigs returns the configuration of all TPDOs of the node which exist in the DCF.
+	 */
+	std::vector<PdoConfig> getTpdoConfigs() const;
+
 	/**
 	 * @brief getDefaultNodeID returns the node ID for which this configuration was set in the master.dcf
 	 * @return
@@ -68,9 +117,23 @@ public:
 	// const lely::canopen::SdoDownloadRequest<std::function<void(std::error_code)>>* getBinaryDCF();
 	const std::string& getBinaryDcfFile() {return m_binaryDcfFile;}
 
+	/**
+	 * @brief setBinaryDcfImage sets the in-memory image of the binary DCF which is transferred to the node.
+	 * @param image The image, probably shared with other nodes.
+	 * @param imageNodeID The node ID the image was generated for. If it differs from the node ID of this config,
+	 * the node ID dependent COB IDs are patched during the transfer.
+	 */
+	void setBinaryDcfImage(std::shared_ptr<const ConciseDcfImage> image, uint8_t imageNodeID) {m_binaryDcfImage = image; m_binaryDcfImageNodeID = imageNodeID;}
+	std::shared_ptr<const ConciseDcfImage> getBinaryDcfImage() const {return m_binaryDcfImage;}
+	uint8_t getBinaryDcfImageNodeID() const {return m_binaryDcfImageNodeID;}
+
 private:
+	std::vector<PdoConfig> getPdoConfigs(uint16_t firstCommunicationIndex, uint16_t lastCommunicationIndex) const;
+
 	uint8_t m_defaultNodeID;
 	// std::unique_ptr<lely::canopen::SdoDownloadRequest<std::function<void(std::error_code)>>> m_binaryDCF;
 	std::string m_binaryDcfFile;
+	std::shared_ptr<const ConciseDcfImage> m_binaryDcfImage;
+	uint8_t m_binaryDcfImageNodeID;
 };
 
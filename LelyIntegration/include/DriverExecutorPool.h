@@ -0,0 +1,87 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a thread pool which runs the drivers on strands.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <lely/ev/loop.hpp>
+#include <lely/ev/strand.hpp>
+
+/**
+ * @brief The DriverExecutorPool class runs the drivers on a pool of threads instead of the single executor of the master.
+ *
+ * Each group of drivers gets its own strand (see getStrand()): the tasks of one group never run concurrently and keep their order,
+ * the tasks of different groups run in parallel on the threads of the pool. A slow application callback of one axis
+ * (e.g. callbackOnIDLE or the ErrorCallback) then only delays the axes of its own group.
+ * Give a leader and its followers the same group, they share the state of the follower relationship.
+ * The master itself stays on its own executor: DCFConfigMaster posts the events of the drivers (PDOs, boot, master object changes,
+ * timers) to the executor of each driver and serializes the calls of the drivers into the master with its lock; the drivers take
+ * the lock for their object handles (see DCFDriver::lockMasterObjects()).
+ *
+ * The pool must outlive the master and its drivers. The groups follow the topology of the machine, e.g. node 3 follows node 2:
+ * @code
+ * DriverExecutorPool pool(4);
+ * const std::map<uint8_t, uint8_t> leaders = {{3, 2}};  // follower -> leader
+ * master.setDriverFactory([&](std::shared_ptr<DCFDriverConfig> config)
+ * {
+ *     uint8_t nodeID = config->getDefaultNodeID();
+ *     auto leader = leaders.find(nodeID);
+ *     return std::make_shared<MotorDriver>(pool.getStrand(leader != leaders.end() ? leader->second : nodeID), master, config);
+ * });
+ * @endcode
+ */
+class DriverExecutorPool
+{
+public:
+	/**
+	 * @param numberOfThreads The number of worker threads, 0 = one per core.
+	 * @param cpus The cores to pin the worker threads to (round robin), empty = not pinned.
+	 */
+	explicit DriverExecutorPool(size_t numberOfThreads = 0, const std::vector<int>& cpus = std::vector<int>());
+	~DriverExecutorPool();
+
+	/**
+	 * @brief getStrand returns the executor of the given group, it is created on first use. May be called from any thread.
+	 * @param group E.g. the node ID of the driver or of the leader of a follower group.
+	 */
+	ev_exec_t* getStrand(unsigned group);
+
+	size_t getNumberOfThreads() const {return m_threads.size();}
+	size_t getNumberOfStrands() const;
+
+	/// Stops and joins the worker threads; the tasks which are still queued are not executed. Called by the destructor.
+	void stop();
+
+private:
+	void runWorker(size_t worker);
+
+	lely::ev::Loop m_loop;
+	std::vector<int> m_cpus;
+	std::vector<std::thread> m_threads;
+	mutable std::mutex m_mutex;
+	std::map<unsigned /* group */, std::unique_ptr<lely::ev::Strand>> m_strands;
+	bool m_stopped = false;
+};
@@ -0,0 +1,88 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a runner of the event loop with a blocking and a busy-poll mode.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <system_error>
+#include <lely/ev/loop.hpp>
+
+/**
+ * @brief The EventLoopRunner class runs the event loop of the master on the calling thread.
+ *
+ * In the BLOCKING mode the thread sleeps in the kernel until a frame or a timer wakes it up (lely::ev::Loop::run()), so each event
+ * pays the wakeup latency of the scheduler. In the BUSY_POLL mode the thread polls the CAN socket and the timers without blocking
+ * (lely::ev::Loop::poll()) and reacts within a few microseconds, at the price of a fully loaded core. Pin the thread to a core
+ * which is isolated from other load (e.g. isolcpus), otherwise the busy thread competes with the rest of the system.
+ * See LelyLatency for a comparison of the wakeup latencies of both modes.
+ */
+class EventLoopRunner
+{
+public:
+	enum Mode
+	{
+		BLOCKING,
+		BUSY_POLL
+	};
+
+	/**
+	 * @brief Statistics counts the iterations of the busy-poll mode.
+	 */
+	struct Statistics
+	{
+		size_t tasks;
+		size_t polls;
+		/// The polls which found nothing to do.
+		size_t idlePolls;
+	};
+
+	/**
+	 * @param cpu The core to pin the loop thread to, -1 = not pinned.
+	 */
+	explicit EventLoopRunner(lely::ev::Loop& loop, Mode mode = BLOCKING, int cpu = -1);
+
+	void setMode(Mode mode) {m_mode = mode;}
+	Mode getMode() const {return m_mode;}
+	void setCpu(int cpu) {m_cpu = cpu;}
+
+	/**
+	 * @brief run pins the calling thread (if a core is configured) and runs the loop until stop() is called or the loop has
+	 * no outstanding work left, in both modes.
+	 * @return The number of executed tasks.
+	 */
+	size_t run();
+	/// Stops the loop, may be called from any thread.
+	void stop();
+
+	Statistics getStatistics() const;
+
+	/// Pins the calling thread to the given core.
+	static bool pinThread(int cpu, std::error_code& error);
+
+private:
+	lely::ev::Loop& m_loop;
+	Mode m_mode;
+	int m_cpu;
+	std::atomic<size_t> m_tasks{0};
+	std::atomic<size_t> m_polls{0};
+	std::atomic<size_t> m_idlePolls{0};
+};
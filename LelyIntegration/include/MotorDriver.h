@@ -21,8 +21,11 @@
  */
 
 #pragma once
-#include <deque>
+#include <chrono>
+#include <vector>
 #include "DCFDriver.h"
+#include "PdoLayout.h"
+#include "SeqLock.h"
 
 /**
  * @brief The MotorDriver class controls a CiA-402 compliant motor.
@@ -33,6 +36,48 @@ class MotorDriver : public DCFDriver
 public:
 	MotorDriver(ev_exec_t *exec, lely::canopen::BasicMaster &m, std::shared_ptr<DCFDriverConfig> config);
 
+	/**
+	 * @brief The State enum represents the internal state of the driver. This state has nothing to do with the CiA-402 state.
+	 */
+	enum State : uint8_t
+	{
+		INITIAL_STATE,
+		INITIAL_POWER_ON,
+		INITIAL_POWER_OFF,
+		CYCLE_POWER_SHUTDOWN,
+		POWER_ON_DISABLE_OPERATION,
+		IDLE,
+		PREPARE_MOVE,
+		READY_TO_MOVE,
+		MOVING,
+		PREPARE_HOMING,
+		READY_FOR_HOMING,
+		HOMING,
+		FAULT_STATE,
+		FAULT_RESET,
+		NODE_RESET
+	};
+
+	/**
+	 * @brief AxisSnapshot is the state of the axis as seen by the driver, readable from any thread (see getSnapshot()).
+	 */
+	struct AxisSnapshot
+	{
+		State state;
+		/// The CiA-402 status word received last (0x6041).
+		uint16_t statusWord;
+		/// The error code of the last fault (0x603F or the EMCY error code), 0 while there is no fault.
+		uint16_t faultCode;
+		bool heartbeatLost;
+		/// The parameters of the last move().
+		uint16_t moveMode;
+		int32_t targetPosition;
+		uint32_t targetVelocity;
+		std::chrono::steady_clock::time_point stateChangedAt;
+		std::chrono::steady_clock::time_point statusWordReceivedAt;
+		std::chrono::steady_clock::time_point targetSetAt;
+	};
+
 	/// Constants for the homing method. See SDO 0x6098 in the CiA-402 spec.
 	/// The home() method accepts integers for it since custom homing modes are possible too.
 	enum PredefinedHomingMethod: int8_t
@@ -67,6 +112,11 @@ public:
 		MOTOR_STATUSWORD = 0x6041
 	};
 
+	/// The RPDO layouts expected by createRawPdoSetter() (see LelyTest/demo.yml and LelyTest/motor.dcf).
+	typedef PdoLayout<PdoObject<MOTOR_CONTROLWORD, 0, uint16_t>, PdoObject<MOTOR_OPERATIONMODE, 0, int8_t>> ControlPdoLayout;
+	typedef PdoLayout<PdoObject<MOTOR_POSITION, 0, int32_t>, PdoObject<MOTOR_VELOCITY, 0, uint32_t>> TargetPdoLayout;
+	typedef PdoLayout<PdoObject<MOTOR_ACCELERATION, 0, uint32_t>, PdoObject<MOTOR_DECELERATION, 0, uint32_t>> RampPdoLayout;
+
 	/**
 	 *  This strategy is used to set an SDO on the motor side, e.g. via SDO communication (slow) or PDO communicaion.
 	 */
@@ -98,7 +148,8 @@ public:
 		/// Sets the method to configure the operation mode (See SDO 0x6084 in the CiA 402 spec)
 		void setMotorDecelerationSetter(const SetterStrategy<uint32_t> &MotorDecelerationSetter);
 		/// Sets a function which checks if the change of a certain master SDO means that the staus word (See SDO 0x6041 in the CiA 402 spec) on the corresponding motor has changed.
-		/// Only necessary in screnarios where a custom PDO mapping (not generated by dcfgen) is used.
+		/// Only necessary in screnarios where a custom PDO mapping (not generated by dcfgen) is used and the master objects receiving the
+		/// status words cannot be derived from the PDOs of the master.dcf and the node DCFs (see DCFConfigMaster::getMappedMasterObject()).
 		void setIsStatusWordCheckForMasterSDOChange(const IsStatusWordCheck &isStatusWordCheckForMasterSDOChange);
 
 	private:
@@ -148,6 +199,16 @@ public:
 	 */
 	void setCommunicationConfig(CommunicationConfig config) {m_communicationConfig = config;}
 
+	/**
+	 * @brief getSnapshot returns the state of the axis without locks and without posting to the executor of the driver,
+	 * so any thread may poll it. The snapshot is published by the driver on every change of it and on every received status word.
+	 */
+	AxisSnapshot getSnapshot() const {return m_snapshot.load();}
+	/// Changes with every published snapshot, e.g. to skip unchanged axes.
+	uint64_t getSnapshotVersion() const {return m_snapshot.getVersion();}
+
+	static const char* stateToString(State state);
+
 	/**
 	 * Create a strategy which sets an SDO on the motor side via SDO communication. Not suitable for follower relationships.
 	 */
@@ -156,11 +217,7 @@ public:
 	{
 		return [sdo, this](T value, std::function<void (std::error_code)> callback)
 		{
-			SubmitWrite<T>(sdo, 0, std::forward<T>(value), [callback](uint8_t /*id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec)
-			{
-				if (callback != nullptr)
-					callback(ec);
-			});
+			submitPooledWrite<T>(sdo, 0, value, callback);
 		};
 	}
 
@@ -172,10 +229,23 @@ public:
 	template<typename T>
 	SetterStrategy<T> createMasterSDOSetter(uint16_t masterIndex, uint8_t masterSubIndex, int tpdo)
 	{
-		return [masterIndex, masterSubIndex, tpdo, this](T value, std::function<void (std::error_code)> callback)
+		ObjectHandle<T> handle;
+		return [masterIndex, masterSubIndex, tpdo, handle, this](T value, std::function<void (std::error_code)> callback) mutable
 		{
+			// Resolved on the first call, the setter is created before the object dictionary of the master is complete.
+			if (!handle.isResolved())
+				handle = getMasterObjectHandle<T>(masterIndex, masterSubIndex);
+
 			std::error_code error;
-			master.Write<T>(masterIndex, masterSubIndex, value, error);
+			if (handle.isValid())
+			{
+				auto lock = lockMasterObjects();
+				handle.write(value);
+			}
+			else
+			{
+				master.Write<T>(masterIndex, masterSubIndex, value, error);
+			}
 			if (!error && tpdo >= 0)
 				master.TpdoEvent(tpdo);
 			if (callback != nullptr)
@@ -183,18 +253,97 @@ public:
 		};
 	}
 
+	/**
+	 * Creates a strategy which sets an SDO on the motor side via PDO communication,
+	 * using the master SDO which DCFConfigMaster generated for it (see DCFConfigMaster::setAutomaticPdoMapping()).
+	 * If sendPdo is true, the master TPDO containing the SDO is triggered.
+	 * Falls back to SDO communication if the SDO is not mapped into a PDO.
+	 */
+	template<typename T>
+	SetterStrategy<T> createGeneratedMappingSetter(MotorSDO sdo, bool sendPdo)
+	{
+		uint16_t masterIndex = 0;
+		uint8_t masterSubIndex = 0;
+		int tpdo = -1;
+		if (!getGeneratedMasterObject(sdo, masterIndex, masterSubIndex, tpdo) || tpdo < 0)
+			return createSDOSetter<T>(sdo);
+		return createMasterSDOSetter<T>(masterIndex, masterSubIndex, sendPdo ? tpdo : -1);
+	}
+
+	/**
+	 * Creates a status word check for the master SDO which DCFConfigMaster generated for the status word of this motor
+	 * (see DCFConfigMaster::setAutomaticPdoMapping()).
+	 */
+	IsStatusWordCheck createGeneratedStatusWordCheck();
+
 	/**
 	 * Create a strategy which sets an SDO on the motor side via PDO communication through mapped TPDOs.
 	 */
 	template<typename T>
 	SetterStrategy<T> createMappedTpdoSetter(MotorSDO sdo, bool writeEvent)
 	{
-		return [sdo, writeEvent, this](T value, std::function<void (std::error_code)> callback)
+		ObjectHandle<T> handle;
+		return [sdo, writeEvent, handle, this](T value, std::function<void (std::error_code)> callback) mutable
 		{
+			// Resolved on the first call, the setter is created before the object dictionary of the master is complete.
+			if (!handle.isResolved())
+				handle = getMappedObjectHandle<T>(id(), sdo, 0);
+
 			std::error_code error;
-			tpdo_mapped[sdo][0].Write(value, error);
-			if (writeEvent)
-				tpdo_mapped[sdo][0].WriteEvent(error);
+			if (handle.isValid())
+			{
+				auto lock = lockMasterObjects();
+				handle.write(value);
+				if (writeEvent)
+					handle.writeEvent();
+			}
+			else
+			{
+				tpdo_mapped[sdo][0].Write(value, error);
+				if (writeEvent)
+					tpdo_mapped[sdo][0].WriteEvent(error);
+			}
+			if (callback != nullptr)
+				callback(error);
+		};
+	}
+
+	/**
+	 * Creates a strategy which sets an SDO on the motor side by sending the RPDO of the motor which contains it as raw CAN frame,
+	 * encoded with ControlPdoLayout, TargetPdoLayout or RampPdoLayout instead of through the PDO of the master.
+	 * The other objects of the frame keep the value set last. If send is false, the value is only stored for the next frame.
+	 * The mode of operation of the control frame starts with the one of the drive (0x6061, read in OnConfig()); if it cannot be read,
+	 * the control frame is not sent until the mode has been set.
+	 * The value is also written to the master object mapped to it (without an event), so a PDO of the master with the same COB ID,
+	 * e.g. sent on SYNC, carries the same value instead of an outdated one. Set all objects of such a PDO with these setters.
+	 * Falls back to createMappedTpdoSetter() if the DCF of the node does not map the layout or the master is no DCFConfigMaster.
+	 */
+	template<typename T>
+	SetterStrategy<T> createRawPdoSetter(MotorSDO sdo, bool send)
+	{
+		if (getRawPdoCobID(sdo) == 0)
+			return createMappedTpdoSetter<T>(sdo, send);
+
+		ObjectHandle<T> handle;
+		return [sdo, send, handle, this](T value, std::function<void (std::error_code)> callback) mutable
+		{
+			// Resolved on the first call like in createMappedTpdoSetter().
+			if (!handle.isResolved())
+				handle = getMappedObjectHandle<T>(id(), sdo, 0);
+
+			if (handle.isValid())
+			{
+				auto lock = lockMasterObjects();
+				handle.write(value);
+			}
+			else
+			{
+				// Fails if the master does not map the object at all, then there is no PDO of the master to keep consistent.
+				std::error_code notMapped;
+				tpdo_mapped[sdo][0].Write(value, notMapped);
+			}
+
+			std::error_code error = setRawPdoValue(sdo, static_cast<int64_t>(value), send);
 			if (callback != nullptr)
 				callback(error);
 		};
@@ -204,39 +353,24 @@ public:
 	virtual void OnState(lely::canopen::NmtState st) noexcept override;
 
 	virtual void onSystemBootCompleted() noexcept override;
+	/// Reads the status word again, e.g. after its TPDO was invalidated for a moment.
+	virtual void resynchronizeInputs() noexcept override;
+	virtual void preallocate() override;
 
 protected:
 	virtual void OnConfig(::std::function<void (::std::error_code)> res) noexcept override;
 
 	virtual void OnBoot(lely::canopen::NmtState st, char es, const ::std::string &what) noexcept override;
 
+	/// A lost heartbeat puts the motor into the FAULT_STATE; recoverFromFault() resets the node.
+	virtual void OnHeartbeat(bool occurred) noexcept override;
+	virtual void OnEmcy(uint16_t emergencyErrorCode, uint8_t errorRegister, uint8_t manufSpecificError[5]) noexcept override;
+
 	virtual void onMasterSDOChanged(uint16_t index, uint8_t subIndex) override;
-	virtual void OnRpdoWrite (uint16_t idx, uint8_t subidx) noexcept override;
+	virtual void onRpdoFrame(const std::vector<std::pair<uint16_t, uint8_t>>& objects) noexcept override;
 	virtual void onFollowerRpdoWrite  (uint16_t idx, uint8_t subidx) noexcept override;
 
 private:
-	/**
-	 * @brief The State enum represents the internal state of the driver. This state has nothing to do with the CiA-402 state.
-	 */
-	enum State
-	{
-		INITIAL_STATE,
-		INITIAL_POWER_ON,
-		INITIAL_POWER_OFF,
-		CYCLE_POWER_SHUTDOWN,
-		POWER_ON_DISABLE_OPERATION,
-		IDLE,
-		PREPARE_MOVE,
-		READY_TO_MOVE,
-		MOVING,
-		PREPARE_HOMING,
-		READY_FOR_HOMING,
-		HOMING,
-		FAULT_STATE,
-		FAULT_RESET,
-		NODE_RESET
-	};
-
 	enum StatusWordFlags
 	{
 		READY_TO_SWITCH_ON       = 0x0001,
@@ -257,12 +391,34 @@ private:
 		MANUFACTURER_SPECIFIC3   = 0x8000
 	};
 
+	/// Sets the internal state from the status word of the motor after the first configuration.
+	void synchronizeStateAfterConfig(std::function<void (std::error_code)> res);
+
 	void prepareHoming(int8_t method, uint32_t researchSpeed, uint32_t releaseSpeed, uint32_t accel, int32_t offset);
 
 	void prepareMove();
 	void executeMove();
 
-	bool isSetterOK(const std::error_code& ec, const std::string& message);
+	bool isSetterOK(const std::error_code& ec, const char* message);
+	bool getGeneratedMasterObject(MotorSDO sdo, uint16_t& masterIndex, uint8_t& masterSubIndex, int& tpdo);
+
+	void verifyPdoLayouts();
+	uint32_t getRawPdoCobID(MotorSDO sdo) const;
+	std::error_code setRawPdoValue(MotorSDO sdo, int64_t value, bool send);
+
+	/// The COB IDs of the RPDOs of the node which match ControlPdoLayout, TargetPdoLayout and RampPdoLayout, 0 if there is none.
+	uint32_t m_controlPdoCobID = 0;
+	uint32_t m_targetPdoCobID = 0;
+	uint32_t m_rampPdoCobID = 0;
+	/// The values of the raw PDOs (see createRawPdoSetter()).
+	uint16_t m_rawControlWord = 0;
+	int8_t m_rawOperationMode = 0;
+	/// false until m_rawOperationMode was read from the drive (see OnConfig()) or set, the control frame is not sent meanwhile.
+	bool m_rawOperationModeKnown = false;
+	int32_t m_rawPosition = 0;
+	uint32_t m_rawVelocity = 0;
+	uint32_t m_rawAcceleration = 0;
+	uint32_t m_rawDeceleration = 0;
 
 	CommunicationConfig m_communicationConfig;
 
@@ -275,21 +431,47 @@ private:
 	State m_followingNodeState = IDLE;
 	/// The aggregated state (identical with m_mainNodeState if the node has no follower).
 	State m_state = INITIAL_STATE;
+	/// The watchdog of the fault reset (see recoverFromFault()), only set while it runs on the timer wheel of the master.
+	TimerWheel::TimerID m_faultResetWatchdog = TimerWheel::INVALID_TIMER;
 	/// The original CiA-402 state
 	uint16_t m_statusWord = 0;
+	/// The fault code published in the snapshot.
+	uint16_t m_faultCode = 0;
+	/// Written on the executor of the driver only, see publishSnapshot().
+	AxisSnapshot m_lastSnapshot = AxisSnapshot();
+	SeqLock<AxisSnapshot> m_snapshot;
+	void publishSnapshot();
+	/// The master objects receiving the status words of this node and the following node, resolved in OnConfig().
+	ObjectHandle<uint16_t> m_statusWordHandle;
+	ObjectHandle<uint16_t> m_followingStatusWordHandle;
+
+	/**
+	 * @brief HandledStatusWord is the input of the last handleStatusWordChange() call. It is valid if the call did not change
+	 * any state: the same status word in the same states leads to the same result then, so it is skipped.
+	 */
+	struct HandledStatusWord
+	{
+		bool valid;
+		uint16_t statusWord;
+		State state;
+		State mainNodeState;
+		State followingNodeState;
+	};
+	/// Index 0: the status word of this node, 1: the status word of the following node.
+	HandledStatusWord m_lastHandledStatusWords[2] = {{false, 0, INITIAL_STATE, IDLE, IDLE}, {false, 0, INITIAL_STATE, IDLE, IDLE}};
 
 	void handleStatusWordChange(uint16_t statusWord, bool statusWordOfFollowerChanged);
+	void handleStatusWord(uint16_t statusWord, bool statusWordOfFollowerChanged);
 
 	State determineStateFromStatusWord(State currentState, uint16_t statusWord, uint8_t nodeID);
 	void setState(State newState);
-	std::string stateToString(State state);
 	uint16_t m_currentMoveMode = 0;
 	int32_t m_moveToPosition = 0;
 	uint32_t m_moveSpeed = 0;
 	uint32_t m_moveAcceleration = 0;
 	uint32_t m_moveDeacceleration = 0;
 
-	void handleFault();
+	void handleFault(unsigned attempt = 0);
 	void performFaultReset();
 	void retriggerFaultReset() noexcept;
 
@@ -297,9 +479,14 @@ private:
 	lely::canopen::NmtState m_nodeNmtState = lely::canopen::NmtState::STOP;
 	void handleInitialStateSwitching();
 
-	std::deque<std::function<void()>> m_callbackOnIDLE;
+	/// A ring of the callbacks, oldest first, preallocated by preallocate() and only grown if it is full.
+	std::vector<std::function<void()>> m_callbacksOnIdle;
+	size_t m_oldestCallbackOnIdle = 0;
+	size_t m_numberOfCallbacksOnIdle = 0;
 	std::mutex m_callbacksOnIdleMutex;
 	void addCallbackOnIdle(std::function<void()> callback);
 	void processOldestCallbackOnIdle();
+	void clearCallbacksOnIdle();
+	void growCallbacksOnIdle(size_t size);
 
 };
@@ -0,0 +1,175 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a coordinator of the masters of several CAN buses.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <lely/ev/loop.hpp>
+#include <lely/io2/posix/poll.hpp>
+#include <lely/io2/sys/timer.hpp>
+
+#include "BatchedCanChannel.h"
+#include "DCFConfigMaster.h"
+#include "EventLoopRunner.h"
+
+/**
+ * @brief The MultiBusMaster class runs one DCFConfigMaster per CAN bus, each with its own event loop on its own thread
+ * (optionally pinned to a core), and combines them under one API: the nodes are addressed by (bus, node ID),
+ * axes of different buses form groups and one notification tells that all buses have booted.
+ *
+ * @code
+ * MultiBusMaster machine([](lely::io::TimerBase& timer, lely::io::CanChannelBase& channel, ev_exec_t* exec, const std::string& dcf)
+ * {
+ *     auto master = std::make_shared<DCFConfigMaster>(timer, channel, dcf, exec);
+ *     master->setDriverFactory(...);
+ *     return master;
+ * });
+ * uint8_t bus0, bus1;
+ * machine.addBus(MultiBusMaster::BusConfig("can0", "bus0/master.dcf", 2), bus0, error);
+ * machine.addBus(MultiBusMaster::BusConfig("can1", "bus1/master.dcf", 3), bus1, error);
+ * machine.addAxisGroup("conveyor", {{bus0, 3}, {bus1, 3}});
+ * machine.setBootCompletedCallback([&machine]() {...});
+ * machine.start();
+ * @endcode
+ * The callbacks run on the thread of the bus which triggered them. The boot completed callbacks of the masters are used by this class,
+ * do not set them in the factory. A bus without nodes never completes its boot.
+ */
+class MultiBusMaster
+{
+public:
+	/**
+	 * @brief NodeAddress identifies a node of the machine.
+	 */
+	struct NodeAddress
+	{
+		uint8_t bus;
+		uint8_t nodeID;
+
+		bool operator<(const NodeAddress& other) const {return bus != other.bus ? bus < other.bus : nodeID < other.nodeID;}
+		bool operator==(const NodeAddress& other) const {return bus == other.bus && nodeID == other.nodeID;}
+	};
+
+	/**
+	 * @brief BusConfig describes one bus.
+	 */
+	struct BusConfig
+	{
+		std::string interface;
+		/// The DCF of the master of this bus.
+		std::string dcf;
+		/// The core of the event loop thread, -1 = not pinned.
+		int cpu = -1;
+		EventLoopRunner::Mode mode = EventLoopRunner::BLOCKING;
+		/// Installs the COB IDs consumed by the master as receive filter (see DCFConfigMaster::enableReceiveFilter()).
+		bool receiveFilter = true;
+
+		BusConfig(const std::string& interface, const std::string& dcf, int cpu = -1) : interface(interface), dcf(dcf), cpu(cpu) {}
+	};
+
+	/// Creates the master of a bus. Called by addBus() on the calling thread.
+	typedef std::function<std::shared_ptr<DCFConfigMaster>(lely::io::TimerBase& timer, lely::io::CanChannelBase& channel, ev_exec_t* exec, const std::string& dcf)> MasterFactory;
+	typedef std::vector<NodeAddress> AxisGroup;
+	/// Runs an action for a driver, done() has to be called once it is completed (e.g. in the callbackOnIDLE of a move).
+	typedef std::function<void(std::shared_ptr<DCFDriver> driver, std::function<void()> done)> GroupAction;
+
+	explicit MultiBusMaster(MasterFactory factory);
+	/// Stops the event loops.
+	~MultiBusMaster();
+
+	MultiBusMaster(const MultiBusMaster&) = delete;
+	MultiBusMaster& operator=(const MultiBusMaster&) = delete;
+
+	/**
+	 * @brief addBus opens the CAN interface and creates the master of the bus. Has to be called before start().
+	 * @return The number of the bus, used in the NodeAddress.
+	 */
+	bool addBus(const BusConfig& config, uint8_t& bus, std::error_code& error);
+
+	/**
+	 * @brief start configures the drivers of all masters, resets the nodes and starts one event loop thread per bus.
+	 */
+	void start();
+	/// Stops the event loops and waits for their threads.
+	void stop();
+
+	size_t getNumberOfBuses() const {return m_buses.size();}
+	std::shared_ptr<DCFConfigMaster> getMaster(uint8_t bus) const;
+	/// The executor of the bus, to run code which accesses its master or drivers.
+	ev_exec_t* getExecutor(uint8_t bus) const;
+	/// Returns nullptr if there is no such node.
+	std::shared_ptr<DCFDriver> getDriver(NodeAddress address) const;
+
+	/// Defines (or replaces) a group of axes, which may be on different buses.
+	void addAxisGroup(const std::string& name, const AxisGroup& axes);
+	/// Returns nullptr if there is no such group.
+	const AxisGroup* getAxisGroup(const std::string& name) const;
+
+	/**
+	 * @brief forEachInGroup runs the action for each driver of the group on the executor of the driver (usually the one of its bus,
+	 * see DriverExecutorPool), i.e. the buses work in parallel.
+	 * @param completed Called once all actions called done(), on the thread of the last one. Called immediately for an unknown or empty group.
+	 */
+	void forEachInGroup(const std::string& name, GroupAction action, std::function<void()> completed = nullptr);
+
+	/// Called for each node which has booted.
+	void setNodeBootedCallback(std::function<void(NodeAddress)> callback) {m_nodeBootedCallback = callback;}
+	/// Called once, when the nodes of all buses have booted.
+	void setBootCompletedCallback(std::function<void()> callback) {m_bootCompletedCallback = callback;}
+
+private:
+	/**
+	 * @brief Bus holds the event loop and the master of one bus, in the order of their construction.
+	 */
+	struct Bus
+	{
+		explicit Bus(const BusConfig& config);
+
+		BusConfig config;
+		lely::io::Context context;
+		lely::io::Poll poll;
+		lely::ev::Loop loop;
+		lely::io::Timer timer;
+		lely::io::Timer timerWheelTimer;
+		BatchedCanChannel channel;
+		std::shared_ptr<DCFConfigMaster> master;
+		std::unique_ptr<EventLoopRunner> runner;
+		std::thread thread;
+		bool booted = false;
+	};
+
+	void onBootCompleted(uint8_t bus, uint8_t nodeID);
+
+	MasterFactory m_factory;
+	std::vector<std::unique_ptr<Bus>> m_buses;
+	std::map<std::string, AxisGroup> m_axisGroups;
+	std::function<void(NodeAddress)> m_nodeBootedCallback;
+	std::function<void()> m_bootCompletedCallback;
+	std::mutex m_mutex;
+	bool m_bootCompletedNotified = false;
+};
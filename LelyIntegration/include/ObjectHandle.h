@@ -0,0 +1,107 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains a typed handle to a sub-object of a local object dictionary.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <type_traits>
+
+#include <lely/co/dev.h>
+
+/**
+ * @brief The ObjectHandle class gives direct access to the value of a sub-object of a local object dictionary (e.g. the one of the master),
+ * resolved once instead of looking up the object on every access like lely::canopen::Device::Write() or rpdo_mapped[idx][subidx].
+ * The type is checked when the handle is resolved, a read or write is then a single load or store.
+ *
+ * The value is accessed without the indications and the locking of lely: use the handle on the executor of the master only,
+ * or with the lock of the master (see DCFDriver::lockMasterObjects() for the drivers on a DriverExecutorPool).
+ * Inserting sub-objects moves the values of an object, so resolve handles only after the object dictionary is complete,
+ * i.e. after DCFConfigMaster::configureDrivers() (see DCFDriver::getMasterObjectHandle()).
+ */
+template<class T>
+class ObjectHandle
+{
+	static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "Only basic numeric types are supported.");
+
+public:
+	/// An unresolved handle.
+	ObjectHandle() = default;
+
+	/**
+	 * @brief ObjectHandle resolves the sub-object. The handle is invalid if the sub-object does not exist or has another type.
+	 * @param dev The object dictionary, may be nullptr.
+	 */
+	ObjectHandle(co_dev_t* dev, uint16_t index, uint8_t subIndex) :
+		m_resolved(true),
+		m_index(index),
+		m_subIndex(subIndex)
+	{
+		co_sub_t* subObject = dev != nullptr ? co_dev_find_sub(dev, index, subIndex) : nullptr;
+		if (subObject != nullptr && co_sub_get_type(subObject) == getDataType())
+		{
+			m_dev = dev;
+			m_value = static_cast<T*>(co_sub_addressof_val(subObject));
+		}
+	}
+
+	/// true if resolving was tried, even if it failed.
+	bool isResolved() const {return m_resolved;}
+	bool isValid() const {return m_value != nullptr;}
+
+	uint16_t getIndex() const {return m_index;}
+	uint8_t getSubIndex() const {return m_subIndex;}
+
+	/// Only valid handles can be read or written.
+	T read() const {return *m_value;}
+	void write(T value) const {*m_value = value;}
+	/// The value in the object dictionary, e.g. to read it without knowing T at the caller (see DCFDriver::updateRemoteObjectCache()).
+	const T* getAddress() const {return m_value;}
+
+	/// Triggers the event driven TPDOs which map the sub-object, like lely::canopen::BasicDriver::tpdo_mapped[idx][subidx].WriteEvent().
+	void writeEvent() const {co_dev_tpdo_event(m_dev, m_index, m_subIndex);}
+
+	/// The CANopen data type (CO_DEFTYPE_*) which corresponds to T.
+	static uint16_t getDataType()
+	{
+		if (std::is_floating_point<T>::value)
+			return sizeof(T) == 4 ? CO_DEFTYPE_REAL32 : CO_DEFTYPE_REAL64;
+
+		bool isSigned = std::is_signed<T>::value;
+		switch (sizeof(T))
+		{
+		case 1:
+			return isSigned ? CO_DEFTYPE_INTEGER8 : CO_DEFTYPE_UNSIGNED8;
+		case 2:
+			return isSigned ? CO_DEFTYPE_INTEGER16 : CO_DEFTYPE_UNSIGNED16;
+		case 4:
+			return isSigned ? CO_DEFTYPE_INTEGER32 : CO_DEFTYPE_UNSIGNED32;
+		default:
+			return isSigned ? CO_DEFTYPE_INTEGER64 : CO_DEFTYPE_UNSIGNED64;
+		}
+	}
+
+private:
+	bool m_resolved = false;
+	co_dev_t* m_dev = nullptr;
+	T* m_value = nullptr;
+	uint16_t m_index = 0;
+	uint8_t m_subIndex = 0;
+};
@@ -0,0 +1,110 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a snapshot of the parameters of all nodes of a system.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+class DCFDriverConfig;
+
+/**
+ * @brief The ParameterSnapshot class holds the values of the objects read from the nodes of a system
+ * (see DCFConfigMaster::backupParameters()), e.g. to commission a replaced drive with the parameters of the old one.
+ *
+ * The file format is compact and binary: the magic "LPS1", followed by one block per node
+ * (node ID: 1 byte, size of the block: 4 bytes, the block itself is a concise DCF as defined by CiA-302-3).
+ * All numbers are little endian.
+ */
+class ParameterSnapshot
+{
+public:
+	/**
+	 * @brief Entry is the value of one object as transferred by SDO.
+	 */
+	struct Entry
+	{
+		uint16_t index;
+		uint8_t subIndex;
+		std::vector<uint8_t> data;
+	};
+
+	/**
+	 * @brief Statistics describes a backup or restore of the whole system.
+	 */
+	struct Statistics
+	{
+		size_t nodes;
+		size_t objects;        ///< Transferred successfully.
+		size_t failedObjects;
+		size_t bytes;          ///< Payload of the transferred objects.
+		std::chrono::milliseconds duration;
+
+		/// The payload throughput in bytes/s.
+		double getThroughput() const {return duration.count() > 0 ? bytes * 1000.0 / duration.count() : 0;}
+	};
+
+	void addEntry(uint8_t nodeID, Entry entry);
+
+	/// The entries per node ID, sorted by index and sub index.
+	const std::map<uint8_t, std::vector<Entry>>& getNodes() const {return m_nodes;}
+	size_t getNumberOfEntries() const;
+
+	/**
+	 * @brief getRestorableEntries returns the entries of the given node which can be written back in the order they have to be written:
+	 * only configuration parameters (see isConfigurationParameter()) which are writable and not PDO mappable according to the DCF of the node,
+	 * the PDOs are disabled while their parameters are written.
+	 * Process data like the control word or the target position is never restored, the drive would act on it immediately.
+	 * @param nodeID The node.
+	 * @param config The configuration of the node.
+	 * @param onlyDifferences If set, only objects (or PDOs) whose value differs from the DCF are returned.
+	 */
+	std::vector<Entry> getRestorableEntries(uint8_t nodeID, const DCFDriverConfig& config, bool onlyDifferences) const;
+
+	/**
+	 * @brief isConfigurationParameter checks if the given object holds a configuration parameter by its index:
+	 * the communication profile area 0x1000 - 0x1FFF without commands (e.g. store/restore parameters),
+	 * the manufacturer specific area 0x2000 - 0x5FFF and the device profile area 0x6000 - 0x9FFF
+	 * without the set points of CiA-402 (e.g. control word, modes of operation, target position, velocity and torque).
+	 * Configuration of CiA-402 like the software position limits (0x607D) or the homing parameters (0x6098 - 0x609A) is included.
+	 */
+	static bool isConfigurationParameter(uint16_t index);
+
+	/**
+	 * @brief toConciseDcf encodes the given entries as concise DCF (CiA-302-3), e.g. for lely::canopen::BasicDriver::SubmitWriteDcf().
+	 */
+	static std::vector<uint8_t> toConciseDcf(const std::vector<Entry>& entries);
+
+	bool save(const std::string& fileName, std::error_code& error) const;
+	/**
+	 * @brief load reads a snapshot written by save().
+	 * @return The snapshot or nullptr in case of an error.
+	 */
+	static std::shared_ptr<ParameterSnapshot> load(const std::string& fileName, std::error_code& error);
+
+private:
+	std::map<uint8_t, std::vector<Entry>> m_nodes;
+};
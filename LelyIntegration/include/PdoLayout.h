@@ -0,0 +1,143 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains compile-time descriptions of PDO layouts with the functions to encode and decode the frames.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief PdoObject describes one object mapped into a PDO: the object on the node and its C++ type,
+ * which also defines the length of the mapping entry.
+ */
+template<uint16_t Index, uint8_t SubIndex, class T>
+struct PdoObject
+{
+	static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && sizeof(T) <= 8, "Only basic numeric types can be mapped.");
+
+	typedef T Type;
+	static const uint16_t index = Index;
+	static const uint8_t subIndex = SubIndex;
+	static const uint32_t bits = sizeof(T) * 8;
+
+	/// The mapping entry as written to the mapping parameter of a PDO: index << 16 | sub index << 8 | length in bits.
+	static uint32_t getMappingEntry() {return (static_cast<uint32_t>(Index) << 16) | (static_cast<uint32_t>(SubIndex) << 8) | bits;}
+};
+
+namespace PdoLayoutDetail
+{
+	template<size_t Size> struct Unsigned;
+	template<> struct Unsigned<1> {typedef uint8_t Type;};
+	template<> struct Unsigned<2> {typedef uint16_t Type;};
+	template<> struct Unsigned<4> {typedef uint32_t Type;};
+	template<> struct Unsigned<8> {typedef uint64_t Type;};
+
+	/// Stores the value little endian (CANopen byte order), independent of the byte order of the host.
+	template<class T>
+	inline void store(uint8_t* data, T value)
+	{
+		typename Unsigned<sizeof(T)>::Type bits;
+		std::memcpy(&bits, &value, sizeof(T));
+		for (size_t i = 0; i < sizeof(T); i++)
+			data[i] = static_cast<uint8_t>(bits >> (8 * i));
+	}
+
+	template<class T>
+	inline T load(const uint8_t* data)
+	{
+		typename Unsigned<sizeof(T)>::Type bits = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+			bits |= static_cast<typename Unsigned<sizeof(T)>::Type>(data[i]) << (8 * i);
+		T value;
+		std::memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	inline void pack(uint8_t* /* data */) {}
+
+	template<class T, class... Rest>
+	inline void pack(uint8_t* data, T value, Rest... rest)
+	{
+		store(data, value);
+		pack(data + sizeof(T), rest...);
+	}
+
+	inline void unpack(const uint8_t* /* data */) {}
+
+	template<class T, class... Rest>
+	inline void unpack(const uint8_t* data, T& value, Rest&... rest)
+	{
+		value = load<T>(data);
+		unpack(data + sizeof(T), rest...);
+	}
+
+	template<class... Objects> struct Size;
+	template<> struct Size<> {static const size_t value = 0;};
+	template<class Object, class... Rest> struct Size<Object, Rest...> {static const size_t value = sizeof(typename Object::Type) + Size<Rest...>::value;};
+}
+
+/**
+ * @brief PdoLayout describes the contents of a PDO at compile time: the objects (see PdoObject) in the order of the mapping,
+ * without gaps. It generates the functions to encode and decode the frame, the offsets are resolved by the compiler.
+ *
+ * Example: the RPDO with the controlword and the mode of operation of a CiA-402 drive:
+ * @code
+ * typedef PdoLayout<PdoObject<0x6040, 0, uint16_t>, PdoObject<0x6060, 0, int8_t>> ControlPdo;
+ * uint8_t frame[ControlPdo::size];
+ * ControlPdo::pack(frame, 0x000f, 1);
+ * @endcode
+ * Use matches() to verify at startup that the mapping configured on the node is the expected one.
+ */
+template<class... Objects>
+class PdoLayout
+{
+public:
+	/// The length of the frame in bytes.
+	static const size_t size = PdoLayoutDetail::Size<Objects...>::value;
+	static_assert(size <= 8, "A PDO holds at most 8 bytes.");
+
+	/// Encodes the values into data, which must hold at least size bytes.
+	static void pack(uint8_t* data, typename Objects::Type... values)
+	{
+		PdoLayoutDetail::pack(data, values...);
+	}
+
+	/// Decodes the values from data, which must hold at least size bytes.
+	static void unpack(const uint8_t* data, typename Objects::Type&... values)
+	{
+		PdoLayoutDetail::unpack(data, values...);
+	}
+
+	/// The mapping entries (index << 16 | sub index << 8 | length in bits) of the layout.
+	static std::vector<uint32_t> getMapping()
+	{
+		return std::vector<uint32_t>{Objects::getMappingEntry()...};
+	}
+
+	/// Checks if the given mapping entries describe this layout.
+	static bool matches(const std::vector<uint32_t>& mapping)
+	{
+		return mapping == getMapping();
+	}
+};
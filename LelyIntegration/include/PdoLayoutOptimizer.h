@@ -0,0 +1,138 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of an offline optimizer for the PDO layout of the axes on a CAN bus.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * @brief The PdoLayoutOptimizer class packs the signals of all axes into as few 8 byte PDOs as possible and
+ * assigns the COB IDs by urgency (the lower the COB ID, the higher the priority in the CAN arbitration).
+ *
+ * Signals with the same update rate share a frame; frames with the shortest deadline get the lowest COB IDs.
+ * The result can be written as textual DCF sections (for DCFDriverConfig) or as rpdo/tpdo sections of a dcfgen YAML file.
+ * It is meant to be used offline (e.g. by a small tool at build time), it does not need a running bus.
+ */
+class PdoLayoutOptimizer
+{
+public:
+	/**
+	 * @brief Signal is one object of an axis which has to be exchanged cyclically.
+	 */
+	struct Signal
+	{
+		std::string name;          ///< Used as comment in the generated fragments, e.g. "Control Word".
+		uint16_t index;
+		uint8_t subIndex;
+		uint8_t bitLength;         ///< 1..64
+		bool toSlave;              ///< true: sent by the master (slave RPDO), false: sent by the slave (slave TPDO).
+		double periodMs;           ///< The update period.
+		double deadlineMs;         ///< The maximum latency, 0 = periodMs.
+	};
+
+	/**
+	 * @brief Axis describes the signals of one node.
+	 */
+	struct Axis
+	{
+		uint8_t nodeID;
+		std::vector<Signal> signals;
+		uint8_t leaderNodeID = 0;  ///< != 0: the node follows the given node and receives the same RPDOs (see DCFConfigMaster), so its toSlave signals have to be ones of the leader.
+		uint16_t maxRpdos = 4;     ///< The number of RPDOs the device supports.
+		uint16_t maxTpdos = 4;     ///< The number of TPDOs the device supports.
+	};
+
+	/**
+	 * @brief Pdo is one generated frame.
+	 */
+	struct Pdo
+	{
+		uint8_t nodeID;
+		bool isRpdo;               ///< From the point of view of the slave.
+		uint16_t number;           ///< 1 based, i.e. the communication parameter is 0x1400/0x1800 + number - 1.
+		uint32_t cobID;
+		double periodMs;
+		double deadlineMs;
+		std::vector<Signal> signals;
+
+		/// The number of data bytes of the frame.
+		uint8_t getSize() const;
+		/// The PDO mapping entries (index << 16 | sub index << 8 | bit length).
+		std::vector<uint32_t> getMapping() const;
+	};
+
+	/**
+	 * @brief Layout is the result of the optimization.
+	 */
+	struct Layout
+	{
+		std::vector<Pdo> pdos;     ///< Sorted by COB ID, i.e. by priority.
+		double busLoad;            ///< The worst case bus load (bit stuffing included) of the PDOs, 1.0 = 100 %.
+	};
+
+	/**
+	 * @param bitRate The bit rate of the bus in bit/s, e.g. 500000.
+	 */
+	explicit PdoLayoutOptimizer(uint32_t bitRate);
+
+	void addAxis(const Axis& axis) {m_axes.push_back(axis);}
+
+	/**
+	 * @brief setCobIDRange restricts the COB IDs to assign. The default is the PDO range of the predefined connection set.
+	 */
+	void setCobIDRange(uint32_t first, uint32_t last) {m_firstCobID = first; m_lastCobID = last;}
+
+	/**
+	 * @brief optimize calculates the layout.
+	 * @param error Set if the signals do not fit into the PDOs of an axis, the COB ID range is too small, the bus is overloaded
+	 * or a following axis has a toSlave signal which its leader does not receive.
+	 * The layout is returned nevertheless (if possible), so it can be inspected.
+	 */
+	Layout optimize(std::error_code& error) const;
+
+	/**
+	 * @brief getFrameTime returns the worst case transmission time in seconds of a standard (11 bit) frame with the given number of data bytes.
+	 */
+	double getFrameTime(uint8_t dataBytes) const;
+
+	/**
+	 * @brief toDcfFragment returns the PDO communication and mapping sections of the given node in textual DCF syntax.
+	 * They replace the corresponding sections of the slave DCF. The TPDOs get the period as event timer (sub index 5).
+	 */
+	static std::string toDcfFragment(const Layout& layout, uint8_t nodeID);
+
+	/**
+	 * @brief toYamlFragment returns the rpdo and tpdo sections of the given node for the dcfgen YAML configuration.
+	 * The TPDOs get the period as event_timer.
+	 */
+	static std::string toYamlFragment(const Layout& layout, uint8_t nodeID);
+
+private:
+	bool packAxis(const Axis& axis, bool toSlave, std::vector<Pdo>& pdos) const;
+
+	uint32_t m_bitRate;
+	uint32_t m_firstCobID = 0x181;
+	uint32_t m_lastCobID = 0x57F;
+	std::vector<Axis> m_axes;
+};
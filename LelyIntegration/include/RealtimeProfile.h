@@ -0,0 +1,124 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of the real-time operation profile of the process running the master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <system_error>
+#include <vector>
+#include <sched.h>
+#include <lely/util/diag.h>
+
+/**
+ * @brief The RealtimeProfile class prepares the process and the thread of the event loop for real-time operation:
+ * - the memory is locked (mlockall()) and the heap is neither trimmed nor mapped per allocation, so no page fault delays the loop,
+ * - the stack of the loop thread is prefaulted,
+ * - the loop thread gets a real-time scheduling policy and priority (needs CAP_SYS_NICE or an rtprio limit),
+ * - the diagnostic messages are formatted into a preallocated ring buffer, which is written by flushLog() from another thread.
+ *
+ * The steady state is not free of allocations, the profile only keeps them from page faulting. The structures of this library
+ * which run in each cycle (TimerWheel, AxisTable, BusLoadMonitor, PdoLayout) do not allocate once they ran for the first time,
+ * LelyIntegrationTest checks this. The drivers preallocate their bookkeeping in DCFConfigMaster::configureDrivers()
+ * (see DCFDriver::preallocate()). lely allocates
+ * on the loop thread in every cycle: a task for each post to an executor, e.g. for each object of a received RPDO frame
+ * (AsyncMaster::OnRpdoWrite() and DCFConfigMaster::runOnDriverExecutor() for the drivers on a strand), and for each timer wait.
+ * Error handling (EMCY, failed SDOs, error callbacks) and the callbacks passed to move() / home() may allocate, too.
+ *
+ * The allocation check counts the allocations of a thread while it is armed (see armAllocationCheck()) and optionally aborts
+ * the process. It needs the replaced global operator new of AllocationHook.cpp, which is linked into LelyIntegrationTest and
+ * into the library with the CMake option LELY_INTEGRATION_ALLOCATION_HOOK. Meant for tests only.
+ */
+class RealtimeProfile
+{
+public:
+	/// The length of a buffered diagnostic message, longer messages are truncated.
+	static const size_t LOG_LINE_LENGTH = 200;
+
+	/**
+	 * @brief Config selects the parts of the profile.
+	 */
+	struct Config
+	{
+		bool lockMemory = true;
+		/// SCHED_FIFO or SCHED_RR, SCHED_OTHER keeps the policy of the thread.
+		int schedulingPolicy = SCHED_FIFO;
+		int priority = 80;
+		size_t stackPrefault = 256 * 1024;
+		/// The number of buffered diagnostic messages, 0 leaves the diagnostic handler of lely.
+		size_t logLines = 1024;
+	};
+
+	RealtimeProfile() = default;
+	/// Flushes the buffered messages and restores the diagnostic handler.
+	~RealtimeProfile();
+
+	RealtimeProfile(const RealtimeProfile&) = delete;
+	RealtimeProfile& operator=(const RealtimeProfile&) = delete;
+
+	/**
+	 * @brief apply applies the profile to the process and to the calling thread, which should be the thread of the event loop.
+	 * Call it before configureDrivers(). The parts which failed are skipped, the first error is returned.
+	 */
+	bool apply(const Config& config, std::error_code& error);
+
+	/**
+	 * @brief flushLog writes the buffered messages with the previous diagnostic handler. Call it from a thread without real-time priority.
+	 * @return The number of written messages.
+	 */
+	size_t flushLog();
+	/// The messages overwritten before they were flushed.
+	size_t getLostLogLines() const;
+
+	/// Is true if the allocation hook is linked (see AllocationHook.cpp), otherwise the allocation check does nothing.
+	static bool isAllocationCheckAvailable();
+	/**
+	 * @brief armAllocationCheck counts the allocations of the calling thread from now on, e.g. on the executor of the master
+	 * after the first motion cycle.
+	 * @param abortOnAllocation Aborts the process at the first allocation, so a debugger or core dump shows where it happened.
+	 */
+	static void armAllocationCheck(bool abortOnAllocation = false);
+	static void disarmAllocationCheck();
+	/// The allocations while the check was armed.
+	static size_t getCheckedAllocations();
+	/// Called by the allocation hook for every allocation.
+	static void countAllocation();
+
+private:
+	struct LogLine
+	{
+		diag_severity severity;
+		int errc;
+		char text[LOG_LINE_LENGTH];
+	};
+
+	static void onDiag(void* handle, diag_severity severity, int errc, const char* format, va_list ap);
+	void restoreDiagHandler();
+
+	mutable std::mutex m_logMutex;
+	std::vector<LogLine> m_log;
+	size_t m_firstLogLine = 0;
+	size_t m_numberOfLogLines = 0;
+	size_t m_lostLogLines = 0;
+	diag_handler_t* m_previousDiagHandler = nullptr;
+	void* m_previousDiagHandle = nullptr;
+	bool m_diagHandlerInstalled = false;
+};
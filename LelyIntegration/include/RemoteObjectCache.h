@@ -0,0 +1,80 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a local mirror of the objects of a remote node.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+/**
+ * @brief The RemoteObjectCache class mirrors the last known values of the objects (basic types up to 64 bits) of a remote node.
+ * The values are fed by received PDOs and successful SDO transfers (see DCFDriver::submitCachedRead()),
+ * a lookup only succeeds if the value is younger than the maximum age of the caller. Not thread safe.
+ */
+class RemoteObjectCache
+{
+public:
+	/// The cached value of one object. The entries are never removed, so a reference to one stays valid.
+	struct Entry
+	{
+		uint64_t value = 0;
+		std::chrono::steady_clock::time_point updatedAt;
+		bool valid = false;
+	};
+
+	/// Stores the value, signed values sign extended.
+	void update(uint16_t index, uint8_t subIndex, uint64_t value, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+	{
+		update(getEntry(index, subIndex), value, now);
+	}
+
+	/// Stores the value in an entry taken from getEntry(), without looking it up.
+	static void update(Entry& entry, uint64_t value, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+	{
+		entry.value = value;
+		entry.updatedAt = now;
+		entry.valid = true;
+	}
+
+	/// Returns the entry of the object, it is created without a value.
+	Entry& getEntry(uint16_t index, uint8_t subIndex) {return m_entries[(static_cast<uint32_t>(index) << 8) | subIndex];}
+
+	/**
+	 * @brief lookup returns the cached value if it is not older than maxAge and counts the hit or miss.
+	 * @return false if the value is unknown or too old.
+	 */
+	bool lookup(uint16_t index, uint8_t subIndex, std::chrono::milliseconds maxAge, uint64_t& value,
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+	/// Forgets all values, e.g. after a reset of the node. The entries and the statistics are kept.
+	void clear();
+
+	size_t getHits() const {return m_hits;}
+	size_t getMisses() const {return m_misses;}
+	/// The share of the lookups served from the cache, 0 without lookups.
+	double getHitRate() const {return m_hits + m_misses > 0 ? static_cast<double>(m_hits) / (m_hits + m_misses) : 0;}
+
+private:
+	std::map<uint32_t /* index << 8 | sub index */, Entry> m_entries;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+};
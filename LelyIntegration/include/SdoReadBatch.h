@@ -0,0 +1,116 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a batch of SDO reads from many nodes.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+class DCFConfigMaster;
+
+/**
+ * @brief The SdoReadBatch class reads a list of objects from many nodes at the same time (scatter/gather),
+ * e.g. the error register 0x603F of all axes.
+ *
+ * Each node has only one SDO server, so the requests of one node are sent one after the other;
+ * the requests of different nodes run concurrently, limited by a global maximum. The time for the whole batch
+ * is therefore the time of the slowest node, not the sum of all nodes.
+ * Used by DCFConfigMaster (see DCFConfigMaster::submitReads()), the callbacks run on the executor of the master.
+ */
+class SdoReadBatch : public std::enable_shared_from_this<SdoReadBatch>
+{
+public:
+	/**
+	 * @brief Request describes one object to read.
+	 */
+	struct Request
+	{
+		uint8_t nodeID;
+		uint16_t index;
+		uint8_t subIndex;
+		uint16_t type;  ///< The CANopen data type (CO_DEFTYPE_*), only basic types up to 64 bits.
+	};
+
+	/**
+	 * @brief Result is the value read for the request at the same position.
+	 */
+	struct Result
+	{
+		std::error_code error;
+		/// The raw value, signed types are sign extended.
+		uint64_t value;
+
+		template<class T> typename std::enable_if<std::is_integral<T>::value, T>::type get() const {return static_cast<T>(value);}
+		template<class T> typename std::enable_if<std::is_floating_point<T>::value && sizeof(T) == 4, T>::type get() const
+		{
+			uint32_t bits = static_cast<uint32_t>(value);
+			T result;
+			std::memcpy(&result, &bits, sizeof(result));
+			return result;
+		}
+		template<class T> typename std::enable_if<std::is_floating_point<T>::value && sizeof(T) == 8, T>::type get() const
+		{
+			T result;
+			std::memcpy(&result, &value, sizeof(result));
+			return result;
+		}
+	};
+
+	typedef std::function<void(const std::vector<Result>&)> CompletedCallback;
+
+	SdoReadBatch(DCFConfigMaster& master, const std::vector<Request>& requests, size_t maxConcurrentRequests, CompletedCallback callback);
+
+	/**
+	 * @brief start sends the first requests. The batch keeps itself alive until all requests are completed.
+	 * @return The results in the order of the requests. Do not wait for it on the executor of the master, this would block the SDOs.
+	 */
+	std::future<std::vector<Result>> start();
+
+private:
+	void submitRequests();
+	void onRead(size_t i, std::error_code error, const std::vector<uint8_t>& value);
+
+	DCFConfigMaster& m_master;
+	std::vector<Request> m_requests;
+	size_t m_maxConcurrentRequests;
+	CompletedCallback m_callback;
+
+	std::mutex m_mutex;
+	std::vector<Result> m_results;
+	/// The positions of the requests which are not sent yet, per node.
+	std::map<uint8_t /* node ID */, std::deque<size_t>> m_pendingRequests;
+	std::set<uint8_t /* node ID */> m_busyNodes;
+	/// The nodes are served round robin if the maximum number of requests is reached.
+	uint8_t m_lastSubmittedNode = 0;
+	size_t m_runningRequests = 0;
+	size_t m_completedRequests = 0;
+	std::promise<std::vector<Result>> m_promise;
+};
@@ -0,0 +1,300 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a pool of reusable SDO requests of a node.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <lely/coapp/sdo.hpp>
+
+class DCFConfigMaster;
+
+/**
+ * @brief The SdoRequestPool class holds pre-constructed SDO requests for the objects a driver writes and reads at runtime
+ * (e.g. the controlword), which are recycled on completion instead of allocating a new lely request and
+ * completion function for every SubmitWrite() / SubmitRead().
+ *
+ * Requests are only taken from the pool while a request of the object is free, the callers fall back to the
+ * allocating functions of lely otherwise and count it (see countAllocatedRequest()). The confirmations of reads are stored
+ * in the pooled request itself (see ReadConfirmation), the callback of a write is taken over from the caller. A failed write is retried with
+ * the same request (see setWriteRetryHandler()). The round trip times of the requests are reported to the SDO timeout policy of the master
+ * (see DCFConfigMaster::getSdoTimeoutPolicy()).
+ * Not thread safe: use it on the executor of its driver only (the executor of the master or a strand of a DriverExecutorPool),
+ * where the driver callbacks run and the completions of the pooled requests are posted to.
+ */
+class SdoRequestPool
+{
+public:
+	typedef std::function<void(std::error_code)> WriteCallback;
+	/// Calls the retry function (later) and returns true if a write which failed after the given number of retries is retried.
+	typedef std::function<bool(unsigned attempt, std::error_code error, std::function<void()> retry)> RetryHandler;
+
+	/**
+	 * @brief ReadConfirmation holds a callable void(std::error_code, uint64_t value) of up to SIZE bytes without allocation,
+	 * the value is sign extended for signed types.
+	 */
+	class ReadConfirmation
+	{
+	public:
+		static const size_t SIZE = 64;
+
+		/// Checks if the callable F is stored without allocation.
+		template<class F>
+		struct Fits : std::integral_constant<bool, sizeof(F) <= SIZE && alignof(F) <= alignof(std::max_align_t)> {};
+
+		ReadConfirmation() = default;
+		ReadConfirmation(const ReadConfirmation&) = delete;
+		ReadConfirmation& operator=(const ReadConfirmation&) = delete;
+		~ReadConfirmation() {reset();}
+
+		/// Stores a copy of the callable.
+		template<class F>
+		void assign(const F& confirmation)
+		{
+			static_assert(Fits<F>::value, "The confirmation is too large to be stored without allocation.");
+			reset();
+			new (&m_storage) F(confirmation);
+			m_invoke = [](void* storage, std::error_code error, uint64_t value) {(*static_cast<F*>(storage))(error, value);};
+			m_move = [](void* from, void* to) {new (to) F(std::move(*static_cast<F*>(from))); static_cast<F*>(from)->~F();};
+			m_destroy = [](void* storage) {static_cast<F*>(storage)->~F();};
+		}
+
+		/// Moves the callable to the target, this one is empty afterwards.
+		void moveTo(ReadConfirmation& target)
+		{
+			target.reset();
+			if (m_invoke == nullptr)
+				return;
+			m_move(&m_storage, &target.m_storage);
+			target.m_invoke = m_invoke;
+			target.m_move = m_move;
+			target.m_destroy = m_destroy;
+			m_invoke = nullptr;
+		}
+
+		void reset()
+		{
+			if (m_invoke != nullptr)
+				m_destroy(&m_storage);
+			m_invoke = nullptr;
+		}
+
+		explicit operator bool() const {return m_invoke != nullptr;}
+		void operator()(std::error_code error, uint64_t value) {m_invoke(&m_storage, error, value);}
+
+	private:
+		typename std::aligned_storage<SIZE, alignof(std::max_align_t)>::type m_storage;
+		void (*m_invoke)(void*, std::error_code, uint64_t) = nullptr;
+		void (*m_move)(void*, void*) = nullptr;
+		void (*m_destroy)(void*) = nullptr;
+	};
+
+	/**
+	 * @brief Creates an empty pool.
+	 * @param master The master to submit the requests with, nullptr disables the pool.
+	 */
+	SdoRequestPool(DCFConfigMaster* master, ev_exec_t* exec, uint8_t nodeID);
+
+	/// Pre-constructs the given number of requests to write the object with the type T.
+	template<class T>
+	void addWriteObject(uint16_t index, uint8_t subIndex, size_t requests = 1)
+	{
+		auto& pooledRequests = m_writeRequests[getKey(index, subIndex)];
+		for (size_t i = 0; i < requests; i++)
+			pooledRequests.emplace_back(new PooledDownload<T>(this, index, subIndex));
+	}
+
+	/// Pre-constructs the given number of requests to read the object with the type T.
+	template<class T>
+	void addReadObject(uint16_t index, uint8_t subIndex, size_t requests = 1)
+	{
+		auto& pooledRequests = m_readRequests[getKey(index, subIndex)];
+		for (size_t i = 0; i < requests; i++)
+			pooledRequests.emplace_back(new PooledUpload<T>(this, index, subIndex));
+	}
+
+	/**
+	 * @brief setWriteRetryHandler sets the function which decides whether a failed write is retried, none by default.
+	 */
+	void setWriteRetryHandler(RetryHandler handler) {m_writeRetryHandler = std::move(handler);}
+
+	/**
+	 * @brief submitWrite writes the value (converted to the type of the pooled object) with a free pooled request.
+	 * @param callback Taken over if the request is submitted (without copying it), called once with the result of the last attempt.
+	 * @param attempt The number of retries so far, see setWriteRetryHandler().
+	 * @return false if the object is not pooled, all its requests are in use or the node has no SDO client.
+	 * The callback is left to the caller then.
+	 */
+	template<class T>
+	bool submitWrite(uint16_t index, uint8_t subIndex, T value, WriteCallback& callback, unsigned attempt = 0)
+	{
+		PooledRequest* request = acquire(m_writeRequests, index, subIndex);
+		if (request == nullptr)
+			return false;
+		request->setValue(static_cast<uint64_t>(value));
+		request->attempt = attempt;
+		request->writeCallback.swap(callback);
+		if (submit(*request))
+			return true;
+		callback.swap(request->writeCallback);
+		return false;
+	}
+
+	/**
+	 * @brief submitRead reads the object with a free pooled request, the confirmation is copied into it (see ReadConfirmation).
+	 * @return false if the object is not pooled, all its requests are in use, the node has no SDO client
+	 * or the confirmation does not fit into the request.
+	 */
+	template<class F>
+	typename std::enable_if<ReadConfirmation::Fits<F>::value, bool>::type submitRead(uint16_t index, uint8_t subIndex, const F& confirmation)
+	{
+		PooledRequest* request = acquire(m_readRequests, index, subIndex);
+		if (request == nullptr)
+			return false;
+		request->readConfirmation.assign(confirmation);
+		if (submit(*request))
+			return true;
+		request->readConfirmation.reset();
+		return false;
+	}
+
+	/// Larger confirmations would be allocated: the caller falls back to lely.
+	template<class F>
+	typename std::enable_if<!ReadConfirmation::Fits<F>::value, bool>::type submitRead(uint16_t /* index */, uint8_t /* subIndex */, const F& /* confirmation */)
+	{
+		return false;
+	}
+
+	/// Counts a request which had to be allocated since the object is not pooled or all its requests were in use.
+	void countAllocatedRequest() {m_allocatedRequests++;}
+	/// The number of requests served from the pool.
+	size_t getPooledRequests() const {return m_pooledRequests;}
+	/// The number of requests allocated by lely instead, see countAllocatedRequest(). Only the request objects are counted,
+	/// not the other allocations of a transfer (e.g. the tasks lely posts).
+	size_t getAllocatedRequests() const {return m_allocatedRequests;}
+
+private:
+	/**
+	 * @brief PooledRequest is the type independent part of a pooled request.
+	 */
+	struct PooledRequest
+	{
+		explicit PooledRequest(SdoRequestPool* pool) : pool(pool) {}
+		virtual ~PooledRequest() = default;
+		virtual lely::canopen::detail::SdoRequestBase& getRequest() = 0;
+		virtual void setValue(uint64_t /* value */) {}
+
+		void complete(std::error_code error, uint64_t value)
+		{
+			pool->onCompleted(submitted, error);
+			// A write is retried with the same value and callback, the request stays in use meanwhile.
+			if (error && !readConfirmation && pool->retryWrite(*this, error))
+				return;
+			finish(error, value);
+		}
+
+		/// Releases the request before the callback is called, so the callback can submit the next request of the object.
+		void finish(std::error_code error, uint64_t value)
+		{
+			WriteCallback completedWrite;
+			ReadConfirmation completedRead;
+			completedWrite.swap(writeCallback);
+			readConfirmation.moveTo(completedRead);
+			busy = false;
+			if (completedWrite != nullptr)
+				completedWrite(error);
+			if (completedRead)
+				completedRead(error, value);
+		}
+
+		SdoRequestPool* pool;
+		bool busy = false;
+		unsigned attempt = 0;  ///< The number of retries of the write so far.
+		std::chrono::steady_clock::time_point submitted;
+		WriteCallback writeCallback;
+		ReadConfirmation readConfirmation;
+	};
+
+	template<class T>
+	struct PooledDownload : public PooledRequest
+	{
+		PooledDownload(SdoRequestPool* pool, uint16_t index, uint8_t subIndex) :
+			PooledRequest(pool),
+			request(pool->m_exec, [this](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, std::error_code ec)
+			{
+				complete(ec, 0);
+			})
+		{
+			request.idx = index;
+			request.subidx = subIndex;
+		}
+
+		lely::canopen::detail::SdoRequestBase& getRequest() override {return request;}
+		void setValue(uint64_t value) override {request.value = static_cast<T>(value);}
+
+		lely::canopen::SdoDownloadRequest<T> request;
+	};
+
+	template<class T>
+	struct PooledUpload : public PooledRequest
+	{
+		PooledUpload(SdoRequestPool* pool, uint16_t index, uint8_t subIndex) :
+			PooledRequest(pool),
+			request(pool->m_exec, [this](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, std::error_code ec, T value)
+			{
+				complete(ec, static_cast<uint64_t>(value));
+			})
+		{
+			request.idx = index;
+			request.subidx = subIndex;
+		}
+
+		lely::canopen::detail::SdoRequestBase& getRequest() override {return request;}
+
+		lely::canopen::SdoUploadRequest<T> request;
+	};
+
+	typedef std::map<uint32_t /* index << 8 | sub index */, std::vector<std::unique_ptr<PooledRequest>>> PooledRequests;
+
+	static uint32_t getKey(uint16_t index, uint8_t subIndex) {return (static_cast<uint32_t>(index) << 8) | subIndex;}
+	PooledRequest* acquire(PooledRequests& requests, uint16_t index, uint8_t subIndex);
+	bool submit(PooledRequest& request);
+	void onCompleted(std::chrono::steady_clock::time_point submitted, std::error_code error);
+	bool retryWrite(PooledRequest& request, std::error_code error);
+
+	DCFConfigMaster* m_master;
+	ev_exec_t* m_exec;
+	uint8_t m_nodeID;
+	PooledRequests m_writeRequests;
+	PooledRequests m_readRequests;
+	RetryHandler m_writeRetryHandler;
+	size_t m_pooledRequests = 0;
+	size_t m_allocatedRequests = 0;
+};
@@ -0,0 +1,155 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of the adaptive SDO timeouts and the retry policies.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <system_error>
+
+/**
+ * @brief The SdoTimeoutPolicy class adapts the SDO timeout of every node to its measured round trip time and
+ * decides whether a failed SDO request is retried.
+ *
+ * The round trip time of a node is tracked as an exponentially weighted mean and deviation (like the retransmission
+ * timeout of TCP); the timeout is mean + k * deviation within the configured bounds. A node which never answered or is
+ * missing gets the short probe timeout, so a missing node blocks the configuration only briefly; a node which answered,
+ * but not a few requests yet, gets the initial timeout. Timeouts are no samples, they only count as consecutive timeouts
+ * of the node and double its timeout up to the upper bound. lely sends the requests of a node one after the other, so a
+ * request queued behind another one is measured from the completion of the previous one.
+ *
+ * Only timeouts and aborts because of the current state of the node (0x08000021, 0x08000022) are retried, with a bounded
+ * number of retries per request class. A node which never answered or which did not answer a whole series of retries
+ * is considered missing: its timeouts are not retried until it answers again, so a missing node fails fast.
+ * Used by DCFConfigMaster (see DCFConfigMaster::enableAdaptiveSdoTimeouts()) and DCFDriver.
+ */
+class SdoTimeoutPolicy
+{
+public:
+	/**
+	 * @brief RequestClass selects the retry policy of a request.
+	 */
+	enum RequestClass
+	{
+		CONFIGURATION,  ///< Writes of the configuration, idempotent and needed for the boot.
+		MOTION,         ///< Commands like the controlword: a late command is worse than a lost one, the next one follows anyway.
+		DIAGNOSTICS,    ///< Reads like the error register, which may fail shortly after a state change.
+		NUMBER_OF_REQUEST_CLASSES
+	};
+
+	/**
+	 * @brief RetryPolicy bounds the retries of one request class.
+	 */
+	struct RetryPolicy
+	{
+		unsigned maxRetries;
+		std::chrono::milliseconds retryDelay;
+	};
+
+	/**
+	 * @brief Statistics describes the SDO round trips of one node.
+	 */
+	struct Statistics
+	{
+		size_t samples;
+		size_t timeouts;
+		size_t retries;
+		unsigned consecutiveTimeouts;
+		std::chrono::microseconds meanRoundTripTime;
+		std::chrono::microseconds roundTripDeviation;
+		std::chrono::microseconds maxRoundTripTime;
+	};
+
+	/**
+	 * @brief Creates a policy with fixed timeouts (see setAdaptive()) and the default retry policies:
+	 * 2 retries for the configuration, none for motion commands and 3 retries after 50 ms for diagnostics.
+	 * @param initialTimeout The timeout of nodes which answered, but not often enough to measure them.
+	 */
+	explicit SdoTimeoutPolicy(std::chrono::milliseconds initialTimeout);
+
+	/**
+	 * @brief setAdaptive enables the adaptive timeouts.
+	 * @param minTimeout The lower bound, it should cover the worst case delay of an SDO response at high bus load.
+	 * @param maxTimeout The upper bound.
+	 * @param deviationFactor The factor k of the deviation added to the mean round trip time.
+	 */
+	void setAdaptive(std::chrono::milliseconds minTimeout, std::chrono::milliseconds maxTimeout, double deviationFactor = 4.0);
+
+	void setInitialTimeout(std::chrono::milliseconds timeout);
+	/// The timeout of nodes which never answered or are missing, 0 (the default) uses the lower bound of setAdaptive().
+	void setProbeTimeout(std::chrono::milliseconds timeout);
+	void setRetryPolicy(RequestClass requestClass, const RetryPolicy& policy);
+	RetryPolicy getRetryPolicy(RequestClass requestClass) const;
+
+	/**
+	 * @brief getTimeout returns the timeout for the next request of the given class to the given node.
+	 * All classes follow the round trip time of the node, a request which takes longer (e.g. 0x1010 store parameters)
+	 * is retried with a doubled timeout.
+	 */
+	std::chrono::milliseconds getTimeout(uint8_t nodeID, RequestClass requestClass) const;
+
+	/**
+	 * @brief addResult records the completion of a request which was submitted at the given time.
+	 * The time it was queued behind the previous request of the node is not part of the round trip time.
+	 * Errors which were not caused by the node (e.g. no SDO client) are ignored.
+	 */
+	void addResult(uint8_t nodeID, std::chrono::steady_clock::time_point submitted, std::error_code error);
+
+	/**
+	 * @brief shouldRetry returns whether a request which failed with the given error is retried and counts the retry.
+	 * @param attempt The number of retries so far.
+	 */
+	bool shouldRetry(uint8_t nodeID, RequestClass requestClass, unsigned attempt, std::error_code error);
+
+	/**
+	 * @brief getStatistics returns the round trips measured for the given node.
+	 * @return false if the node was never requested.
+	 */
+	bool getStatistics(uint8_t nodeID, Statistics& result) const;
+
+private:
+	struct NodeState
+	{
+		size_t samples = 0;
+		size_t timeouts = 0;
+		size_t retries = 0;
+		unsigned consecutiveTimeouts = 0;
+		/// Set if the node did not answer a whole series of retries, reset with the next answer.
+		bool missing = false;
+		double meanRoundTripTime = 0.0;  ///< in us
+		double variance = 0.0;           ///< in us^2
+		double maxRoundTripTime = 0.0;   ///< in us
+		/// The completion of the previous request, the next one was sent at this time if it was queued.
+		std::chrono::steady_clock::time_point lastCompletedAt;
+	};
+
+	mutable std::mutex m_mutex;
+	std::map<uint8_t /* node ID */, NodeState> m_nodes;
+	RetryPolicy m_retryPolicies[NUMBER_OF_REQUEST_CLASSES];
+	std::chrono::milliseconds m_initialTimeout;
+	std::chrono::milliseconds m_probeTimeout{0};
+	std::chrono::milliseconds m_minTimeout;
+	std::chrono::milliseconds m_maxTimeout;
+	double m_deviationFactor = 4.0;
+	bool m_adaptive = false;
+};
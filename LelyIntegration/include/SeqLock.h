@@ -0,0 +1,99 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains a sequence lock which publishes a value from one writer to any number of lock-free readers.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief The SeqLock class publishes a value from one writer thread to readers on any thread without locks.
+ *
+ * The writer makes the sequence odd, stores the value and makes the sequence even again; a reader copies the value and retries
+ * if the sequence was odd or has changed meanwhile. The writer never waits for readers and readers never block each other,
+ * which suits small values written often and read by polling threads (e.g. a HMI), see MotorDriver::getSnapshot().
+ * The value is stored in atomic words, so the concurrent copy is no data race.
+ *
+ * Only one thread may store at a time, e.g. the executor of a driver.
+ */
+template<class T>
+class SeqLock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be copied concurrently.");
+
+public:
+	SeqLock()
+	{
+		store(T());
+	}
+
+	explicit SeqLock(const T& value)
+	{
+		store(value);
+	}
+
+	SeqLock(const SeqLock&) = delete;
+	SeqLock& operator=(const SeqLock&) = delete;
+
+	/// Publishes the value, called by the single writer.
+	void store(const T& value)
+	{
+		uint64_t words[WORDS] = {};
+		std::memcpy(words, &value, sizeof(T));
+
+		uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+		m_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < WORDS; i++)
+			m_words[i].store(words[i], std::memory_order_relaxed);
+		m_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	/// Returns the value published last, from any thread. Retries while the writer stores concurrently.
+	T load() const
+	{
+		uint64_t words[WORDS];
+		uint64_t sequence;
+		do
+		{
+			sequence = m_sequence.load(std::memory_order_acquire);
+			for (size_t i = 0; i < WORDS; i++)
+				words[i] = m_words[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		while ((sequence & 1) != 0 || m_sequence.load(std::memory_order_relaxed) != sequence);
+
+		T value;
+		std::memcpy(&value, words, sizeof(T));
+		return value;
+	}
+
+	/// Changes with every store(), so a poller can skip the copy of an unchanged value.
+	uint64_t getVersion() const {return m_sequence.load(std::memory_order_acquire) / 2;}
+
+private:
+	static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic<uint64_t> m_sequence{0};
+	std::atomic<uint64_t> m_words[WORDS];
+};
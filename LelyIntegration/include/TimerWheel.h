@@ -0,0 +1,128 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a hierarchical timer wheel.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The TimerWheel class multiplexes many timers (e.g. the watchdogs and retry delays of all drivers) on one timer,
+ * instead of one wait per timer on the timer queue of lely. The wheel counts ticks, it is advanced by the owner, which
+ * only wakes up for the next expiry (see getNextExpiry()).
+ *
+ * The wheel has 4 levels with 64 slots each: level 0 holds the timers of the next 64 ticks, every higher level covers 64 times
+ * the range of the level below. When level 0 wraps, the next slot of level 1 is moved down (and so on), so starting and
+ * canceling a timer is O(1) and each timer is moved at most 3 times. Timers beyond the range (64^4 ticks) are parked in the
+ * highest level until they get into range. The timers are stored in a free list, their callbacks are the only allocation.
+ * Not thread safe, used by DCFConfigMaster on the executor of the master (see DCFConfigMaster::enableTimerWheel()).
+ */
+class TimerWheel
+{
+public:
+	typedef std::function<void()> Callback;
+	/// Identifies a started timer, 0 is never used.
+	typedef uint64_t TimerID;
+
+	static const TimerID INVALID_TIMER = 0;
+
+	/**
+	 * @param resolution The duration of a tick, the delays are rounded up to full ticks.
+	 */
+	explicit TimerWheel(std::chrono::microseconds resolution);
+
+	/**
+	 * @brief start calls the callback once the delay has passed: the delay is rounded up to full ticks plus the tick in progress,
+	 * so the timer never expires early.
+	 * @param elapsedTicks The ticks which have passed since the last advance(), if the owner does not advance the wheel every tick.
+	 * The timer expires relative to getTime() + elapsedTicks then.
+	 * @return The ID to cancel the timer.
+	 */
+	TimerID start(std::chrono::microseconds delay, Callback callback, uint64_t elapsedTicks = 0);
+
+	/**
+	 * @brief cancel stops the timer, the callback is not called.
+	 * @return false if the timer has already expired or was canceled.
+	 */
+	bool cancel(TimerID id);
+
+	/**
+	 * @brief advance moves the wheel by the given number of ticks and calls the callbacks of the expired timers in the order of their expiry.
+	 * The callbacks may start and cancel timers.
+	 */
+	void advance(uint64_t ticks = 1) {advanceTo(m_now + ticks);}
+
+	/**
+	 * @brief advanceTo moves the wheel up to the given tick like advance(), an empty wheel jumps there at once.
+	 * A callback may call it as well, e.g. to bring an empty wheel up to date before it starts a timer.
+	 */
+	void advanceTo(uint64_t tick);
+
+	/**
+	 * @brief getNextExpiry returns the tick at which advance() has to be called next: the expiry of the next timer
+	 * or the move of a higher level which holds the next timers, UINT64_MAX if no timer is running.
+	 */
+	uint64_t getNextExpiry() const;
+
+	/// The number of ticks advanced so far.
+	uint64_t getTime() const {return m_now;}
+
+	/// Reserves the given number of timers, so starting them does not allocate (except for large callbacks).
+	void reserve(size_t timers) {m_timers.reserve(timers);}
+
+	std::chrono::microseconds getResolution() const {return m_resolution;}
+	/// The number of running timers.
+	size_t size() const {return m_runningTimers;}
+	bool empty() const {return m_runningTimers == 0;}
+
+private:
+	static const unsigned LEVELS = 4;
+	static const unsigned SLOT_BITS = 6;
+	static const unsigned SLOTS = 1 << SLOT_BITS;
+	static const uint32_t NONE = 0xFFFFFFFF;
+
+	struct Timer
+	{
+		uint64_t expiry = 0;
+		Callback callback;
+		/// Incremented whenever the timer is reused, so an outdated ID does not cancel its successor.
+		uint32_t generation = 1;
+		bool running = false;
+		uint8_t level = 0;
+		uint8_t slot = 0;
+		uint32_t previous = NONE;
+		uint32_t next = NONE;
+	};
+
+	void insert(uint32_t timer);
+	void remove(uint32_t timer);
+	void release(uint32_t timer);
+	void cascade(unsigned level);
+
+	std::chrono::microseconds m_resolution;
+	uint64_t m_now = 0;
+	std::vector<Timer> m_timers;
+	uint32_t m_freeTimers = NONE;
+	uint32_t m_slots[LEVELS][SLOTS];
+	size_t m_runningTimers = 0;
+};
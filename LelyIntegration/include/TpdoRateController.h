@@ -0,0 +1,117 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the declaration of a controller which adapts the TPDO rates of the slaves to the bus load.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+class BusLoadMonitor;
+class DCFConfigMaster;
+
+/**
+ * @brief The TpdoRateController class throttles the TPDOs of the slaves when the bus load is high and restores their rates when it drops.
+ *
+ * The inhibit time (0x18xx:3) and the event timer (0x18xx:5) of the configured TPDOs are changed via SDO within the configured bounds.
+ * Above the throttle threshold the least important TPDO (highest priority value, the fastest one first) is slowed down by a factor of 2,
+ * below the restore threshold the most important throttled TPDO is sped up again, but not beyond the values read from the slave
+ * before it was throttled. One TPDO is changed per evaluation.
+ * A valid TPDO is invalidated while its inhibit time is changed and gets its original COB ID back afterwards; the driver of the node
+ * then reads its inputs again (see DCFDriver::resynchronizeInputs()), since a change meanwhile was not sent.
+ * Do not throttle event driven TPDOs without event timer which carry state, e.g. the status word: a change is delayed by the
+ * inhibit time and never repeated.
+ *
+ * The bus load is the one of BusLoadMonitor, i.e. only the PDOs of the master: SDO, heartbeat, EMCY and other frames are not
+ * included, so the thresholds need a margin for them.
+ * Used by DCFConfigMaster (see DCFConfigMaster::enableTpdoRateControl()), runs on the executor of the master.
+ */
+class TpdoRateController
+{
+public:
+	/**
+	 * @brief Limit configures a TPDO of a slave which may be throttled.
+	 */
+	struct Limit
+	{
+		uint8_t nodeID;
+		uint16_t tpdo;             ///< 1 based, i.e. the communication parameter is 0x1800 + tpdo - 1.
+		uint8_t priority;          ///< 0 = most important, throttled last.
+		uint16_t minInhibitTime;   ///< in 100 us
+		uint16_t maxInhibitTime;   ///< in 100 us
+		uint16_t minEventTimer;    ///< in ms, ignored if the event timer of the TPDO is disabled (0).
+		uint16_t maxEventTimer;    ///< in ms
+	};
+
+	TpdoRateController(DCFConfigMaster& master, std::shared_ptr<const BusLoadMonitor> monitor);
+
+	void addLimit(const Limit& limit);
+
+	/**
+	 * @brief setThresholds sets the bus loads (1.0 = 100 %) above which TPDOs are throttled and below which they are restored.
+	 */
+	void setThresholds(double throttleAbove, double restoreBelow) {m_throttleAbove = throttleAbove; m_restoreBelow = restoreBelow;}
+
+	/**
+	 * @brief setMonitor replaces the bus load monitor, e.g. after the monitoring was enabled again with another bit rate.
+	 */
+	void setMonitor(std::shared_ptr<const BusLoadMonitor> monitor) {m_monitor = std::move(monitor);}
+
+	/**
+	 * @brief evaluate compares the current bus load with the thresholds and starts the adaption of one TPDO if necessary.
+	 * Called periodically after BusLoadMonitor::update().
+	 */
+	void evaluate();
+
+	/**
+	 * @brief reset forgets the TPDO parameters read from the given slave (0 = all slaves), e.g. after it has been reconfigured.
+	 */
+	void reset(uint8_t nodeID = 0);
+
+private:
+	struct TpdoState
+	{
+		Limit limit;
+		bool known;                ///< The current values have been read from the slave.
+		bool supported;            ///< false if the slave rejected the access.
+		uint32_t cobID;
+		uint16_t inhibitTime;
+		uint16_t eventTimer;
+		bool throttled;            ///< The values below were saved and have not been restored yet.
+		uint16_t originalInhibitTime;
+		uint16_t originalEventTimer;
+	};
+
+	// The states are referenced by their position since the callbacks might outlive a reallocation of m_tpdos.
+	void readState(size_t i);
+	void adjust(size_t i, uint16_t inhibitTime, uint16_t eventTimer);
+	void writeEventTimer(size_t i, uint16_t eventTimer);
+	void failAdjustment(size_t i, uint16_t subIndex, const std::error_code& error);
+
+	DCFConfigMaster& m_master;
+	std::shared_ptr<const BusLoadMonitor> m_monitor;
+	std::vector<TpdoState> m_tpdos;
+	double m_throttleAbove = 0.7;
+	double m_restoreBelow = 0.5;
+	/// Only one SDO sequence at a time, so the SDO traffic does not add to the bus load.
+	bool m_busy = false;
+};
@@ -0,0 +1,190 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a structure-of-arrays table of the axes of a master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "AxisTable.h"
+
+namespace
+{
+	// The bits of the CiA-402 status word (0x6041).
+	const uint16_t STATUS_FAULT = 0x0008;
+	const uint16_t STATUS_WARNING = 0x0080;
+	const uint16_t STATUS_TARGET_REACHED = 0x0400;
+}
+
+AxisTable::AxisTable()
+{
+	std::fill(std::begin(m_slots), std::end(m_slots), -1);
+}
+
+size_t AxisTable::addAxis(uint8_t nodeID)
+{
+	size_t slot = getSlot(nodeID);
+	if (slot != INVALID_SLOT || nodeID >= 128)
+		return slot;
+
+	slot = m_nodeIDs.size();
+	m_slots[nodeID] = static_cast<int16_t>(slot);
+	m_nodeIDs.push_back(nodeID);
+	m_statusWords.push_back(0);
+	m_states.push_back(UNKNOWN);
+	m_flags.push_back(0);
+	m_positions.push_back(0);
+	m_followingErrors.push_back(0);
+	return slot;
+}
+
+void AxisTable::clear()
+{
+	m_nodeIDs.clear();
+	m_statusWords.clear();
+	m_states.clear();
+	m_flags.clear();
+	m_positions.clear();
+	m_followingErrors.clear();
+	std::fill(std::begin(m_slots), std::end(m_slots), -1);
+}
+
+void AxisTable::setStatusWord(size_t slot, uint16_t statusWord)
+{
+	m_statusWords[slot] = statusWord;
+	m_states[slot] = decodeState(statusWord);
+
+	uint8_t flags = (m_flags[slot] & FLAG_FOLLOWING_ERROR) | FLAG_STATUS_WORD_RECEIVED;
+	if (statusWord & STATUS_FAULT)
+		flags |= FLAG_FAULT;
+	if (statusWord & STATUS_WARNING)
+		flags |= FLAG_WARNING;
+	if (statusWord & STATUS_TARGET_REACHED)
+		flags |= FLAG_TARGET_REACHED;
+	m_flags[slot] = flags;
+}
+
+void AxisTable::setFollowingError(size_t slot, int32_t followingError)
+{
+	m_followingErrors[slot] = followingError;
+	m_flags[slot] |= FLAG_FOLLOWING_ERROR;
+}
+
+// The queries reduce without early exit, so the loops are vectorized.
+
+bool AxisTable::allIdle() const
+{
+	const uint8_t* flags = m_flags.data();
+	const uint8_t* states = m_states.data();
+	size_t n = m_flags.size();
+	uint8_t all = 0xFF;
+	uint8_t any = 0;
+	uint8_t switchedOn = 1;
+	for (size_t i = 0; i < n; i++)
+	{
+		all &= flags[i];
+		any |= flags[i];
+		// A drive which is not switched on reports the target reached as well, but it has not been powered yet.
+		// Switched on is idle, the drive has been stopped or waits for its next motion.
+		switchedOn &= (states[i] == SWITCHED_ON) | (states[i] == OPERATION_ENABLED);
+	}
+	const uint8_t required = FLAG_STATUS_WORD_RECEIVED | FLAG_TARGET_REACHED;
+	return n > 0 && switchedOn && (all & required) == required && (any & FLAG_FAULT) == 0;
+}
+
+bool AxisTable::anyFault() const
+{
+	const uint8_t* flags = m_flags.data();
+	size_t n = m_flags.size();
+	uint8_t any = 0;
+	for (size_t i = 0; i < n; i++)
+		any |= flags[i];
+	return (any & FLAG_FAULT) != 0;
+}
+
+size_t AxisTable::countFaults() const
+{
+	const uint8_t* flags = m_flags.data();
+	size_t n = m_flags.size();
+	size_t result = 0;
+	for (size_t i = 0; i < n; i++)
+		result += (flags[i] & FLAG_FAULT) != 0;
+	return result;
+}
+
+uint32_t AxisTable::getMaxFollowingError(size_t *slot) const
+{
+	const int32_t* errors = m_followingErrors.data();
+	size_t n = m_followingErrors.size();
+	// The axes without a following error keep 0, so they never win.
+	uint32_t result = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		uint32_t error = errors[i] < 0 ? 0u - static_cast<uint32_t>(errors[i]) : static_cast<uint32_t>(errors[i]);
+		result = std::max(result, error);
+	}
+
+	if (slot != nullptr)
+	{
+		// Only the axis is searched in a second pass, the maximum above stays branch free.
+		*slot = INVALID_SLOT;
+		for (size_t i = 0; i < n; i++)
+		{
+			if ((m_flags[i] & FLAG_FOLLOWING_ERROR) == 0)
+				continue;
+			uint32_t error = errors[i] < 0 ? 0u - static_cast<uint32_t>(errors[i]) : static_cast<uint32_t>(errors[i]);
+			if (error == result)
+			{
+				*slot = i;
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+AxisTable::Cia402State AxisTable::decodeState(uint16_t statusWord)
+{
+	// See CiA-402 part 2, table of the status word: the bits 0-3, 5 and 6 encode the state.
+	switch (statusWord & 0x006F)
+	{
+	case 0x0000:
+	case 0x0020:
+		return NOT_READY_TO_SWITCH_ON;
+	case 0x0040:
+	case 0x0060:
+		return SWITCH_ON_DISABLED;
+	case 0x0021:
+		return READY_TO_SWITCH_ON;
+	case 0x0023:
+		return SWITCHED_ON;
+	case 0x0027:
+		return OPERATION_ENABLED;
+	case 0x0007:
+		return QUICK_STOP_ACTIVE;
+	case 0x000F:
+	case 0x002F:
+		return FAULT_REACTION_ACTIVE;
+	case 0x0008:
+	case 0x0028:
+		return FAULT;
+	default:
+		return UNKNOWN;
+	}
+}
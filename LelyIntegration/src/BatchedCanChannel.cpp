@@ -0,0 +1,286 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a CAN channel which batches the frames of the master into few system calls.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <lely/util/diag.h>
+
+#include "BatchedCanChannel.h"
+
+const size_t BatchedCanChannel::MAX_QUEUED_FRAMES;
+constexpr std::chrono::microseconds BatchedCanChannel::MIN_RETRY_DELAY;
+constexpr std::chrono::microseconds BatchedCanChannel::MAX_RETRY_DELAY;
+
+BatchedCanChannel::BatchedCanChannel(lely::io::Context &ctx, io_poll_t *poll, ev_exec_t *exec) :
+	m_poll(poll),
+	m_exec(exec),
+	m_channel(ctx, exec, 0, 0, 0, &BatchedCanChannel::onWrite, this),
+	m_retryTimer(poll, exec, CLOCK_MONOTONIC),
+	m_watchTimer(poll, exec, CLOCK_MONOTONIC)
+{
+	m_watch.base.func = &BatchedCanChannel::onPollEvent;
+	m_watch.channel = this;
+	m_txQueue.reserve(BatchedCanSocket::MAX_BATCH);
+}
+
+BatchedCanChannel::~BatchedCanChannel()
+{
+	close();
+}
+
+bool BatchedCanChannel::open(const std::string &interface, std::error_code &error)
+{
+	close();
+	if (!m_socket.open(interface, error))
+	{
+		diag(DIAG_ERROR, 0, "Cannot open CAN interface %s: %s", interface.c_str(), error.message().c_str());
+		return false;
+	}
+	watch();
+	return true;
+}
+
+void BatchedCanChannel::close()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_socket.isOpen())
+	{
+		io_poll_watch(m_poll, m_socket.getHandle(), 0, &m_watch.base);
+		m_socket.close();
+	}
+	if (m_waitingForRetry)
+		m_retryTimer.cancel_wait();
+	if (m_waitingForWatch)
+		m_watchTimer.cancel_wait();
+	m_txQueue.clear();
+	m_waitingForOutput = false;
+	m_waitingForRetry = false;
+	m_retryDelay = std::chrono::microseconds(0);
+	m_waitingForWatch = false;
+	m_watchDelay = std::chrono::microseconds(0);
+	m_receiveErrors = 0;
+	m_filtered = false;
+}
+
+bool BatchedCanChannel::setReceiveFilter(const std::vector<uint32_t> &cobIDs, std::error_code &error)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_socket.isOpen())
+	{
+		error = std::make_error_code(std::errc::bad_file_descriptor);
+		return false;
+	}
+	if (!m_socket.setReceiveFilter(cobIDs, error))
+		return false;
+
+	if (!m_filtered)
+	{
+		m_interfaceFramesAtFilter = m_socket.getInterfaceReceivedFrames();
+		m_receivedFramesAtFilter = m_socket.getReceivedFrames();
+	}
+	m_filtered = !cobIDs.empty();
+	return true;
+}
+
+BatchedCanChannel::Statistics BatchedCanChannel::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t filteredFrames = 0;
+	if (m_filtered)
+	{
+		size_t interfaceFrames = m_socket.getInterfaceReceivedFrames();
+		size_t receivedFrames = m_socket.getReceivedFrames() - m_receivedFramesAtFilter;
+		if (interfaceFrames > m_interfaceFramesAtFilter + receivedFrames)
+			filteredFrames = interfaceFrames - m_interfaceFramesAtFilter - receivedFrames;
+	}
+	return Statistics{m_socket.getReceiveCalls(), m_socket.getReceivedFrames(), m_socket.getSendCalls(), m_socket.getSentFrames(), m_droppedFrames, filteredFrames};
+}
+
+int BatchedCanChannel::onWrite(const can_msg *msg, int /* timeout */, void *arg)
+{
+	auto self = static_cast<BatchedCanChannel*>(arg);
+	bool postFlush = false;
+	{
+		std::lock_guard<std::mutex> lock(self->m_mutex);
+		if (!self->m_socket.isOpen() || self->m_txQueue.size() >= MAX_QUEUED_FRAMES)
+		{
+			self->m_droppedFrames++;
+			errno = self->m_socket.isOpen() ? EAGAIN : EBADF;
+			return -1;
+		}
+		self->m_txQueue.push_back(*msg);
+		// The frames written until the flush runs are sent together. While the socket is full, the poll or the retry timer flushes.
+		if (!self->m_flushPosted && !self->m_waitingForOutput && !self->m_waitingForRetry)
+		{
+			self->m_flushPosted = true;
+			postFlush = true;
+		}
+	}
+	if (postFlush)
+		self->m_exec.post([self]() {self->flush();});
+	return 0;
+}
+
+void BatchedCanChannel::onPollEvent(struct io_poll_watch *watch, int events)
+{
+	auto self = reinterpret_cast<PollWatch*>(watch)->channel;
+	if (events & (IO_EVENT_IN | IO_EVENT_ERR))
+		self->receive();
+	if (events & IO_EVENT_OUT)
+	{
+		{
+			std::lock_guard<std::mutex> lock(self->m_mutex);
+			self->m_waitingForOutput = false;
+		}
+		self->flush();
+	}
+	// With a persistent error (e.g. the interface is down) the socket would report it again immediately.
+	if (self->m_receiveErrors > 0)
+		self->watchLater();
+	else
+		self->watch();
+}
+
+void BatchedCanChannel::receive()
+{
+	can_msg msgs[BatchedCanSocket::MAX_BATCH];
+	for (;;)
+	{
+		std::error_code error;
+		size_t received;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_socket.isOpen())
+				return;
+			received = m_socket.receive(msgs, BatchedCanSocket::MAX_BATCH, error);
+		}
+		if (error)
+		{
+			// A persistent error (e.g. the interface is down) is reported by each poll, so only the first one is logged.
+			if (m_receiveErrors++ == 0)
+				diag(DIAG_WARNING, 0, "Cannot receive CAN frames: %s", error.message().c_str());
+		}
+		else if (received > 0 && m_receiveErrors > 0)
+		{
+			diag(DIAG_INFO, 0, "Receiving CAN frames again after %zu errors", m_receiveErrors);
+			m_receiveErrors = 0;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_watchDelay = std::chrono::microseconds(0);
+		}
+
+		// Passed on without holding the lock, the channel might write a frame in return.
+		for (size_t i = 0; i < received; i++)
+			m_channel.on_read(&msgs[i]);
+		if (received < BatchedCanSocket::MAX_BATCH)
+			return;
+	}
+}
+
+void BatchedCanChannel::flush()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_flushPosted = false;
+	if (!m_socket.isOpen() || m_waitingForOutput || m_waitingForRetry)
+		return;
+
+	size_t sent = 0;
+	while (sent < m_txQueue.size())
+	{
+		std::error_code error;
+		size_t count = m_socket.send(&m_txQueue[sent], m_txQueue.size() - sent, error);
+		if (error == std::errc::no_buffer_space)
+		{
+			// The queue of the interface is full, but the socket stays writable: polling for output would spin.
+			m_waitingForRetry = true;
+			break;
+		}
+		else if (error)
+		{
+			diag(DIAG_WARNING, 0, "Cannot send CAN frames: %s", error.message().c_str());
+			m_droppedFrames += m_txQueue.size() - sent;
+			sent = m_txQueue.size();
+		}
+		else if (count == 0)
+		{
+			// The send queue of the interface is full, the poll flushes the remaining frames.
+			m_waitingForOutput = true;
+			break;
+		}
+		else
+			m_retryDelay = std::chrono::microseconds(0);
+		sent += count;
+	}
+	m_txQueue.erase(m_txQueue.begin(), m_txQueue.begin() + sent);
+	if (m_waitingForOutput)
+		io_poll_watch(m_poll, m_socket.getHandle(), IO_EVENT_IN | IO_EVENT_OUT, &m_watch.base);
+	if (m_waitingForRetry)
+		retryLater();
+}
+
+void BatchedCanChannel::retryLater()
+{
+	m_retryDelay = m_retryDelay.count() == 0 ? MIN_RETRY_DELAY : std::min(m_retryDelay * 2, MAX_RETRY_DELAY);
+	m_retryTimer.settime(std::chrono::duration_cast<lely::io::TimerBase::duration>(m_retryDelay));
+	m_retryTimer.submit_wait(m_exec, [this](int /* overrun */, std::error_code ec)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (ec || !m_waitingForRetry)
+				return;  // canceled
+			m_waitingForRetry = false;
+		}
+		flush();
+	});
+}
+
+void BatchedCanChannel::watch()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_socket.isOpen())
+		return;
+	// The watch is one-shot, so it is renewed after each event.
+	int events = IO_EVENT_IN;
+	if (m_waitingForOutput)
+		events |= IO_EVENT_OUT;
+	io_poll_watch(m_poll, m_socket.getHandle(), events, &m_watch.base);
+}
+
+void BatchedCanChannel::watchLater()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_socket.isOpen() || m_waitingForWatch)
+		return;
+
+	m_waitingForWatch = true;
+	m_watchDelay = m_watchDelay.count() == 0 ? MIN_RETRY_DELAY : std::min(m_watchDelay * 2, MAX_RETRY_DELAY);
+	m_watchTimer.settime(std::chrono::duration_cast<lely::io::TimerBase::duration>(m_watchDelay));
+	m_watchTimer.submit_wait(m_exec, [this](int /* overrun */, std::error_code ec)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (ec || !m_waitingForWatch)
+				return;  // canceled
+			m_waitingForWatch = false;
+		}
+		watch();
+	});
+}
@@ -0,0 +1,228 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a SocketCAN socket which reads and writes several frames per system call.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "BatchedCanSocket.h"
+
+namespace
+{
+	void toFrame(const can_msg& msg, can_frame& frame)
+	{
+		std::memset(&frame, 0, sizeof(frame));
+		frame.can_id = (msg.flags & CAN_FLAG_IDE) ? ((msg.id & CAN_EFF_MASK) | CAN_EFF_FLAG) : (msg.id & CAN_SFF_MASK);
+		if (msg.flags & CAN_FLAG_RTR)
+			frame.can_id |= CAN_RTR_FLAG;
+		frame.can_dlc = std::min<uint8_t>(msg.len, CAN_MAX_DLEN);
+		std::memcpy(frame.data, msg.data, frame.can_dlc);
+	}
+
+	void toMessage(const can_frame& frame, can_msg& msg)
+	{
+		msg = CAN_MSG_INIT;
+		if (frame.can_id & CAN_EFF_FLAG)
+		{
+			msg.id = frame.can_id & CAN_EFF_MASK;
+			msg.flags |= CAN_FLAG_IDE;
+		}
+		else
+		{
+			msg.id = frame.can_id & CAN_SFF_MASK;
+		}
+		if (frame.can_id & CAN_RTR_FLAG)
+			msg.flags |= CAN_FLAG_RTR;
+		msg.len = std::min<uint8_t>(frame.can_dlc, CAN_MAX_LEN);
+		std::memcpy(msg.data, frame.data, msg.len);
+	}
+}
+
+const size_t BatchedCanSocket::MAX_BATCH;
+const size_t BatchedCanSocket::MAX_FILTERS;
+
+BatchedCanSocket::~BatchedCanSocket()
+{
+	close();
+}
+
+bool BatchedCanSocket::open(const std::string &interface, std::error_code &error, bool receiveOwnFrames)
+{
+	close();
+	unsigned int interfaceIndex = if_nametoindex(interface.c_str());
+	if (interfaceIndex == 0)
+	{
+		error = std::error_code(errno, std::generic_category());
+		return false;
+	}
+
+	m_fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+	if (m_fd < 0)
+	{
+		error = std::error_code(errno, std::generic_category());
+		return false;
+	}
+
+	int enabled = receiveOwnFrames ? 1 : 0;
+	setsockopt(m_fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &enabled, sizeof(enabled));
+
+	sockaddr_can address;
+	std::memset(&address, 0, sizeof(address));
+	address.can_family = AF_CAN;
+	address.can_ifindex = static_cast<int>(interfaceIndex);
+	if (bind(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		error = std::error_code(errno, std::generic_category());
+		close();
+		return false;
+	}
+
+	m_interface = interface;
+	error.clear();
+	return true;
+}
+
+void BatchedCanSocket::close()
+{
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+}
+
+bool BatchedCanSocket::setReceiveFilter(const std::vector<uint32_t> &cobIDs, std::error_code &error)
+{
+	if (cobIDs.size() > MAX_FILTERS)
+	{
+		error = std::make_error_code(std::errc::argument_out_of_domain);
+		return false;
+	}
+
+	std::vector<can_filter> filters;
+	for (auto cobID : cobIDs)
+	{
+		// The RTR flag is not part of the mask, so a remote request for a TPDO of the reader is received, too.
+		can_filter filter;
+		if (cobID & 0x20000000)
+		{
+			filter.can_id = (cobID & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			filter.can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+		}
+		else
+		{
+			filter.can_id = cobID & CAN_SFF_MASK;
+			filter.can_mask = CAN_SFF_MASK | CAN_EFF_FLAG;
+		}
+		filters.push_back(filter);
+	}
+	if (filters.empty())
+		filters.push_back(can_filter{0, 0});  // The default of the kernel: receive everything.
+
+	if (setsockopt(m_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(), filters.size() * sizeof(can_filter)) != 0)
+	{
+		error = std::error_code(errno, std::generic_category());
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
+
+size_t BatchedCanSocket::getInterfaceReceivedFrames() const
+{
+	std::ifstream file("/sys/class/net/" + m_interface + "/statistics/rx_packets");
+	size_t frames = 0;
+	file >> frames;
+	return file ? frames : 0;
+}
+
+size_t BatchedCanSocket::receive(can_msg *msgs, size_t count, std::error_code &error)
+{
+	error.clear();
+	count = std::min(count, MAX_BATCH);
+	can_frame frames[MAX_BATCH];
+	iovec vectors[MAX_BATCH];
+	mmsghdr headers[MAX_BATCH];
+	std::memset(headers, 0, sizeof(headers[0]) * count);
+	for (size_t i = 0; i < count; i++)
+	{
+		vectors[i].iov_base = &frames[i];
+		vectors[i].iov_len = sizeof(frames[i]);
+		headers[i].msg_hdr.msg_iov = &vectors[i];
+		headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	m_receiveCalls++;
+	int received = recvmmsg(m_fd, headers, static_cast<unsigned int>(count), MSG_DONTWAIT, nullptr);
+	if (received < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			error = std::error_code(errno, std::generic_category());
+		return 0;
+	}
+
+	size_t messages = 0;
+	for (int i = 0; i < received; i++)
+	{
+		if (headers[i].msg_len == sizeof(can_frame))  // CAN FD frames are not supported.
+			toMessage(frames[i], msgs[messages++]);
+	}
+	m_receivedFrames += messages;
+	return messages;
+}
+
+size_t BatchedCanSocket::send(const can_msg *msgs, size_t count, std::error_code &error)
+{
+	error.clear();
+	count = std::min(count, MAX_BATCH);
+	can_frame frames[MAX_BATCH];
+	iovec vectors[MAX_BATCH];
+	mmsghdr headers[MAX_BATCH];
+	std::memset(headers, 0, sizeof(headers[0]) * count);
+	for (size_t i = 0; i < count; i++)
+	{
+		toFrame(msgs[i], frames[i]);
+		vectors[i].iov_base = &frames[i];
+		vectors[i].iov_len = sizeof(frames[i]);
+		headers[i].msg_hdr.msg_iov = &vectors[i];
+		headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	m_sendCalls++;
+	int sent = sendmmsg(m_fd, headers, static_cast<unsigned int>(count), MSG_DONTWAIT);
+	if (sent < 0)
+	{
+		// ENOBUFS (the queue of the interface is full) is passed on, unlike EAGAIN the poll does not wait for it.
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			error = std::error_code(errno, std::generic_category());
+		return 0;
+	}
+	m_sentFrames += static_cast<size_t>(sent);
+	return static_cast<size_t>(sent);
+}
@@ -0,0 +1,339 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the implementation of an offline bus load and worst case latency estimator for a DCF set.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <boost/format.hpp>
+
+#include <lely/util/diag.h>
+
+#include "BusLoadAnalyzer.h"
+#include "ConciseDcfImage.h"
+#include "DCFDriverConfig.h"
+
+namespace
+{
+	/// The position in the arbitration: the lower, the higher the priority.
+	/// The 11 bit base identifier decides first; with the same base identifier a standard frame wins against an extended one.
+	uint64_t getArbitrationKey(const BusLoadAnalyzer::Message& message)
+	{
+		if (message.extended)
+			return (static_cast<uint64_t>(message.cobID & 0x1FFFFFFF) << 1) | 1;
+		return static_cast<uint64_t>(message.cobID & 0x7FF) << 19;
+	}
+
+	uint8_t getDataBytes(const std::vector<uint32_t>& mapping)
+	{
+		unsigned bits = 0;
+		for (auto entry : mapping)
+			bits += entry & 0xFF;
+		return static_cast<uint8_t>(std::min(8u, (bits + 7) / 8));
+	}
+
+	std::string resolveFileName(const std::string& fileName, const std::string& relativeTo)
+	{
+		auto separator = relativeTo.find_last_of('/');
+		if (fileName.empty() || fileName[0] == '/' || separator == std::string::npos)
+			return fileName;
+		return relativeTo.substr(0, separator + 1) + fileName;
+	}
+}
+
+BusLoadAnalyzer::BusLoadAnalyzer(uint32_t bitRate) :
+	m_bitRate(bitRate)
+{
+}
+
+double BusLoadAnalyzer::getFrameTime(uint32_t bitRate, uint8_t dataBytes, bool extended)
+{
+	// Davis et al., "Controller Area Network (CAN) schedulability analysis: Refuted, revisited and revised", equations (1) and (2).
+	unsigned bits = extended ? 67 + 8 * dataBytes + (54 + 8 * dataBytes - 1) / 4
+							 : 47 + 8 * dataBytes + (34 + 8 * dataBytes - 1) / 4;
+	return static_cast<double>(bits) / bitRate;
+}
+
+bool BusLoadAnalyzer::addMasterDcf(const std::string &fileName, uint8_t nodeID, std::error_code &error)
+{
+	std::vector<std::pair<uint8_t, std::string>> textualSlaves;
+	std::vector<std::pair<uint8_t, std::string>> conciseSlaves;
+	try
+	{
+		DCFDriverConfig master(fileName, "", nodeID);
+		for (const auto& pdo : master.getRpdoConfigs())
+			if (pdo.isValid())
+				// The event timer of an RPDO is the deadline monitoring, not a send period.
+				addPdo({pdo.cobID, pdo.transmissionType, 0, 0, getDataBytes(pdo.mapping),
+						(boost::format("master RPDO %d") % (pdo.communicationIndex - 0x1400 + 1)).str(), false});
+		for (const auto& pdo : master.getTpdoConfigs())
+			if (pdo.isValid())
+				addPdo({pdo.cobID, pdo.transmissionType, pdo.inhibitTime, pdo.eventTimer, getDataBytes(pdo.mapping),
+						(boost::format("master TPDO %d") % (pdo.communicationIndex - 0x1800 + 1)).str(), true});
+
+		std::error_code readError;
+		uint32_t syncCobID = master.Read<uint32_t>(0x1005, 0, readError);
+		uint32_t syncPeriodUs = readError ? 0 : master.Read<uint32_t>(0x1006, 0, readError);
+		if (!readError && (syncCobID & 0x40000000) && syncPeriodUs > 0)
+		{
+			m_syncCobID = syncCobID & 0x7FF;
+			m_dcfSyncPeriodMs = syncPeriodUs / 1000.0;
+		}
+
+		uint16_t producerTimeMs = master.Read<uint16_t>(0x1017, 0, readError);
+		if (!readError)
+			addHeartbeat(nodeID, producerTimeMs, "master heartbeat");
+
+		for (uint8_t subIndex = 1; subIndex <= 127; subIndex++)
+		{
+			// Errors are expected at this point since the SDO might not exist.
+			const char* textualFileName = master.GetUploadFile(0x1F20, subIndex, readError);
+			if (textualFileName != nullptr && *textualFileName != '\0')
+				textualSlaves.emplace_back(subIndex, resolveFileName(textualFileName, fileName));
+			const char* conciseFileName = master.GetUploadFile(0x1F22, subIndex, readError);
+			if (conciseFileName != nullptr && *conciseFileName != '\0')
+				conciseSlaves.emplace_back(subIndex, resolveFileName(conciseFileName, fileName));
+		}
+	}
+	catch (const std::system_error& e)
+	{
+		diag(DIAG_ERROR, 0, "BusLoadAnalyzer: Cannot read %s: %s", fileName.c_str(), e.what());
+		error = e.code();
+		return false;
+	}
+
+	for (const auto& slave : textualSlaves)
+		if (!addSlaveDcf(slave.second, slave.first, error))
+			return false;
+	for (const auto& slave : conciseSlaves)
+		if (!addSlaveConciseDcf(slave.second, slave.first, error))
+			return false;
+	return true;
+}
+
+bool BusLoadAnalyzer::addSlaveDcf(const std::string &fileName, uint8_t nodeID, std::error_code &error)
+{
+	try
+	{
+		DCFDriverConfig slave(fileName, "", nodeID);
+		// The RPDOs of the slave are sent by the master or another slave and therefore already known.
+		for (const auto& pdo : slave.getTpdoConfigs())
+			if (pdo.isValid())
+				addPdo({pdo.cobID, pdo.transmissionType, pdo.inhibitTime, pdo.eventTimer, getDataBytes(pdo.mapping),
+						(boost::format("node %d TPDO %d") % static_cast<int>(nodeID) % (pdo.communicationIndex - 0x1800 + 1)).str(), true});
+
+		std::error_code readError;
+		uint16_t producerTimeMs = slave.Read<uint16_t>(0x1017, 0, readError);
+		if (!readError)
+			addHeartbeat(nodeID, producerTimeMs, (boost::format("node %d heartbeat") % static_cast<int>(nodeID)).str());
+	}
+	catch (const std::system_error& e)
+	{
+		diag(DIAG_ERROR, 0, "BusLoadAnalyzer: Cannot read %s: %s", fileName.c_str(), e.what());
+		error = e.code();
+		return false;
+	}
+	return true;
+}
+
+bool BusLoadAnalyzer::addSlaveConciseDcf(const std::string &fileName, uint8_t nodeID, std::error_code &error)
+{
+	auto image = ConciseDcfImage::load(fileName, error);
+	if (image == nullptr)
+		return false;
+
+	// Only the values written by the concise DCF are known, the last write of an object wins (as on the device).
+	std::map<uint32_t, uint32_t> values;
+	for (const auto& entry : image->getEntries())
+	{
+		if (entry.size == 0 || entry.size > 4)
+			continue;
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < entry.size; i++)
+			value |= static_cast<uint32_t>(entry.data[i]) << (8 * i);
+		values[(static_cast<uint32_t>(entry.index) << 8) | entry.subIndex] = value;
+	}
+	auto get = [&values](uint16_t index, uint8_t subIndex, uint32_t defaultValue) -> uint32_t
+	{
+		auto value = values.find((static_cast<uint32_t>(index) << 8) | subIndex);
+		return value != values.end() ? value->second : defaultValue;
+	};
+
+	for (uint16_t communicationIndex = 0x1800; communicationIndex <= 0x19FF; communicationIndex++)
+	{
+		uint32_t cobID = get(communicationIndex, 1, 0x80000000);
+		if (cobID & 0x80000000)
+			continue;
+
+		std::vector<uint32_t> mapping;
+		uint8_t numberOfMappings = get(communicationIndex + 0x200, 0, 0);
+		for (uint8_t i = 1; i <= numberOfMappings; i++)
+			mapping.push_back(get(communicationIndex + 0x200, i, 0));
+		addPdo({cobID, static_cast<uint8_t>(get(communicationIndex, 2, 0xFF)), static_cast<uint16_t>(get(communicationIndex, 3, 0)),
+				static_cast<uint16_t>(get(communicationIndex, 5, 0)), getDataBytes(mapping),
+				(boost::format("node %d TPDO %d") % static_cast<int>(nodeID) % (communicationIndex - 0x1800 + 1)).str(), true});
+	}
+
+	addHeartbeat(nodeID, get(0x1017, 0, 0), (boost::format("node %d heartbeat") % static_cast<int>(nodeID)).str());
+	return true;
+}
+
+void BusLoadAnalyzer::addMessage(const BusLoadAnalyzer::Message &message)
+{
+	m_messages.push_back(message);
+}
+
+void BusLoadAnalyzer::addPdo(const BusLoadAnalyzer::PdoSource &pdo)
+{
+	PdoSource source = pdo;
+	source.cobID &= 0x3FFFFFFF;  // The frame bit (29 bit) is kept.
+
+	// The same COB ID is one frame on the bus, e.g. a master TPDO which is received by a leading and a following node.
+	for (auto& known : m_pdos)
+	{
+		if (known.cobID == source.cobID)
+		{
+			// The parameters of the producer decide when the frame is sent, no matter in which order the DCFs are added.
+			uint8_t dataBytes = std::max(known.dataBytes, source.dataBytes);
+			if (!known.producer && source.producer)
+				known = source;
+			known.dataBytes = dataBytes;
+			return;
+		}
+	}
+	m_pdos.push_back(source);
+}
+
+void BusLoadAnalyzer::addHeartbeat(uint8_t nodeID, uint16_t producerTimeMs, const std::string &description)
+{
+	if (producerTimeMs == 0)
+		return;
+
+	Message heartbeat = {0x700u + nodeID, false, 1, static_cast<double>(producerTimeMs), 0, description, 0, 0, false};
+	m_messages.push_back(heartbeat);
+}
+
+double BusLoadAnalyzer::getPdoPeriod(const BusLoadAnalyzer::PdoSource &pdo) const
+{
+	double syncPeriodMs = m_syncPeriodMs > 0 ? m_syncPeriodMs : m_dcfSyncPeriodMs;
+	if (pdo.transmissionType <= 240 && syncPeriodMs > 0)
+		return syncPeriodMs * std::max<uint8_t>(1, pdo.transmissionType);  // acyclic (0): at most once per SYNC
+
+	auto eventRate = m_eventRates.find(pdo.cobID & 0x1FFFFFFF);
+	double framesPerSecond = eventRate != m_eventRates.end() ? eventRate->second : m_defaultEventRate;
+	if (pdo.eventTimer > 0)
+		framesPerSecond = std::max(framesPerSecond, 1000.0 / pdo.eventTimer);
+	if (pdo.inhibitTime > 0)
+		framesPerSecond = std::min(framesPerSecond, 10000.0 / pdo.inhibitTime);  // inhibit time in 100 us
+	return framesPerSecond > 0 ? 1000.0 / framesPerSecond : 0;
+}
+
+BusLoadAnalyzer::Result BusLoadAnalyzer::analyze() const
+{
+	Result result;
+	result.messages = m_messages;
+	for (const auto& pdo : m_pdos)
+	{
+		Message message = {pdo.cobID & 0x1FFFFFFF, (pdo.cobID & 0x20000000) != 0, pdo.dataBytes, getPdoPeriod(pdo), 0, pdo.description, 0, 0, false};
+		if (message.periodMs > 0)
+			result.messages.push_back(message);
+	}
+
+	double syncPeriodMs = m_syncPeriodMs > 0 ? m_syncPeriodMs : m_dcfSyncPeriodMs;
+	if (syncPeriodMs > 0)
+		result.messages.push_back({m_syncCobID, false, 0, syncPeriodMs, 0, "SYNC", 0, 0, false});
+
+	std::stable_sort(result.messages.begin(), result.messages.end(), [](const Message& a, const Message& b)
+	{
+		return getArbitrationKey(a) < getArbitrationKey(b);
+	});
+
+	result.framesPerSecond = 0;
+	result.utilization = 0;
+	for (auto& message : result.messages)
+	{
+		message.frameTimeMs = getFrameTime(m_bitRate, message.dataBytes, message.extended) * 1000.0;
+		result.framesPerSecond += 1000.0 / message.periodMs;
+		result.utilization += message.frameTimeMs / message.periodMs;
+	}
+
+	calculateResponseTimes(result.messages);
+	result.schedulable = std::all_of(result.messages.begin(), result.messages.end(), [](const Message& message) {return message.schedulable;});
+	return result;
+}
+
+void BusLoadAnalyzer::calculateResponseTimes(std::vector<BusLoadAnalyzer::Message> &messages) const
+{
+	// The messages are sorted by priority. Jitter is not modelled (J = 0), the deadline defaults to the period.
+	double bitTimeMs = 1000.0 / m_bitRate;
+	for (size_t m = 0; m < messages.size(); m++)
+	{
+		auto& message = messages[m];
+		double deadlineMs = message.deadlineMs > 0 ? message.deadlineMs : message.periodMs;
+		message.responseTimeMs = std::numeric_limits<double>::infinity();
+		message.schedulable = false;
+
+		// Blocking: a lower priority frame which has just started cannot be interrupted.
+		double blockingMs = 0;
+		for (size_t k = m + 1; k < messages.size(); k++)
+			blockingMs = std::max(blockingMs, messages[k].frameTimeMs);
+
+		double utilization = 0;
+		for (size_t k = 0; k <= m; k++)
+			utilization += messages[k].frameTimeMs / messages[k].periodMs;
+		if (utilization >= 1.0)
+			continue;  // The busy period is unbounded.
+
+		// Length of the priority level-m busy period.
+		double busyPeriodMs = message.frameTimeMs;
+		for (;;)
+		{
+			double next = blockingMs;
+			for (size_t k = 0; k <= m; k++)
+				next += std::ceil(busyPeriodMs / messages[k].periodMs) * messages[k].frameTimeMs;
+			if (next <= busyPeriodMs)
+				break;
+			busyPeriodMs = next;
+		}
+
+		// Every instance within the busy period has to be checked.
+		unsigned instances = static_cast<unsigned>(std::ceil(busyPeriodMs / message.periodMs));
+		double responseTimeMs = 0;
+		for (unsigned q = 0; q < instances; q++)
+		{
+			double queuingDelayMs = blockingMs + q * message.frameTimeMs;
+			for (;;)
+			{
+				double next = blockingMs + q * message.frameTimeMs;
+				for (size_t k = 0; k < m; k++)
+					next += std::ceil((queuingDelayMs + bitTimeMs) / messages[k].periodMs) * messages[k].frameTimeMs;
+				if (next <= queuingDelayMs)
+					break;
+				queuingDelayMs = next;
+			}
+			responseTimeMs = std::max(responseTimeMs, queuingDelayMs - q * message.periodMs + message.frameTimeMs);
+		}
+
+		message.responseTimeMs = responseTimeMs;
+		message.schedulable = responseTimeMs <= deadlineMs;
+	}
+}
@@ -0,0 +1,62 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the implementation of a runtime bus load monitor.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BusLoadAnalyzer.h"
+#include "BusLoadMonitor.h"
+
+BusLoadMonitor::BusLoadMonitor(uint32_t bitRate) :
+	m_bitRate(bitRate),
+	m_windowStartedAt(std::chrono::steady_clock::now())
+{
+	for (uint8_t dataBytes = 0; dataBytes <= 8; dataBytes++)
+		m_frameTimes[dataBytes] = BusLoadAnalyzer::getFrameTime(bitRate, dataBytes, /* extended = */ false);
+}
+
+void BusLoadMonitor::countFrame(uint32_t cobID, uint8_t dataBytes)
+{
+	auto& counter = m_counters[cobID];
+	counter.frames++;
+	counter.busTime += m_frameTimes[dataBytes <= 8 ? dataBytes : 8];
+}
+
+void BusLoadMonitor::update(std::chrono::steady_clock::time_point now)
+{
+	double window = std::chrono::duration<double>(now - m_windowStartedAt).count();
+	if (window <= 0)
+		return;
+
+	double busTime = 0;
+	for (auto& counter : m_counters)
+	{
+		m_frameRates[counter.first] = counter.second.frames / window;
+		busTime += counter.second.busTime;
+		counter.second = Counter();  // The COB IDs are kept, so no allocation is needed in the next window.
+	}
+	m_busLoad = busTime / window;
+	m_windowStartedAt = now;
+}
+
+double BusLoadMonitor::getFrameRate(uint32_t cobID) const
+{
+	auto frameRate = m_frameRates.find(cobID);
+	return frameRate != m_frameRates.end() ? frameRate->second : 0;
+}
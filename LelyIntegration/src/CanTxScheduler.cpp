@@ -0,0 +1,215 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a scheduler for the CAN frames sent by the master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "CanTxScheduler.h"
+
+namespace
+{
+	/// The delay before a frame is sent again if the CAN channel did not take it.
+	const std::chrono::microseconds RETRY_DELAY(1000);
+}
+
+const size_t CanTxScheduler::MAX_QUEUED_FRAMES;
+
+CanTxScheduler::CanTxScheduler(can_net_t *net, CanTxScheduler::ReleaseRequest releaseRequest) :
+	m_net(net),
+	m_releaseRequest(releaseRequest)
+{
+	for (auto& statistics : m_statistics)
+		statistics = Statistics{0, 0, 0, std::chrono::microseconds(0), std::chrono::microseconds(0)};
+	can_net_get_send_func(m_net, &m_send, &m_sendData);
+	can_net_set_send_func(m_net, &CanTxScheduler::onSend, this);
+}
+
+CanTxScheduler::~CanTxScheduler()
+{
+	can_net_set_send_func(m_net, m_send, m_sendData);
+}
+
+void CanTxScheduler::addMotionCobID(uint32_t cobID)
+{
+	if (cobID & 0x20000000)
+		m_extendedMotionCobIDs.insert(cobID & 0x1FFFFFFF);
+	else
+		m_motionCobIDs.set(cobID & 0x7FF);
+}
+
+void CanTxScheduler::clearMotionCobIDs()
+{
+	m_motionCobIDs.reset();
+	m_extendedMotionCobIDs.clear();
+}
+
+void CanTxScheduler::setSdoRate(unsigned framesPerSecond, unsigned burst)
+{
+	m_sdoTokensPerMicrosecond = framesPerSecond / 1000000.0;
+	m_sdoBurst = std::max(burst, 1u);
+	m_sdoTokens = m_sdoBurst;
+	m_tokensRefilledAt = std::chrono::steady_clock::now();
+}
+
+void CanTxScheduler::setSyncGap(uint32_t syncCobID, std::chrono::microseconds period, std::chrono::microseconds windowLength, std::chrono::microseconds guardTime)
+{
+	m_syncCobID = syncCobID & 0x7FF;
+	// Without a gap the non-cyclic frames would never be sent.
+	m_syncPeriod = windowLength + guardTime < period ? period : std::chrono::microseconds(0);
+	m_syncWindowLength = windowLength;
+	m_guardTime = guardTime;
+}
+
+int CanTxScheduler::onSend(const can_msg *msg, void *data)
+{
+	return static_cast<CanTxScheduler*>(data)->send(*msg);
+}
+
+int CanTxScheduler::send(const can_msg &msg)
+{
+	auto now = std::chrono::steady_clock::now();
+	TrafficClass trafficClass = classify(msg);
+	m_statistics[trafficClass].frames++;
+	if (trafficClass == MOTION)
+	{
+		if (!(msg.flags & CAN_FLAG_IDE) && msg.id == m_syncCobID)
+		{
+			m_syncSeen = true;
+			m_lastSync = now;
+		}
+		return m_send(&msg, m_sendData);
+	}
+
+	// Only passes if no frame of the class is waiting, so the segments of an SDO transfer stay in order.
+	auto& queue = m_queues[trafficClass];
+	auto holdTime = getHoldTime(trafficClass, now);
+	if (queue.empty() && holdTime.count() == 0)
+	{
+		if (trafficClass == SDO && m_sdoTokensPerMicrosecond > 0)
+			m_sdoTokens -= 1.0;
+		return m_send(&msg, m_sendData);
+	}
+
+	if (queue.size() >= MAX_QUEUED_FRAMES)
+	{
+		m_statistics[trafficClass].droppedFrames++;
+		return -1;
+	}
+	queue.push_back(QueuedFrame{msg, now});
+	m_statistics[trafficClass].queuedFrames++;
+	requestRelease(std::max(holdTime, std::chrono::microseconds(1)), now);
+	return 0;
+}
+
+void CanTxScheduler::release(std::chrono::steady_clock::time_point now)
+{
+	m_releaseRequested = false;
+	// Service frames first: a heartbeat must not wait for a configuration burst.
+	for (TrafficClass trafficClass : {SERVICE, SDO})
+	{
+		auto& queue = m_queues[trafficClass];
+		while (!queue.empty())
+		{
+			auto holdTime = getHoldTime(trafficClass, now);
+			if (holdTime.count() > 0)
+			{
+				requestRelease(holdTime, now);
+				break;
+			}
+			if (m_send(&queue.front().msg, m_sendData) != 0)
+			{
+				requestRelease(RETRY_DELAY, now);  // The channel is full, try again later.
+				return;
+			}
+
+			if (trafficClass == SDO && m_sdoTokensPerMicrosecond > 0)
+				m_sdoTokens -= 1.0;
+			countLatency(trafficClass, now - queue.front().queuedAt);
+			queue.pop_front();
+		}
+	}
+}
+
+CanTxScheduler::TrafficClass CanTxScheduler::classify(const can_msg &msg) const
+{
+	if (msg.flags & CAN_FLAG_IDE)
+		return m_extendedMotionCobIDs.find(msg.id & 0x1FFFFFFF) != m_extendedMotionCobIDs.end() ? MOTION : SERVICE;
+
+	uint32_t cobID = msg.id & 0x7FF;
+	if (cobID == 0x000 || cobID == m_syncCobID || m_motionCobIDs.test(cobID))
+		return MOTION;  // NMT, SYNC, PDO
+	if (cobID >= 0x581 && cobID <= 0x67F)
+		return SDO;
+	return SERVICE;
+}
+
+std::chrono::microseconds CanTxScheduler::getHoldTime(CanTxScheduler::TrafficClass trafficClass, std::chrono::steady_clock::time_point now)
+{
+	std::chrono::microseconds holdTime(0);
+	if (m_syncPeriod.count() > 0 && m_syncSeen)
+	{
+		// Modulo the period: if a SYNC was not sent through the scheduler, the cycle is assumed to go on.
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastSync) % m_syncPeriod;
+		if (elapsed < m_syncWindowLength)
+			holdTime = m_syncWindowLength - elapsed;
+		else if (elapsed + m_guardTime >= m_syncPeriod)
+			holdTime = m_syncPeriod - elapsed + m_syncWindowLength;
+	}
+
+	if (trafficClass == SDO && m_sdoTokensPerMicrosecond > 0)
+	{
+		refillTokens(now);
+		if (m_sdoTokens < 1.0)
+		{
+			auto tokenTime = std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(std::ceil((1.0 - m_sdoTokens) / m_sdoTokensPerMicrosecond)));
+			holdTime = std::max(holdTime, tokenTime);
+		}
+	}
+	return holdTime;
+}
+
+void CanTxScheduler::refillTokens(std::chrono::steady_clock::time_point now)
+{
+	if (now <= m_tokensRefilledAt)
+		return;
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_tokensRefilledAt).count();
+	m_sdoTokens = std::min(m_sdoBurst, m_sdoTokens + elapsed * m_sdoTokensPerMicrosecond);
+	m_tokensRefilledAt = now;
+}
+
+void CanTxScheduler::countLatency(CanTxScheduler::TrafficClass trafficClass, std::chrono::steady_clock::duration latency)
+{
+	auto& statistics = m_statistics[trafficClass];
+	auto latencyInMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency);
+	statistics.totalLatency += latencyInMicroseconds;
+	statistics.maxLatency = std::max(statistics.maxLatency, latencyInMicroseconds);
+}
+
+void CanTxScheduler::requestRelease(std::chrono::microseconds delay, std::chrono::steady_clock::time_point now)
+{
+	// Requested again only if the frame is due earlier than the pending release, release() does not mind extra calls.
+	if (m_releaseRequest == nullptr || (m_releaseRequested && now + delay >= m_releaseDueAt))
+		return;
+	m_releaseRequested = true;
+	m_releaseDueAt = now + delay;
+	m_releaseRequest(delay);
+}
@@ -0,0 +1,215 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the implementation of a memory-mapped, shareable concise (binary) DCF image.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lely/util/diag.h>
+
+#include "ConciseDcfImage.h"
+
+namespace
+{
+	uint16_t readUint16(const uint8_t* data)
+	{
+		return static_cast<uint16_t>(data[0] | (data[1] << 8));
+	}
+
+	uint32_t readUint32(const uint8_t* data)
+	{
+		return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+	}
+
+	bool isNodeIDDependentCobID(uint16_t index, uint8_t subIndex)
+	{
+		return (index == 0x1014 && subIndex == 0) ||                      // EMCY COB ID
+				(index >= 0x1400 && index <= 0x15FF && subIndex == 1) ||  // RPDO COB ID
+				(index >= 0x1800 && index <= 0x19FF && subIndex == 1);    // TPDO COB ID
+	}
+
+	// All images which are currently in use, so the same file is only mapped once.
+	std::mutex s_imagesMutex;
+	std::map<std::string, std::weak_ptr<const ConciseDcfImage>> s_images;
+}
+
+std::shared_ptr<const ConciseDcfImage> ConciseDcfImage::load(const std::string &fileName, std::error_code &error)
+{
+	std::unique_lock<std::mutex> lock(s_imagesMutex);
+	for (auto it = s_images.begin(); it != s_images.end();)
+	{
+		// Forget the images which are not in use anymore, otherwise the map grows with every file loaded.
+		if (it->second.expired())
+			it = s_images.erase(it);
+		else
+			++it;
+	}
+
+	auto cached = s_images.find(fileName);
+	if (cached != s_images.end())
+	{
+		auto image = cached->second.lock();
+		if (image != nullptr)
+			return image;  // Otherwise the last user released it just now.
+	}
+
+	int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		error = std::error_code(errno, std::generic_category());
+		return nullptr;
+	}
+
+	struct stat fileStatus;
+	if (::fstat(fd, &fileStatus) == -1)
+	{
+		error = std::error_code(errno, std::generic_category());
+		::close(fd);
+		return nullptr;
+	}
+
+	size_t size = static_cast<size_t>(fileStatus.st_size);
+	if (size < 4)
+	{
+		error = std::make_error_code(std::errc::invalid_argument);  // Not even the number of entries is in the file.
+		::close(fd);
+		return nullptr;
+	}
+
+	void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);  // The mapping stays valid without the file descriptor.
+	if (data == MAP_FAILED)
+	{
+		error = std::error_code(errno, std::generic_category());
+		return nullptr;
+	}
+
+	std::shared_ptr<ConciseDcfImage> image(new ConciseDcfImage(fileName, static_cast<const uint8_t*>(data), size));
+	if (!image->parseEntries())
+	{
+		diag(DIAG_ERROR, 0, "ConciseDcfImage: %s is not a valid concise DCF.", fileName.c_str());
+		error = std::make_error_code(std::errc::invalid_argument);
+		return nullptr;
+	}
+
+	diag(DIAG_INFO, 0, "ConciseDcfImage: Mapped %s (%zu bytes, %zu objects).", fileName.c_str(), size, image->m_entries.size());
+	s_images[fileName] = image;
+	error.clear();
+	return image;
+}
+
+ConciseDcfImage::ConciseDcfImage(const std::string &fileName, const uint8_t *data, size_t size) :
+	m_fileName(fileName),
+	m_data(data),
+	m_size(size)
+{
+}
+
+ConciseDcfImage::~ConciseDcfImage()
+{
+	::munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+bool ConciseDcfImage::parseEntries()
+{
+	// Layout (CiA-302-3): UNSIGNED32 number of entries, followed by the entries:
+	// UNSIGNED16 index, UNSIGNED8 sub index, UNSIGNED32 size, size bytes data.
+	uint32_t numberOfEntries = readUint32(m_data);
+	size_t offset = 4;
+	m_entries.reserve(numberOfEntries);
+	for (uint32_t i = 0; i < numberOfEntries; i++)
+	{
+		if (offset + 7 > m_size)
+			return false;
+
+		Entry entry;
+		entry.index = readUint16(m_data + offset);
+		entry.subIndex = m_data[offset + 2];
+		entry.size = readUint32(m_data + offset + 3);
+		offset += 7;
+		if (entry.size > m_size - offset)
+			return false;
+
+		entry.data = m_data + offset;
+		offset += entry.size;
+		m_entries.push_back(entry);
+	}
+	return true;
+}
+
+uint32_t ConciseDcfImage::getPatchedValue(const ConciseDcfImage::Entry &entry, uint8_t fromNodeID, uint8_t toNodeID)
+{
+	uint32_t value = readUint32(entry.data);
+	if (fromNodeID == toNodeID || !isNodeIDDependentCobID(entry.index, entry.subIndex) || (value & 0x20000000))
+		return value;  // Nothing to patch or extended (29 bit) COB ID.
+
+	uint32_t cobID = value & 0x7FF;
+	if ((cobID & 0x7F) != fromNodeID)
+		return value;
+
+	switch (cobID - fromNodeID)
+	{
+	case 0x080:  // EMCY
+	case 0x180:  // TPDO1
+	case 0x200:  // RPDO1
+	case 0x280:  // TPDO2
+	case 0x300:  // RPDO2
+	case 0x380:  // TPDO3
+	case 0x400:  // RPDO3
+	case 0x480:  // TPDO4
+	case 0x500:  // RPDO4
+		return (value & ~static_cast<uint32_t>(0x7FF)) | (cobID - fromNodeID + toNodeID);
+	default:
+		return value;  // Not a COB ID of the predefined connection set, e.g. a shared RPDO of a following motor.
+	}
+}
+
+bool ConciseDcfImage::isEquivalentFor(uint8_t nodeID, const ConciseDcfImage &other, uint8_t otherNodeID) const
+{
+	if (m_size != other.m_size || m_entries.size() != other.m_entries.size())
+		return false;
+
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		const auto& entry = m_entries[i];
+		const auto& otherEntry = other.m_entries[i];
+		if (entry.index != otherEntry.index || entry.subIndex != otherEntry.subIndex || entry.size != otherEntry.size)
+			return false;
+
+		if (entry.size == 4 && isNodeIDDependentCobID(entry.index, entry.subIndex))
+		{
+			if (getPatchedValue(entry, nodeID, otherNodeID) != readUint32(otherEntry.data))
+				return false;
+		}
+		else if (std::memcmp(entry.data, otherEntry.data, entry.size) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -20,17 +20,100 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cmath>
+
 #include <lely/co/dev.hpp>
 #include <lely/co/obj.hpp>
+#include <lely/co/type.h>
+#include <lely/coapp/sdo_error.hpp>
 #include <lely/util/diag.h>
 
+#include "BatchedCanChannel.h"
+#include "BusLoadAnalyzer.h"
 #include "MotorDriver.h"
 #include "DCFConfigMaster.h"
 #include "DCFDriverConfig.h"
 
+namespace
+{
+	/// The watchdogs and retries which a driver runs at the same time, see preallocate().
+	const size_t TIMERS_PER_DRIVER = 4;
+
+	/// Returns the given sub object of the local object dictionary. Missing objects and sub objects are created.
+	co_sub_t* findOrCreateSubObject(co_dev_t* od, uint16_t index, uint8_t subIndex, uint16_t type, uint8_t objectCode, bool pdoMapping)
+	{
+		co_obj_t* object = co_dev_find_obj(od, index);
+		if (object == nullptr)
+		{
+			object = co_obj_create(index);
+			if (object == nullptr)
+				return nullptr;
+			co_obj_set_code(object, objectCode);
+			if (co_dev_insert_obj(od, object) == -1)
+			{
+				co_obj_destroy(object);
+				return nullptr;
+			}
+		}
+
+		co_sub_t* subObject = co_obj_find_sub(object, subIndex);
+		if (subObject == nullptr)
+		{
+			subObject = co_sub_create(subIndex, type);
+			if (subObject == nullptr)
+				return nullptr;
+			co_sub_set_access(subObject, subIndex == 0 ? CO_ACCESS_RO : CO_ACCESS_RW);
+			co_sub_set_pdo_mapping(subObject, pdoMapping);
+			if (co_obj_insert_sub(object, subObject) == -1)
+			{
+				co_sub_destroy(subObject);
+				return nullptr;
+			}
+		}
+		else if (co_sub_get_type(subObject) != type)
+		{
+			diag(DIAG_ERROR, 0, "Object 0x%04x/0x%02x already exists with type 0x%04x instead of 0x%04x.", index, subIndex, co_sub_get_type(subObject), type);
+			return nullptr;
+		}
+
+		if (subIndex != 0)
+		{
+			// Keep the highest sub index of arrays and records up to date.
+			co_sub_t* highestSubIndex = findOrCreateSubObject(od, index, 0, CO_DEFTYPE_UNSIGNED8, objectCode, false);
+			if (highestSubIndex != nullptr && co_sub_get_val_u8(highestSubIndex) < subIndex)
+				co_sub_set_val_u8(highestSubIndex, subIndex);
+		}
+		return subObject;
+	}
+
+	/// Checks that findOrCreateSubObject() can provide the sub-object: it does not exist yet or has the type.
+	bool canCreateSubObject(co_dev_t* od, uint16_t index, uint8_t subIndex, uint16_t type)
+	{
+		co_sub_t* subObject = co_dev_find_sub(od, index, subIndex);
+		return subObject == nullptr || co_sub_get_type(subObject) == type;
+	}
+}
+
+
+/**
+ * @brief ParameterTransfer holds the state of a running backupParameters() or restoreParameters().
+ */
+struct DCFConfigMaster::ParameterTransfer
+{
+	std::shared_ptr<ParameterSnapshot> snapshot;
+	std::map<uint8_t /* node ID */, std::vector<std::pair<uint16_t /* index */, uint8_t /* sub index */>>> objectsToRead;
+	size_t runningNodes = 0;
+	std::error_code error;
+	ParameterSnapshot::Statistics statistics = {0, 0, 0, 0, std::chrono::milliseconds(0)};
+	std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+	BackupCompletedCallback backupCompletedCallback;
+	RestoreCompletedCallback restoreCompletedCallback;
+};
 
 DCFConfigMaster::DCFConfigMaster(lely::io::TimerBase &timer, lely::io::CanChannelBase &chan, const std::string &dcf_txt, ev_exec_t *exec) :
 	lely::canopen::AsyncMaster(timer, chan, dcf_txt),
+	m_sdoTimeoutPolicy(GetTimeout()),
 	m_exec(exec)
 {
 	diag(DIAG_INFO, 0, "Master runnning on node ID 0x%02x, configured from %s", id(), dcf_txt.c_str());
@@ -38,10 +121,21 @@ DCFConfigMaster::DCFConfigMaster(lely::io::TimerBase &timer, lely::io::CanChanne
 	// Forward SDO changes of the master, which were probably triggered by PDOs from the slaves.
 	OnWrite([this](uint16_t idx, uint8_t subidx)
 	{
-		for (auto& driver : m_drivers)
+		// A remapped PDO or a new slave changes the consumed COB IDs.
+		if (m_receiveFilterChannel != nullptr && ((idx >= 0x1200 && idx <= 0x15FF) || (idx >= 0x1800 && idx <= 0x19FF)
+												  || idx == 0x1005 || idx == 0x1012 || idx == 0x1016 || idx == 0x1028 || idx == 0x1F81))
+			updateReceiveFilter();
+		if (idx >= 0x1600 && idx <= 0x17FF)
+			collectRpdoMappedObjects();
+
+		if (m_rpdoMappedObjects.find((static_cast<uint32_t>(idx) << 8) | subidx) != m_rpdoMappedObjects.end())
 		{
-			driver.second->onMasterSDOChanged(idx, subidx);
+			// Written by a received PDO: forwarded in OnRpdo(), when all objects of the frame are written.
+			m_pendingMasterWrites.emplace_back(idx, subidx);
+			return;
 		}
+
+		forwardMasterObjectChange(idx, subidx);
 	});
 }
 
@@ -49,12 +143,37 @@ void DCFConfigMaster::configureDrivers()
 {
 	initializeDevicesFromTextualDCF();
 	initializeDevicesForBinaryDCF();
+	configureHeartbeatConsumers();
+	collectRpdoMappedObjects();
+	buildAxisTable();
+	if (m_txScheduler != nullptr)
+		updateTxScheduling();
+	if (m_receiveFilterChannel != nullptr)
+		updateReceiveFilter();
+	preallocate();
+}
+
+void DCFConfigMaster::preallocate()
+{
+	// See RealtimeProfile: the structures grown at runtime get their final size now.
+	m_pendingMasterWrites.reserve(64);
+	m_dispatchedMasterWrites.reserve(64);
+	m_rpdoWrittenNodes.reserve(m_drivers.size());
+	if (m_timerWheel != nullptr)
+		m_timerWheel->reserve(TIMERS_PER_DRIVER * (m_drivers.size() + 1));
+	for (const auto& driver : m_drivers)
+		driver.second->preallocate();
 }
 
 void DCFConfigMaster::registerDriver(std::shared_ptr<DCFDriver> driver)
 {
 	m_drivers[driver->id()] = driver;
+	m_broadcastDrivers[driver->id()] = driver.get();
 	m_devicesToBoot.insert(driver->id());
+	// The PDOs of the master may have been generated for the new driver (see generatePdoMapping()).
+	collectRpdoMappedObjects();
+	if (m_receiveFilterChannel != nullptr)
+		updateReceiveFilter();
 }
 
 std::shared_ptr<DCFDriver> DCFConfigMaster::getDriver(uint8_t nodeID)
@@ -66,6 +185,56 @@ std::shared_ptr<DCFDriver> DCFConfigMaster::getDriver(uint8_t nodeID)
 		return result->second;
 }
 
+bool DCFConfigMaster::getMappedMasterObject(uint8_t nodeID, uint16_t slaveIndex, uint8_t slaveSubIndex, DCFConfigMaster::MappedMasterObject &result) const
+{
+	auto node = m_mappedMasterObjects.find(nodeID);
+	if (node == m_mappedMasterObjects.end())
+		return false;
+
+	auto object = node->second.find((static_cast<uint32_t>(slaveIndex) << 8) | slaveSubIndex);
+	if (object == node->second.end())
+		return false;
+
+	result = object->second;
+	return true;
+}
+
+std::vector<std::pair<uint32_t, DCFConfigMaster::MappedMasterObject>> DCFConfigMaster::getRpdoMappedObjects(uint8_t nodeID) const
+{
+	std::vector<std::pair<uint32_t, MappedMasterObject>> result;
+	auto node = m_mappedMasterObjects.find(nodeID);
+	if (node != m_mappedMasterObjects.end())
+	{
+		for (const auto& object : node->second)
+			if (object.second.tpdo < 0)
+				result.push_back(object);
+	}
+
+	// Like lely::canopen::Device::RpdoRead(): 0x5800 + n holds the node ID of the TPDO received by the RPDO n,
+	// 0x5A00 + n its mapping, entry by entry the same as the one of the RPDO (0x1600 + n).
+	for (unsigned n = 0; n < 0x200; n++)
+	{
+		co_obj_t* remotePdo = co_dev_find_obj(dev(), 0x5800 + n);
+		if (remotePdo == nullptr || (co_obj_get_val_u32(remotePdo, 0) & 0xFF) != nodeID)
+			continue;
+		co_obj_t* mapping = co_dev_find_obj(dev(), 0x1600 + n);
+		co_obj_t* remoteMapping = co_dev_find_obj(dev(), 0x5A00 + n);
+		if (mapping == nullptr || remoteMapping == nullptr || co_obj_get_val_u8(mapping, 0) != co_obj_get_val_u8(remoteMapping, 0))
+			continue;
+
+		for (uint8_t subIndex = 1; subIndex <= co_obj_get_val_u8(mapping, 0); subIndex++)
+		{
+			uint32_t entry = co_obj_get_val_u32(mapping, subIndex);
+			uint32_t remoteEntry = co_obj_get_val_u32(remoteMapping, subIndex);
+			if (entry == 0 || (entry & 0xFF) != (remoteEntry & 0xFF))
+				continue;
+			MappedMasterObject object = {static_cast<uint16_t>(entry >> 16), static_cast<uint8_t>(entry >> 8), -1};
+			result.emplace_back(remoteEntry >> 8, object);
+		}
+	}
+	return result;
+}
+
 uint8_t DCFConfigMaster::getFirstNodeIDUsing_RPDO_COB_ID(uint32_t cobID)
 {
 	auto mapping = m_firstNodeIDUsing_RPDO_COB_ID.find(cobID);
@@ -97,6 +266,8 @@ const char* DCFConfigMaster::getSoftwareFileForSlave(uint8_t nodeID, std::error_
 void DCFConfigMaster::OnBoot(uint8_t id, lely::canopen::NmtState st, char es, const std::string &what) noexcept
 {
 	lely::canopen::AsyncMaster::OnBoot(id, st, es, what);
+	if (m_tpdoRateController != nullptr)
+		m_tpdoRateController->reset(id);  // The node was (re)configured, so the TPDO parameters have to be read again.
 	if (m_bootCompletedCallback != nullptr)
 		m_bootCompletedCallback(id);
 
@@ -113,7 +284,10 @@ void DCFConfigMaster::OnBoot(uint8_t id, lely::canopen::NmtState st, char es, co
 		if (m_devicesToBoot.size() == 0 && m_bootCompletedCallback != nullptr)
 		{
 			for (const auto& driver : m_drivers)
-				driver.second->onSystemBootCompleted();
+			{
+				DCFDriver* dcfDriver = driver.second.get();
+				runOnDriverExecutor(*dcfDriver, [dcfDriver]() {dcfDriver->onSystemBootCompleted();});
+			}
 			m_bootCompletedCallback(0);
 		}
 	}
@@ -128,9 +302,9 @@ void DCFConfigMaster::OnCommand(lely::canopen::NmtCommand cs) noexcept
 			std::error_code error;
 			// Disable automatic textual upload in any case since this is broken in Lely Core for PDO configuration.
 			SetUploadFile(0x1F20, driver.first, "", error);
-			// Disable automatic binary upload if a custom clear configuration strategy has been set.
+			// Disable automatic binary upload if a custom clear configuration strategy has been set or the binary DCF is held in memory.
 			// In this case, DCFDriver will trigger the binary upload after the configuration was cleared.
-			if (driver.second->hasCustomClearConfigurationStrategy())
+			if (driver.second->hasCustomClearConfigurationStrategy() || driver.second->hasBinaryDcfImage())
 				SetUploadFile(0x1F22, driver.first, "", error);
 			// Ignore the error since 1F20 or 1F22 might not be set depending on the system configuration.
 		}
@@ -155,6 +329,835 @@ void DCFConfigMaster::OnState(uint8_t id, lely::canopen::NmtState st) noexcept
 	// because we are not called here during the configuration. This will be fixed in lely-core 2.1
 }
 
+void DCFConfigMaster::OnHeartbeat(uint8_t id, bool occurred) noexcept
+{
+	if (occurred)
+	{
+		auto lastHeartbeat = m_lastHeartbeats.find(id);
+		if (lastHeartbeat != m_lastHeartbeats.end())
+		{
+			auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - lastHeartbeat->second);
+			auto jitter = std::max(elapsed - std::chrono::microseconds(m_heartbeatDetectionLatency), std::chrono::microseconds(0));
+			auto& statistics = m_heartbeatStatistics[id];
+			statistics.losses++;
+			statistics.lastTimeoutJitter = jitter;
+			statistics.maxTimeoutJitter = std::max(statistics.maxTimeoutJitter, jitter);
+			statistics.totalTimeoutJitter += jitter;
+			diag(DIAG_WARNING, 0, "Node 0x%02x: Heartbeat lost, reported %lld us after the consumer time (loss #%u).", id, static_cast<long long>(jitter.count()), statistics.losses);
+		}
+		else
+		{
+			diag(DIAG_WARNING, 0, "Node 0x%02x: Heartbeat lost.", id);
+		}
+	}
+	else
+	{
+		diag(DIAG_INFO, 0, "Node 0x%02x: Heartbeat resolved.", id);
+	}
+
+	// Let the parent class forward the event to the driver.
+	lely::canopen::AsyncMaster::OnHeartbeat(id, occurred);
+}
+
+void DCFConfigMaster::OnRpdoWrite(uint8_t id, uint16_t idx, uint8_t subidx) noexcept
+{
+	// Called for every object of the frame before OnRpdo(), a frame usually carries the objects of one node.
+	if (std::find(m_rpdoWrittenNodes.begin(), m_rpdoWrittenNodes.end(), id) == m_rpdoWrittenNodes.end())
+		m_rpdoWrittenNodes.push_back(id);
+	lely::canopen::AsyncMaster::OnRpdoWrite(id, idx, subidx);
+}
+
+void DCFConfigMaster::OnRpdo(int num, std::error_code ec, const void *p, std::size_t n) noexcept
+{
+	// With an error (e.g. the deadline of the RPDO has passed) lely did not process a frame, like OnTpdo().
+	if (m_busLoadMonitor != nullptr && !ec)
+		m_busLoadMonitor->countFrame(getPdoCobID(0x1400 + num - 1), n);
+
+	// Lely calls this after all mapped objects of the frame have been written: now the drivers see consistent values.
+	m_dispatchedMasterWrites.swap(m_pendingMasterWrites);
+	for (const auto& write : m_dispatchedMasterWrites)
+	{
+		updateAxisTable(write.first, write.second);
+		forwardMasterObjectChange(write.first, write.second);
+	}
+	m_dispatchedMasterWrites.clear();
+
+	// Posted, since lely posts the writes themselves to the executor of each driver (AsyncMaster::OnRpdoWrite()): the flush runs after them.
+	for (auto nodeID : m_rpdoWrittenNodes)
+	{
+		auto driver = m_drivers.find(nodeID);
+		if (driver == m_drivers.end())
+			continue;
+		DCFDriver* dcfDriver = driver->second.get();
+		lely::ev::Executor(dcfDriver->GetExecutor()).post([dcfDriver]() {dcfDriver->flushRpdoWrites();});
+	}
+	m_rpdoWrittenNodes.clear();
+}
+
+void DCFConfigMaster::OnTpdo(int num, std::error_code ec, const void *p, std::size_t n) noexcept
+{
+	if (m_busLoadMonitor != nullptr && !ec)
+		m_busLoadMonitor->countFrame(getPdoCobID(0x1800 + num - 1), n);
+}
+
+bool DCFConfigMaster::sendFrame(uint32_t cobID, const uint8_t *data, uint8_t size)
+{
+	if (size > CAN_MAX_LEN)
+		return false;
+
+	can_msg msg = CAN_MSG_INIT;
+	msg.id = cobID & 0x1FFFFFFF;
+	if (cobID & 0x20000000)
+		msg.flags |= CAN_FLAG_IDE;
+	msg.len = size;
+	std::copy(data, data + size, msg.data);
+	std::lock_guard<lely::util::BasicLockable> lock(*this);
+	if (can_net_send(net(), &msg) != 0)
+		return false;
+
+	if (m_busLoadMonitor != nullptr)
+		m_busLoadMonitor->countFrame(msg.id, size);
+	return true;
+}
+
+bool DCFConfigMaster::submitSdoRequest(uint8_t nodeID, lely::canopen::detail::SdoRequestBase &request)
+{
+	std::lock_guard<lely::util::BasicLockable> lock(*this);
+	lely::canopen::Sdo* sdo = GetSdo(nodeID);
+	if (sdo == nullptr)
+		return false;
+
+	request.timeout = getSdoTimeout(nodeID);
+	sdo->Submit(request);
+	return true;
+}
+
+void DCFConfigMaster::enableAdaptiveSdoTimeouts(std::chrono::milliseconds minTimeout, std::chrono::milliseconds maxTimeout, double deviationFactor)
+{
+	m_sdoTimeoutPolicy.setInitialTimeout(GetTimeout());
+	m_sdoTimeoutPolicy.setAdaptive(minTimeout, maxTimeout, deviationFactor);
+	m_adaptiveSdoTimeouts = true;
+}
+
+std::chrono::milliseconds DCFConfigMaster::getSdoTimeout(uint8_t nodeID, SdoTimeoutPolicy::RequestClass requestClass) const
+{
+	return m_adaptiveSdoTimeouts ? m_sdoTimeoutPolicy.getTimeout(nodeID, requestClass) : GetTimeout();
+}
+
+void DCFConfigMaster::enableTimerWheel(lely::io::TimerBase &timer, std::chrono::milliseconds resolution)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_timerWheelMutex);
+	m_timerWheel.reset(new TimerWheel(resolution));
+	m_timerWheelTimer = &timer;
+	m_timerWheelWaiting = false;
+	m_timerWheelStartedAt = std::chrono::steady_clock::now();
+}
+
+TimerWheel::TimerID DCFConfigMaster::startTimer(std::chrono::milliseconds delay, TimerWheel::Callback callback)
+{
+	if (m_timerWheel == nullptr)
+	{
+		SubmitWait(delay, [callback](std::error_code ec)
+		{
+			if (!ec)
+				callback();
+		});
+		return TimerWheel::INVALID_TIMER;
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(m_timerWheelMutex);
+	auto now = std::chrono::steady_clock::now();
+	uint64_t currentTick = getTimerWheelTick(now);
+	// The wheel stands still without timers, it jumps to the current time. Else it is behind by the ticks since its last expiry.
+	if (m_timerWheel->empty())
+		m_timerWheel->advanceTo(currentTick);
+	auto id = m_timerWheel->start(delay, std::move(callback), currentTick - std::min(currentTick, m_timerWheel->getTime()));
+	// The timer is only reprogrammed if the new timer expires before the next one.
+	if (!m_timerWheelWaiting || m_timerWheel->getNextExpiry() < m_timerWheelArmedTick)
+		armTimerWheel(now);
+	return id;
+}
+
+bool DCFConfigMaster::cancelTimer(TimerWheel::TimerID id)
+{
+	// The timer of the wheel is not reprogrammed, at worst it wakes up once for nothing.
+	std::lock_guard<std::recursive_mutex> lock(m_timerWheelMutex);
+	return m_timerWheel != nullptr && m_timerWheel->cancel(id);
+}
+
+uint64_t DCFConfigMaster::getTimerWheelTick(std::chrono::steady_clock::time_point now) const
+{
+	return now > m_timerWheelStartedAt ? static_cast<uint64_t>((now - m_timerWheelStartedAt) / m_timerWheel->getResolution()) : 0;
+}
+
+void DCFConfigMaster::armTimerWheel(std::chrono::steady_clock::time_point now)
+{
+	m_timerWheelArmedTick = m_timerWheel->getNextExpiry();
+	if (m_timerWheelArmedTick == UINT64_MAX)
+		return;
+
+	// A one-shot timer for the next expiry instead of a periodic tick: no wakeups while the timers are far away.
+	auto expiry = m_timerWheelStartedAt + m_timerWheel->getResolution() * m_timerWheelArmedTick;
+	auto delay = std::max(std::chrono::duration_cast<lely::io::TimerBase::duration>(expiry - now), lely::io::TimerBase::duration(1));
+	m_timerWheelTimer->settime(delay);
+	if (!m_timerWheelWaiting)
+	{
+		m_timerWheelWaiting = true;
+		waitForTimerWheelExpiry();
+	}
+}
+
+void DCFConfigMaster::waitForTimerWheelExpiry()
+{
+	m_timerWheelTimer->submit_wait(m_exec, [this](int /* overrun */, std::error_code ec)
+	{
+		std::lock_guard<std::recursive_mutex> lock(m_timerWheelMutex);
+		m_timerWheelWaiting = false;
+		if (ec)
+			return;  // canceled
+
+		// All ticks up to now, also the ones missed because the executor was busy. The callbacks may start timers.
+		m_timerWheel->advanceTo(getTimerWheelTick(std::chrono::steady_clock::now()));
+		if (!m_timerWheel->empty())
+			armTimerWheel(std::chrono::steady_clock::now());
+	});
+}
+
+void DCFConfigMaster::enableTxScheduling(unsigned sdoFramesPerSecond, unsigned sdoBurst, bool confineToSyncGap)
+{
+	std::lock_guard<lely::util::BasicLockable> lock(*this);
+	m_txScheduler.reset();  // Restores the send function of the network first.
+	m_txScheduler.reset(new CanTxScheduler(net(), [this](std::chrono::microseconds delay)
+	{
+		// Requested while a frame is sent, i.e. with the lock of the master held: the timer is started from the executor.
+		lely::ev::Executor(m_exec).post([this, delay]()
+		{
+			startTimer(std::chrono::duration_cast<std::chrono::milliseconds>(delay + std::chrono::microseconds(999)), [this]()
+			{
+				std::lock_guard<lely::util::BasicLockable> lock(*this);
+				if (m_txScheduler != nullptr)
+					m_txScheduler->release();
+			});
+		});
+	}));
+	m_txScheduler->setSdoRate(sdoFramesPerSecond, sdoBurst);
+	m_confineTxToSyncGap = confineToSyncGap;
+	updateTxScheduling();
+}
+
+void DCFConfigMaster::updateTxScheduling()
+{
+	m_txScheduler->clearMotionCobIDs();
+	for (uint16_t communicationIndex = 0x1800; communicationIndex <= 0x19FF; communicationIndex++)
+	{
+		co_sub_t* cobIDSubObject = co_dev_find_sub(dev(), communicationIndex, 1);
+		if (cobIDSubObject == nullptr)
+			continue;
+		uint32_t cobID = co_sub_get_val_u32(cobIDSubObject);
+		if (!(cobID & 0x80000000))
+			m_txScheduler->addMotionCobID(cobID & 0x3FFFFFFF);
+	}
+
+	co_sub_t* syncCobIDSubObject = co_dev_find_sub(dev(), 0x1005, 0);
+	co_sub_t* periodSubObject = co_dev_find_sub(dev(), 0x1006, 0);
+	co_sub_t* windowLengthSubObject = co_dev_find_sub(dev(), 0x1007, 0);
+	uint32_t syncCobID = syncCobIDSubObject != nullptr ? co_sub_get_val_u32(syncCobIDSubObject) : 0x80;
+	uint32_t period = periodSubObject != nullptr ? co_sub_get_val_u32(periodSubObject) : 0;
+	uint32_t windowLength = windowLengthSubObject != nullptr ? co_sub_get_val_u32(windowLengthSubObject) : 0;
+	bool syncProducer = (syncCobID & 0x40000000) != 0;
+	if (m_confineTxToSyncGap && (!syncProducer || period == 0))
+		diag(DIAG_WARNING, 0, "Non-cyclic frames are not confined to the SYNC gap: the master does not produce the SYNC.");
+
+	// Guard time: the longest frame (8 data bytes with stuff bits, about 160 bits) must not delay the next SYNC.
+	uint32_t bitRate = m_busLoadMonitor != nullptr ? m_busLoadMonitor->getBitRate() : 125000;
+	std::chrono::microseconds guardTime(160ul * 1000000ul / bitRate);
+	m_txScheduler->setSyncGap(syncCobID & 0x7FF, std::chrono::microseconds(m_confineTxToSyncGap && syncProducer ? period : 0),
+							  std::chrono::microseconds(windowLength), guardTime);
+}
+
+void DCFConfigMaster::enableReceiveFilter(BatchedCanChannel &channel)
+{
+	m_receiveFilterChannel = &channel;
+	updateReceiveFilter();
+}
+
+void DCFConfigMaster::updateReceiveFilter()
+{
+	auto cobIDs = getConsumedCobIDs();
+	if (cobIDs.size() > BatchedCanSocket::MAX_FILTERS)
+	{
+		diag(DIAG_WARNING, 0, "The master consumes %zu COB IDs, more than the %zu receive filters of the kernel: all frames are received.",
+			 cobIDs.size(), BatchedCanSocket::MAX_FILTERS);
+		cobIDs.clear();
+	}
+
+	std::error_code error;
+	if (!m_receiveFilterChannel->setReceiveFilter(cobIDs, error))
+		diag(DIAG_WARNING, 0, "Cannot set the receive filter: %s", error.message().c_str());
+	else
+		diag(DIAG_INFO, 0, "Receive filter: %zu COB IDs.", cobIDs.size());
+}
+
+std::vector<uint32_t> DCFConfigMaster::getConsumedCobIDs()
+{
+	std::set<uint32_t> cobIDs;
+	auto addCobID = [&cobIDs](uint32_t cobID)
+	{
+		if (!(cobID & 0x80000000))
+			cobIDs.insert(cobID & ((cobID & 0x20000000) ? 0x3FFFFFFF : 0x7FF));
+	};
+	auto getValue = [this](uint16_t index, uint8_t subIndex, uint32_t defaultValue)
+	{
+		co_sub_t* subObject = co_dev_find_sub(dev(), index, subIndex);
+		return subObject != nullptr ? co_sub_get_val_u32(subObject) : defaultValue;
+	};
+
+	// The PDOs received by the master and the TPDOs which may be requested by a remote frame.
+	for (uint16_t communicationIndex = 0x1400; communicationIndex <= 0x15FF; communicationIndex++)
+		addCobID(getValue(communicationIndex, 1, 0x80000000));
+	for (uint16_t communicationIndex = 0x1800; communicationIndex <= 0x19FF; communicationIndex++)
+	{
+		uint32_t cobID = getValue(communicationIndex, 1, 0x80000000);
+		if (!(cobID & 0x40000000))
+			addCobID(cobID);
+	}
+
+	// The requests to the SDO servers and the responses to the SDO clients of the master.
+	addCobID(0x600 + id());
+	for (uint16_t serverIndex = 0x1201; serverIndex <= 0x127F; serverIndex++)
+		addCobID(getValue(serverIndex, 1, 0x80000000));
+	for (uint16_t clientIndex = 0x1280; clientIndex <= 0x12FF; clientIndex++)
+		addCobID(getValue(clientIndex, 2, 0x80000000));
+
+	// The slaves: the SDO responses of the default SDO server, EMCY, heartbeat, boot-up and node guarding.
+	std::set<uint8_t> nodeIDs;
+	for (const auto& driver : m_drivers)
+		nodeIDs.insert(driver.first);
+	for (uint8_t nodeID = 1; nodeID <= 127; nodeID++)
+	{
+		if (getValue(0x1F81, nodeID, 0) & 0x01)
+			nodeIDs.insert(nodeID);
+	}
+	for (auto nodeID : nodeIDs)
+	{
+		addCobID(0x580 + nodeID);
+		addCobID(getValue(0x1028, nodeID, 0x80 + nodeID));
+		addCobID(0x700 + nodeID);
+	}
+	for (uint8_t subIndex = 1; subIndex <= 127; subIndex++)
+	{
+		uint32_t consumer = getValue(0x1016, subIndex, 0);
+		uint8_t nodeID = (consumer >> 16) & 0x7F;
+		if (nodeID != 0 && (consumer & 0xFFFF) != 0)
+			addCobID(0x700 + nodeID);
+	}
+
+	// SYNC and TIME, if they are consumed and not produced by the master.
+	uint32_t syncCobID = getValue(0x1005, 0, 0x80);
+	if (!(syncCobID & 0x40000000))
+		addCobID(syncCobID & 0x3FFFFFFF);
+	uint32_t timeCobID = getValue(0x1012, 0, 0x100);
+	if ((timeCobID & 0x80000000) && !(timeCobID & 0x40000000))
+		addCobID(timeCobID & 0x3FFFFFFF);
+
+	// The LSS responses, always: the master may switch or configure unconfigured slaves, whose node IDs it does not know.
+	addCobID(0x7E4);
+
+	return std::vector<uint32_t>(cobIDs.begin(), cobIDs.end());
+}
+
+void DCFConfigMaster::enableBusLoadMonitoring(uint32_t bitRate, std::chrono::milliseconds interval)
+{
+	bool started = m_busLoadMonitor != nullptr;
+	m_busLoadMonitor = std::make_shared<BusLoadMonitor>(bitRate);
+	m_busLoadMonitoringInterval = interval;
+	if (m_tpdoRateController != nullptr)
+		m_tpdoRateController->setMonitor(m_busLoadMonitor);
+	if (!started)
+		scheduleBusLoadUpdate();
+}
+
+void DCFConfigMaster::enableTpdoRateControl(const std::vector<TpdoRateController::Limit> &limits, double throttleAbove, double restoreBelow)
+{
+	if (m_busLoadMonitor == nullptr)
+	{
+		diag(DIAG_ERROR, 0, "TPDO rate control needs the bus load monitoring, see enableBusLoadMonitoring().");
+		return;
+	}
+
+	m_tpdoRateController.reset(new TpdoRateController(*this, m_busLoadMonitor));
+	m_tpdoRateController->setThresholds(throttleAbove, restoreBelow);
+	for (const auto& limit : limits)
+		m_tpdoRateController->addLimit(limit);
+}
+
+void DCFConfigMaster::scheduleBusLoadUpdate()
+{
+	SubmitWait(m_busLoadMonitoringInterval, [this](std::error_code ec)
+	{
+		if (ec)
+			return;  // canceled
+
+		{
+			// sendFrame() counts the frames of the drivers on their executors, with the lock of the master.
+			std::lock_guard<lely::util::BasicLockable> lock(*this);
+			m_busLoadMonitor->update();
+		}
+		if (m_tpdoRateController != nullptr)
+			m_tpdoRateController->evaluate();
+		updateHeartbeatProducerTime();
+		scheduleBusLoadUpdate();
+	});
+}
+
+void DCFConfigMaster::enableHeartbeatMonitoring(std::chrono::milliseconds detectionLatency, uint32_t bitRate, double expectedBusLoad)
+{
+	m_heartbeatDetectionLatency = detectionLatency;
+	m_heartbeatBitRate = bitRate;
+	m_expectedBusLoad = expectedBusLoad;
+}
+
+bool DCFConfigMaster::getHeartbeatStatistics(uint8_t nodeID, DCFConfigMaster::HeartbeatStatistics &result) const
+{
+	auto statistics = m_heartbeatStatistics.find(nodeID);
+	if (statistics == m_heartbeatStatistics.end())
+		return false;
+
+	result = statistics->second;
+	return true;
+}
+
+void DCFConfigMaster::backupParameters(DCFConfigMaster::BackupCompletedCallback callback)
+{
+	auto transfer = std::make_shared<ParameterTransfer>();
+	transfer->snapshot = std::make_shared<ParameterSnapshot>();
+	transfer->backupCompletedCallback = callback;
+	for (const auto& driver : m_drivers)
+	{
+		auto& objects = transfer->objectsToRead[driver.first];
+		for (const auto& object : driver.second->getConfig()->getReadableObjects())
+			for (auto subIndex : std::get<1>(object))
+				objects.push_back(std::make_pair(std::get<0>(object), subIndex));
+	}
+
+	transfer->statistics.nodes = transfer->objectsToRead.size();
+	transfer->runningNodes = transfer->objectsToRead.size() + 1;
+	// The SDO requests of the nodes are independent, so all nodes are read at the same time.
+	for (const auto& node : transfer->objectsToRead)
+		backupNextObject(transfer, node.first, 0);
+	onParameterTransferOfNodeCompleted(transfer);  // Completes the transfer if there are no nodes.
+}
+
+void DCFConfigMaster::backupNextObject(std::shared_ptr<DCFConfigMaster::ParameterTransfer> transfer, uint8_t nodeID, size_t position)
+{
+	const auto& objects = transfer->objectsToRead[nodeID];
+	if (position >= objects.size())
+	{
+		onParameterTransferOfNodeCompleted(transfer);
+		return;
+	}
+
+	auto readResultHandler = [this, transfer, nodeID, position](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec, std::vector<uint8_t> value)
+	{
+		if (ec == lely::canopen::SdoErrc::TIMEOUT)
+		{
+			// The node does not answer, do not wait for the timeout of every object.
+			size_t remainingObjects = transfer->objectsToRead[nodeID].size() - position;
+			diag(DIAG_ERROR, 0, "Node 0x%02x: Parameter backup aborted at 0x%04x/0x%02x, %zu objects are missing.", nodeID, idx, subidx, remainingObjects);
+			transfer->statistics.failedObjects += remainingObjects;
+			onParameterTransferOfNodeCompleted(transfer);
+			return;
+		}
+
+		if (ec)
+		{
+			diag(DIAG_WARNING, 0, "Node 0x%02x: Cannot read 0x%04x/0x%02x: %s", nodeID, idx, subidx, ec.message().c_str());
+			transfer->statistics.failedObjects++;
+		}
+		else
+		{
+			transfer->statistics.objects++;
+			transfer->statistics.bytes += value.size();
+			transfer->snapshot->addEntry(nodeID, {idx, subidx, value});
+		}
+		backupNextObject(transfer, nodeID, position + 1);
+	};
+
+	auto driver = getDriver(nodeID);
+	uint16_t index = objects[position].first;
+	uint8_t subIndex = objects[position].second;
+	uint16_t type = driver->getConfig()->getTypeOfObject(index, subIndex);
+	if (type == CO_DEFTYPE_VISIBLE_STRING || type == CO_DEFTYPE_OCTET_STRING || type == CO_DEFTYPE_UNICODE_STRING || type == CO_DEFTYPE_DOMAIN)
+	{
+		// Large objects: block upload, with a fall back to the segmented upload for nodes without block transfer.
+		auto blockReadResultHandler = [driver, readResultHandler](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec, std::vector<uint8_t> value)
+		{
+			if (ec && ec != lely::canopen::SdoErrc::TIMEOUT)
+			{
+				try
+				{
+					driver->SubmitRead<std::vector<uint8_t>>(idx, subidx, readResultHandler);
+				}
+				catch (const std::system_error& error)
+				{
+					readResultHandler(id, idx, subidx, error.code(), std::vector<uint8_t>());
+				}
+			}
+			else
+			{
+				readResultHandler(id, idx, subidx, ec, value);
+			}
+		};
+		// lely throws if e.g. the SDO client of the node is missing, this is reported like a failed read.
+		try
+		{
+			driver->SubmitBlockRead<std::vector<uint8_t>>(index, subIndex, blockReadResultHandler, GetTimeout());
+		}
+		catch (const std::system_error& error)
+		{
+			readResultHandler(nodeID, index, subIndex, error.code(), std::vector<uint8_t>());
+		}
+	}
+	else
+	{
+		try
+		{
+			driver->SubmitRead<std::vector<uint8_t>>(index, subIndex, readResultHandler);
+		}
+		catch (const std::system_error& error)
+		{
+			readResultHandler(nodeID, index, subIndex, error.code(), std::vector<uint8_t>());
+		}
+	}
+}
+
+void DCFConfigMaster::restoreParameters(std::shared_ptr<const ParameterSnapshot> snapshot, bool onlyDifferences, DCFConfigMaster::RestoreCompletedCallback callback)
+{
+	auto transfer = std::make_shared<ParameterTransfer>();
+	transfer->restoreCompletedCallback = callback;
+	transfer->runningNodes = 1;
+	for (const auto& node : snapshot->getNodes())
+	{
+		auto driver = getDriver(node.first);
+		if (driver == nullptr)
+		{
+			diag(DIAG_WARNING, 0, "Node 0x%02x: Parameter restore skipped, the node is not configured.", node.first);
+			continue;
+		}
+
+		auto entries = snapshot->getRestorableEntries(node.first, *driver->getConfig(), onlyDifferences);
+		if (entries.empty())
+			continue;
+
+		size_t bytes = 0;
+		for (const auto& entry : entries)
+			bytes += entry.data.size();
+		transfer->statistics.nodes++;
+		transfer->runningNodes++;
+
+		// The same transfer as used for the binary DCFs during the configuration (see DCFDriver::writeBinaryDcf()). The captured buffer stays alive until the end of it.
+		auto dcf = std::make_shared<std::vector<uint8_t>>(ParameterSnapshot::toConciseDcf(entries));
+		size_t numberOfEntries = entries.size();
+		auto writeResultHandler = [this, transfer, dcf, numberOfEntries, bytes](uint8_t id, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+		{
+			if (ec)
+			{
+				diag(DIAG_ERROR, 0, "Node 0x%02x: Parameter restore failed at 0x%04x/0x%02x: %s", id, idx, subidx, ec.message().c_str());
+				transfer->statistics.failedObjects += numberOfEntries;
+				if (!transfer->error)
+					transfer->error = ec;
+			}
+			else
+			{
+				transfer->statistics.objects += numberOfEntries;
+				transfer->statistics.bytes += bytes;
+			}
+			onParameterTransferOfNodeCompleted(transfer);
+		};
+		try
+		{
+			driver->SubmitWriteDcf(dcf->data(), dcf->data() + dcf->size(), writeResultHandler);
+		}
+		catch (const std::system_error& error)
+		{
+			writeResultHandler(node.first, 0, 0, error.code());
+		}
+	}
+	onParameterTransferOfNodeCompleted(transfer);  // Completes the transfer if there is nothing to write.
+}
+
+std::future<std::vector<SdoReadBatch::Result>> DCFConfigMaster::submitReads(const std::vector<SdoReadBatch::Request> &requests, size_t maxConcurrentRequests,
+																			SdoReadBatch::CompletedCallback callback)
+{
+	// The batch keeps itself alive through the SDO confirmations.
+	return std::make_shared<SdoReadBatch>(*this, requests, maxConcurrentRequests, callback)->start();
+}
+
+void DCFConfigMaster::onParameterTransferOfNodeCompleted(std::shared_ptr<DCFConfigMaster::ParameterTransfer> transfer)
+{
+	if (--transfer->runningNodes > 0)
+		return;
+
+	auto& statistics = transfer->statistics;
+	statistics.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - transfer->startedAt);
+	diag(DIAG_INFO, 0, "Parameter %s of %zu nodes: %zu objects (%zu bytes, %zu failed) in %d ms, %.1f bytes/s.",
+		 transfer->snapshot != nullptr ? "backup" : "restore", statistics.nodes, statistics.objects, statistics.bytes, statistics.failedObjects,
+		 static_cast<int>(statistics.duration.count()), statistics.getThroughput());
+
+	if (transfer->backupCompletedCallback != nullptr)
+		transfer->backupCompletedCallback(transfer->snapshot, statistics);
+	if (transfer->restoreCompletedCallback != nullptr)
+		transfer->restoreCompletedCallback(transfer->error, statistics);
+}
+
+void DCFConfigMaster::configureHeartbeatConsumers()
+{
+	if (m_heartbeatDetectionLatency.count() <= 0 || m_heartbeatDetectionLatency.count() > 0xFFFF)
+		return;
+
+	// The consumer time is the detection latency, the producer time leaves the margin (see calculateHeartbeatProducerTime()).
+	uint16_t consumerTime = static_cast<uint16_t>(m_heartbeatDetectionLatency.count());
+	double busLoad;
+	m_heartbeatProducerTime = calculateHeartbeatProducerTime(busLoad);
+	diag(DIAG_INFO, 0, "Heartbeat monitoring: producer time %d ms, consumer time %d ms, bus load %.0f %%.", m_heartbeatProducerTime, consumerTime, busLoad * 100);
+
+	// The services are not running yet (configureDrivers() is called before the NMT reset), so the values are set directly.
+	co_dev_t* od = dev();
+	co_sub_t* numberOfEntries = findOrCreateSubObject(od, 0x1016, 0, CO_DEFTYPE_UNSIGNED8, CO_OBJECT_ARRAY, false);
+	if (numberOfEntries == nullptr)
+	{
+		diag(DIAG_ERROR, 0, "Cannot create the heartbeat consumer object 0x1016.");
+		return;
+	}
+
+	for (const auto& driver : m_drivers)
+	{
+		uint8_t nodeID = driver.first;
+		uint8_t highestSubIndex = co_sub_get_val_u8(numberOfEntries);
+		uint8_t subIndex = highestSubIndex + 1;
+		for (uint8_t i = 1; i <= highestSubIndex; i++)
+		{
+			co_sub_t* entry = co_dev_find_sub(od, 0x1016, i);
+			if (entry != nullptr && ((co_sub_get_val_u32(entry) >> 16) & 0x7F) == nodeID)
+			{
+				subIndex = i;  // Reuse the entry of the DCF.
+				break;
+			}
+		}
+
+		co_sub_t* entry = findOrCreateSubObject(od, 0x1016, subIndex, CO_DEFTYPE_UNSIGNED32, CO_OBJECT_ARRAY, false);
+		if (entry == nullptr)
+		{
+			diag(DIAG_ERROR, 0, "Node 0x%02x: Cannot create the heartbeat consumer entry 0x1016/0x%02x.", nodeID, subIndex);
+			continue;
+		}
+		co_sub_set_val_u32(entry, (static_cast<uint32_t>(nodeID) << 16) | consumerTime);
+
+		// Track the heartbeats to measure the jitter of the consumer timeout.
+		if (m_heartbeatReceivers.find(nodeID) == m_heartbeatReceivers.end())
+		{
+			std::shared_ptr<can_recv_t> receiver(can_recv_create(), can_recv_destroy);
+			if (receiver == nullptr)
+				continue;
+			can_recv_set_func(receiver.get(), &DCFConfigMaster::onHeartbeatMessage, this);
+			can_recv_start(receiver.get(), net(), 0x700 + nodeID, 0);
+			m_heartbeatReceivers[nodeID] = receiver;
+		}
+	}
+}
+
+uint16_t DCFConfigMaster::calculateHeartbeatProducerTime(double &busLoad) const
+{
+	// The consumer reports the loss after the consumer time has elapsed since the last heartbeat, so the consumer time is the detection latency.
+	// The producer has to send early enough that a heartbeat still arrives in time when it is delayed by the other traffic:
+	// in the worst case it has to wait for a frame of 8 bytes and for the rest of the load on the bus.
+	int consumerTime = static_cast<int>(m_heartbeatDetectionLatency.count());
+	busLoad = m_busLoadMonitor != nullptr ? std::max(m_expectedBusLoad, m_busLoadMonitor->getBusLoad()) : m_expectedBusLoad;
+	busLoad = std::min(std::max(busLoad, 0.0), 0.95);
+	double worstCaseDelayMs = (BusLoadAnalyzer::getFrameTime(m_heartbeatBitRate, 8, false) + BusLoadAnalyzer::getFrameTime(m_heartbeatBitRate, 1, false)) * 1000.0 / (1.0 - busLoad);
+	// The timers of the slaves are not exact either.
+	double marginMs = std::max(worstCaseDelayMs, consumerTime / 10.0);
+	int producerTime = consumerTime - static_cast<int>(std::ceil(marginMs));
+	if (producerTime < 1)
+	{
+		diag(DIAG_WARNING, 0, "The heartbeat detection latency of %d ms is too short for a bus load of %.0f %%.", consumerTime, busLoad * 100);
+		producerTime = 1;
+	}
+	return static_cast<uint16_t>(producerTime);
+}
+
+void DCFConfigMaster::updateHeartbeatProducerTime()
+{
+	if (m_heartbeatProducerTime == 0)
+		return;
+
+	// Shortened at once when the load rises, lengthened only by a clear step, so a fluctuating load does not cause SDO traffic.
+	double busLoad;
+	uint16_t producerTime = calculateHeartbeatProducerTime(busLoad);
+	if (producerTime >= m_heartbeatProducerTime && producerTime < m_heartbeatProducerTime * 5 / 4)
+		return;
+
+	diag(DIAG_INFO, 0, "Bus load %.0f %%: heartbeat producer time %d ms --> %d ms.", busLoad * 100, m_heartbeatProducerTime, producerTime);
+	m_heartbeatProducerTime = producerTime;
+	for (const auto& driver : m_drivers)
+	{
+		try
+		{
+			SubmitWrite<uint16_t>(driver.first, 0x1017, 0, static_cast<uint16_t>(producerTime), [](uint8_t id, uint16_t, uint8_t, std::error_code ec)
+			{
+				if (ec)
+					diag(DIAG_WARNING, 0, "Node 0x%02x: Cannot update the heartbeat producer time: %s", id, ec.message().c_str());
+			});
+		}
+		catch (const std::system_error& error)
+		{
+			// The node is not configured yet, it gets the new time with its configuration (see DCFDriver).
+			diag(DIAG_INFO, 0, "Node 0x%02x: The heartbeat producer time is written with the configuration: %s", driver.first, error.what());
+		}
+	}
+}
+
+int DCFConfigMaster::onHeartbeatMessage(const can_msg *msg, void *data)
+{
+	auto* self = static_cast<DCFConfigMaster*>(data);
+	self->m_lastHeartbeats[msg->id & 0x7F] = std::chrono::steady_clock::now();
+	return 0;
+}
+
+void DCFConfigMaster::subscribeMasterObject(DCFDriver *driver, uint16_t index, uint8_t subIndex)
+{
+	// Called in OnConfig() of the driver, which may run on a strand: the subscribers are only changed on the executor of the master,
+	// where forwardMasterObjectChange() iterates them. Until then the driver still gets all changes.
+	auto subscribe = [this, driver, index, subIndex]()
+	{
+		m_masterObjectSubscribers[(static_cast<uint32_t>(index) << 8) | subIndex].insert(driver);
+		m_broadcastDrivers.erase(driver->id());
+	};
+
+	if (static_cast<ev_exec_t*>(driver->GetExecutor()) == m_exec)
+		subscribe();
+	else
+		lely::ev::Executor(m_exec).post(subscribe);
+}
+
+void DCFConfigMaster::forwardMasterObjectChange(uint16_t index, uint8_t subIndex)
+{
+	auto subscribers = m_masterObjectSubscribers.find((static_cast<uint32_t>(index) << 8) | subIndex);
+	if (subscribers != m_masterObjectSubscribers.end())
+	{
+		for (auto* driver : subscribers->second)
+			runOnDriverExecutor(*driver, [driver, index, subIndex]() {driver->onMasterSDOChanged(index, subIndex);});
+	}
+
+	for (auto& driver : m_broadcastDrivers)
+	{
+		DCFDriver* dcfDriver = driver.second;
+		runOnDriverExecutor(*dcfDriver, [dcfDriver, index, subIndex]() {dcfDriver->onMasterSDOChanged(index, subIndex);});
+	}
+}
+
+void DCFConfigMaster::runOnDriverExecutor(DCFDriver &driver, std::function<void()> task)
+{
+	// The drivers on the executor of the master are called directly, as before; the others are not called concurrently to their strand.
+	if (static_cast<ev_exec_t*>(driver.GetExecutor()) == m_exec)
+		task();
+	else
+		lely::ev::Executor(driver.GetExecutor()).post(std::move(task));
+}
+
+void DCFConfigMaster::collectRpdoMappedObjects()
+{
+	m_rpdoMappedObjects.clear();
+	for (uint16_t mappingIndex = 0x1600; mappingIndex <= 0x17FF; mappingIndex++)
+	{
+		co_sub_t* numberOfMappings = co_dev_find_sub(dev(), mappingIndex, 0);
+		if (numberOfMappings == nullptr)
+			continue;
+
+		for (uint8_t subIndex = 1; subIndex <= co_sub_get_val_u8(numberOfMappings); subIndex++)
+		{
+			co_sub_t* mapping = co_dev_find_sub(dev(), mappingIndex, subIndex);
+			if (mapping != nullptr)
+				m_rpdoMappedObjects.insert(co_sub_get_val_u32(mapping) >> 8);  // index << 8 | sub index
+		}
+	}
+}
+
+uint32_t DCFConfigMaster::getPdoCobID(uint16_t communicationIndex)
+{
+	co_sub_t* cobIDSubObject = co_dev_find_sub(dev(), communicationIndex, 1);
+	return cobIDSubObject != nullptr ? co_sub_get_val_u32(cobIDSubObject) & 0x1FFFFFFF : 0;
+}
+
+void DCFConfigMaster::buildAxisTable()
+{
+	m_axisTable.clear();
+	m_axisTableSources.clear();
+	for (const auto& driver : m_drivers)
+	{
+		uint8_t nodeID = driver.first;
+		MappedMasterObject statusWord;
+		if (!getMappedMasterObject(nodeID, 0x6041, 0, statusWord) || statusWord.tpdo >= 0)
+		{
+			// E.g. a binary DCF generated by dcfgen: the master objects of the status word are not known here.
+			if (dynamic_cast<MotorDriver*>(driver.second.get()) != nullptr)
+			{
+				m_axisTable.addAxis(nodeID);
+				diag(DIAG_WARNING, 0, "Node 0x%02x: The status word is not received by a generated master PDO, the axis table is updated by the driver.", nodeID);
+			}
+			continue;
+		}
+
+		size_t slot = m_axisTable.addAxis(nodeID);
+		AxisTableSource source = {slot, 0x6041, ObjectHandle<uint16_t>(dev(), statusWord.index, statusWord.subIndex), ObjectHandle<int32_t>()};
+		m_axisTableSources[(static_cast<uint32_t>(statusWord.index) << 8) | statusWord.subIndex] = source;
+
+		// The position actual value and the following error.
+		for (uint16_t slaveIndex : {0x6064, 0x60F4})
+		{
+			MappedMasterObject object;
+			if (getMappedMasterObject(nodeID, slaveIndex, 0, object) && object.tpdo < 0)
+			{
+				source = {slot, slaveIndex, ObjectHandle<uint16_t>(), ObjectHandle<int32_t>(dev(), object.index, object.subIndex)};
+				m_axisTableSources[(static_cast<uint32_t>(object.index) << 8) | object.subIndex] = source;
+			}
+		}
+	}
+	diag(DIAG_INFO, 0, "The axis table contains %u axes.", static_cast<unsigned>(m_axisTable.size()));
+}
+
+void DCFConfigMaster::updateAxisStatusWord(uint8_t nodeID, uint16_t statusWord)
+{
+	auto update = [this, nodeID, statusWord]()
+	{
+		size_t slot = m_axisTable.getSlot(nodeID);
+		if (slot != AxisTable::INVALID_SLOT)
+			m_axisTable.setStatusWord(slot, statusWord);
+	};
+
+	// Directly for the drivers on the executor of the master, without allocating a task.
+	auto driver = m_drivers.find(nodeID);
+	if (driver != m_drivers.end() && static_cast<ev_exec_t*>(driver->second->GetExecutor()) == m_exec)
+		update();
+	else
+		lely::ev::Executor(m_exec).post(update);
+}
+
+void DCFConfigMaster::updateAxisTable(uint16_t index, uint8_t subIndex)
+{
+	auto source = m_axisTableSources.find((static_cast<uint32_t>(index) << 8) | subIndex);
+	if (source == m_axisTableSources.end())
+		return;
+
+	const auto& column = source->second;
+	if (column.statusWord.isValid())
+		m_axisTable.setStatusWord(column.slot, column.statusWord.read());
+	else if (column.value.isValid() && column.slaveIndex == 0x6064)
+		m_axisTable.setPosition(column.slot, column.value.read());
+	else if (column.value.isValid())
+		m_axisTable.setFollowingError(column.slot, column.value.read());
+}
+
 void DCFConfigMaster::initializeDevicesFromTextualDCF()
 {
 	for (uint8_t subIndex = 1; subIndex <= 127; subIndex++)
@@ -171,6 +1174,9 @@ void DCFConfigMaster::initializeDevicesFromTextualDCF()
 				if (m_loadConfigStartedCallback != nullptr)
 					m_loadConfigStartedCallback(subIndex);
 				auto driverConfig = std::make_shared<DCFDriverConfig>(filename, /* binary DCF */ "", subIndex);
+				// Before the factory is called, so the driver can use the mapping. Without the automatic mapping, the master objects
+				// are only derived from the PDOs of the master.dcf (e.g. to find the status word, see MotorDriver::OnConfig()).
+				generatePdoMapping(*driverConfig, m_automaticPdoMapping);
 				registerDriver(m_driverFactory(driverConfig));
 			}
 		}
@@ -197,6 +1203,7 @@ void DCFConfigMaster::initializeDevicesForBinaryDCF()
 				if (m_loadConfigStartedCallback != nullptr)
 					m_loadConfigStartedCallback(subIndex);
 				auto driverConfig = std::make_shared<DCFDriverConfig>("dummy.dcf", filename, subIndex);
+				assignBinaryDcfImage(driverConfig, filename);
 				registerDriver(m_driverFactory(driverConfig));
 			}
 		}
@@ -207,3 +1214,198 @@ void DCFConfigMaster::initializeDevicesForBinaryDCF()
 	}
 }
 
+void DCFConfigMaster::assignBinaryDcfImage(std::shared_ptr<DCFDriverConfig> driverConfig, const std::string &filename)
+{
+	std::error_code error;
+	auto image = ConciseDcfImage::load(filename, error);
+	if (image == nullptr)
+	{
+		diag(DIAG_WARNING, 0, "Cannot map binary slave DCF %s (%s), it is read from disk on each configuration.", filename.c_str(), error.message().c_str());
+		return;
+	}
+
+	// Share the image of another node if it only differs in the node ID dependent COB IDs.
+	uint8_t nodeID = driverConfig->getDefaultNodeID();
+	for (const auto& loadedImage : m_binaryDcfImages)
+	{
+		if (loadedImage.second != image && loadedImage.second->isEquivalentFor(loadedImage.first, *image, nodeID))
+		{
+			diag(DIAG_INFO, 0, "0x1F22:0x%02x: Sharing the binary DCF image of node 0x%02x (%s).", nodeID, loadedImage.first, loadedImage.second->getFileName().c_str());
+			driverConfig->setBinaryDcfImage(loadedImage.second, loadedImage.first);
+			return;
+		}
+	}
+
+	m_binaryDcfImages.push_back(std::make_pair(nodeID, image));
+	driverConfig->setBinaryDcfImage(image, nodeID);
+}
+
+void DCFConfigMaster::generatePdoMapping(const DCFDriverConfig &driverConfig, bool createMissingPdos)
+{
+	// The RPDOs of the slave are transmitted by the master and vice versa.
+	for (const auto& slavePdo : driverConfig.getRpdoConfigs())
+		generateMasterPdo(driverConfig, slavePdo, /* masterTransmits = */ true, createMissingPdos);
+	for (const auto& slavePdo : driverConfig.getTpdoConfigs())
+		generateMasterPdo(driverConfig, slavePdo, /* masterTransmits = */ false, createMissingPdos);
+}
+
+void DCFConfigMaster::generateMasterPdo(const DCFDriverConfig &driverConfig, const DCFDriverConfig::PdoConfig &slavePdo, bool masterTransmits, bool createMissingPdo)
+{
+	if (!slavePdo.isValid() || slavePdo.mapping.empty())
+		return;
+
+	co_dev_t* od = dev();
+	uint8_t nodeID = driverConfig.getDefaultNodeID();
+	uint16_t firstCommunicationIndex = masterTransmits ? 0x1800 : 0x1400;
+	uint32_t cobID = slavePdo.cobID & 0x3FFFFFFF;  // without the valid bit, with the frame bit.
+
+	// 1) Find a master PDO which already uses the COB ID (hand written in master.dcf or generated for a node which follows another node).
+	int existingPdo = -1;
+	int freePdo = -1;
+	for (int pdo = 0; pdo < 512 && existingPdo < 0; pdo++)
+	{
+		uint16_t communicationIndex = firstCommunicationIndex + pdo;
+		co_sub_t* cobIDSubObject = co_dev_find_sub(od, communicationIndex, 1);
+		if (cobIDSubObject == nullptr)
+		{
+			if (freePdo < 0 && co_dev_find_obj(od, communicationIndex) == nullptr)
+				freePdo = pdo;
+			continue;
+		}
+
+		uint32_t masterCobID = co_sub_get_val_u32(cobIDSubObject);
+		co_sub_t* numberOfMappings = co_dev_find_sub(od, communicationIndex + 0x200, 0);
+		if (!(masterCobID & 0x80000000) && (masterCobID & 0x3FFFFFFF) == cobID)
+			existingPdo = pdo;
+		else if (freePdo < 0 && (masterCobID & 0x80000000) && (numberOfMappings == nullptr || co_sub_get_val_u8(numberOfMappings) == 0))
+			freePdo = pdo;  // Unused (invalid and unmapped) PDO of the master.dcf.
+	}
+
+	if (existingPdo >= 0)
+	{
+		// 2a) Derive the master objects from the existing mapping. Merged only if the whole PDO matches, a partial mapping would be wrong.
+		uint16_t mappingIndex = firstCommunicationIndex + 0x200 + existingPdo;
+		co_sub_t* numberOfMappings = co_dev_find_sub(od, mappingIndex, 0);
+		size_t masterEntries = numberOfMappings != nullptr ? co_sub_get_val_u8(numberOfMappings) : 0;
+		if (masterEntries != slavePdo.mapping.size())
+		{
+			diag(DIAG_WARNING, 0, "Node 0x%02x: PDO 0x%04x (COB ID 0x%x) maps %zu objects, the master PDO 0x%04x maps %zu.",
+				 nodeID, slavePdo.communicationIndex, cobID, slavePdo.mapping.size(), firstCommunicationIndex + existingPdo, masterEntries);
+			return;
+		}
+		std::map<uint32_t, MappedMasterObject> existingMappedObjects;
+		for (size_t i = 0; i < slavePdo.mapping.size(); i++)
+		{
+			co_sub_t* masterMappingSubObject = co_dev_find_sub(od, mappingIndex, i + 1);
+			uint32_t slaveMapping = slavePdo.mapping[i];
+			uint32_t masterMapping = masterMappingSubObject != nullptr ? co_sub_get_val_u32(masterMappingSubObject) : 0;
+			if ((masterMapping & 0xFF) != (slaveMapping & 0xFF))
+			{
+				diag(DIAG_WARNING, 0, "Node 0x%02x: PDO 0x%04x (COB ID 0x%x) entry %zu: the master mapping 0x%08x does not match 0x%08x.",
+					 nodeID, slavePdo.communicationIndex, cobID, i + 1, masterMapping, slaveMapping);
+				return;
+			}
+			MappedMasterObject masterObject = {static_cast<uint16_t>(masterMapping >> 16), static_cast<uint8_t>(masterMapping >> 8), masterTransmits ? existingPdo + 1 : -1};
+			existingMappedObjects[slaveMapping >> 8] = masterObject;
+		}
+		for (const auto& object : existingMappedObjects)
+			m_mappedMasterObjects[nodeID][object.first] = object.second;
+		diag(DIAG_INFO, 0, "Node 0x%02x: PDO 0x%04x (COB ID 0x%x) uses the master PDO 0x%04x.", nodeID, slavePdo.communicationIndex, cobID, firstCommunicationIndex + existingPdo);
+		return;
+	}
+
+	if (!createMissingPdo)
+		return;
+	if (freePdo < 0)
+	{
+		diag(DIAG_ERROR, 0, "Node 0x%02x: No free master PDO left for PDO 0x%04x (COB ID 0x%x).", nodeID, slavePdo.communicationIndex, cobID);
+		return;
+	}
+
+	// 2b) Create one array per slave object on the master (sub index = node ID) and map it.
+	// The whole PDO is checked first, so a failure leaves no objects behind.
+	uint16_t communicationIndex = firstCommunicationIndex + freePdo;
+	uint16_t mappingIndex = communicationIndex + 0x200;
+	std::vector<uint16_t> masterTypes;
+	std::vector<uint32_t> masterMappings;
+	std::map<uint32_t, MappedMasterObject> newMappedObjects;
+	for (auto slaveMapping : slavePdo.mapping)
+	{
+		uint16_t slaveIndex = slaveMapping >> 16;
+		uint8_t slaveSubIndex = (slaveMapping >> 8) & 0xFF;
+		uint16_t type = driverConfig.getTypeOfObject(slaveIndex, slaveSubIndex);
+		uint16_t masterIndex = getGeneratedMasterObjectIndex(slaveIndex, slaveSubIndex, masterTransmits);
+		if (type == 0 || masterIndex == 0 || !canCreateSubObject(od, masterIndex, nodeID, type) || !canCreateSubObject(od, masterIndex, 0, CO_DEFTYPE_UNSIGNED8))
+		{
+			diag(DIAG_ERROR, 0, "Node 0x%02x: Cannot create the master object for 0x%04x/0x%02x.", nodeID, slaveIndex, slaveSubIndex);
+			return;
+		}
+		masterTypes.push_back(type);
+		masterMappings.push_back((static_cast<uint32_t>(masterIndex) << 16) | (static_cast<uint32_t>(nodeID) << 8) | (slaveMapping & 0xFF));
+		MappedMasterObject masterObject = {masterIndex, nodeID, masterTransmits ? freePdo + 1 : -1};
+		newMappedObjects[slaveMapping >> 8] = masterObject;
+	}
+	bool canCreatePdo = canCreateSubObject(od, communicationIndex, 0, CO_DEFTYPE_UNSIGNED8) && canCreateSubObject(od, communicationIndex, 1, CO_DEFTYPE_UNSIGNED32)
+			&& canCreateSubObject(od, communicationIndex, 2, CO_DEFTYPE_UNSIGNED8) && canCreateSubObject(od, mappingIndex, 0, CO_DEFTYPE_UNSIGNED8);
+	for (size_t i = 0; i < masterMappings.size(); i++)
+		canCreatePdo = canCreatePdo && canCreateSubObject(od, mappingIndex, i + 1, CO_DEFTYPE_UNSIGNED32);
+	if (!canCreatePdo)
+	{
+		diag(DIAG_ERROR, 0, "Node 0x%02x: Cannot create the master PDO 0x%04x.", nodeID, communicationIndex);
+		return;
+	}
+
+	for (size_t i = 0; i < masterMappings.size(); i++)
+	{
+		if (findOrCreateSubObject(od, masterMappings[i] >> 16, nodeID, masterTypes[i], CO_OBJECT_ARRAY, true) == nullptr)
+		{
+			diag(DIAG_ERROR, 0, "Node 0x%02x: Cannot create the master object 0x%04x/0x%02x.", nodeID, masterMappings[i] >> 16, nodeID);
+			return;
+		}
+	}
+
+	co_sub_t* cobIDSubObject = findOrCreateSubObject(od, communicationIndex, 1, CO_DEFTYPE_UNSIGNED32, CO_OBJECT_RECORD, false);
+	co_sub_t* transmissionTypeSubObject = findOrCreateSubObject(od, communicationIndex, 2, CO_DEFTYPE_UNSIGNED8, CO_OBJECT_RECORD, false);
+	co_sub_t* numberOfMappings = findOrCreateSubObject(od, mappingIndex, 0, CO_DEFTYPE_UNSIGNED8, CO_OBJECT_RECORD, false);
+	if (cobIDSubObject == nullptr || transmissionTypeSubObject == nullptr || numberOfMappings == nullptr)
+	{
+		diag(DIAG_ERROR, 0, "Node 0x%02x: Cannot create the master PDO 0x%04x.", nodeID, communicationIndex);
+		return;
+	}
+
+	// The services are not running yet (configureDrivers() is called before the NMT reset), so the values are set directly.
+	co_sub_set_val_u8(numberOfMappings, 0);
+	for (size_t i = 0; i < masterMappings.size(); i++)
+	{
+		co_sub_t* mappingSubObject = findOrCreateSubObject(od, mappingIndex, i + 1, CO_DEFTYPE_UNSIGNED32, CO_OBJECT_RECORD, false);
+		if (mappingSubObject == nullptr)
+			return;
+		co_sub_set_val_u32(mappingSubObject, masterMappings[i]);
+	}
+	co_sub_set_val_u8(numberOfMappings, masterMappings.size());
+	co_sub_set_val_u8(transmissionTypeSubObject, 0xFE);  // event driven (manufacturer specific): sent by TpdoEvent() / processed on reception
+	co_sub_set_val_u32(cobIDSubObject, cobID);
+
+	m_mappedMasterObjects[nodeID].insert(newMappedObjects.begin(), newMappedObjects.end());
+	diag(DIAG_INFO, 0, "Node 0x%02x: Generated master PDO 0x%04x (COB ID 0x%x) for PDO 0x%04x with %zu objects.",
+		 nodeID, communicationIndex, cobID, slavePdo.communicationIndex, masterMappings.size());
+}
+
+uint16_t DCFConfigMaster::getGeneratedMasterObjectIndex(uint16_t slaveIndex, uint8_t slaveSubIndex, bool masterTransmits)
+{
+	uint32_t key = (masterTransmits ? 0x1000000 : 0) | (static_cast<uint32_t>(slaveIndex) << 8) | slaveSubIndex;
+	auto generatedIndex = m_generatedMasterObjectIndices.find(key);
+	if (generatedIndex != m_generatedMasterObjectIndices.end())
+		return generatedIndex->second;
+
+	// Outputs are allocated from 0x2000, inputs from 0x2010 upwards (see doc/manual-PDO-mapping-example.md), existing objects are skipped.
+	uint16_t& nextIndex = masterTransmits ? m_nextGeneratedOutputIndex : m_nextGeneratedInputIndex;
+	uint16_t lastIndex = masterTransmits ? 0x200F : 0x201F;
+	while (nextIndex <= lastIndex && co_dev_find_obj(dev(), nextIndex) != nullptr)
+		nextIndex++;
+	if (nextIndex > lastIndex)
+		return 0;
+
+	m_generatedMasterObjectIndices[key] = nextIndex;
+	return nextIndex++;
+}
@@ -39,43 +39,223 @@ DCFDriver::DCFDriver(ev_exec_t *exec, lely::canopen::BasicMaster &m, std::shared
 	lely::canopen::BasicDriver(exec, m, config->getDefaultNodeID()),  // the node ID of master.dcf always wins since we reuse the DCF for multiple drivers and our tooling wants to set explicitely the Node ID in the DCF.
 	m_followingNodeID(0),
 	m_followsNodeID(0),
-	m_emergencyOccured(false)
+	m_emergencyOccured(false),
+	m_heartbeatLost(false),
+	m_sdoRequestPool(dynamic_cast<DCFConfigMaster*>(&m), exec, config->getDefaultNodeID()),
+	m_rpdoFramesAreFlushed(dynamic_cast<DCFConfigMaster*>(&m) != nullptr)
 {
 	m_config = config;
 	m_sdosToConfigure = m_config->getSDOIndicesForDriverConfiguration();
+	m_sdoRequestPool.setWriteRetryHandler([this](unsigned attempt, std::error_code error, std::function<void()> retry)
+	{
+		return retrySdo(SdoTimeoutPolicy::MOTION, attempt, error, std::move(retry));
+	});
+}
+
+bool DCFDriver::findMappedMasterObject(uint8_t nodeID, uint16_t slaveIndex, uint8_t slaveSubIndex, uint16_t &masterIndex, uint8_t &masterSubIndex, int &tpdo) const
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	DCFConfigMaster::MappedMasterObject masterObject;
+	if (dcfConfigMaster == nullptr || !dcfConfigMaster->getMappedMasterObject(nodeID, slaveIndex, slaveSubIndex, masterObject))
+		return false;
+
+	masterIndex = masterObject.index;
+	masterSubIndex = masterObject.subIndex;
+	tpdo = masterObject.tpdo;
+	return true;
+}
+
+void DCFDriver::subscribeMasterObject(uint16_t masterIndex, uint8_t masterSubIndex)
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster != nullptr)
+		dcfConfigMaster->subscribeMasterObject(this, masterIndex, masterSubIndex);
+}
+
+std::chrono::milliseconds DCFDriver::getSdoTimeout(SdoTimeoutPolicy::RequestClass requestClass) const
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	return dcfConfigMaster != nullptr ? dcfConfigMaster->getSdoTimeout(id(), requestClass) : master.GetTimeout();
+}
+
+void DCFDriver::recordSdoResult(std::chrono::steady_clock::time_point submitted, std::error_code error)
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster != nullptr)
+		dcfConfigMaster->getSdoTimeoutPolicy().addResult(id(), submitted, error);
+}
+
+bool DCFDriver::retrySdo(SdoTimeoutPolicy::RequestClass requestClass, unsigned attempt, std::error_code error, std::function<void ()> retry)
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster == nullptr || !dcfConfigMaster->getSdoTimeoutPolicy().shouldRetry(id(), requestClass, attempt, error))
+		return false;
+
+	auto delay = dcfConfigMaster->getSdoTimeoutPolicy().getRetryPolicy(requestClass).retryDelay;
+	diag(DIAG_INFO, 0, "Node 0x%02x: Retry %u of an SDO request in %d ms: %s", id(), attempt + 1, static_cast<int>(delay.count()), error.message().c_str());
+	if (delay.count() > 0)
+		startTimer(delay, retry);
+	else
+		retry();
+	return true;
+}
+
+TimerWheel::TimerID DCFDriver::startTimer(std::chrono::milliseconds delay, std::function<void ()> callback)
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster != nullptr)
+	{
+		// The timers expire on the executor of the master, the callback belongs on the executor of the driver.
+		ev_exec_t* exec = GetExecutor();
+		if (exec != dcfConfigMaster->getExecutor())
+			return dcfConfigMaster->startTimer(delay, [exec, callback]() {lely::ev::Executor(exec).post(callback);});
+		return dcfConfigMaster->startTimer(delay, std::move(callback));
+	}
+
+	SubmitWait(delay, [callback](std::error_code ec)
+	{
+		if (!ec)
+			callback();
+	});
+	return TimerWheel::INVALID_TIMER;
+}
+
+bool DCFDriver::cancelTimer(TimerWheel::TimerID id)
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	return dcfConfigMaster != nullptr && dcfConfigMaster->cancelTimer(id);
+}
+
+std::unique_lock<lely::util::BasicLockable> DCFDriver::lockMasterObjects()
+{
+	// On the executor of the master the driver does not run concurrently to it; the handles are only valid with a DCFConfigMaster.
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster == nullptr || static_cast<ev_exec_t*>(GetExecutor()) == dcfConfigMaster->getExecutor())
+		return std::unique_lock<lely::util::BasicLockable>();
+	return dcfConfigMaster->lockObjectDictionary();
+}
+
+co_dev_t *DCFDriver::getMasterObjectDictionary() const
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	return dcfConfigMaster != nullptr ? dcfConfigMaster->getObjectDictionary() : nullptr;
 }
 
 void DCFDriver::OnConfig(::std::function<void (std::error_code)> res) noexcept
 {
+	// The node was reset and OnBoot() is called after the configuration, so the values of the previous session must not be used by it.
+	m_remoteObjectCache.clear();
+	resolveCachedRpdoObjects();
 	if (!m_config->getBinaryDcfFile().empty())
 		configureFollowerRelationship();
 
+	auto configureAll = [res,this]()
+	{
+		configure([res,this](std::error_code error)
+		{
+			if (error)
+			{
+				res(error);
+				return;
+			}
+			writeBinaryDcf([res,this](std::error_code error)
+			{
+				if (!error)
+					writeHeartbeatProducerTime(res);
+				else
+					res(error);
+			});
+		});
+	};
+
 	if (m_clearConfigurationStrategy == nullptr)
 	{
-		configure(res);
+		configureAll();
 	}
 	else
 	{
-		m_clearConfigurationStrategy([res,this](std::error_code ec)
+		m_clearConfigurationStrategy([res,configureAll](std::error_code ec)
 		{
 			if (ec == std::errc::operation_canceled)
 				res(std::error_code());  // Cancel configuration without an error.
 			else if (ec)
 				res(ec);  // no configuration due to error during m_clearConfigurationStrategy, just call the callback
 			else
-				configure([res,this](std::error_code error)
-				{
-					if (!error && !m_config->getBinaryDcfFile().empty())
-						SubmitWriteDcf(m_config->getBinaryDcfFile().c_str(), [res](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec)
-						{
-							res(ec);
-						});
-					else
-						res(error);
-				});
+				configureAll();
 		});
 	}
-	// In case of binary config and no m_clearConfigurationStrategy, the lely::coapp::BasicMaster does the config.
+}
+
+void DCFDriver::writeBinaryDcf(std::function<void (std::error_code)> onCompletedFunction)
+{
+	auto image = m_config->getBinaryDcfImage();
+	if (image != nullptr)
+	{
+		if (m_config->getBinaryDcfImageNodeID() == id())
+		{
+			// Fast path: transfer the mapped image as it is. The captured image keeps the mapping alive.
+			SubmitWriteDcf(image->begin(), image->end(), [image, onCompletedFunction](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+			{
+				if (ec)
+					onCompletedFunction(std::error_code(ec.value(), DCFDriver::ConfigErrorCategory(DCFDriver::ConfigErrorCategory::WRITE_REMOTE_SDO, idx, subidx, ec)));
+				else
+					onCompletedFunction(ec);
+			});
+		}
+		else
+		{
+			// The image is shared with a node using another node ID: patch the COB IDs while sending the objects.
+			writePatchedBinaryDcf(image, 0, onCompletedFunction);
+		}
+	}
+	else if (!m_config->getBinaryDcfFile().empty() && hasCustomClearConfigurationStrategy())
+	{
+		// The image could not be mapped, fall back to reading the file.
+		SubmitWriteDcf(m_config->getBinaryDcfFile().c_str(), [onCompletedFunction](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec)
+		{
+			onCompletedFunction(ec);
+		});
+	}
+	else
+	{
+		// No binary config or the lely::coapp::BasicMaster does the config through 0x1F22.
+		onCompletedFunction(std::error_code());
+	}
+}
+
+void DCFDriver::writePatchedBinaryDcf(std::shared_ptr<const ConciseDcfImage> image, size_t entryToSend, ::std::function<void (std::error_code)> onCompletedFunction)
+{
+	const auto& entries = image->getEntries();
+	if (entryToSend >= entries.size())
+	{
+		// nothing to do anymore, upwards recursion
+		onCompletedFunction(std::error_code());
+		return;
+	}
+
+	WriteConfirmation writeResultHandler = [image, entryToSend, onCompletedFunction, this](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+	{
+		if (ec)
+			onCompletedFunction(std::error_code(ec.value(), DCFDriver::ConfigErrorCategory(DCFDriver::ConfigErrorCategory::WRITE_REMOTE_SDO, idx, subidx, ec)));  // Error occured, cancel recursion
+		else
+			writePatchedBinaryDcf(image, entryToSend + 1, onCompletedFunction);
+	};
+
+	const auto& entry = entries[entryToSend];
+	switch (entry.size)
+	{
+	case 1:
+		submitTimedWrite<uint8_t>(SdoTimeoutPolicy::CONFIGURATION, entry.index, entry.subIndex, static_cast<uint8_t>(entry.data[0]), writeResultHandler);
+		break;
+	case 2:
+		submitTimedWrite<uint16_t>(SdoTimeoutPolicy::CONFIGURATION, entry.index, entry.subIndex, static_cast<uint16_t>(entry.data[0] | (entry.data[1] << 8)), writeResultHandler);
+		break;
+	case 4:
+		submitTimedWrite<uint32_t>(SdoTimeoutPolicy::CONFIGURATION, entry.index, entry.subIndex, ConciseDcfImage::getPatchedValue(entry, m_config->getBinaryDcfImageNodeID(), id()), writeResultHandler);
+		break;
+	default:
+		submitTimedWrite<std::vector<uint8_t>>(SdoTimeoutPolicy::CONFIGURATION, entry.index, entry.subIndex, std::vector<uint8_t>(entry.data, entry.data + entry.size), writeResultHandler);
+	}
 }
 
 void DCFDriver::configure(std::function<void (std::error_code)> res)
@@ -142,7 +322,7 @@ void copyObject(uint16_t index, uint8_t subIndex, std::shared_ptr<DCFDriverConfi
 		else
 			onCompletedFunction(std::error_code(ec.value(), DCFDriver::ConfigErrorCategory(DCFDriver::ConfigErrorCategory::READ_LOCAL_VALUE, index, subIndex, ec)));
 	else
-		driver->SubmitWrite<T>(index, subIndex, std::forward<T>(value), [onCompletedFunction, onErrorFunction](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+		driver->submitTimedWrite<T>(SdoTimeoutPolicy::CONFIGURATION, index, subIndex, value, [onCompletedFunction, onErrorFunction](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
 		{
 			// DCFDriver::ConfigErrorCategory cat(DCFDriver::ConfigErrorCategory::WRITE_REMOTE_SDO, idx, subidx, ec);
 			if (ec && onErrorFunction != nullptr)
@@ -158,7 +338,7 @@ void setObject(uint16_t index, uint8_t subIndex, T value, DCFDriver* driver,
 				std::function<void(::std::error_code ec)> onErrorFunction)
 {
 	std::error_code ec;
-	driver->SubmitWrite<T>(index, subIndex, std::forward<T>(value), [onCompletedFunction, onErrorFunction](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
+	driver->submitTimedWrite<T>(SdoTimeoutPolicy::CONFIGURATION, index, subIndex, value, [onCompletedFunction, onErrorFunction](uint8_t /* id */, uint16_t idx, uint8_t subidx, ::std::error_code ec)
 	{
 		if (ec)
 			onErrorFunction(std::error_code(ec.value(), DCFDriver::ConfigErrorCategory(DCFDriver::ConfigErrorCategory::WRITE_REMOTE_SDO, idx, subidx, ec)));
@@ -168,6 +348,21 @@ void setObject(uint16_t index, uint8_t subIndex, T value, DCFDriver* driver,
 }
 
 
+void DCFDriver::writeHeartbeatProducerTime(std::function<void (std::error_code)> onCompletedFunction)
+{
+	// Written after the DCF, so the producer time calculated by the master wins.
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	uint16_t producerTime = dcfConfigMaster != nullptr ? dcfConfigMaster->getHeartbeatProducerTime() : 0;
+	if (producerTime == 0)
+	{
+		onCompletedFunction(std::error_code());
+		return;
+	}
+
+	diag(DIAG_INFO, 0, "Node 0x%02x: Setting the heartbeat producer time to %d ms", id(), producerTime);
+	setObject<uint16_t>(0x1017, 0, producerTime, this, onCompletedFunction, onCompletedFunction);
+}
+
 void DCFDriver::configurePDO(const DCFDriverConfig::ObjectsList::iterator objectToSend, ::std::function<void (::std::error_code ec)> onCompletedFunction)
 {
 	auto writeMappings = [this](uint16_t pdoMappingIndex,
@@ -222,8 +417,8 @@ void DCFDriver::configurePDO(const DCFDriverConfig::ObjectsList::iterator object
 	};
 
 	auto index = std::get<0>(*objectToSend);
-	SubmitRead<uint32_t>(index, 1,
-						 [=](uint8_t /* id */, uint16_t index, uint8_t subIndex, ::std::error_code ec, uint32_t valueFromDevice)
+	submitTimedRead<uint32_t>(SdoTimeoutPolicy::CONFIGURATION, index, 1,
+							  [=](uint8_t /* id */, uint16_t index, uint8_t subIndex, ::std::error_code ec, uint32_t valueFromDevice)
 	{
 		if (ec)
 		{
@@ -421,6 +616,13 @@ void DCFDriver::OnState(lely::canopen::NmtState st) noexcept
 		m_nmtStateChangedCallback(st);
 }
 
+void DCFDriver::preallocate()
+{
+	// A PDO maps at most 64 objects.
+	m_pendingRpdoWrites.reserve(64);
+	m_dispatchedRpdoWrites.reserve(64);
+}
+
 void DCFDriver::OnEmcy(uint16_t emergencyErrorCode, uint8_t errorRegister, uint8_t manufSpecificError[]) noexcept
 {
 	m_emergencyOccured = (emergencyErrorCode != 0);
@@ -449,6 +651,9 @@ void DCFDriver::OnEmcy(uint16_t emergencyErrorCode, uint8_t errorRegister, uint8
 void DCFDriver::OnBoot(lely::canopen::NmtState st, char es, const std::string &what) noexcept
 {
 	diag(DIAG_INFO, 0, "OnBoot: NMT node: 0x%02x state: 0x%02x es: 0x%02x", id(), st, es);
+	if (es == 0)
+		m_heartbeatLost = false;
+	m_remoteObjectCache.clear();  // The node was reset, so the values are outdated.
 
 	// check for boot errors and report via callback.
 	if (es != 0 && m_errorCallback != nullptr)
@@ -462,29 +667,173 @@ void DCFDriver::OnBoot(lely::canopen::NmtState st, char es, const std::string &w
 	}
 }
 
+void DCFDriver::OnHeartbeat(bool occurred) noexcept
+{
+	diag(DIAG_INFO, 0, "OnHeartbeat: node: 0x%02x heartbeat %s", id(), occurred ? "lost" : "back");
+	m_heartbeatLost = occurred;
+	if (occurred && m_errorCallback != nullptr)
+	{
+		std::stringstream message;
+		message << boost::format("Heartbeat of node 0x%02x lost") % static_cast<int>(id());
+		m_errorCallback(AdditionalErrorCode::HEARTBEAT_LOST, message.str());
+	}
+}
+
 void DCFDriver::OnRpdoWrite(uint16_t idx, uint8_t subidx) noexcept
 {
-	// Execute on_rpdo_mapped callback if registered.
-	const auto& idxIter = on_rpdo_mapped.find(idx);
-	if (idxIter != on_rpdo_mapped.end())
+	updateRemoteObjectCache(idx, subidx);
+
+	// Lely reports every mapped object separately: collect them until the whole frame is processed.
+	m_pendingRpdoWrites.emplace_back(idx, subidx);
+	if (!m_rpdoFramesAreFlushed)
+		flushRpdoWrites();
+}
+
+void DCFDriver::flushRpdoWrites()
+{
+	if (m_pendingRpdoWrites.empty())
+		return;
+
+	// Swapped, so the handlers may receive the next frame. Both buffers keep their capacity.
+	m_dispatchedRpdoWrites.swap(m_pendingRpdoWrites);
+	onRpdoFrame(m_dispatchedRpdoWrites);
+	m_dispatchedRpdoWrites.clear();
+}
+
+void DCFDriver::onRpdoFrame(const std::vector<std::pair<uint16_t, uint8_t>> &objects) noexcept
+{
+	for (const auto& object : objects)
+	{
+		uint16_t idx = object.first;
+		uint8_t subidx = object.second;
+
+		// Execute on_rpdo_mapped callback if registered.
+		const auto& idxIter = on_rpdo_mapped.find(idx);
+		if (idxIter != on_rpdo_mapped.end())
+		{
+			const auto& subidxIter = idxIter->second.find(subidx);
+			if (subidxIter != idxIter->second.end())
+			{
+				const auto& function = subidxIter->second;
+				if (function != nullptr)
+					function();
+			}
+		}
+
+		// Handle follower relationship, on the executor of the followed node.
+		if (m_followsNodeID > 0)
+		{
+			auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+			DCFDriver* followed = dcfConfigMaster != nullptr ? dcfConfigMaster->getDriver(m_followsNodeID).get() : nullptr;
+			if (followed != nullptr)
+			{
+				if (static_cast<ev_exec_t*>(followed->GetExecutor()) == static_cast<ev_exec_t*>(GetExecutor()))
+					followed->onFollowerRpdoWrite(idx, subidx);
+				else
+					followed->GetExecutor().post([followed, idx, subidx]() {followed->onFollowerRpdoWrite(idx, subidx);});
+			}
+		}
+	}
+}
+
+namespace
+{
+	template<class T>
+	uint64_t readCachedValue(const void* value)
+	{
+		return static_cast<uint64_t>(*static_cast<const T*>(value));  // Sign extended for signed types.
+	}
+
+	template<class T>
+	bool resolveCachedValue(co_dev_t* dev, uint16_t index, uint8_t subIndex, const void*& value, uint64_t (*&read)(const void*))
+	{
+		ObjectHandle<T> handle(dev, index, subIndex);
+		if (!handle.isValid())
+			return false;
+		value = handle.getAddress();
+		read = &readCachedValue<T>;
+		return true;
+	}
+}
+
+void DCFDriver::resolveCachedRpdoObjects()
+{
+	m_cachedRpdoObjects.clear();
+	m_nextCachedRpdoObject = 0;
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (dcfConfigMaster == nullptr)
+		return;  // The master objects are unknown, only the SDO transfers are cached.
+
+	co_dev_t* dev = dcfConfigMaster->getObjectDictionary();
+	auto lock = lockMasterObjects();
+	for (const auto& object : dcfConfigMaster->getRpdoMappedObjects(id()))
 	{
-		const auto& subidxIter = idxIter->second.find(subidx);
-		if (subidxIter != idxIter->second.end())
+		CachedRpdoObject cached;
+		cached.idx = static_cast<uint16_t>(object.first >> 8);
+		cached.subidx = static_cast<uint8_t>(object.first);
+		if (std::any_of(m_cachedRpdoObjects.begin(), m_cachedRpdoObjects.end(), [&cached](const CachedRpdoObject& other)
+		{
+			return other.idx == cached.idx && other.subidx == cached.subidx;
+		}))
+			continue;
+
+		// The type of the master object, which lely checks against the slave object when it receives the PDO.
+		co_sub_t* masterObject = co_dev_find_sub(dev, object.second.index, object.second.subIndex);
+		bool resolved = false;
+		switch (masterObject != nullptr ? co_sub_get_type(masterObject) : 0)
 		{
-			const auto& function = subidxIter->second;
-			if (function != nullptr)
-				function();
+		case CO_DEFTYPE_INTEGER8:
+			resolved = resolveCachedValue<int8_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_INTEGER16:
+			resolved = resolveCachedValue<int16_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_INTEGER32:
+			resolved = resolveCachedValue<int32_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_INTEGER64:
+			resolved = resolveCachedValue<int64_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_UNSIGNED8:
+			resolved = resolveCachedValue<uint8_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_UNSIGNED16:
+			resolved = resolveCachedValue<uint16_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_UNSIGNED32:
+			resolved = resolveCachedValue<uint32_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		case CO_DEFTYPE_UNSIGNED64:
+			resolved = resolveCachedValue<uint64_t>(dev, object.second.index, object.second.subIndex, cached.value, cached.read);
+			break;
+		default:
+			break;  // E.g. BOOLEAN or REAL32, not cached.
 		}
+		if (!resolved)
+			continue;
+
+		cached.entry = &m_remoteObjectCache.getEntry(cached.idx, cached.subidx);
+		m_cachedRpdoObjects.push_back(cached);
 	}
+}
 
-	// Handle follower relationship.
-	if (m_followsNodeID > 0)
+void DCFDriver::updateRemoteObjectCache(uint16_t idx, uint8_t subidx)
+{
+	size_t size = m_cachedRpdoObjects.size();
+	for (size_t i = 0, position = m_nextCachedRpdoObject; i < size; i++, position = position + 1 < size ? position + 1 : 0)
 	{
-		auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
-		if (dcfConfigMaster != nullptr)
+		const auto& object = m_cachedRpdoObjects[position];
+		if (object.idx != idx || object.subidx != subidx)
+			continue;
+
+		uint64_t value;
 		{
-			dcfConfigMaster->getDriver(m_followsNodeID)->onFollowerRpdoWrite(idx, subidx);
+			auto lock = lockMasterObjects();
+			value = object.read(object.value);
 		}
+		RemoteObjectCache::update(*object.entry, value);
+		m_nextCachedRpdoObject = position + 1 < size ? position + 1 : 0;
+		return;
 	}
 }
 
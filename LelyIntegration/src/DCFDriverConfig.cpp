@@ -23,6 +23,7 @@
 #include <lely/co/dev.hpp>
 #include <lely/co/obj.hpp>
 #include <lely/co/obj.h>
+#include <lely/co/val.h>
 #include <lely/util/diag.h>
 
 #include "DCFDriverConfig.h"
@@ -30,7 +31,8 @@
 DCFDriverConfig::DCFDriverConfig(const std::string &textualDcfFileName, const std::string &binaryDcfFileName, uint8_t defaultNodeID) :
 	lely::canopen::Device(textualDcfFileName, binaryDcfFileName, defaultNodeID),
 	m_defaultNodeID(defaultNodeID),
-	m_binaryDcfFile(binaryDcfFileName)
+	m_binaryDcfFile(binaryDcfFileName),
+	m_binaryDcfImageNodeID(defaultNodeID)
 {
 
 }
@@ -70,3 +72,98 @@ uint16_t DCFDriverConfig::getTypeOfObject(uint16_t sdoIndex, uint8_t sdoSubIndex
 		return 0;
 	return sdoSubObject->getType();
 }
+
+DCFDriverConfig::ObjectsList DCFDriverConfig::getReadableObjects() const
+{
+	ObjectsList result;
+	std::vector<uint16_t> sdoIndices = reinterpret_cast<lely::CODev*>(dev())->getIdx();
+	for (auto sdoIndex : sdoIndices)
+	{
+		lely::COObj* sdoObject = reinterpret_cast<lely::CODev*>(dev())->find(sdoIndex);
+		std::vector<uint8_t> readableSubIndices;
+		for (auto sdoSubIndex : sdoObject->getSubidx())
+		{
+			if (sdoObject->find(sdoSubIndex)->getAccess() & CO_ACCESS_READ)
+				readableSubIndices.push_back(sdoSubIndex);
+		}
+		if (!readableSubIndices.empty())
+			result.push_back(std::make_tuple(sdoIndex, readableSubIndices));
+	}
+	return result;
+}
+
+bool DCFDriverConfig::isWritable(uint16_t sdoIndex, uint8_t sdoSubIndex) const
+{
+	co_sub_t* sdoSubObject = co_dev_find_sub(dev(), sdoIndex, sdoSubIndex);
+	return sdoSubObject != nullptr && (co_sub_get_access(sdoSubObject) & CO_ACCESS_WRITE);
+}
+
+bool DCFDriverConfig::isPdoMappable(uint16_t sdoIndex, uint8_t sdoSubIndex) const
+{
+	co_sub_t* sdoSubObject = co_dev_find_sub(dev(), sdoIndex, sdoSubIndex);
+	return sdoSubObject != nullptr && co_sub_get_pdo_mapping(sdoSubObject);
+}
+
+bool DCFDriverConfig::getValue(uint16_t sdoIndex, uint8_t sdoSubIndex, std::vector<uint8_t> &value) const
+{
+	co_sub_t* sdoSubObject = co_dev_find_sub(dev(), sdoIndex, sdoSubIndex);
+	if (sdoSubObject == nullptr)
+		return false;
+
+	uint16_t type = co_sub_get_type(sdoSubObject);
+	const void* localValue = co_sub_get_val(sdoSubObject);
+	value.resize(co_val_write(type, localValue, nullptr, nullptr));
+	if (!value.empty())
+		co_val_write(type, localValue, value.data(), value.data() + value.size());
+	return true;
+}
+
+std::vector<DCFDriverConfig::PdoConfig> DCFDriverConfig::getRpdoConfigs() const
+{
+	return getPdoConfigs(0x1400, 0x15FF);
+}
+
+std::vector<DCFDriverConfig::PdoConfig> DCFDriverConfig::getTpdoConfigs() const
+{
+	return getPdoConfigs(0x1800, 0x19FF);
+}
+
+std::vector<DCFDriverConfig::PdoConfig> DCFDriverConfig::getPdoConfigs(uint16_t firstCommunicationIndex, uint16_t lastCommunicationIndex) const
+{
+	std::vector<PdoConfig> result;
+	for (uint32_t communicationIndex = firstCommunicationIndex; communicationIndex <= lastCommunicationIndex; communicationIndex++)
+	{
+		if (reinterpret_cast<lely::CODev*>(dev())->find(communicationIndex) == nullptr)
+			continue;
+
+		std::error_code error;
+		PdoConfig pdo;
+		pdo.communicationIndex = communicationIndex;
+		pdo.cobID = Read<uint32_t>(communicationIndex, 1, error);
+		if (error)
+			continue;  // Without COB ID, this is no usable PDO.
+		pdo.transmissionType = Read<uint8_t>(communicationIndex, 2, error);
+		if (error)
+			pdo.transmissionType = 0xFF;
+		pdo.inhibitTime = Read<uint16_t>(communicationIndex, 3, error);
+		if (error)
+			pdo.inhibitTime = 0;  // Errors are expected, the sub index is optional.
+		pdo.eventTimer = Read<uint16_t>(communicationIndex, 5, error);
+		if (error)
+			pdo.eventTimer = 0;
+
+		uint16_t mappingIndex = communicationIndex + 0x200;
+		uint8_t numberOfMappings = Read<uint8_t>(mappingIndex, 0, error);
+		for (uint8_t subIndex = 1; !error && subIndex <= numberOfMappings; subIndex++)
+		{
+			uint32_t mapping = Read<uint32_t>(mappingIndex, subIndex, error);
+			if (!error)
+				pdo.mapping.push_back(mapping);
+		}
+		if (error)
+			diag(DIAG_WARNING, 0, "Cannot read the complete mapping 0x%04x of the PDO 0x%04x.", mappingIndex, communicationIndex);
+
+		result.push_back(pdo);
+	}
+	return result;
+}
@@ -0,0 +1,91 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a thread pool which runs the drivers on strands.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <lely/util/diag.h>
+
+#include "DriverExecutorPool.h"
+#include "EventLoopRunner.h"
+
+DriverExecutorPool::DriverExecutorPool(size_t numberOfThreads, const std::vector<int> &cpus) :
+	m_cpus(cpus)
+{
+	if (numberOfThreads == 0)
+		numberOfThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Outstanding work, so the workers keep waiting for tasks instead of returning from an empty loop.
+	m_loop.get_executor().on_task_init();
+	for (size_t worker = 0; worker < numberOfThreads; worker++)
+		m_threads.emplace_back(&DriverExecutorPool::runWorker, this, worker);
+}
+
+DriverExecutorPool::~DriverExecutorPool()
+{
+	stop();
+}
+
+ev_exec_t *DriverExecutorPool::getStrand(unsigned group)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& strand = m_strands[group];
+	if (strand == nullptr)
+		strand.reset(new lely::ev::Strand(m_loop.get_executor()));
+	return *strand;
+}
+
+size_t DriverExecutorPool::getNumberOfStrands() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_strands.size();
+}
+
+void DriverExecutorPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_stopped)
+			return;
+		m_stopped = true;
+	}
+
+	m_loop.get_executor().on_task_fini();
+	m_loop.stop();
+	for (auto& thread : m_threads)
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+}
+
+void DriverExecutorPool::runWorker(size_t worker)
+{
+	if (!m_cpus.empty())
+	{
+		int cpu = m_cpus[worker % m_cpus.size()];
+		std::error_code error;
+		if (!EventLoopRunner::pinThread(cpu, error))
+			diag(DIAG_WARNING, 0, "Cannot pin worker %u of the driver pool to core %d: %s", static_cast<unsigned>(worker), cpu, error.message().c_str());
+	}
+
+	// All workers run the same loop: each strand is executed by one worker at a time.
+	m_loop.run();
+}
@@ -0,0 +1,122 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a runner of the event loop with a blocking and a busy-poll mode.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <lely/util/diag.h>
+
+#include "EventLoopRunner.h"
+
+namespace
+{
+	/// Tells the core that this is a spin loop, which saves power and frees resources of a sibling hyper-thread.
+	inline void relaxCpu()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		asm volatile("yield");
+#endif
+	}
+}
+
+EventLoopRunner::EventLoopRunner(lely::ev::Loop &loop, EventLoopRunner::Mode mode, int cpu) :
+	m_loop(loop),
+	m_mode(mode),
+	m_cpu(cpu)
+{
+}
+
+size_t EventLoopRunner::run()
+{
+	if (m_cpu >= 0)
+	{
+		std::error_code error;
+		if (!pinThread(m_cpu, error))
+			diag(DIAG_WARNING, 0, "Cannot pin the event loop to core %d: %s", m_cpu, error.message().c_str());
+	}
+	if (m_mode == BUSY_POLL && m_cpu < 0)
+		diag(DIAG_WARNING, 0, "The busy-polling event loop is not pinned to a core.");
+
+	if (m_mode == BLOCKING)
+	{
+		size_t tasks = m_loop.run();
+		m_tasks += tasks;
+		return tasks;
+	}
+
+	size_t tasks = 0;
+	if (m_loop.stopped())
+		return tasks;
+	for (;;)
+	{
+		// Runs the ready tasks and polls the sockets and timers with a timeout of 0.
+		size_t executed = m_loop.poll();
+		m_polls.fetch_add(1, std::memory_order_relaxed);
+		m_tasks.fetch_add(executed, std::memory_order_relaxed);
+		tasks += executed;
+		// Like run(), poll() stops the loop when it has no outstanding work left (no task, watch or timer wait), so the
+		// busy loop returns in the same cases as the blocking one instead of spinning on an empty loop forever.
+		if (m_loop.stopped())
+			break;
+		if (executed == 0)
+		{
+			m_idlePolls.fetch_add(1, std::memory_order_relaxed);
+			relaxCpu();
+		}
+	}
+	return tasks;
+}
+
+void EventLoopRunner::stop()
+{
+	m_loop.stop();
+}
+
+EventLoopRunner::Statistics EventLoopRunner::getStatistics() const
+{
+	return Statistics{m_tasks.load(std::memory_order_relaxed), m_polls.load(std::memory_order_relaxed), m_idlePolls.load(std::memory_order_relaxed)};
+}
+
+bool EventLoopRunner::pinThread(int cpu, std::error_code &error)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (cpu < 0 || cpu >= cpus || cpu >= CPU_SETSIZE)
+	{
+		error = std::make_error_code(std::errc::invalid_argument);
+		return false;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (result != 0)
+	{
+		error = std::error_code(result, std::generic_category());
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
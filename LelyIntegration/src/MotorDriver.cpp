@@ -20,6 +20,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <sstream>
 
 #include <boost/format.hpp>
@@ -31,9 +32,57 @@
 
 #include "MotorDriver.h"
 
+namespace
+{
+	/// Status word and fault code are usually sent by TPDO: a value of the last cycles is as good as a new SDO read.
+	const std::chrono::milliseconds STATUS_WORD_MAX_AGE(20);
+	const std::chrono::milliseconds FAULT_CODE_MAX_AGE(20);
+	/// The callbacks of home() / move() usually wait one at a time, more only grow the ring.
+	const size_t MAX_CALLBACKS_ON_IDLE = 8;
+
+	/**
+	 * Returns the COB ID (without the valid bit, with the frame bit) of the valid RPDO which is mapped exactly like the layout, 0 if there is none.
+	 * Warns if the objects of the layout are mapped differently.
+	 */
+	template<class Layout>
+	uint32_t findPdo(uint8_t nodeID, const std::vector<DCFDriverConfig::PdoConfig>& pdos, const char* name)
+	{
+		const std::vector<uint32_t> layout = Layout::getMapping();
+		bool mappedDifferently = false;
+		for (const auto& pdo : pdos)
+		{
+			if (!pdo.isValid())
+				continue;
+			if (Layout::matches(pdo.mapping))
+			{
+				diag(DIAG_INFO, 0, "Node 0x%02x: RPDO 0x%04x (COB ID 0x%x) matches the %s PDO layout.", nodeID, pdo.communicationIndex, pdo.cobID & 0x3FFFFFFF, name);
+				return pdo.cobID & 0x3FFFFFFF;
+			}
+			// Any object of the layout in another PDO, compared without the length.
+			for (auto entry : pdo.mapping)
+				for (auto object : layout)
+					mappedDifferently |= (entry >> 8) == (object >> 8);
+		}
+
+		if (mappedDifferently)
+			diag(DIAG_WARNING, 0, "Node 0x%02x: The RPDO mapping differs from the %s PDO layout, its objects are not sent as raw frames.", nodeID, name);
+		return 0;
+	}
+}
+
 MotorDriver::MotorDriver(ev_exec_t *exec, lely::canopen::BasicMaster &m, std::shared_ptr<DCFDriverConfig> config) :
 	DCFDriver(exec, m, config)
 {
+	verifyPdoLayouts();
+
+	// The objects written and read by SDO while moving and handling faults (operation mode twice in a row by prepareHoming()).
+	m_sdoRequestPool.addWriteObject<uint16_t>(MOTOR_CONTROLWORD, 0, 2);
+	m_sdoRequestPool.addWriteObject<int8_t>  (MOTOR_OPERATIONMODE, 0, 2);
+	m_sdoRequestPool.addWriteObject<int32_t> (MOTOR_POSITION, 0);
+	m_sdoRequestPool.addWriteObject<uint32_t>(MOTOR_VELOCITY, 0);
+	m_sdoRequestPool.addWriteObject<uint32_t>(MOTOR_ACCELERATION, 0);
+	m_sdoRequestPool.addWriteObject<uint32_t>(MOTOR_DECELERATION, 0);
+	m_sdoRequestPool.addReadObject<uint16_t> (0x603F, 0);  // Error code
 }
 
 void MotorDriver::home(int8_t method, uint32_t researchSpeed, uint32_t releaseSpeed, uint32_t accel, int32_t offset, std::function<void ()> callbackOnIDLE)
@@ -63,6 +112,8 @@ void MotorDriver::move(uint16_t mode, int32_t position, uint32_t speed, uint32_t
 	m_moveSpeed = speed;
 	m_moveAcceleration = accel;
 	m_moveDeacceleration = deaccel;
+	m_lastSnapshot.targetSetAt = std::chrono::steady_clock::now();
+	publishSnapshot();
 
 	auto prepareMove = [this]()
 	{
@@ -91,7 +142,7 @@ void MotorDriver::move(uint16_t mode, int32_t position, uint32_t speed, uint32_t
 
 void MotorDriver::recoverFromFault(std::function<void ()> callbackOnIDLE)
 {
-	diag(DIAG_INFO, 0, "recoverFromFault: Node 0x%02x: Recovering in state %s", id(), stateToString(m_state).c_str());
+	diag(DIAG_INFO, 0, "recoverFromFault: Node 0x%02x: Recovering in state %s", id(), stateToString(m_state));
 	addCallbackOnIdle(callbackOnIDLE);
 	if (m_state == FAULT_STATE)
 	{
@@ -101,12 +152,15 @@ void MotorDriver::recoverFromFault(std::function<void ()> callbackOnIDLE)
 	else if (m_state == FAULT_RESET)
 	{
 		// The fault reset is already in progress. When done, the motor becomes IDLE. This triggers the callback.
-		// Watchdog if the motor is hanging in the fault reset:
-		SubmitWait(std::chrono::milliseconds(1000),  [this](std::error_code error)
+		// Watchdog if the motor is hanging in the fault reset, one is enough if recoverFromFault() is called repeatedly:
+		if (m_faultResetWatchdog == TimerWheel::INVALID_TIMER)
 		{
-			if (!error)
+			m_faultResetWatchdog = startTimer(std::chrono::milliseconds(1000), [this]()
+			{
+				m_faultResetWatchdog = TimerWheel::INVALID_TIMER;
 				retriggerFaultReset();
-		});
+			});
+		}
 	}
 	else
 	{
@@ -129,7 +183,7 @@ void MotorDriver::performFaultReset()
 	State recoveryFrom = determineStateFromStatusWord(INITIAL_STATE, m_statusWord, id());
 	if (recoveryFrom == FAULT_STATE)
 	{
-		SubmitWrite<int16_t> (0x6040, 0, 0x0080, nullptr);  // Fault Reset, CYCLE_POWER_SHUTDOWN is triggered through determineStateFromStatusWord().
+		submitPooledWrite<int16_t>(0x6040, 0, 0x0080, nullptr);  // Fault Reset, CYCLE_POWER_SHUTDOWN is triggered through determineStateFromStatusWord().
 	}
 	else if (recoveryFrom == INITIAL_POWER_ON)
 	{
@@ -179,21 +233,56 @@ void MotorDriver::handleInitialStateSwitching()
 	}
 }
 
+void MotorDriver::preallocate()
+{
+	DCFDriver::preallocate();
+	std::unique_lock<std::mutex> lock(m_callbacksOnIdleMutex);
+	if (m_callbacksOnIdle.size() < MAX_CALLBACKS_ON_IDLE)
+		growCallbacksOnIdle(MAX_CALLBACKS_ON_IDLE);
+}
+
 void MotorDriver::addCallbackOnIdle(std::function<void ()> callback)
 {
 	std::unique_lock<std::mutex> lock(m_callbacksOnIdleMutex);
-	m_callbackOnIDLE.push_front(callback);
+	if (m_numberOfCallbacksOnIdle == m_callbacksOnIdle.size())
+		growCallbacksOnIdle(std::max<size_t>(2 * m_callbacksOnIdle.size(), MAX_CALLBACKS_ON_IDLE));
+	m_callbacksOnIdle[(m_oldestCallbackOnIdle + m_numberOfCallbacksOnIdle) % m_callbacksOnIdle.size()].swap(callback);
+	m_numberOfCallbacksOnIdle++;
 }
 
 void MotorDriver::processOldestCallbackOnIdle()
 {
-	std::unique_lock<std::mutex> lock(m_callbacksOnIdleMutex);
-	if (!m_callbackOnIDLE.empty())
+	std::function<void()> callback;
 	{
-		if (m_callbackOnIDLE.back() != nullptr)
-			m_callbackOnIDLE.back()();
-		m_callbackOnIDLE.pop_back();
+		std::unique_lock<std::mutex> lock(m_callbacksOnIdleMutex);
+		if (m_numberOfCallbacksOnIdle == 0)
+			return;
+		callback.swap(m_callbacksOnIdle[m_oldestCallbackOnIdle]);
+		m_oldestCallbackOnIdle = (m_oldestCallbackOnIdle + 1) % m_callbacksOnIdle.size();
+		m_numberOfCallbacksOnIdle--;
 	}
+	// Called without the lock, so the callback can add the next one.
+	if (callback != nullptr)
+		callback();
+}
+
+void MotorDriver::clearCallbacksOnIdle()
+{
+	std::unique_lock<std::mutex> lock(m_callbacksOnIdleMutex);
+	for (auto& callback : m_callbacksOnIdle)
+		callback = nullptr;
+	m_oldestCallbackOnIdle = 0;
+	m_numberOfCallbacksOnIdle = 0;
+}
+
+void MotorDriver::growCallbacksOnIdle(size_t size)
+{
+	// Allocates: the callbacks are moved to the beginning of the new ring in their order.
+	std::vector<std::function<void()>> callbacks(size);
+	for (size_t i = 0; i < m_numberOfCallbacksOnIdle; i++)
+		callbacks[i].swap(m_callbacksOnIdle[(m_oldestCallbackOnIdle + i) % m_callbacksOnIdle.size()]);
+	m_callbacksOnIdle.swap(callbacks);
+	m_oldestCallbackOnIdle = 0;
 }
 
 void MotorDriver::OnConfig(::std::function<void (std::error_code)> res) noexcept
@@ -203,20 +292,38 @@ void MotorDriver::OnConfig(::std::function<void (std::error_code)> res) noexcept
 	{
 		if (!ec)
 		{
-			if (m_state == INITIAL_STATE)
+			m_statusWordHandle = getMappedObjectHandle<uint16_t>(id(), MOTOR_STATUSWORD, 0);
+			m_followingStatusWordHandle = getMappedObjectHandle<uint16_t>(m_followingNodeID, MOTOR_STATUSWORD, 0);
+			// If the master PDOs receive all needed status words, no IsStatusWordCheck is needed and only these objects are forwarded.
+			if (m_statusWordHandle.isValid() && (m_followingNodeID == 0 || m_followingStatusWordHandle.isValid()))
+			{
+				subscribeMasterObject(m_statusWordHandle.getIndex(), m_statusWordHandle.getSubIndex());
+				if (m_followingNodeID != 0)
+					subscribeMasterObject(m_followingStatusWordHandle.getIndex(), m_followingStatusWordHandle.getSubIndex());
+			}
+
+			if (m_controlPdoCobID != 0 && !m_rawOperationModeKnown)
 			{
-				// Read the initial motor state and set the internal state accordingly.
-				SubmitRead<uint16_t>(0x6041, 0,
-									 [this,res](uint8_t id, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec, uint16_t value)
+				// The raw control frame also carries the mode of operation: start with the one of the drive instead of 0 (no mode).
+				submitCachedRead<int8_t>(0x6061, 0, STATUS_WORD_MAX_AGE,
+										 [this,res](uint8_t id, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec, int8_t value)
 				{
-					m_statusWord = value;
-					setState(determineStateFromStatusWord(m_state, value, id));
-					res(ec);
+					if (!ec)
+					{
+						m_rawOperationMode = value;
+						m_rawOperationModeKnown = true;
+					}
+					else
+					{
+						diag(DIAG_WARNING, 0, "Node 0x%02x: Cannot read the mode of operation, the raw control frame is sent after it has been set: %s",
+							 id, ec.message().c_str());
+					}
+					synchronizeStateAfterConfig(res);
 				});
 			}
 			else
 			{
-				res(ec);
+				synchronizeStateAfterConfig(res);
 			}
 		}
 		else
@@ -230,6 +337,29 @@ void MotorDriver::OnConfig(::std::function<void (std::error_code)> res) noexcept
 	});
 }
 
+void MotorDriver::synchronizeStateAfterConfig(std::function<void (std::error_code)> res)
+{
+	if (m_state != INITIAL_STATE)
+	{
+		res(std::error_code());
+		return;
+	}
+
+	// Read the initial motor state and set the internal state accordingly.
+	submitCachedRead<uint16_t>(0x6041, 0, STATUS_WORD_MAX_AGE,
+							   [this,res](uint8_t id, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec, uint16_t value)
+	{
+		m_statusWord = value;
+		auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+		if (!ec && dcfConfigMaster != nullptr)
+			dcfConfigMaster->updateAxisStatusWord(id, value);
+		m_lastSnapshot.statusWordReceivedAt = std::chrono::steady_clock::now();
+		publishSnapshot();
+		setState(determineStateFromStatusWord(m_state, value, id));
+		res(ec);
+	});
+}
+
 void MotorDriver::OnBoot(lely::canopen::NmtState st, char es, const std::string &what) noexcept
 {
 	DCFDriver::OnBoot(st, es, what);
@@ -256,6 +386,55 @@ void MotorDriver::OnCommand(lely::canopen::NmtCommand cs) noexcept
 	handleInitialStateSwitching();
 }
 
+void MotorDriver::OnHeartbeat(bool occurred) noexcept
+{
+	DCFDriver::OnHeartbeat(occurred);
+	publishSnapshot();
+	if (occurred)
+		setState(FAULT_STATE);
+}
+
+void MotorDriver::resynchronizeInputs() noexcept
+{
+	try
+	{
+		SubmitRead<uint16_t>(MOTOR_STATUSWORD, 0, [this](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec, uint16_t value)
+		{
+			if (!ec)
+				handleStatusWordChange(value, /* statusWordOfFollowerChanged */ false);
+			else
+				diag(DIAG_WARNING, 0, "Node 0x%02x: Cannot read the status word again: %s", id(), ec.message().c_str());
+		}, getSdoTimeout());
+	}
+	catch (const std::system_error& error)
+	{
+		diag(DIAG_WARNING, 0, "Node 0x%02x: Cannot read the status word again: %s", id(), error.what());
+	}
+}
+
+void MotorDriver::OnEmcy(uint16_t emergencyErrorCode, uint8_t errorRegister, uint8_t manufSpecificError[]) noexcept
+{
+	// The error code 0 only resets the emergency, the fault itself ends with the next IDLE.
+	if (emergencyErrorCode != 0)
+	{
+		m_faultCode = emergencyErrorCode;
+		publishSnapshot();
+	}
+	DCFDriver::OnEmcy(emergencyErrorCode, errorRegister, manufSpecificError);
+}
+
+void MotorDriver::publishSnapshot()
+{
+	m_lastSnapshot.state = m_state;
+	m_lastSnapshot.statusWord = m_statusWord;
+	m_lastSnapshot.faultCode = m_faultCode;
+	m_lastSnapshot.heartbeatLost = m_heartbeatLost;
+	m_lastSnapshot.moveMode = m_currentMoveMode;
+	m_lastSnapshot.targetPosition = m_moveToPosition;
+	m_lastSnapshot.targetVelocity = m_moveSpeed;
+	m_snapshot.store(m_lastSnapshot);
+}
+
 void MotorDriver::OnState(lely::canopen::NmtState st) noexcept
 {
 	DCFDriver::OnState(st);
@@ -268,14 +447,14 @@ void MotorDriver::prepareHoming(int8_t method, uint32_t researchSpeed, uint32_t
 {
 	setState(PREPARE_HOMING);
 	// master.Command(lely::canopen::NmtCommand::ENTER_PREOP, id());
-	SubmitWrite<uint8_t> (0x6060, 0, 1,      nullptr);                                 // Profile is Position mode (needed for setting the homing offset)
+	submitPooledWrite<uint8_t>(0x6060, 0, 1,  nullptr);                                // Profile is Position mode (needed for setting the homing offset)
 	SubmitWrite<int8_t>  (0x6098, 0, std::forward<int8_t>(method), nullptr);           // Homing Method
 	SubmitWrite<uint32_t>(0x6099, 1, std::forward<uint32_t>(researchSpeed),  nullptr); // Geschwindigkeit setzen: Suche nach Schalter
 	SubmitWrite<uint32_t>(0x6099, 2, std::forward<uint32_t>(releaseSpeed),  nullptr);  // Geschwindigkeit setzen: Nullpunkt anfahren
 	SubmitWrite<uint32_t>(0x609A, 0, std::forward<uint32_t>(accel),  nullptr);         // Beschleunigung während des Homing
 	SubmitWrite<int32_t> (0x607C, 0, std::forward<int32_t>(offset),  nullptr);         // Offset nach Homing
-	SubmitWrite<uint8_t> (0x6060, 0, 6,      nullptr);                                 // Profile is Homing Mode
-	SubmitWrite<int16_t> (0x6040, 0, 0x000f, nullptr);                                 // Enable Operation (for some reason we need to cycle the operation for the homing to work reliable, and in IDLE operation is disabled)
+	submitPooledWrite<uint8_t>(0x6060, 0, 6,  nullptr);                                // Profile is Homing Mode
+	submitPooledWrite<int16_t>(0x6040, 0, 0x000f, nullptr);                                                            // Enable Operation (for some reason we need to cycle the operation for the homing to work reliable, and in IDLE operation is disabled)
 }
 
 void MotorDriver::prepareMove()
@@ -340,7 +519,7 @@ void MotorDriver::executeMove()
 	diag(DIAG_INFO, 0, "submit SDOs callbacks finished after %fms", elapsed.count());
 }
 
-bool MotorDriver::isSetterOK(const std::error_code &error, const std::string &message)
+bool MotorDriver::isSetterOK(const std::error_code &error, const char *message)
 {
 	if (!error)
 	{
@@ -350,11 +529,107 @@ bool MotorDriver::isSetterOK(const std::error_code &error, const std::string &me
 	{
 		std::stringstream msg;
 		msg << message << ": " << error << ": " << error.message();
-		m_errorCallback(AdditionalErrorCode::WRTIE_TO_NODE_ERROR, message);
+		m_errorCallback(AdditionalErrorCode::WRTIE_TO_NODE_ERROR, msg.str());
 		return false;
 	}
 }
 
+bool MotorDriver::getGeneratedMasterObject(MotorSDO sdo, uint16_t &masterIndex, uint8_t &masterSubIndex, int &tpdo)
+{
+	return findMappedMasterObject(id(), sdo, 0, masterIndex, masterSubIndex, tpdo);
+}
+
+void MotorDriver::verifyPdoLayouts()
+{
+	// Raw frames are sent through the CAN network of the DCFConfigMaster.
+	if (dynamic_cast<DCFConfigMaster*>(&master) == nullptr)
+		return;
+
+	std::vector<DCFDriverConfig::PdoConfig> rpdos = m_config->getRpdoConfigs();
+	m_controlPdoCobID = findPdo<ControlPdoLayout>(id(), rpdos, "control");
+	m_targetPdoCobID = findPdo<TargetPdoLayout>(id(), rpdos, "target");
+	m_rampPdoCobID = findPdo<RampPdoLayout>(id(), rpdos, "ramp");
+}
+
+uint32_t MotorDriver::getRawPdoCobID(MotorSDO sdo) const
+{
+	switch (sdo)
+	{
+	case MOTOR_CONTROLWORD:
+	case MOTOR_OPERATIONMODE:
+		return m_controlPdoCobID;
+	case MOTOR_POSITION:
+	case MOTOR_VELOCITY:
+		return m_targetPdoCobID;
+	case MOTOR_ACCELERATION:
+	case MOTOR_DECELERATION:
+		return m_rampPdoCobID;
+	default:
+		return 0;
+	}
+}
+
+std::error_code MotorDriver::setRawPdoValue(MotorSDO sdo, int64_t value, bool send)
+{
+	uint8_t frame[8];
+	uint8_t size = 0;
+	switch (sdo)
+	{
+	case MOTOR_CONTROLWORD:
+	case MOTOR_OPERATIONMODE:
+		if (sdo == MOTOR_CONTROLWORD)
+		{
+			m_rawControlWord = static_cast<uint16_t>(value);
+		}
+		else
+		{
+			m_rawOperationMode = static_cast<int8_t>(value);
+			m_rawOperationModeKnown = true;
+		}
+		// The frame must not override the mode of the drive with an unknown one.
+		if (send && !m_rawOperationModeKnown)
+			return std::make_error_code(std::errc::operation_not_permitted);
+		ControlPdoLayout::pack(frame, m_rawControlWord, m_rawOperationMode);
+		size = ControlPdoLayout::size;
+		break;
+	case MOTOR_POSITION:
+	case MOTOR_VELOCITY:
+		if (sdo == MOTOR_POSITION)
+			m_rawPosition = static_cast<int32_t>(value);
+		else
+			m_rawVelocity = static_cast<uint32_t>(value);
+		TargetPdoLayout::pack(frame, m_rawPosition, m_rawVelocity);
+		size = TargetPdoLayout::size;
+		break;
+	case MOTOR_ACCELERATION:
+	case MOTOR_DECELERATION:
+		if (sdo == MOTOR_ACCELERATION)
+			m_rawAcceleration = static_cast<uint32_t>(value);
+		else
+			m_rawDeceleration = static_cast<uint32_t>(value);
+		RampPdoLayout::pack(frame, m_rawAcceleration, m_rawDeceleration);
+		size = RampPdoLayout::size;
+		break;
+	default:
+		return std::make_error_code(std::errc::invalid_argument);
+	}
+
+	if (send && !static_cast<DCFConfigMaster&>(master).sendFrame(getRawPdoCobID(sdo), frame, size))
+		return std::make_error_code(std::errc::io_error);
+	return std::error_code();
+}
+
+MotorDriver::IsStatusWordCheck MotorDriver::createGeneratedStatusWordCheck()
+{
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	return [dcfConfigMaster](uint16_t masterIndex, uint8_t masterSubIndex, uint8_t nodeID) -> bool
+	{
+		DCFConfigMaster::MappedMasterObject masterObject;
+		return dcfConfigMaster != nullptr && dcfConfigMaster->getMappedMasterObject(nodeID, MOTOR_STATUSWORD, 0, masterObject) &&
+				masterObject.index == masterIndex && masterObject.subIndex == masterSubIndex;
+	};
+}
+
 void MotorDriver::CommunicationConfig::setIsStatusWordCheckForMasterSDOChange(const IsStatusWordCheck &isStatusWordCheckForMasterSDOChange)
 {
 	this->isStatusWordCheckForMasterSDOChange = isStatusWordCheckForMasterSDOChange;
@@ -392,6 +667,18 @@ void MotorDriver::CommunicationConfig::setMotorControlWordSetter(const SetterStr
 
 void MotorDriver::onMasterSDOChanged(uint16_t index, uint8_t subIndex)
 {
+	// The status words detected from the PDO mapping (see OnConfig()).
+	if (m_statusWordHandle.isValid() && index == m_statusWordHandle.getIndex() && subIndex == m_statusWordHandle.getSubIndex())
+	{
+		handleStatusWordChange(readMasterObject(m_statusWordHandle), /* statusWordOfFollowerChanged */ false);
+		return;
+	}
+	if (m_followingStatusWordHandle.isValid() && index == m_followingStatusWordHandle.getIndex() && subIndex == m_followingStatusWordHandle.getSubIndex())
+	{
+		handleStatusWordChange(readMasterObject(m_followingStatusWordHandle), /* statusWordOfFollowerChanged */ true);
+		return;
+	}
+
 	if (m_communicationConfig.isStatusWordCheckForMasterSDOChange != nullptr &&
 			(m_communicationConfig.isStatusWordCheckForMasterSDOChange(index, subIndex, id()) || m_communicationConfig.isStatusWordCheckForMasterSDOChange(index, subIndex, m_followingNodeID)))
 	{
@@ -401,13 +688,18 @@ void MotorDriver::onMasterSDOChanged(uint16_t index, uint8_t subIndex)
 	}
 }
 
-void MotorDriver::OnRpdoWrite(uint16_t idx, uint8_t subidx) noexcept
+void MotorDriver::onRpdoFrame(const std::vector<std::pair<uint16_t, uint8_t>> &objects) noexcept
 {
-	DCFDriver::OnRpdoWrite(idx, subidx);
-	if (idx == MOTOR_STATUSWORD && subidx == 0)
+	DCFDriver::onRpdoFrame(objects);
+	for (const auto& object : objects)
 	{
-		uint16_t statusWord = rpdo_mapped[idx][subidx];
-		handleStatusWordChange(statusWord, /* statusWordOfFollowerChanged */ false);
+		if (object.first == MOTOR_STATUSWORD && object.second == 0)
+		{
+			// The other objects of the frame (e.g. the actual position) are already up to date.
+			uint16_t statusWord = m_statusWordHandle.isValid() ? readMasterObject(m_statusWordHandle) : rpdo_mapped[MOTOR_STATUSWORD][0];
+			handleStatusWordChange(statusWord, /* statusWordOfFollowerChanged */ false);
+			break;
+		}
 	}
 }
 
@@ -415,7 +707,7 @@ void MotorDriver::onFollowerRpdoWrite(uint16_t idx, uint8_t subidx) noexcept
 {
 	if (idx == MOTOR_STATUSWORD && subidx == 0)
 	{
-		uint16_t statusWord = master.RpdoMapped(m_followingNodeID)[idx][subidx];
+		uint16_t statusWord = m_followingStatusWordHandle.isValid() ? readMasterObject(m_followingStatusWordHandle) : master.RpdoMapped(m_followingNodeID)[idx][subidx];
 		handleStatusWordChange(statusWord, /* statusWordOfFollowerChanged */ true);
 	}
 }
@@ -430,8 +722,35 @@ void MotorDriver::handleStatusWordChange(uint16_t statusWord, bool statusWordOfF
 #endif
 
 	if (!statusWordOfFollowerChanged)
+	{
 		m_statusWord = statusWord;
+		m_remoteObjectCache.update(MOTOR_STATUSWORD, 0, statusWord);  // Also received through master objects (manual or generated mapping).
+		// Published before the skip below: the time of reception tells the readers that the node is still alive.
+		m_lastSnapshot.statusWordReceivedAt = std::chrono::steady_clock::now();
+		publishSnapshot();
+	}
+
+	// Cyclic PDOs repeat the status word: skip it if it was handled in the same states without changing them.
+	auto& lastHandled = m_lastHandledStatusWords[statusWordOfFollowerChanged ? 1 : 0];
+	HandledStatusWord current = {true, statusWord, m_state, m_mainNodeState, m_followingNodeState};
+	if (lastHandled.valid && lastHandled.statusWord == statusWord && lastHandled.state == m_state &&
+			lastHandled.mainNodeState == m_mainNodeState && lastHandled.followingNodeState == m_followingNodeState)
+		return;
 
+	// The master updates its axis table itself only from the status words received by its generated PDO mapping.
+	const auto& statusWordHandle = statusWordOfFollowerChanged ? m_followingStatusWordHandle : m_statusWordHandle;
+	auto* dcfConfigMaster = dynamic_cast<DCFConfigMaster*>(&master);
+	if (!statusWordHandle.isValid() && dcfConfigMaster != nullptr && (lastHandled.statusWord != statusWord || !lastHandled.valid))
+		dcfConfigMaster->updateAxisStatusWord(statusWordOfFollowerChanged ? m_followingNodeID : id(), statusWord);
+
+	handleStatusWord(statusWord, statusWordOfFollowerChanged);
+	// Only a result which does not change the states anymore may be skipped, some transitions need the same status word twice.
+	current.valid = current.state == m_state && current.mainNodeState == m_mainNodeState && current.followingNodeState == m_followingNodeState;
+	lastHandled = current;
+}
+
+void MotorDriver::handleStatusWord(uint16_t statusWord, bool statusWordOfFollowerChanged)
+{
 	auto isRelevantStateForFollowerRelationship = [](State s)
 	{
 		return s == PREPARE_MOVE || s == READY_TO_MOVE || s == MOVING || s == IDLE;
@@ -458,7 +777,7 @@ void MotorDriver::handleStatusWordChange(uint16_t statusWord, bool statusWordOfF
 				m_followingNodeState = determineStateFromStatusWord(m_followingNodeState, statusWord, m_followingNodeID);
 			}
 
-			diag(DIAG_INFO, 0, "handleStatusWordChange: (aggregate) state for 0x%02x: main: %s, follow: %s, current: %s", id(), stateToString(m_mainNodeState).c_str(), stateToString(m_followingNodeState).c_str(), stateToString(m_state).c_str());
+			diag(DIAG_INFO, 0, "handleStatusWordChange: (aggregate) state for 0x%02x: main: %s, follow: %s, current: %s", id(), stateToString(m_mainNodeState), stateToString(m_followingNodeState), stateToString(m_state));
 			if ((m_mainNodeState == READY_TO_MOVE && m_followingNodeState == READY_TO_MOVE) && m_state == PREPARE_MOVE)
 				setState(READY_TO_MOVE);
 			else if ((m_mainNodeState == MOVING || m_followingNodeState == MOVING) && m_state == READY_TO_MOVE)
@@ -478,7 +797,7 @@ void MotorDriver::handleStatusWordChange(uint16_t statusWord, bool statusWordOfF
 			if (!isRelevantStateForFollowerRelationship(nextState) || (m_state == POWER_ON_DISABLE_OPERATION && nextState == IDLE))
 			{
 				diag(DIAG_INFO, 0, "handleStatusWordChange: local follower handling 0x%02x: 0x%04x %s --> %s",
-					 id(), statusWord, stateToString(m_state).c_str(), stateToString(nextState).c_str());
+					 id(), statusWord, stateToString(m_state), stateToString(nextState));
 
 				setState(nextState);
 			}
@@ -603,7 +922,7 @@ void MotorDriver::setState(MotorDriver::State newState)
 {
 	if (m_state != newState)
 	{
-		diag(DIAG_INFO, 0, "setState: Node 0x%02x: Switching %s --> %s", id(), stateToString(m_state).c_str(), stateToString(newState).c_str());
+		diag(DIAG_INFO, 0, "setState: Node 0x%02x: Switching %s --> %s", id(), stateToString(m_state), stateToString(newState));
 		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - m_jobStartedAt;
 
 		switch (newState)
@@ -618,7 +937,7 @@ void MotorDriver::setState(MotorDriver::State newState)
 			break;
 		case MotorDriver::CYCLE_POWER_SHUTDOWN:
 			diag(DIAG_INFO, 0, "Node 0x%02x: Entering CYCLE_POWER_SHUTDOWN after %.6fms", id(), elapsed.count());
-			SubmitWrite<int16_t> (0x6040, 0, 0x0006, nullptr);
+			submitPooledWrite<int16_t>(0x6040, 0, 0x0006, nullptr);
 			break;
 		case MotorDriver::POWER_ON_DISABLE_OPERATION:
 			// Since this is triggered after every move we want to have faster PDO communication if configured.
@@ -642,7 +961,7 @@ void MotorDriver::setState(MotorDriver::State newState)
 			break;
 		case MotorDriver::READY_FOR_HOMING:
 			// Start Homing
-			SubmitWrite<int16_t> (0x6040, 0, 0x001f, [this](uint8_t /*id */, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code /* ec */)
+			submitPooledWrite<int16_t>(0x6040, 0, 0x001f, [this](::std::error_code /* ec */)
 			{
 				// TODO: remove once we can drop support for AuxInd firmwares < 8.47
 				setState(MotorDriver::HOMING);  // Work-Around for older firmware versions: switch automatically into the homing mode.
@@ -652,13 +971,13 @@ void MotorDriver::setState(MotorDriver::State newState)
 			diag(DIAG_INFO, 0, "Node 0x%02x: Start HOMING after %.3fms", id(), elapsed.count());
 			break;
 		case MotorDriver::IDLE:
-			diag(DIAG_INFO, 0, "Node 0x%02x: Entering IDLE after %.6fms", id(), elapsed.count());
+			m_faultCode = 0;
+			diag(DIAG_INFO, 0, "Node 0x%02x: Entering IDLE after %.6fms (lely SDO request objects: %zu pooled, %zu allocated)", id(), elapsed.count(),
+				 m_sdoRequestPool.getPooledRequests(), m_sdoRequestPool.getAllocatedRequests());
 			processOldestCallbackOnIdle();
 			break;
 		case MotorDriver::FAULT_STATE:
-			m_callbacksOnIdleMutex.lock();
-			m_callbackOnIDLE.clear();
-			m_callbacksOnIdleMutex.unlock();
+			clearCallbacksOnIdle();
 			if (m_state != INITIAL_STATE)
 				handleFault();
 			break;
@@ -670,14 +989,16 @@ void MotorDriver::setState(MotorDriver::State newState)
 			break;
 		}
 		m_state = newState;
+		m_lastSnapshot.stateChangedAt = std::chrono::steady_clock::now();
+		publishSnapshot();
 	}
 	else
 	{
-		diag(DIAG_INFO, 0, "setState: Node 0x%02x: NOT Switching %s --> %s", id(), stateToString(m_state).c_str(), stateToString(newState).c_str());
+		diag(DIAG_INFO, 0, "setState: Node 0x%02x: NOT Switching %s --> %s", id(), stateToString(m_state), stateToString(newState));
 	}
 }
 
-std::string MotorDriver::stateToString(MotorDriver::State state)
+const char* MotorDriver::stateToString(MotorDriver::State state)
 {
 	switch (state)
 	{
@@ -712,30 +1033,33 @@ std::string MotorDriver::stateToString(MotorDriver::State state)
 	case MotorDriver::NODE_RESET:
 		return("NODE_RESET");
 	}
+	return "UNKNOWN";
 }
 
-void MotorDriver::handleFault()
+void MotorDriver::handleFault(unsigned attempt)
 {
-	if (!m_emergencyOccured)
+	if (!m_emergencyOccured && !m_heartbeatLost)
 	{
 		// Handle the fault only in CiA-402 style if it was not detected yet by an emergency.
-		// else we get the error twice.
-		SubmitRead<uint16_t>(0x603F, 0,
-							 [this](uint8_t /*id*/, uint16_t /*idx*/, uint8_t /*subidx*/, ::std::error_code ec, uint16_t value)
+		// else we get the error twice. Without a heartbeat the node would not answer anyway.
+		submitCachedRead<uint16_t>(0x603F, 0, FAULT_CODE_MAX_AGE,
+								   [this, attempt](uint8_t /*id*/, uint16_t /*idx*/, uint8_t /*subidx*/, ::std::error_code ec, uint16_t value)
 		{
 			if (!ec)
 			{
 				if (value != 0)
 				{
+					m_faultCode = value;
+					publishSnapshot();
 					std::stringstream message;
 					message << boost::format("Motor Fault: code: 0x%04x") % value;
 					if (m_errorCallback != nullptr)
 						m_errorCallback(value, message.str());
 				}
 			}
-			else
+			else if (!retrySdo(SdoTimeoutPolicy::DIAGNOSTICS, attempt, ec, [this, attempt]() {handleFault(attempt + 1);}))
 			{
-				// TODO: Retry here? Sometimes it is not possible to read the register, e.g. when the state was set shortly before.
+				// Sometimes it is not possible to read the register, e.g. when the state was set shortly before: reported once the retries are exhausted.
 				std::stringstream message;
 				message << "Error while reading the Fault Register: " << ec << ":" << ec.message();
 				if (m_errorCallback != nullptr)
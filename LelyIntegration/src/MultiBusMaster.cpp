@@ -0,0 +1,205 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a coordinator of the masters of several CAN buses.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <lely/util/diag.h>
+
+#include "DCFDriver.h"
+#include "MultiBusMaster.h"
+
+MultiBusMaster::Bus::Bus(const MultiBusMaster::BusConfig &config) :
+	config(config),
+	poll(context),
+	loop(poll.get_poll()),
+	timer(poll, loop.get_executor(), CLOCK_MONOTONIC),
+	timerWheelTimer(poll, loop.get_executor(), CLOCK_MONOTONIC),
+	channel(context, poll, loop.get_executor())
+{
+}
+
+MultiBusMaster::MultiBusMaster(MultiBusMaster::MasterFactory factory) :
+	m_factory(factory)
+{
+}
+
+MultiBusMaster::~MultiBusMaster()
+{
+	stop();
+}
+
+bool MultiBusMaster::addBus(const MultiBusMaster::BusConfig &config, uint8_t &bus, std::error_code &error)
+{
+	if (m_buses.size() > 0xFF)
+	{
+		error = std::make_error_code(std::errc::value_too_large);
+		return false;
+	}
+
+	std::unique_ptr<Bus> newBus(new Bus(config));
+	if (!newBus->channel.open(config.interface, error))
+		return false;
+
+	ev_exec_t* exec = newBus->loop.get_executor();
+	newBus->master = m_factory(newBus->timer, newBus->channel.getChannel(), exec, config.dcf);
+	if (newBus->master == nullptr)
+	{
+		error = std::make_error_code(std::errc::invalid_argument);
+		return false;
+	}
+
+	bus = static_cast<uint8_t>(m_buses.size());
+	newBus->master->enableTimerWheel(newBus->timerWheelTimer);
+	if (config.receiveFilter)
+		newBus->master->enableReceiveFilter(newBus->channel);
+	uint8_t busNumber = bus;
+	newBus->master->setBootCompletedCallback([this, busNumber](uint8_t nodeID)
+	{
+		onBootCompleted(busNumber, nodeID);
+	});
+	newBus->runner.reset(new EventLoopRunner(newBus->loop, config.mode, config.cpu));
+	m_buses.push_back(std::move(newBus));
+
+	diag(DIAG_INFO, 0, "Bus %u: %s, master %s, core %d", bus, config.interface.c_str(), config.dcf.c_str(), config.cpu);
+	error.clear();
+	return true;
+}
+
+void MultiBusMaster::start()
+{
+	for (auto& bus : m_buses)
+	{
+		if (bus->thread.joinable())
+			continue;
+		bus->master->configureDrivers();
+		bus->master->Reset();
+		Bus* runningBus = bus.get();
+		bus->thread = std::thread([runningBus]()
+		{
+			runningBus->runner->run();
+		});
+	}
+}
+
+void MultiBusMaster::stop()
+{
+	for (auto& bus : m_buses)
+	{
+		if (!bus->thread.joinable())
+			continue;
+		bus->runner->stop();
+		bus->thread.join();
+	}
+}
+
+std::shared_ptr<DCFConfigMaster> MultiBusMaster::getMaster(uint8_t bus) const
+{
+	return bus < m_buses.size() ? m_buses[bus]->master : nullptr;
+}
+
+ev_exec_t *MultiBusMaster::getExecutor(uint8_t bus) const
+{
+	return bus < m_buses.size() ? static_cast<ev_exec_t*>(m_buses[bus]->loop.get_executor()) : nullptr;
+}
+
+std::shared_ptr<DCFDriver> MultiBusMaster::getDriver(MultiBusMaster::NodeAddress address) const
+{
+	auto master = getMaster(address.bus);
+	return master != nullptr ? master->getDriver(address.nodeID) : nullptr;
+}
+
+void MultiBusMaster::addAxisGroup(const std::string &name, const MultiBusMaster::AxisGroup &axes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_axisGroups[name] = axes;
+}
+
+const MultiBusMaster::AxisGroup *MultiBusMaster::getAxisGroup(const std::string &name) const
+{
+	auto group = m_axisGroups.find(name);
+	return group != m_axisGroups.end() ? &group->second : nullptr;
+}
+
+void MultiBusMaster::forEachInGroup(const std::string &name, MultiBusMaster::GroupAction action, std::function<void ()> completed)
+{
+	std::vector<std::shared_ptr<DCFDriver>> drivers;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto group = m_axisGroups.find(name);
+		if (group != m_axisGroups.end())
+		{
+			for (const auto& address : group->second)
+			{
+				auto driver = getDriver(address);
+				if (driver != nullptr)
+					drivers.push_back(driver);
+				else
+					diag(DIAG_WARNING, 0, "Axis group %s: there is no node 0x%02x on bus %u.", name.c_str(), address.nodeID, address.bus);
+			}
+		}
+	}
+
+	if (drivers.empty())
+	{
+		if (completed != nullptr)
+			completed();
+		return;
+	}
+
+	auto pending = std::make_shared<std::atomic<size_t>>(drivers.size());
+	std::function<void()> done = [pending, completed]()
+	{
+		if (--*pending == 0 && completed != nullptr)
+			completed();
+	};
+	for (const auto& target : drivers)
+	{
+		// On the executor of the driver, which is a strand of a DriverExecutorPool or the executor of its bus.
+		target->GetExecutor().post([action, target, done]()
+		{
+			action(target, done);
+		});
+	}
+}
+
+void MultiBusMaster::onBootCompleted(uint8_t bus, uint8_t nodeID)
+{
+	if (nodeID != 0)
+	{
+		if (m_nodeBootedCallback != nullptr)
+			m_nodeBootedCallback(NodeAddress{bus, nodeID});
+		return;
+	}
+
+	bool allBooted = true;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_buses[bus]->booted = true;
+		for (const auto& otherBus : m_buses)
+			allBooted = allBooted && otherBus->booted;
+		if (!allBooted || m_bootCompletedNotified)
+			return;
+		m_bootCompletedNotified = true;
+	}
+	diag(DIAG_INFO, 0, "All %zu buses have booted.", m_buses.size());
+	if (m_bootCompletedCallback != nullptr)
+		m_bootCompletedCallback();
+}
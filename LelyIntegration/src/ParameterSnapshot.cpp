@@ -0,0 +1,288 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a snapshot of the parameters of all nodes of a system.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+#include "DCFDriverConfig.h"
+#include "ParameterSnapshot.h"
+
+namespace
+{
+	const char MAGIC[4] = {'L', 'P', 'S', '1'};
+
+	void appendUint(std::vector<uint8_t>& buffer, uint32_t value, size_t bytes)
+	{
+		for (size_t i = 0; i < bytes; i++)
+			buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+	}
+
+	uint32_t readUint(const uint8_t* data, size_t bytes)
+	{
+		uint32_t value = 0;
+		for (size_t i = 0; i < bytes; i++)
+			value |= static_cast<uint32_t>(data[i]) << (8 * i);
+		return value;
+	}
+
+	bool isPdoParameter(uint16_t index)
+	{
+		return index >= 0x1400 && index <= 0x1BFF;
+	}
+
+	/// Returns the communication parameter of a PDO communication or mapping parameter.
+	uint16_t getCommunicationIndex(uint16_t index)
+	{
+		return (index & 0x0200) ? index - 0x200 : index;
+	}
+
+	/// Objects which trigger an action on the node instead of holding a parameter.
+	bool isCommand(uint16_t index)
+	{
+		return index == 0x1010 || index == 0x1011 || (index >= 0x1F50 && index <= 0x1F5F);
+	}
+
+	/// The set points of CiA-402, in case a DCF declares them as not PDO mappable.
+	bool isProcessData(uint16_t index)
+	{
+		switch (index)
+		{
+		case 0x6040:  // Control word
+		case 0x6042:  // vl target velocity
+		case 0x6060:  // Modes of operation
+		case 0x6071:  // Target torque
+		case 0x607A:  // Target position
+		case 0x60B0:  // Position offset
+		case 0x60B1:  // Velocity offset
+		case 0x60B2:  // Torque offset
+		case 0x60C1:  // Interpolation data record
+		case 0x60FE:  // Digital outputs
+		case 0x60FF:  // Target velocity
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/// Parses a concise DCF (CiA-302-3) into the entries of the given node.
+	bool parseConciseDcf(const uint8_t* data, size_t size, uint8_t nodeID, ParameterSnapshot& snapshot)
+	{
+		if (size < 4)
+			return false;
+		uint32_t numberOfEntries = readUint(data, 4);
+		size_t offset = 4;
+		for (uint32_t i = 0; i < numberOfEntries; i++)
+		{
+			if (offset + 7 > size)
+				return false;
+			ParameterSnapshot::Entry entry;
+			entry.index = static_cast<uint16_t>(readUint(data + offset, 2));
+			entry.subIndex = data[offset + 2];
+			uint32_t entrySize = readUint(data + offset + 3, 4);
+			offset += 7;
+			if (entrySize > size - offset)
+				return false;
+			entry.data.assign(data + offset, data + offset + entrySize);
+			offset += entrySize;
+			snapshot.addEntry(nodeID, entry);
+		}
+		return offset == size;
+	}
+}
+
+void ParameterSnapshot::addEntry(uint8_t nodeID, ParameterSnapshot::Entry entry)
+{
+	auto& entries = m_nodes[nodeID];
+	auto position = std::lower_bound(entries.begin(), entries.end(), entry, [](const Entry& a, const Entry& b)
+	{
+		return a.index != b.index ? a.index < b.index : a.subIndex < b.subIndex;
+	});
+	if (position != entries.end() && position->index == entry.index && position->subIndex == entry.subIndex)
+		*position = entry;
+	else
+		entries.insert(position, entry);
+}
+
+size_t ParameterSnapshot::getNumberOfEntries() const
+{
+	size_t result = 0;
+	for (const auto& node : m_nodes)
+		result += node.second.size();
+	return result;
+}
+
+bool ParameterSnapshot::isConfigurationParameter(uint16_t index)
+{
+	if (index >= 0x1000 && index <= 0x1FFF)
+		return !isCommand(index);
+	if (isProcessData(index))
+		return false;
+	return index >= 0x2000 && index <= 0x9FFF;
+}
+
+std::vector<ParameterSnapshot::Entry> ParameterSnapshot::getRestorableEntries(uint8_t nodeID, const DCFDriverConfig &config, bool onlyDifferences) const
+{
+	std::vector<Entry> result;
+	auto node = m_nodes.find(nodeID);
+	if (node == m_nodes.end())
+		return result;
+
+	std::map<uint16_t /* communication index */, std::vector<const Entry*>> pdos;
+	std::set<uint16_t> changedPdos;
+	for (const auto& entry : node->second)
+	{
+		if (!isConfigurationParameter(entry.index) || !config.isWritable(entry.index, entry.subIndex) || config.isPdoMappable(entry.index, entry.subIndex))
+			continue;
+
+		std::vector<uint8_t> dcfValue;
+		bool changed = !onlyDifferences || !config.getValue(entry.index, entry.subIndex, dcfValue) || dcfValue != entry.data;
+		if (isPdoParameter(entry.index))
+		{
+			// The parameters of a PDO are only consistent as a whole, so a PDO is restored completely or not at all.
+			uint16_t communicationIndex = getCommunicationIndex(entry.index);
+			pdos[communicationIndex].push_back(&entry);
+			if (changed)
+				changedPdos.insert(communicationIndex);
+		}
+		else if (changed)
+		{
+			result.push_back(entry);
+		}
+	}
+
+	// Like the concise DCFs of dcfgen: disable the PDO, clear the mapping, write the parameters and the mapping, then enable the PDO again (see CiA-301).
+	for (const auto& pdo : pdos)
+	{
+		if (changedPdos.find(pdo.first) == changedPdos.end())
+			continue;
+
+		const Entry* cobID = nullptr;
+		const Entry* numberOfMappings = nullptr;
+		for (const auto* entry : pdo.second)
+		{
+			if (entry->index == pdo.first && entry->subIndex == 1)
+				cobID = entry;
+			else if (entry->index != pdo.first && entry->subIndex == 0)
+				numberOfMappings = entry;
+		}
+
+		if (cobID != nullptr && cobID->data.size() == 4)
+		{
+			Entry disable = *cobID;
+			disable.data[3] |= 0x80;
+			result.push_back(disable);
+		}
+		if (numberOfMappings != nullptr)
+		{
+			Entry clear = *numberOfMappings;
+			std::fill(clear.data.begin(), clear.data.end(), 0);
+			result.push_back(clear);
+		}
+		for (const auto* entry : pdo.second)
+		{
+			if (entry != cobID && entry != numberOfMappings)
+				result.push_back(*entry);
+		}
+		if (numberOfMappings != nullptr)
+			result.push_back(*numberOfMappings);
+		if (cobID != nullptr)
+			result.push_back(*cobID);
+	}
+	return result;
+}
+
+std::vector<uint8_t> ParameterSnapshot::toConciseDcf(const std::vector<ParameterSnapshot::Entry> &entries)
+{
+	std::vector<uint8_t> result;
+	appendUint(result, entries.size(), 4);
+	for (const auto& entry : entries)
+	{
+		appendUint(result, entry.index, 2);
+		appendUint(result, entry.subIndex, 1);
+		appendUint(result, entry.data.size(), 4);
+		result.insert(result.end(), entry.data.begin(), entry.data.end());
+	}
+	return result;
+}
+
+bool ParameterSnapshot::save(const std::string &fileName, std::error_code &error) const
+{
+	std::vector<uint8_t> content(MAGIC, MAGIC + sizeof(MAGIC));
+	for (const auto& node : m_nodes)
+	{
+		std::vector<uint8_t> block = toConciseDcf(node.second);
+		appendUint(content, node.first, 1);
+		appendUint(content, block.size(), 4);
+		content.insert(content.end(), block.begin(), block.end());
+	}
+
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(content.data()), content.size());
+	file.close();
+	if (file.fail())
+	{
+		error = std::error_code(errno != 0 ? errno : EIO, std::generic_category());
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
+
+std::shared_ptr<ParameterSnapshot> ParameterSnapshot::load(const std::string &fileName, std::error_code &error)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	if (!file)
+	{
+		error = std::error_code(errno != 0 ? errno : ENOENT, std::generic_category());
+		return nullptr;
+	}
+	std::vector<uint8_t> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	auto snapshot = std::make_shared<ParameterSnapshot>();
+	bool valid = content.size() >= sizeof(MAGIC) && std::equal(MAGIC, MAGIC + sizeof(MAGIC), content.begin());
+	size_t offset = sizeof(MAGIC);
+	while (valid && offset < content.size())
+	{
+		if (offset + 5 > content.size())
+		{
+			valid = false;
+			break;
+		}
+		uint8_t nodeID = content[offset];
+		uint32_t blockSize = readUint(&content[offset + 1], 4);
+		offset += 5;
+		valid = blockSize <= content.size() - offset && parseConciseDcf(&content[offset], blockSize, nodeID, *snapshot);
+		offset += blockSize;
+	}
+	if (!valid)
+	{
+		error = std::make_error_code(std::errc::invalid_argument);
+		return nullptr;
+	}
+
+	error.clear();
+	return snapshot;
+}
@@ -0,0 +1,311 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the implementation of an offline optimizer for the PDO layout of the axes on a CAN bus.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <sstream>
+
+#include <boost/format.hpp>
+
+#include <lely/util/diag.h>
+
+#include "BusLoadAnalyzer.h"
+#include "PdoLayoutOptimizer.h"
+
+namespace
+{
+	const unsigned MAX_PDO_BITS = 64;
+
+	double getDeadline(const PdoLayoutOptimizer::Signal& signal)
+	{
+		return signal.deadlineMs > 0 ? signal.deadlineMs : signal.periodMs;
+	}
+
+	unsigned getUsedBits(const PdoLayoutOptimizer::Pdo& pdo)
+	{
+		unsigned bits = 0;
+		for (const auto& signal : pdo.signals)
+			bits += signal.bitLength;
+		return bits;
+	}
+
+	/// The more urgent frame wins the arbitration, so it gets the lower COB ID (and the lower PDO number).
+	bool isMoreUrgent(const PdoLayoutOptimizer::Pdo& a, const PdoLayoutOptimizer::Pdo& b)
+	{
+		if (a.deadlineMs != b.deadlineMs)
+			return a.deadlineMs < b.deadlineMs;
+		if (a.periodMs != b.periodMs)
+			return a.periodMs < b.periodMs;
+		if (a.nodeID != b.nodeID)
+			return a.nodeID < b.nodeID;
+		if (a.isRpdo != b.isRpdo)
+			return a.isRpdo;  // The master commands first, the answers are caused by them.
+		return a.number < b.number;
+	}
+}
+
+uint8_t PdoLayoutOptimizer::Pdo::getSize() const
+{
+	return static_cast<uint8_t>((getUsedBits(*this) + 7) / 8);
+}
+
+std::vector<uint32_t> PdoLayoutOptimizer::Pdo::getMapping() const
+{
+	std::vector<uint32_t> mapping;
+	for (const auto& signal : signals)
+		mapping.push_back((static_cast<uint32_t>(signal.index) << 16) | (static_cast<uint32_t>(signal.subIndex) << 8) | signal.bitLength);
+	return mapping;
+}
+
+PdoLayoutOptimizer::PdoLayoutOptimizer(uint32_t bitRate) :
+	m_bitRate(bitRate)
+{
+}
+
+double PdoLayoutOptimizer::getFrameTime(uint8_t dataBytes) const
+{
+	return BusLoadAnalyzer::getFrameTime(m_bitRate, dataBytes, /* extended = */ false);
+}
+
+bool PdoLayoutOptimizer::packAxis(const PdoLayoutOptimizer::Axis &axis, bool toSlave, std::vector<PdoLayoutOptimizer::Pdo> &pdos) const
+{
+	std::vector<Signal> signals;
+	for (const auto& signal : axis.signals)
+		if (signal.toSlave == toSlave)
+			signals.push_back(signal);
+
+	// Fast signals first, within the same rate the big ones first (first fit decreasing).
+	std::stable_sort(signals.begin(), signals.end(), [](const Signal& a, const Signal& b)
+	{
+		if (a.periodMs != b.periodMs)
+			return a.periodMs < b.periodMs;
+		return a.bitLength > b.bitLength;
+	});
+
+	std::vector<Pdo> frames;
+	for (const auto& signal : signals)
+	{
+		auto frame = std::find_if(frames.begin(), frames.end(), [&signal](const Pdo& pdo)
+		{
+			return pdo.periodMs == signal.periodMs && getUsedBits(pdo) + signal.bitLength <= MAX_PDO_BITS;
+		});
+		if (frame == frames.end())
+		{
+			Pdo pdo;
+			pdo.nodeID = axis.nodeID;
+			pdo.isRpdo = toSlave;
+			pdo.number = 0;
+			pdo.cobID = 0;
+			pdo.periodMs = signal.periodMs;
+			pdo.deadlineMs = getDeadline(signal);
+			frames.push_back(pdo);
+			frame = frames.end() - 1;
+		}
+		frame->signals.push_back(signal);
+		frame->deadlineMs = std::min(frame->deadlineMs, getDeadline(signal));
+	}
+
+	// Too many frames for the device: move the slowest frame into the slowest frame with enough room.
+	// The moved signals are sent faster than necessary, which costs bandwidth but no PDO.
+	size_t maxPdos = toSlave ? axis.maxRpdos : axis.maxTpdos;
+	while (frames.size() > maxPdos)
+	{
+		auto slowest = std::max_element(frames.begin(), frames.end(), [](const Pdo& a, const Pdo& b) {return a.periodMs < b.periodMs;});
+		unsigned bits = getUsedBits(*slowest);
+		auto target = frames.end();
+		for (auto frame = frames.begin(); frame != frames.end(); ++frame)
+		{
+			if (frame != slowest && getUsedBits(*frame) + bits <= MAX_PDO_BITS && (target == frames.end() || frame->periodMs > target->periodMs))
+				target = frame;
+		}
+		if (target == frames.end())
+			return false;
+
+		target->signals.insert(target->signals.end(), slowest->signals.begin(), slowest->signals.end());
+		target->periodMs = std::min(target->periodMs, slowest->periodMs);
+		target->deadlineMs = std::min(target->deadlineMs, slowest->deadlineMs);
+		frames.erase(slowest);
+	}
+
+	std::sort(frames.begin(), frames.end(), isMoreUrgent);
+	for (size_t i = 0; i < frames.size(); i++)
+		frames[i].number = i + 1;
+	pdos.insert(pdos.end(), frames.begin(), frames.end());
+	return true;
+}
+
+PdoLayoutOptimizer::Layout PdoLayoutOptimizer::optimize(std::error_code &error) const
+{
+	error.clear();
+	Layout layout;
+	layout.busLoad = 0;
+
+	for (const auto& axis : m_axes)
+	{
+		for (const auto& signal : axis.signals)
+		{
+			if (signal.bitLength == 0 || signal.bitLength > MAX_PDO_BITS || signal.periodMs <= 0)
+			{
+				error = std::make_error_code(std::errc::invalid_argument);
+				return layout;
+			}
+		}
+
+		// The RPDOs of a following node are the ones of its leader.
+		if ((axis.leaderNodeID == 0 && !packAxis(axis, true, layout.pdos)) || !packAxis(axis, false, layout.pdos))
+			error = std::make_error_code(std::errc::no_buffer_space);
+	}
+
+	std::sort(layout.pdos.begin(), layout.pdos.end(), isMoreUrgent);
+	uint32_t cobID = m_firstCobID;
+	for (auto& pdo : layout.pdos)
+	{
+		if (cobID > m_lastCobID)
+		{
+			error = std::make_error_code(std::errc::result_out_of_range);
+			break;
+		}
+		pdo.cobID = cobID++;
+	}
+
+	std::vector<Pdo> followerPdos;
+	for (const auto& axis : m_axes)
+	{
+		if (axis.leaderNodeID == 0)
+			continue;
+
+		size_t numberOfRpdos = 0;
+		for (const auto& pdo : layout.pdos)
+		{
+			if (pdo.nodeID == axis.leaderNodeID && pdo.isRpdo)
+			{
+				Pdo followerPdo = pdo;
+				followerPdo.nodeID = axis.nodeID;
+				followerPdos.push_back(followerPdo);
+				numberOfRpdos++;
+			}
+		}
+		if (numberOfRpdos == 0)
+			error = std::make_error_code(std::errc::invalid_argument);  // Unknown leader.
+		else if (numberOfRpdos > axis.maxRpdos)
+			error = std::make_error_code(std::errc::no_buffer_space);
+
+		// A following node only receives the RPDOs of its leader, so it cannot get signals of its own.
+		for (const auto& signal : axis.signals)
+		{
+			if (!signal.toSlave)
+				continue;
+
+			bool shared = std::any_of(followerPdos.begin(), followerPdos.end(), [&axis, &signal](const Pdo& pdo)
+			{
+				return pdo.nodeID == axis.nodeID && std::any_of(pdo.signals.begin(), pdo.signals.end(), [&signal](const Signal& leaderSignal)
+				{
+					return leaderSignal.index == signal.index && leaderSignal.subIndex == signal.subIndex;
+				});
+			});
+			if (!shared)
+			{
+				diag(DIAG_ERROR, 0, "PdoLayoutOptimizer: Node %d follows node %d, but its signal %s (%04X:%02X) is not sent to the leader.",
+					 axis.nodeID, axis.leaderNodeID, signal.name.c_str(), signal.index, signal.subIndex);
+				error = std::make_error_code(std::errc::invalid_argument);
+			}
+		}
+	}
+
+	// The shared RPDOs of following nodes are only one frame on the bus.
+	for (const auto& pdo : layout.pdos)
+		layout.busLoad += getFrameTime(pdo.getSize()) / (pdo.periodMs / 1000.0);
+	if (!error && layout.busLoad > 1.0)
+		error = std::make_error_code(std::errc::value_too_large);
+
+	layout.pdos.insert(layout.pdos.end(), followerPdos.begin(), followerPdos.end());
+	std::stable_sort(layout.pdos.begin(), layout.pdos.end(), [](const Pdo& a, const Pdo& b) {return a.cobID < b.cobID;});
+	return layout;
+}
+
+namespace
+{
+	/// The event timer (sub index 5) in ms of a periodic TPDO: rounded down, so the signals are never older than their period.
+	unsigned getEventTimer(const PdoLayoutOptimizer::Pdo& pdo)
+	{
+		return static_cast<unsigned>(std::min(std::max(std::floor(pdo.periodMs), 1.0), 65535.0));
+	}
+}
+
+std::string PdoLayoutOptimizer::toDcfFragment(const PdoLayoutOptimizer::Layout &layout, uint8_t nodeID)
+{
+	std::stringstream dcf;
+	for (const auto& pdo : layout.pdos)
+	{
+		if (pdo.nodeID != nodeID)
+			continue;
+
+		unsigned communicationIndex = (pdo.isRpdo ? 0x1400 : 0x1800) + pdo.number - 1;
+		unsigned mappingIndex = communicationIndex + 0x200;
+		const char* direction = pdo.isRpdo ? "Receive" : "Transmit";
+		std::vector<uint32_t> mapping = pdo.getMapping();
+
+		// The slave sends its TPDOs periodically by the event timer; the RPDOs are sent by the master in its own cycle.
+		bool periodic = !pdo.isRpdo;
+		dcf << boost::format("[%04X]\nParameterName=%s PDO Communication Parameter %d\nObjectType=0x9\nSubNumber=%d\n\n") % communicationIndex % direction % (pdo.number - 1) % (periodic ? 4 : 3);
+		dcf << boost::format("[%04Xsub0]\nParameterName=Highest sub-index supported\nObjectType=0x7\nDataType=0x0005\nAccessType=ro\nDefaultValue=%d\nPDOMapping=0\n\n") % communicationIndex % (periodic ? 5 : 2);
+		dcf << boost::format("[%04Xsub1]\nParameterName=COB ID\nObjectType=0x7\nDataType=0x0007\nAccessType=rw\nDefaultValue=0x%X\nPDOMapping=0\nParameterValue=0x%X\n\n") % communicationIndex % pdo.cobID % pdo.cobID;
+		dcf << boost::format("[%04Xsub2]\nParameterName=Transmission Type\nObjectType=0x7\nDataType=0x0005\nAccessType=rw\nDefaultValue=0\nPDOMapping=0\nParameterValue=0xFF\n\n") % communicationIndex;
+		if (periodic)
+			dcf << boost::format("[%04Xsub5]\nParameterName=Event Timer\nObjectType=0x7\nDataType=0x0006\nAccessType=rw\nDefaultValue=0\nPDOMapping=0\nParameterValue=%d\n\n") % communicationIndex % getEventTimer(pdo);
+
+		dcf << boost::format("[%04X]\nParameterName=%s PDO Mapping Parameter %d\nObjectType=0x9\nSubNumber=%d\n\n") % mappingIndex % direction % (pdo.number - 1) % (mapping.size() + 1);
+		dcf << boost::format("[%04Xsub0]\nParameterName=Number of entries\nObjectType=0x7\nDataType=0x0005\nAccessType=rw\nDefaultValue=0\nPDOMapping=0\nParameterValue=0x%X\n\n") % mappingIndex % mapping.size();
+		for (size_t i = 0; i < mapping.size(); i++)
+		{
+			dcf << boost::format("[%04Xsub%X]\nParameterName=PDO Mapping Entry (%s)\nObjectType=0x7\nDataType=0x0007\nAccessType=rw\nDefaultValue=0\nPDOMapping=0\nParameterValue=0x%08X\n\n")
+				   % mappingIndex % (i + 1) % pdo.signals[i].name % mapping[i];
+		}
+	}
+	return dcf.str();
+}
+
+std::string PdoLayoutOptimizer::toYamlFragment(const PdoLayoutOptimizer::Layout &layout, uint8_t nodeID)
+{
+	std::stringstream yaml;
+	for (bool rpdos : {false, true})
+	{
+		bool first = true;
+		for (const auto& pdo : layout.pdos)
+		{
+			if (pdo.nodeID != nodeID || pdo.isRpdo != rpdos)
+				continue;
+
+			if (first)
+				yaml << (rpdos ? "    rpdo:\n" : "    tpdo:\n");
+			first = false;
+			yaml << boost::format("        %d:\n            cob_id: 0x%x\n            transmission: 0xff\n") % pdo.number % pdo.cobID;
+			if (!pdo.isRpdo)
+				yaml << boost::format("            event_timer: %d\n") % getEventTimer(pdo);
+			yaml << "            mapping:\n";
+			for (const auto& signal : pdo.signals)
+				yaml << boost::format("                - {index: 0x%04x, sub_index: %d}  # %s\n") % signal.index % static_cast<int>(signal.subIndex) % signal.name;
+		}
+	}
+	return yaml.str();
+}
@@ -0,0 +1,208 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of the real-time operation profile of the process running the master.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <alloca.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "RealtimeProfile.h"
+
+namespace
+{
+	thread_local bool t_allocationCheckArmed = false;
+	std::atomic<size_t> s_checkedAllocations{0};
+	std::atomic<bool> s_abortOnAllocation{false};
+	std::atomic<bool> s_allocationHookLinked{false};
+
+	/// Touches the pages of the stack, so they are mapped (and locked) before the loop runs.
+	void prefaultStack(size_t size)
+	{
+		volatile char* stack = static_cast<volatile char*>(alloca(size));
+		for (size_t offset = 0; offset < size; offset += 4096)
+			stack[offset] = 0;
+	}
+
+	/// Calls a diagnostic handler, which takes a va_list.
+	void callDiagHandler(diag_handler_t* handler, void* handle, diag_severity severity, int errc, const char* format, ...)
+	{
+		va_list ap;
+		va_start(ap, format);
+		handler(handle, severity, errc, format, ap);
+		va_end(ap);
+	}
+}
+
+const size_t RealtimeProfile::LOG_LINE_LENGTH;
+
+RealtimeProfile::~RealtimeProfile()
+{
+	restoreDiagHandler();
+	flushLog();
+}
+
+bool RealtimeProfile::apply(const RealtimeProfile::Config &config, std::error_code &error)
+{
+	error.clear();
+	if (config.lockMemory)
+	{
+		// Freed memory stays in the (locked) heap instead of being returned to the system.
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0 && !error)
+			error = std::error_code(errno, std::generic_category());
+	}
+	if (config.stackPrefault > 0)
+		prefaultStack(config.stackPrefault);
+
+	if (config.schedulingPolicy != SCHED_OTHER)
+	{
+		sched_param parameter;
+		std::memset(&parameter, 0, sizeof(parameter));
+		parameter.sched_priority = config.priority;
+		int result = pthread_setschedparam(pthread_self(), config.schedulingPolicy, &parameter);
+		if (result != 0 && !error)
+			error = std::error_code(result, std::generic_category());
+	}
+
+	if (config.logLines > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_logMutex);
+		m_log.resize(config.logLines);
+		m_firstLogLine = 0;
+		m_numberOfLogLines = 0;
+		if (!m_diagHandlerInstalled)
+		{
+			diag_get_handler(&m_previousDiagHandler, &m_previousDiagHandle);
+			diag_set_handler(&RealtimeProfile::onDiag, this);
+			m_diagHandlerInstalled = true;
+		}
+	}
+	return !error;
+}
+
+size_t RealtimeProfile::flushLog()
+{
+	size_t flushed = 0;
+	LogLine line;
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_logMutex);
+			if (m_numberOfLogLines == 0)
+				break;
+			line = m_log[m_firstLogLine];
+			m_firstLogLine = (m_firstLogLine + 1) % m_log.size();
+			m_numberOfLogLines--;
+		}
+		// Written without the lock, the handler may block on the output.
+		if (m_previousDiagHandler != nullptr)
+			callDiagHandler(m_previousDiagHandler, m_previousDiagHandle, line.severity, line.errc, "%s", line.text);
+		flushed++;
+	}
+	return flushed;
+}
+
+size_t RealtimeProfile::getLostLogLines() const
+{
+	std::lock_guard<std::mutex> lock(m_logMutex);
+	return m_lostLogLines;
+}
+
+bool RealtimeProfile::isAllocationCheckAvailable()
+{
+	// The hook calls countAllocation() for every allocation, so one allocation shows if it is linked.
+	void* volatile probe = ::operator new(1);
+	::operator delete(probe);
+	return s_allocationHookLinked.load(std::memory_order_relaxed);
+}
+
+void RealtimeProfile::armAllocationCheck(bool abortOnAllocation)
+{
+	s_abortOnAllocation = abortOnAllocation;
+	t_allocationCheckArmed = true;
+}
+
+void RealtimeProfile::disarmAllocationCheck()
+{
+	t_allocationCheckArmed = false;
+}
+
+size_t RealtimeProfile::getCheckedAllocations()
+{
+	return s_checkedAllocations.load(std::memory_order_relaxed);
+}
+
+void RealtimeProfile::countAllocation()
+{
+	s_allocationHookLinked.store(true, std::memory_order_relaxed);
+	if (!t_allocationCheckArmed)
+		return;
+
+	s_checkedAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (s_abortOnAllocation.load(std::memory_order_relaxed))
+	{
+		static const char message[] = "RealtimeProfile: heap allocation while the allocation check is armed\n";
+		ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+		(void)ignored;
+		std::abort();
+	}
+}
+
+void RealtimeProfile::onDiag(void *handle, diag_severity severity, int errc, const char *format, va_list ap)
+{
+	auto self = static_cast<RealtimeProfile*>(handle);
+	// Formatted on the stack, so the lock is only held for the copy.
+	char text[LOG_LINE_LENGTH];
+	vsnprintf(text, sizeof(text), format, ap);
+
+	std::lock_guard<std::mutex> lock(self->m_logMutex);
+	if (self->m_numberOfLogLines == self->m_log.size())
+	{
+		// Full: the oldest message is overwritten.
+		self->m_firstLogLine = (self->m_firstLogLine + 1) % self->m_log.size();
+		self->m_numberOfLogLines--;
+		self->m_lostLogLines++;
+	}
+	auto& line = self->m_log[(self->m_firstLogLine + self->m_numberOfLogLines) % self->m_log.size()];
+	line.severity = severity;
+	line.errc = errc;
+	std::memcpy(line.text, text, sizeof(text));
+	self->m_numberOfLogLines++;
+}
+
+void RealtimeProfile::restoreDiagHandler()
+{
+	if (m_diagHandlerInstalled)
+	{
+		diag_set_handler(m_previousDiagHandler, m_previousDiagHandle);
+		m_diagHandlerInstalled = false;
+	}
+}
@@ -0,0 +1,43 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a local mirror of the objects of a remote node.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RemoteObjectCache.h"
+
+bool RemoteObjectCache::lookup(uint16_t index, uint8_t subIndex, std::chrono::milliseconds maxAge, uint64_t &value, std::chrono::steady_clock::time_point now)
+{
+	auto entry = m_entries.find((static_cast<uint32_t>(index) << 8) | subIndex);
+	if (entry == m_entries.end() || !entry->second.valid || now - entry->second.updatedAt > maxAge)
+	{
+		m_misses++;
+		return false;
+	}
+
+	m_hits++;
+	value = entry->second.value;
+	return true;
+}
+
+void RemoteObjectCache::clear()
+{
+	for (auto& entry : m_entries)
+		entry.second.valid = false;
+}
@@ -0,0 +1,210 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a batch of SDO reads from many nodes.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <lely/co/type.h>
+#include <lely/coapp/sdo_error.hpp>
+
+#include "DCFConfigMaster.h"
+#include "SdoReadBatch.h"
+
+namespace
+{
+	/// Returns the size in bytes of a basic type as transferred by SDO or 0 if the type is not supported.
+	size_t getSize(uint16_t type, bool& isSigned)
+	{
+		isSigned = false;
+		switch (type)
+		{
+		case CO_DEFTYPE_INTEGER8:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_BOOLEAN:
+		case CO_DEFTYPE_UNSIGNED8:
+			return 1;
+		case CO_DEFTYPE_INTEGER16:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED16:
+			return 2;
+		case CO_DEFTYPE_INTEGER24:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED24:
+			return 3;
+		case CO_DEFTYPE_INTEGER32:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED32:
+		case CO_DEFTYPE_REAL32:
+			return 4;
+		case CO_DEFTYPE_INTEGER40:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED40:
+			return 5;
+		case CO_DEFTYPE_INTEGER48:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED48:
+			return 6;
+		case CO_DEFTYPE_INTEGER56:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED56:
+			return 7;
+		case CO_DEFTYPE_INTEGER64:
+			isSigned = true;
+			// fall through
+		case CO_DEFTYPE_UNSIGNED64:
+		case CO_DEFTYPE_REAL64:
+			return 8;
+		default:
+			return 0;
+		}
+	}
+}
+
+SdoReadBatch::SdoReadBatch(DCFConfigMaster &master, const std::vector<SdoReadBatch::Request> &requests, size_t maxConcurrentRequests, SdoReadBatch::CompletedCallback callback) :
+	m_master(master),
+	m_requests(requests),
+	m_maxConcurrentRequests(maxConcurrentRequests > 0 ? maxConcurrentRequests : 1),
+	m_callback(callback),
+	m_results(requests.size(), Result{std::error_code(), 0})
+{
+	for (size_t i = 0; i < m_requests.size(); i++)
+	{
+		bool isSigned;
+		if (getSize(m_requests[i].type, isSigned) == 0)
+		{
+			m_results[i].error = std::make_error_code(std::errc::invalid_argument);
+			m_completedRequests++;
+		}
+		else
+		{
+			m_pendingRequests[m_requests[i].nodeID].push_back(i);
+		}
+	}
+}
+
+std::future<std::vector<SdoReadBatch::Result>> SdoReadBatch::start()
+{
+	auto future = m_promise.get_future();
+	if (m_completedRequests == m_requests.size())
+	{
+		// Nothing to read.
+		if (m_callback != nullptr)
+			m_callback(m_results);
+		m_promise.set_value(m_results);
+	}
+	else
+	{
+		submitRequests();
+	}
+	return future;
+}
+
+void SdoReadBatch::submitRequests()
+{
+	std::vector<size_t> requestsToSubmit;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Start behind the node served last, so no node is starved by the global maximum.
+		auto node = m_pendingRequests.upper_bound(m_lastSubmittedNode);
+		for (size_t checkedNodes = 0; checkedNodes < m_pendingRequests.size() && m_runningRequests < m_maxConcurrentRequests; checkedNodes++, ++node)
+		{
+			if (node == m_pendingRequests.end())
+				node = m_pendingRequests.begin();
+			if (node->second.empty() || m_busyNodes.find(node->first) != m_busyNodes.end())
+				continue;
+
+			requestsToSubmit.push_back(node->second.front());
+			node->second.pop_front();
+			m_busyNodes.insert(node->first);
+			m_lastSubmittedNode = node->first;
+			m_runningRequests++;
+		}
+	}
+
+	// Submitted without holding the lock since the confirmation might be called immediately.
+	auto self = shared_from_this();
+	for (auto i : requestsToSubmit)
+	{
+		const auto& request = m_requests[i];
+		auto submitted = std::chrono::steady_clock::now();
+		try
+		{
+			m_master.SubmitRead<std::vector<uint8_t>>(request.nodeID, request.index, request.subIndex,
+													  [self, i, submitted](uint8_t id, uint16_t /* idx */, uint8_t /* subidx */, ::std::error_code ec, std::vector<uint8_t> value)
+			{
+				self->m_master.getSdoTimeoutPolicy().addResult(id, submitted, ec);
+				self->onRead(i, ec, value);
+			}, m_master.getSdoTimeout(request.nodeID));
+		}
+		catch (const std::system_error& error)
+		{
+			// E.g. the node is not configured or has no SDO client: the request fails with this error.
+			onRead(i, error.code(), std::vector<uint8_t>());
+		}
+	}
+}
+
+void SdoReadBatch::onRead(size_t i, std::error_code error, const std::vector<uint8_t> &value)
+{
+	bool completed;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto& result = m_results[i];
+		result.error = error;
+		if (!error)
+		{
+			bool isSigned;
+			size_t size = getSize(m_requests[i].type, isSigned);
+			if (value.size() > size)
+				result.error = lely::canopen::SdoErrc::TYPE_LEN_HI;
+			else if (value.size() < size)
+				result.error = lely::canopen::SdoErrc::TYPE_LEN_LO;
+			else
+			{
+				result.value = 0;
+				for (size_t byte = 0; byte < size; byte++)
+					result.value |= static_cast<uint64_t>(value[byte]) << (8 * byte);
+				if (isSigned && size < 8 && (value[size - 1] & 0x80))
+					result.value |= ~static_cast<uint64_t>(0) << (8 * size);
+			}
+		}
+
+		m_busyNodes.erase(m_requests[i].nodeID);
+		m_runningRequests--;
+		completed = ++m_completedRequests == m_requests.size();
+	}
+
+	if (completed)
+	{
+		if (m_callback != nullptr)
+			m_callback(m_results);
+		m_promise.set_value(m_results);
+	}
+	else
+	{
+		submitRequests();
+	}
+}
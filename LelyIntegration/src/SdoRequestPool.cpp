@@ -0,0 +1,85 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a pool of reusable SDO requests of a node.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DCFConfigMaster.h"
+#include "SdoRequestPool.h"
+
+SdoRequestPool::SdoRequestPool(DCFConfigMaster *master, ev_exec_t *exec, uint8_t nodeID) :
+	m_master(master),
+	m_exec(exec),
+	m_nodeID(nodeID)
+{
+}
+
+SdoRequestPool::PooledRequest *SdoRequestPool::acquire(SdoRequestPool::PooledRequests &requests, uint16_t index, uint8_t subIndex)
+{
+	if (m_master == nullptr)
+		return nullptr;
+
+	auto pooledRequests = requests.find(getKey(index, subIndex));
+	if (pooledRequests == requests.end())
+		return nullptr;
+
+	for (auto& request : pooledRequests->second)
+	{
+		if (!request->busy)
+		{
+			request->busy = true;
+			return request.get();
+		}
+	}
+	return nullptr;
+}
+
+bool SdoRequestPool::submit(SdoRequestPool::PooledRequest &request)
+{
+	// Set before, the confirmation might be called immediately.
+	request.submitted = std::chrono::steady_clock::now();
+	if (!m_master->submitSdoRequest(m_nodeID, request.getRequest()))
+	{
+		// Not submitted: the caller falls back to lely, which reports the error.
+		request.busy = false;
+		return false;
+	}
+
+	m_pooledRequests++;
+	return true;
+}
+
+void SdoRequestPool::onCompleted(std::chrono::steady_clock::time_point submitted, std::error_code error)
+{
+	m_master->getSdoTimeoutPolicy().addResult(m_nodeID, submitted, error);
+}
+
+bool SdoRequestPool::retryWrite(SdoRequestPool::PooledRequest &request, std::error_code error)
+{
+	if (m_writeRetryHandler == nullptr)
+		return false;
+
+	// Only a failed write allocates the retry function.
+	return m_writeRetryHandler(request.attempt, error, [this, &request, error]()
+	{
+		request.attempt++;
+		if (!submit(request))
+			request.finish(error, 0);  // The node lost its SDO client meanwhile: report the last error.
+	});
+}
@@ -0,0 +1,190 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of the adaptive SDO timeouts and the retry policies.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <lely/coapp/sdo_error.hpp>
+
+#include "SdoTimeoutPolicy.h"
+
+namespace
+{
+	/// The number of answers before the measured round trip time is trusted.
+	const size_t MIN_SAMPLES = 4;
+	/// The weight of a new sample, like the smoothed round trip time of TCP (RFC 6298).
+	const double SMOOTHING = 1.0 / 8.0;
+	/// Limits the doubling of the timeout after consecutive timeouts.
+	const unsigned MAX_BACKOFF_SHIFT = 4;
+
+	bool isTransient(std::error_code error)
+	{
+		return error == lely::canopen::SdoErrc::TIMEOUT || error == lely::canopen::SdoErrc::DATA_CTL || error == lely::canopen::SdoErrc::DATA_DEV;
+	}
+}
+
+SdoTimeoutPolicy::SdoTimeoutPolicy(std::chrono::milliseconds initialTimeout) :
+	m_initialTimeout(initialTimeout),
+	m_minTimeout(initialTimeout),
+	m_maxTimeout(initialTimeout)
+{
+	m_retryPolicies[CONFIGURATION] = RetryPolicy{2, std::chrono::milliseconds(10)};
+	m_retryPolicies[MOTION] = RetryPolicy{0, std::chrono::milliseconds(0)};
+	m_retryPolicies[DIAGNOSTICS] = RetryPolicy{3, std::chrono::milliseconds(50)};
+}
+
+void SdoTimeoutPolicy::setAdaptive(std::chrono::milliseconds minTimeout, std::chrono::milliseconds maxTimeout, double deviationFactor)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_minTimeout = minTimeout;
+	m_maxTimeout = std::max(minTimeout, maxTimeout);
+	m_deviationFactor = deviationFactor;
+	m_adaptive = true;
+}
+
+void SdoTimeoutPolicy::setInitialTimeout(std::chrono::milliseconds timeout)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_initialTimeout = timeout;
+}
+
+void SdoTimeoutPolicy::setProbeTimeout(std::chrono::milliseconds timeout)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_probeTimeout = timeout;
+}
+
+void SdoTimeoutPolicy::setRetryPolicy(SdoTimeoutPolicy::RequestClass requestClass, const SdoTimeoutPolicy::RetryPolicy &policy)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_retryPolicies[requestClass] = policy;
+}
+
+SdoTimeoutPolicy::RetryPolicy SdoTimeoutPolicy::getRetryPolicy(SdoTimeoutPolicy::RequestClass requestClass) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_retryPolicies[requestClass];
+}
+
+std::chrono::milliseconds SdoTimeoutPolicy::getTimeout(uint8_t nodeID, SdoTimeoutPolicy::RequestClass /* requestClass */) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_adaptive)
+		return m_initialTimeout;
+
+	// A node which does not answer is not waited for long, its requests are not retried anyway (see shouldRetry()).
+	auto node = m_nodes.find(nodeID);
+	if (node == m_nodes.end() || node->second.samples == 0 || node->second.missing)
+		return m_probeTimeout.count() > 0 ? m_probeTimeout : m_minTimeout;
+
+	const auto& state = node->second;
+	if (state.samples < MIN_SAMPLES)
+		return m_initialTimeout;
+
+	double timeout = (state.meanRoundTripTime + m_deviationFactor * std::sqrt(state.variance)) / 1000.0;
+	// Back off while the node does not answer, e.g. because it is busy: the retries get a longer timeout.
+	timeout *= static_cast<double>(1u << std::min(state.consecutiveTimeouts, MAX_BACKOFF_SHIFT));
+	timeout = std::min(std::max(std::ceil(timeout), static_cast<double>(m_minTimeout.count())), static_cast<double>(m_maxTimeout.count()));
+	return std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(timeout));
+}
+
+void SdoTimeoutPolicy::addResult(uint8_t nodeID, std::chrono::steady_clock::time_point submitted, std::error_code error)
+{
+	if (error == lely::canopen::SdoErrc::NO_SDO || error == std::errc::operation_canceled)
+		return;  // Not submitted or canceled by the master, the node was not involved.
+
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& state = m_nodes[nodeID];
+	// A request submitted while the previous one was running was sent on its completion.
+	auto sent = std::max(submitted, state.lastCompletedAt);
+	state.lastCompletedAt = now;
+	if (error == lely::canopen::SdoErrc::TIMEOUT)
+	{
+		state.timeouts++;
+		state.consecutiveTimeouts++;
+		return;
+	}
+
+	// Any answer, also an abort by the node, is a sample of the round trip time.
+	double roundTripTime = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count());
+	if (state.samples == 0)
+	{
+		state.meanRoundTripTime = roundTripTime;
+		state.variance = roundTripTime * roundTripTime / 4.0;
+	}
+	else
+	{
+		double difference = roundTripTime - state.meanRoundTripTime;
+		state.meanRoundTripTime += SMOOTHING * difference;
+		state.variance = (1.0 - SMOOTHING) * (state.variance + SMOOTHING * difference * difference);
+	}
+	state.maxRoundTripTime = std::max(state.maxRoundTripTime, roundTripTime);
+	state.samples++;
+	state.consecutiveTimeouts = 0;
+	state.missing = false;
+}
+
+bool SdoTimeoutPolicy::shouldRetry(uint8_t nodeID, SdoTimeoutPolicy::RequestClass requestClass, unsigned attempt, std::error_code error)
+{
+	if (!isTransient(error))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& state = m_nodes[nodeID];
+	const auto& policy = m_retryPolicies[requestClass];
+	if (error == lely::canopen::SdoErrc::TIMEOUT)
+	{
+		if (state.samples == 0 || state.missing)
+			return false;  // Fail fast, the node is not there.
+		if (attempt >= policy.maxRetries)
+		{
+			state.missing = policy.maxRetries > 0;
+			return false;
+		}
+	}
+	else if (attempt >= policy.maxRetries)
+	{
+		return false;
+	}
+
+	state.retries++;
+	return true;
+}
+
+bool SdoTimeoutPolicy::getStatistics(uint8_t nodeID, SdoTimeoutPolicy::Statistics &result) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto node = m_nodes.find(nodeID);
+	if (node == m_nodes.end())
+		return false;
+
+	const auto& state = node->second;
+	result.samples = state.samples;
+	result.timeouts = state.timeouts;
+	result.retries = state.retries;
+	result.consecutiveTimeouts = state.consecutiveTimeouts;
+	result.meanRoundTripTime = std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(state.meanRoundTripTime));
+	result.roundTripDeviation = std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(std::sqrt(state.variance)));
+	result.maxRoundTripTime = std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(state.maxRoundTripTime));
+	return true;
+}
@@ -0,0 +1,205 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains the implementation of a hierarchical timer wheel.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdint>
+
+#include "TimerWheel.h"
+
+const TimerWheel::TimerID TimerWheel::INVALID_TIMER;
+const unsigned TimerWheel::LEVELS;
+const unsigned TimerWheel::SLOT_BITS;
+const unsigned TimerWheel::SLOTS;
+const uint32_t TimerWheel::NONE;
+
+TimerWheel::TimerWheel(std::chrono::microseconds resolution) :
+	m_resolution(std::max(resolution, std::chrono::microseconds(1)))
+{
+	for (auto& level : m_slots)
+		std::fill(level, level + SLOTS, NONE);
+}
+
+TimerWheel::TimerID TimerWheel::start(std::chrono::microseconds delay, TimerWheel::Callback callback, uint64_t elapsedTicks)
+{
+	uint32_t timer = m_freeTimers;
+	if (timer != NONE)
+	{
+		m_freeTimers = m_timers[timer].next;
+	}
+	else
+	{
+		timer = static_cast<uint32_t>(m_timers.size());
+		m_timers.emplace_back();
+	}
+
+	uint64_t ticks = delay.count() > 0 ? static_cast<uint64_t>((delay.count() + m_resolution.count() - 1) / m_resolution.count()) : 0;
+	auto& entry = m_timers[timer];
+	// The tick in progress is partially over, it does not count.
+	entry.expiry = m_now + elapsedTicks + ticks + 1;
+	entry.callback = std::move(callback);
+	entry.running = true;
+	insert(timer);
+	m_runningTimers++;
+	return (static_cast<TimerID>(entry.generation) << 32) | timer;
+}
+
+bool TimerWheel::cancel(TimerWheel::TimerID id)
+{
+	uint32_t timer = static_cast<uint32_t>(id);
+	if (id == INVALID_TIMER || timer >= m_timers.size())
+		return false;
+
+	auto& entry = m_timers[timer];
+	if (!entry.running || entry.generation != static_cast<uint32_t>(id >> 32))
+		return false;
+
+	remove(timer);
+	release(timer);
+	return true;
+}
+
+void TimerWheel::advanceTo(uint64_t tick)
+{
+	while (m_now < tick)
+	{
+		if (m_runningTimers == 0)
+		{
+			m_now = tick;
+			break;
+		}
+
+		m_now++;
+		// Move the timers of the next range down before level 0 is processed, from the highest level affected.
+		unsigned levels = 0;
+		for (unsigned level = 1; level < LEVELS && (m_now & ((static_cast<uint64_t>(1) << (SLOT_BITS * level)) - 1)) == 0; level++)
+			levels = level;
+		for (unsigned level = levels; level > 0; level--)
+			cascade(level);
+
+		uint32_t* slot = &m_slots[0][m_now & (SLOTS - 1)];
+		while (*slot != NONE)
+		{
+			uint32_t timer = *slot;
+			remove(timer);
+			Callback callback;
+			callback.swap(m_timers[timer].callback);
+			release(timer);
+			// Released before the call, so the callback may start the next timer with the same entry.
+			if (callback != nullptr)
+				callback();
+		}
+	}
+}
+
+uint64_t TimerWheel::getNextExpiry() const
+{
+	if (m_runningTimers == 0)
+		return UINT64_MAX;
+
+	// Level 0 holds the timers of the next ticks, each higher level is moved down at the multiples of its slot size.
+	// A move of a higher level may come before the first timer of level 0 (e.g. a long timer started before a short one),
+	// so the earliest of all levels is the next expiry.
+	uint64_t result = UINT64_MAX;
+	for (uint64_t tick = m_now + 1; tick < m_now + SLOTS; tick++)
+	{
+		if (m_slots[0][tick & (SLOTS - 1)] != NONE)
+		{
+			result = tick;
+			break;
+		}
+	}
+	for (unsigned level = 1; level < LEVELS; level++)
+	{
+		unsigned shift = SLOT_BITS * level;
+		for (uint64_t slot = (m_now >> shift) + 1; slot <= (m_now >> shift) + SLOTS; slot++)
+		{
+			if (m_slots[level][slot & (SLOTS - 1)] != NONE)
+			{
+				result = std::min(result, slot << shift);
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+void TimerWheel::insert(uint32_t timer)
+{
+	auto& entry = m_timers[timer];
+	uint64_t delta = entry.expiry > m_now ? entry.expiry - m_now : 0;
+	unsigned level = 0;
+	while (level < LEVELS - 1 && delta >= (static_cast<uint64_t>(1) << (SLOT_BITS * (level + 1))))
+		level++;
+
+	// Beyond the range of the highest level: parked in its last slot, inserted again when it is moved down.
+	uint64_t position = entry.expiry;
+	uint64_t range = static_cast<uint64_t>(1) << (SLOT_BITS * LEVELS);
+	if (delta >= range)
+		position = m_now + range - 1;
+
+	entry.level = static_cast<uint8_t>(level);
+	entry.slot = static_cast<uint8_t>((position >> (SLOT_BITS * level)) & (SLOTS - 1));
+	uint32_t& head = m_slots[entry.level][entry.slot];
+	entry.previous = NONE;
+	entry.next = head;
+	if (head != NONE)
+		m_timers[head].previous = timer;
+	head = timer;
+}
+
+void TimerWheel::remove(uint32_t timer)
+{
+	auto& entry = m_timers[timer];
+	if (entry.previous != NONE)
+		m_timers[entry.previous].next = entry.next;
+	else
+		m_slots[entry.level][entry.slot] = entry.next;
+	if (entry.next != NONE)
+		m_timers[entry.next].previous = entry.previous;
+	entry.previous = NONE;
+	entry.next = NONE;
+}
+
+void TimerWheel::release(uint32_t timer)
+{
+	auto& entry = m_timers[timer];
+	entry.callback = nullptr;
+	entry.running = false;
+	entry.generation++;
+	if (entry.generation == 0)
+		entry.generation = 1;
+	entry.next = m_freeTimers;
+	m_freeTimers = timer;
+	m_runningTimers--;
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+	uint32_t timer = m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+	m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)] = NONE;
+	while (timer != NONE)
+	{
+		uint32_t next = m_timers[timer].next;
+		insert(timer);
+		timer = next;
+	}
+}
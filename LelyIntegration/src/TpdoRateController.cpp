@@ -0,0 +1,290 @@
+/**@file
+ * This header file is part of the LelyIntegration library;
+ * it contains the implementation of a controller which adapts the TPDO rates of the slaves to the bus load.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include <lely/util/diag.h>
+
+#include "BusLoadMonitor.h"
+#include "DCFConfigMaster.h"
+#include "DCFDriver.h"
+#include "TpdoRateController.h"
+
+namespace
+{
+	/// The first inhibit time (1 ms) if a TPDO without inhibit time is throttled.
+	const uint16_t INITIAL_INHIBIT_TIME = 10;
+
+	/// SubmitRead() of the master, which reports the exception thrown if e.g. the node is not configured through the confirmation.
+	template<class T, class F>
+	void submitRead(DCFConfigMaster& master, uint8_t id, uint16_t idx, uint8_t subidx, F con)
+	{
+		try
+		{
+			master.SubmitRead<T>(id, idx, subidx, con);
+		}
+		catch (const std::system_error& error)
+		{
+			con(id, idx, subidx, error.code(), T());
+		}
+	}
+
+	/// SubmitWrite() of the master, with the error handling of submitRead().
+	template<class T, class F>
+	void submitWrite(DCFConfigMaster& master, uint8_t id, uint16_t idx, uint8_t subidx, T value, F con)
+	{
+		try
+		{
+			master.SubmitWrite<T>(id, idx, subidx, std::move(value), con);
+		}
+		catch (const std::system_error& error)
+		{
+			con(id, idx, subidx, error.code());
+		}
+	}
+}
+
+TpdoRateController::TpdoRateController(DCFConfigMaster &master, std::shared_ptr<const BusLoadMonitor> monitor) :
+	m_master(master),
+	m_monitor(std::move(monitor))
+{
+}
+
+void TpdoRateController::addLimit(const TpdoRateController::Limit &limit)
+{
+	TpdoState state;
+	state.limit = limit;
+	state.known = false;
+	state.supported = true;
+	state.cobID = 0;
+	state.inhibitTime = 0;
+	state.eventTimer = 0;
+	state.throttled = false;
+	state.originalInhibitTime = 0;
+	state.originalEventTimer = 0;
+	m_tpdos.push_back(state);
+}
+
+void TpdoRateController::reset(uint8_t nodeID)
+{
+	for (auto& state : m_tpdos)
+	{
+		if (nodeID == 0 || state.limit.nodeID == nodeID)
+		{
+			state.known = false;
+			state.supported = true;
+			state.throttled = false;  // The slave got the values of its configuration again.
+		}
+	}
+}
+
+void TpdoRateController::evaluate()
+{
+	if (m_busy)
+		return;
+
+	for (size_t i = 0; i < m_tpdos.size(); i++)
+	{
+		if (m_tpdos[i].supported && !m_tpdos[i].known)
+		{
+			readState(i);
+			return;
+		}
+	}
+
+	double busLoad = m_monitor->getBusLoad();
+	int selected = -1;
+	if (busLoad > m_throttleAbove)
+	{
+		// The least important TPDO first, of those the one which sends the most.
+		for (size_t i = 0; i < m_tpdos.size(); i++)
+		{
+			const auto& state = m_tpdos[i];
+			bool throttleable = state.inhibitTime < state.limit.maxInhibitTime || (state.eventTimer != 0 && state.eventTimer < state.limit.maxEventTimer);
+			if (!state.supported || !throttleable)
+				continue;
+			if (selected < 0 || state.limit.priority > m_tpdos[selected].limit.priority ||
+					(state.limit.priority == m_tpdos[selected].limit.priority &&
+					 m_monitor->getFrameRate(state.cobID & 0x1FFFFFFF) > m_monitor->getFrameRate(m_tpdos[selected].cobID & 0x1FFFFFFF)))
+				selected = i;
+		}
+		if (selected < 0)
+			return;  // Everything is already throttled as far as allowed.
+
+		auto& state = m_tpdos[selected];
+		if (!state.throttled)
+		{
+			state.throttled = true;
+			state.originalInhibitTime = state.inhibitTime;
+			state.originalEventTimer = state.eventTimer;
+		}
+		uint16_t inhibitTime = std::min<uint32_t>(std::max<uint32_t>({2u * state.inhibitTime, state.limit.minInhibitTime, INITIAL_INHIBIT_TIME}), state.limit.maxInhibitTime);
+		uint16_t eventTimer = state.eventTimer == 0 ? 0 : std::min<uint32_t>(std::max<uint32_t>(2u * state.eventTimer, state.limit.minEventTimer), state.limit.maxEventTimer);
+		diag(DIAG_INFO, 0, "Bus load %.1f %%: Throttling TPDO %d of node 0x%02x", busLoad * 100, state.limit.tpdo, state.limit.nodeID);
+		adjust(selected, std::max(inhibitTime, state.inhibitTime), eventTimer);
+	}
+	else if (busLoad < m_restoreBelow)
+	{
+		// The most important TPDO first.
+		for (size_t i = 0; i < m_tpdos.size(); i++)
+		{
+			const auto& state = m_tpdos[i];
+			if (state.supported && state.throttled && (selected < 0 || state.limit.priority < m_tpdos[selected].limit.priority))
+				selected = i;
+		}
+		if (selected < 0)
+			return;
+
+		const auto& state = m_tpdos[selected];
+		// Back to the values read from the slave, never faster than configured.
+		uint16_t inhibitTime = state.inhibitTime / 2 < std::max(state.originalInhibitTime, INITIAL_INHIBIT_TIME) ? state.originalInhibitTime : state.inhibitTime / 2;
+		uint16_t eventTimer = state.eventTimer == 0 ? 0 : std::max<uint16_t>(state.eventTimer / 2, state.originalEventTimer);
+		diag(DIAG_INFO, 0, "Bus load %.1f %%: Restoring TPDO %d of node 0x%02x", busLoad * 100, state.limit.tpdo, state.limit.nodeID);
+		adjust(selected, inhibitTime, eventTimer);
+	}
+}
+
+void TpdoRateController::readState(size_t i)
+{
+	m_busy = true;
+	const auto& limit = m_tpdos[i].limit;
+	uint16_t communicationIndex = 0x1800 + limit.tpdo - 1;
+	submitRead<uint32_t>(m_master, limit.nodeID, communicationIndex, 1, [this, i](uint8_t id, uint16_t idx, uint8_t /* subidx */, std::error_code ec, uint32_t cobID)
+	{
+		if (ec)
+		{
+			failAdjustment(i, 1, ec);
+			return;
+		}
+		m_tpdos[i].cobID = cobID;
+
+		// The inhibit time and the event timer are optional, missing ones are treated as disabled.
+		submitRead<uint16_t>(m_master, id, idx, 3, [this, i](uint8_t id, uint16_t idx, uint8_t /* subidx */, std::error_code ec, uint16_t inhibitTime)
+		{
+			m_tpdos[i].inhibitTime = ec ? 0 : inhibitTime;
+			submitRead<uint16_t>(m_master, id, idx, 5, [this, i](uint8_t /* id */, uint16_t /* idx */, uint8_t /* subidx */, std::error_code ec, uint16_t eventTimer)
+			{
+				auto& state = m_tpdos[i];
+				state.eventTimer = ec ? 0 : eventTimer;
+				state.known = true;
+				m_busy = false;
+				diag(DIAG_INFO, 0, "Node 0x%02x TPDO %d: COB ID 0x%x, inhibit time %d x 100us, event timer %d ms", state.limit.nodeID, state.limit.tpdo,
+					 state.cobID, state.inhibitTime, state.eventTimer);
+			});
+		});
+	});
+}
+
+void TpdoRateController::adjust(size_t i, uint16_t inhibitTime, uint16_t eventTimer)
+{
+	auto& state = m_tpdos[i];
+	if (inhibitTime == state.inhibitTime)
+	{
+		writeEventTimer(i, eventTimer);
+		return;
+	}
+
+	m_busy = true;
+	uint8_t nodeID = state.limit.nodeID;
+	uint16_t communicationIndex = 0x1800 + state.limit.tpdo - 1;
+	uint32_t originalCobID = state.cobID;
+	if (originalCobID & 0x80000000)
+	{
+		// An invalid PDO may be changed directly, it stays invalid.
+		submitWrite<uint16_t>(m_master, nodeID, communicationIndex, 3, inhibitTime, [this, i, inhibitTime, eventTimer](uint8_t, uint16_t, uint8_t, std::error_code ec)
+		{
+			if (ec)
+			{
+				failAdjustment(i, 3, ec);
+				return;
+			}
+			m_tpdos[i].inhibitTime = inhibitTime;
+			writeEventTimer(i, eventTimer);
+		});
+		return;
+	}
+
+	// The inhibit time must not be changed while the PDO exists (CiA-301, 7.5.2.35), so it is invalidated meanwhile.
+	submitWrite<uint32_t>(m_master, nodeID, communicationIndex, 1, originalCobID | 0x80000000, [this, i, inhibitTime, eventTimer, originalCobID](uint8_t id, uint16_t idx, uint8_t /* subidx */, std::error_code ec)
+	{
+		if (ec)
+		{
+			failAdjustment(i, 1, ec);
+			return;
+		}
+		submitWrite<uint16_t>(m_master, id, idx, 3, inhibitTime, [this, i, inhibitTime, eventTimer, originalCobID](uint8_t id, uint16_t idx, uint8_t /* subidx */, std::error_code inhibitTimeError)
+		{
+			// Restore the original COB ID in any case.
+			submitWrite<uint32_t>(m_master, id, idx, 1, originalCobID, [this, i, inhibitTime, eventTimer, inhibitTimeError](uint8_t id, uint16_t, uint8_t, std::error_code ec)
+			{
+				// A change of an event driven TPDO while it was invalid was never sent: the driver reads its inputs again.
+				auto driver = m_master.getDriver(id);
+				if (driver != nullptr)
+					lely::ev::Executor(driver->GetExecutor()).post([driver]() {driver->resynchronizeInputs();});
+
+				if (inhibitTimeError || ec)
+				{
+					failAdjustment(i, inhibitTimeError ? 3 : 1, inhibitTimeError ? inhibitTimeError : ec);
+					return;
+				}
+				m_tpdos[i].inhibitTime = inhibitTime;
+				writeEventTimer(i, eventTimer);
+			});
+		});
+	});
+}
+
+void TpdoRateController::writeEventTimer(size_t i, uint16_t eventTimer)
+{
+	auto& state = m_tpdos[i];
+	if (eventTimer == state.eventTimer)
+	{
+		m_busy = false;
+		if (state.throttled && state.inhibitTime <= state.originalInhibitTime && state.eventTimer <= state.originalEventTimer)
+			state.throttled = false;
+		diag(DIAG_INFO, 0, "Node 0x%02x TPDO %d: inhibit time %d x 100us, event timer %d ms", state.limit.nodeID, state.limit.tpdo, state.inhibitTime, state.eventTimer);
+		return;
+	}
+
+	m_busy = true;
+	submitWrite<uint16_t>(m_master, state.limit.nodeID, 0x1800 + state.limit.tpdo - 1, 5, eventTimer, [this, i, eventTimer](uint8_t, uint16_t, uint8_t, std::error_code ec)
+	{
+		if (ec)
+		{
+			failAdjustment(i, 5, ec);
+			return;
+		}
+		m_tpdos[i].eventTimer = eventTimer;
+		writeEventTimer(i, eventTimer);
+	});
+}
+
+void TpdoRateController::failAdjustment(size_t i, uint16_t subIndex, const std::error_code &error)
+{
+	// Probably the slave does not support the object, so it is not touched again until reset().
+	auto& state = m_tpdos[i];
+	state.supported = false;
+	m_busy = false;
+	diag(DIAG_WARNING, 0, "Node 0x%02x TPDO %d: Cannot access 0x%04x/0x%02x: %s. The TPDO is not adapted anymore.",
+		 state.limit.nodeID, state.limit.tpdo, 0x1800 + state.limit.tpdo - 1, subIndex, error.message().c_str());
+}
@@ -0,0 +1,568 @@
+/**@file
+ * This file is part of the LelyIntegrationTest project;
+ * it contains the tests of the LelyIntegration library which run without a CAN bus.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include <lely/coapp/sdo_error.hpp>
+
+#include "AxisTable.h"
+#include "BusLoadAnalyzer.h"
+#include "BusLoadMonitor.h"
+#include "CanTxScheduler.h"
+#include "DCFDriverConfig.h"
+#include "ParameterSnapshot.h"
+#include "PdoLayout.h"
+#include "PdoLayoutOptimizer.h"
+#include "RealtimeProfile.h"
+#include "SdoTimeoutPolicy.h"
+#include "SeqLock.h"
+#include "TimerWheel.h"
+
+namespace
+{
+	int failures = 0;
+
+	void check(bool condition, const char* description)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", description);
+			failures++;
+		}
+	}
+
+	bool isClose(double value, double expected)
+	{
+		return std::fabs(value - expected) < 1e-9;
+	}
+
+	bool contains(const std::vector<ParameterSnapshot::Entry>& entries, uint16_t index, uint8_t subIndex)
+	{
+		return std::any_of(entries.begin(), entries.end(), [index, subIndex](const ParameterSnapshot::Entry& entry)
+		{
+			return entry.index == index && entry.subIndex == subIndex;
+		});
+	}
+
+	void testConfigurationParameters()
+	{
+		for (uint16_t index : {0x6040, 0x6060, 0x6071, 0x607A, 0x60FF})
+			check(!ParameterSnapshot::isConfigurationParameter(index), "The set points of CiA-402 are no configuration parameters");
+		for (uint16_t index : {0x605A, 0x6065, 0x607C, 0x607D, 0x607E, 0x607F, 0x6091, 0x6098, 0x6099, 0x609A, 0x60C0, 0x60C5})
+			check(ParameterSnapshot::isConfigurationParameter(index), "The configuration of CiA-402 is a configuration parameter");
+		check(!ParameterSnapshot::isConfigurationParameter(0x1010), "Store parameters is no configuration parameter");
+		check(!ParameterSnapshot::isConfigurationParameter(0xA000), "Network variables are no configuration parameters");
+		check(ParameterSnapshot::isConfigurationParameter(0x1017), "The producer heartbeat time is a configuration parameter");
+		check(ParameterSnapshot::isConfigurationParameter(0x2000), "Manufacturer specific objects are configuration parameters");
+		check(ParameterSnapshot::isConfigurationParameter(0x6402), "The motor type is a configuration parameter");
+	}
+
+	void testAllIdle()
+	{
+		AxisTable table;
+		check(!table.allIdle(), "An empty axis table is not idle");
+
+		size_t slot2 = table.addAxis(2);
+		size_t slot3 = table.addAxis(3);
+		table.setStatusWord(slot2, 0x0427);  // operation enabled, target reached
+		check(!table.allIdle(), "An axis without status word is not idle");
+		table.setStatusWord(slot3, 0x0421);  // ready to switch on, target reached
+		check(!table.allIdle(), "An axis which is not switched on is not idle");
+		table.setStatusWord(slot3, 0x0423);  // switched on, target reached
+		check(table.allIdle(), "A switched on axis with the target reached is idle");
+		table.setStatusWord(slot3, 0x0427);
+		check(table.allIdle(), "All axes operation enabled with the target reached are idle");
+		table.setStatusWord(slot3, 0x042F);  // fault reaction active
+		check(!table.allIdle(), "A faulty axis is not idle");
+		table.setStatusWord(slot3, 0x0427);
+		table.setStatusWord(slot3, 0x0027);
+		check(!table.allIdle(), "A moving axis is not idle");
+	}
+
+	/// Advances the wheel from expiry to expiry like its owner, who only wakes up for getNextExpiry().
+	void advanceWheel(TimerWheel& wheel, uint64_t tick)
+	{
+		while (wheel.getNextExpiry() <= tick)
+			wheel.advanceTo(wheel.getNextExpiry());
+		wheel.advanceTo(tick);
+	}
+
+	void testTimerWheel()
+	{
+		TimerWheel wheel(std::chrono::milliseconds(1));
+		check(wheel.getNextExpiry() == UINT64_MAX, "An empty timer wheel has no next expiry");
+
+		std::vector<uint64_t> expiries;
+		auto record = [&wheel, &expiries]() {expiries.push_back(wheel.getTime());};
+
+		// A long timer on level 1 expires before a short timer started later on level 0.
+		wheel.start(std::chrono::milliseconds(99), record);
+		wheel.advanceTo(60);
+		wheel.start(std::chrono::milliseconds(59), record);
+		check(wheel.getNextExpiry() <= 100, "The next expiry includes the timers of the higher levels");
+		advanceWheel(wheel, 200);
+		check(expiries == std::vector<uint64_t>({100, 120}), "Timers started on different levels expire in order and in time");
+
+		// Timers beyond the range of level 1 are moved down level by level.
+		expiries.clear();
+		wheel.start(std::chrono::milliseconds(5000), record);
+		wheel.start(std::chrono::milliseconds(3), record);
+		advanceWheel(wheel, 6000);
+		check(expiries == std::vector<uint64_t>({204, 5201}), "Timers expire one tick after their delay");
+		check(wheel.empty(), "Expired timers are not running");
+
+		// A canceled timer does not expire, an outdated ID does not cancel the successor of the timer.
+		expiries.clear();
+		TimerWheel::TimerID canceled = wheel.start(std::chrono::milliseconds(10), record);
+		check(wheel.cancel(canceled), "A running timer is canceled");
+		check(!wheel.cancel(canceled), "A timer is canceled once");
+		TimerWheel::TimerID successor = wheel.start(std::chrono::milliseconds(10), record);
+		check(!wheel.cancel(canceled), "An outdated ID does not cancel the successor");
+		advanceWheel(wheel, 6100);
+		check(expiries == std::vector<uint64_t>({6011}), "Only the successor expires");
+		check(!wheel.cancel(successor), "An expired timer is not canceled");
+	}
+
+	/// Runs the action once to set up its structures, then checks that running it again does not allocate.
+	template<class Action>
+	void checkNoAllocation(Action action, const char* description)
+	{
+		action();
+		size_t allocations = RealtimeProfile::getCheckedAllocations();
+		RealtimeProfile::armAllocationCheck();
+		action();
+		RealtimeProfile::disarmAllocationCheck();
+		check(RealtimeProfile::getCheckedAllocations() == allocations, description);
+	}
+
+	void testSteadyStateAllocations()
+	{
+		check(RealtimeProfile::isAllocationCheckAvailable(), "The allocation check is linked into the tests");
+
+		TimerWheel wheel(std::chrono::milliseconds(1));
+		wheel.reserve(16);
+		int expired = 0;
+		checkNoAllocation([&wheel, &expired]()
+		{
+			for (int i = 0; i < 16; i++)
+				wheel.start(std::chrono::milliseconds(i * 10), [&expired]() {expired++;});
+			wheel.cancel(wheel.start(std::chrono::milliseconds(5000), [&expired]() {expired++;}));
+			wheel.advanceTo(wheel.getTime() + 200);
+		}, "A cycle of the timer wheel does not allocate");
+		check(expired == 32, "The timers of both cycles expired");
+
+		AxisTable table;
+		size_t slot2 = table.addAxis(2);
+		size_t slot3 = table.addAxis(3);
+		bool idle = false;
+		checkNoAllocation([&table, slot2, slot3, &idle]()
+		{
+			table.setStatusWord(slot2, 0x0427);
+			table.setStatusWord(slot3, 0x0027);
+			table.setPosition(slot2, 1000);
+			table.setFollowingError(slot3, -20);
+			size_t slot;
+			idle = table.allIdle() || table.anyFault() || table.getMaxFollowingError(&slot) != 20;
+		}, "A cycle of the axis table does not allocate");
+		check(!idle, "The axis table reports the moving axis");
+
+		BusLoadMonitor monitor(500000);
+		auto now = std::chrono::steady_clock::now();
+		checkNoAllocation([&monitor, &now]()
+		{
+			for (uint32_t cobID : {0x080, 0x182, 0x183, 0x202, 0x203, 0x582, 0x602})
+				monitor.countFrame(cobID, 8);
+			now += std::chrono::milliseconds(100);
+			monitor.update(now);
+		}, "A window of the bus load monitor with known COB IDs does not allocate");
+
+		typedef PdoLayout<PdoObject<0x6041, 0, uint16_t>, PdoObject<0x6064, 0, int32_t>> StatusPdo;
+		uint8_t frame[StatusPdo::size];
+		uint16_t statusWord = 0;
+		int32_t position = 0;
+		checkNoAllocation([&frame, &statusWord, &position]()
+		{
+			StatusPdo::pack(frame, 0x0427, -1000);
+			StatusPdo::unpack(frame, statusWord, position);
+		}, "Packing and unpacking a PDO does not allocate");
+	}
+
+	void testPdoLayout()
+	{
+		typedef PdoLayout<PdoObject<0x6040, 0, uint16_t>, PdoObject<0x6060, 0, int8_t>, PdoObject<0x607A, 0, int32_t>> ControlPdo;
+		check(ControlPdo::size == 7, "The size of a PDO is the sum of its objects");
+		check(ControlPdo::getMapping() == std::vector<uint32_t>({0x60400010, 0x60600008, 0x607A0020}), "The mapping entries follow the objects");
+		check(ControlPdo::matches({0x60400010, 0x60600008, 0x607A0020}), "The configured mapping matches the layout");
+		check(!ControlPdo::matches({0x60400010, 0x607A0020, 0x60600008}), "A mapping in another order does not match");
+		check(!ControlPdo::matches({0x60400010, 0x60600008}), "A mapping with missing objects does not match");
+
+		uint8_t frame[8] = {};
+		ControlPdo::pack(frame, 0x010F, -3, 0x12345678);
+		const uint8_t expected[7] = {0x0F, 0x01, 0xFD, 0x78, 0x56, 0x34, 0x12};
+		check(std::equal(expected, expected + 7, frame), "The values are packed little endian without gaps");
+
+		uint16_t controlWord = 0;
+		int8_t mode = 0;
+		int32_t targetPosition = 0;
+		ControlPdo::unpack(frame, controlWord, mode, targetPosition);
+		check(controlWord == 0x010F && mode == -3 && targetPosition == 0x12345678, "Unpacking returns the packed values");
+
+		typedef PdoLayout<PdoObject<0x2000, 1, float>, PdoObject<0x2000, 2, int32_t>> FloatPdo;
+		float velocity = 0;
+		int32_t position = 0;
+		FloatPdo::pack(frame, -1.5f, -100000);
+		FloatPdo::unpack(frame, velocity, position);
+		check(velocity == -1.5f && position == -100000, "Floating point and negative values survive a round trip");
+	}
+
+	const PdoLayoutOptimizer::Pdo* findPdo(const PdoLayoutOptimizer::Layout& layout, uint8_t nodeID, bool isRpdo, uint16_t number)
+	{
+		for (const auto& pdo : layout.pdos)
+			if (pdo.nodeID == nodeID && pdo.isRpdo == isRpdo && pdo.number == number)
+				return &pdo;
+		return nullptr;
+	}
+
+	PdoLayoutOptimizer::Axis createAxis(uint8_t nodeID)
+	{
+		PdoLayoutOptimizer::Axis axis;
+		axis.nodeID = nodeID;
+		axis.signals = {
+			{"Control Word", 0x6040, 0, 16, true, 1, 0},
+			{"Target Position", 0x607A, 0, 32, true, 1, 0},
+			{"Modes of Operation", 0x6060, 0, 8, true, 10, 0},
+			{"Status Word", 0x6041, 0, 16, false, 1, 0},
+			{"Position Actual Value", 0x6064, 0, 32, false, 1, 0},
+			{"Error Register", 0x1001, 0, 8, false, 100, 0},
+		};
+		return axis;
+	}
+
+	void testPdoLayoutOptimizer()
+	{
+		std::error_code error;
+		PdoLayoutOptimizer optimizer(500000);
+		optimizer.addAxis(createAxis(2));
+		auto layout = optimizer.optimize(error);
+		check(!error, "The signals of an axis fit into its PDOs");
+		check(layout.pdos.size() == 4, "The signals are packed into one PDO per direction and rate");
+
+		auto rpdo1 = findPdo(layout, 2, true, 1);
+		auto tpdo1 = findPdo(layout, 2, false, 1);
+		auto rpdo2 = findPdo(layout, 2, true, 2);
+		auto tpdo2 = findPdo(layout, 2, false, 2);
+		check(rpdo1 != nullptr && rpdo1->getMapping() == std::vector<uint32_t>({0x607A0020, 0x60400010}) && rpdo1->getSize() == 6,
+			  "The fast RPDO holds the big signals first");
+		check(tpdo1 != nullptr && tpdo1->getMapping() == std::vector<uint32_t>({0x60640020, 0x60410010}), "The fast TPDO holds the fast signals");
+		check(rpdo2 != nullptr && rpdo2->getMapping() == std::vector<uint32_t>({0x60600008}) && rpdo2->periodMs == 10, "The slow RPDO holds the slow signal");
+		check(tpdo2 != nullptr && tpdo2->getMapping() == std::vector<uint32_t>({0x10010008}) && tpdo2->periodMs == 100, "The slow TPDO holds the slow signal");
+		if (rpdo1 != nullptr && tpdo1 != nullptr && rpdo2 != nullptr && tpdo2 != nullptr)
+		{
+			check(rpdo1->cobID == 0x181 && tpdo1->cobID == 0x182 && rpdo2->cobID == 0x183 && tpdo2->cobID == 0x184,
+				  "The most urgent PDOs get the lowest COB IDs, the commands before the answers");
+		}
+		// 6 bytes: 115 bits every 1 ms, 1 byte: 65 bits every 10 ms and every 100 ms at 500 kbit/s.
+		check(isClose(layout.busLoad, 2 * 115 / 500.0 + 65 / 5000.0 + 65 / 50000.0), "The bus load is the worst case of all PDOs");
+
+		std::string dcf = PdoLayoutOptimizer::toDcfFragment(layout, 2);
+		check(dcf.find("[1400sub1]") != std::string::npos && dcf.find("ParameterValue=0x181") != std::string::npos, "The DCF fragment holds the COB IDs");
+		check(dcf.find("[1A00sub1]") != std::string::npos && dcf.find("ParameterValue=0x60640020") != std::string::npos, "The DCF fragment holds the mapping");
+		check(dcf.find("[1801sub5]") != std::string::npos && dcf.find("ParameterValue=100") != std::string::npos, "The TPDOs are sent by the event timer");
+
+		// With one RPDO the slow signal is sent with the fast ones.
+		PdoLayoutOptimizer limited(500000);
+		auto axis = createAxis(2);
+		axis.maxRpdos = 1;
+		limited.addAxis(axis);
+		layout = limited.optimize(error);
+		rpdo1 = findPdo(layout, 2, true, 1);
+		check(!error && findPdo(layout, 2, true, 2) == nullptr, "The RPDOs are merged to fit the device");
+		check(rpdo1 != nullptr && rpdo1->getMapping().size() == 3 && rpdo1->periodMs == 1, "The merged RPDO is sent at the faster rate");
+
+		axis.maxTpdos = 1;
+		axis.signals.push_back({"Velocity Actual Value", 0x606C, 0, 32, false, 10, 0});
+		PdoLayoutOptimizer tooSmall(500000);
+		tooSmall.addAxis(axis);
+		tooSmall.optimize(error);
+		check(error == std::errc::no_buffer_space, "Signals which do not fit into the PDOs of the device are an error");
+
+		// A following node receives the RPDOs of its leader.
+		PdoLayoutOptimizer group(500000);
+		group.addAxis(createAxis(2));
+		auto follower = createAxis(3);
+		follower.leaderNodeID = 2;
+		group.addAxis(follower);
+		layout = group.optimize(error);
+		auto followerRpdo = findPdo(layout, 3, true, 1);
+		check(!error && followerRpdo != nullptr && followerRpdo->cobID == 0x181, "A following node shares the RPDOs of its leader");
+		auto followerTpdo = findPdo(layout, 3, false, 1);
+		check(followerTpdo != nullptr && followerTpdo->cobID != 0x182, "A following node sends its own TPDOs");
+
+		follower.signals.push_back({"Target Velocity", 0x60FF, 0, 32, true, 1, 0});
+		PdoLayoutOptimizer unsharedGroup(500000);
+		unsharedGroup.addAxis(createAxis(2));
+		unsharedGroup.addAxis(follower);
+		unsharedGroup.optimize(error);
+		check(error == std::errc::invalid_argument, "A following node cannot receive a signal its leader does not receive");
+
+		PdoLayoutOptimizer overloaded(125000);
+		PdoLayoutOptimizer::Axis fastAxis;
+		fastAxis.nodeID = 4;
+		fastAxis.signals = {{"Position Actual Value", 0x6064, 0, 64, false, 0.5, 0}};
+		overloaded.addAxis(fastAxis);
+		overloaded.optimize(error);
+		check(error == std::errc::value_too_large, "A layout which overloads the bus is an error");
+
+		PdoLayoutOptimizer narrowRange(500000);
+		narrowRange.addAxis(createAxis(2));
+		narrowRange.setCobIDRange(0x181, 0x183);
+		narrowRange.optimize(error);
+		check(error == std::errc::result_out_of_range, "More PDOs than COB IDs are an error");
+	}
+
+	void testBusLoadAnalysis()
+	{
+		// Davis et al. (2007): 135 bits for 8 data bytes, 55 bits without data, 160 bits for an extended frame with 8 data bytes.
+		check(isClose(BusLoadAnalyzer::getFrameTime(1000000, 8, false), 135e-6), "The frame time includes the worst case stuff bits");
+		check(isClose(BusLoadAnalyzer::getFrameTime(1000000, 0, false), 55e-6), "The frame time of an empty frame");
+		check(isClose(BusLoadAnalyzer::getFrameTime(500000, 8, true), 320e-6), "The frame time of an extended frame");
+
+		// Three frames of 0.135 ms every 1 ms, added in reverse order of priority.
+		BusLoadAnalyzer analyzer(1000000);
+		analyzer.addMessage({0x300, false, 8, 1, 0, "low", 0, 0, false});
+		analyzer.addMessage({0x200, false, 8, 1, 0, "medium", 0, 0, false});
+		analyzer.addMessage({0x100, false, 8, 1, 0, "high", 0, 0, false});
+		auto result = analyzer.analyze();
+		check(result.messages.size() == 3 && result.messages[0].cobID == 0x100 && result.messages[2].cobID == 0x300, "The messages are sorted by priority");
+		check(isClose(result.framesPerSecond, 3000) && isClose(result.utilization, 0.405), "The bus load is the sum of all messages");
+		check(result.schedulable, "A bus with 40 % load is schedulable");
+		if (result.messages.size() == 3)
+		{
+			// The highest priority is blocked by one lower priority frame, the lowest one waits for both higher ones.
+			check(isClose(result.messages[0].responseTimeMs, 0.270), "The response time of the highest priority includes the blocking");
+			check(isClose(result.messages[1].responseTimeMs, 0.405), "The response time includes the interference of higher priorities");
+			check(isClose(result.messages[2].responseTimeMs, 0.405), "The lowest priority is not blocked");
+		}
+
+		analyzer.addMessage({0x400, false, 8, 1, 0.3, "short deadline", 0, 0, false});
+		result = analyzer.analyze();
+		check(!result.schedulable && !result.messages.back().schedulable, "A message which misses its deadline is not schedulable");
+
+		BusLoadAnalyzer overloaded(125000);
+		overloaded.addMessage({0x100, false, 8, 1, 0, "fast", 0, 0, false});
+		overloaded.addMessage({0x200, false, 8, 1, 0, "starved", 0, 0, false});
+		result = overloaded.analyze();
+		check(result.utilization > 1.0 && std::isinf(result.messages.back().responseTimeMs), "The response time on an overloaded bus is unbounded");
+	}
+
+	void testSdoTimeoutPolicy()
+	{
+		SdoTimeoutPolicy policy(std::chrono::milliseconds(100));
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(100), "Without adaptation the initial timeout is used");
+
+		policy.setAdaptive(std::chrono::milliseconds(20), std::chrono::milliseconds(10000), 1.0);
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(20), "A node which never answered gets the lower bound");
+		policy.setProbeTimeout(std::chrono::milliseconds(5));
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(5), "A node which never answered gets the probe timeout");
+
+		// The first answer after 40 ms, the next ones immediately: about 27 ms mean and 25 ms deviation.
+		auto now = std::chrono::steady_clock::now();
+		policy.addResult(2, now - std::chrono::milliseconds(40), std::error_code());
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(100), "A node with few answers gets the initial timeout");
+		for (int i = 0; i < 3; i++)
+			policy.addResult(2, std::chrono::steady_clock::now(), std::error_code());
+		SdoTimeoutPolicy::Statistics statistics;
+		check(policy.getStatistics(2, statistics) && statistics.samples == 4 && statistics.maxRoundTripTime >= std::chrono::milliseconds(40),
+			  "The round trips are measured");
+		auto timeout = policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION);
+		check(timeout > std::chrono::milliseconds(20) && timeout < std::chrono::milliseconds(100), "The timeout follows the measured round trip time");
+
+		policy.addResult(2, std::chrono::steady_clock::now(), lely::canopen::SdoErrc::TIMEOUT);
+		auto backoff = policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION);
+		check(backoff >= 2 * timeout - std::chrono::milliseconds(1) && backoff <= 2 * timeout, "A timeout doubles the timeout");
+		for (int i = 0; i < 3; i++)
+			policy.addResult(2, std::chrono::steady_clock::now(), lely::canopen::SdoErrc::TIMEOUT);
+		backoff = policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION);
+		policy.addResult(2, std::chrono::steady_clock::now(), lely::canopen::SdoErrc::TIMEOUT);
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == backoff, "The doubling is limited");
+		policy.setAdaptive(std::chrono::milliseconds(20), std::chrono::milliseconds(50), 1.0);
+		check(policy.getTimeout(2, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(50), "The timeout is limited by the upper bound");
+		check(policy.getStatistics(2, statistics) && statistics.timeouts == 5 && statistics.samples == 4, "Timeouts are no samples");
+
+		// Node 3 answered, node 4 never did.
+		policy.addResult(3, std::chrono::steady_clock::now(), std::error_code());
+		check(!policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 0, lely::canopen::SdoErrc::NO_OBJ), "An abort because of the request is not retried");
+		check(!policy.shouldRetry(4, SdoTimeoutPolicy::CONFIGURATION, 0, lely::canopen::SdoErrc::TIMEOUT), "A node which never answered is not retried");
+		check(policy.shouldRetry(4, SdoTimeoutPolicy::DIAGNOSTICS, 2, lely::canopen::SdoErrc::DATA_DEV), "An abort because of the state of the node is retried");
+		check(!policy.shouldRetry(4, SdoTimeoutPolicy::DIAGNOSTICS, 3, lely::canopen::SdoErrc::DATA_DEV), "The retries are bounded per class");
+		check(!policy.shouldRetry(3, SdoTimeoutPolicy::MOTION, 0, lely::canopen::SdoErrc::TIMEOUT), "Motion commands are not retried");
+		check(policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 0, lely::canopen::SdoErrc::TIMEOUT), "A configuration request is retried after a timeout");
+		check(policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 1, lely::canopen::SdoErrc::TIMEOUT), "A configuration request is retried twice");
+		check(!policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 2, lely::canopen::SdoErrc::TIMEOUT), "A configuration request is retried twice only");
+		check(!policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 0, lely::canopen::SdoErrc::TIMEOUT), "A node which did not answer the retries is missing");
+		check(policy.getTimeout(3, SdoTimeoutPolicy::CONFIGURATION) == std::chrono::milliseconds(5), "A missing node gets the probe timeout");
+		policy.addResult(3, std::chrono::steady_clock::now(), std::error_code());
+		check(policy.shouldRetry(3, SdoTimeoutPolicy::CONFIGURATION, 0, lely::canopen::SdoErrc::TIMEOUT), "A missing node which answers again is retried");
+		check(policy.getStatistics(3, statistics) && statistics.retries == 3, "The retries are counted");
+	}
+
+	int recordFrame(const can_msg* msg, void* data)
+	{
+		static_cast<std::vector<uint32_t>*>(data)->push_back(msg->id);
+		return 0;
+	}
+
+	void sendFrame(can_net_t* net, uint32_t cobID)
+	{
+		can_msg msg = CAN_MSG_INIT;
+		msg.id = cobID;
+		msg.len = 8;
+		can_net_send(net, &msg);
+	}
+
+	void testCanTxScheduler()
+	{
+		std::shared_ptr<can_net_t> net(can_net_create(), can_net_destroy);
+		std::vector<uint32_t> sentFrames;
+		can_net_set_send_func(net.get(), &recordFrame, &sentFrames);
+		{
+			std::vector<std::chrono::microseconds> releaseRequests;
+			CanTxScheduler scheduler(net.get(), [&releaseRequests](std::chrono::microseconds delay) {releaseRequests.push_back(delay);});
+			scheduler.addMotionCobID(0x201);
+			// 10 SDO frames per second: the token of the third frame takes 100 ms.
+			scheduler.setSdoRate(10, 2);
+			for (uint32_t cobID : {0x601, 0x601, 0x601, 0x080, 0x201, 0x701})
+				sendFrame(net.get(), cobID);
+			check(sentFrames == std::vector<uint32_t>({0x601, 0x601, 0x080, 0x201, 0x701}), "SDO requests beyond the burst wait, the other frames pass");
+			check(scheduler.getQueuedFrames(CanTxScheduler::SDO) == 1, "The SDO request waits in its queue");
+			check(releaseRequests.size() == 1 && releaseRequests[0] > std::chrono::milliseconds(50) && releaseRequests[0] <= std::chrono::milliseconds(100),
+				  "The release is requested when the next token is available");
+
+			scheduler.release(std::chrono::steady_clock::now() + std::chrono::milliseconds(200));
+			check(sentFrames.size() == 6 && sentFrames.back() == 0x601, "The waiting SDO request is sent on release");
+			auto statistics = scheduler.getStatistics(CanTxScheduler::SDO);
+			check(statistics.frames == 3 && statistics.queuedFrames == 1 && statistics.maxLatency >= std::chrono::milliseconds(200), "The queueing latency is measured");
+			check(scheduler.getStatistics(CanTxScheduler::MOTION).frames == 2, "SYNC and PDOs are motion frames");
+
+			// Non-cyclic frames wait for the gap after the SYNC window.
+			sentFrames.clear();
+			scheduler.setSdoRate(0, 1);
+			scheduler.setSyncGap(0x080, std::chrono::milliseconds(100), std::chrono::milliseconds(50), std::chrono::milliseconds(10));
+			for (uint32_t cobID : {0x080, 0x701, 0x601, 0x201})
+				sendFrame(net.get(), cobID);
+			check(sentFrames == std::vector<uint32_t>({0x080, 0x201}), "Only motion frames are sent in the SYNC window");
+			scheduler.release(std::chrono::steady_clock::now() + std::chrono::milliseconds(60));
+			check(sentFrames == std::vector<uint32_t>({0x080, 0x201, 0x701, 0x601}), "Service frames are sent before SDO requests in the gap");
+		}
+
+		can_send_func_t* send = nullptr;
+		void* data = nullptr;
+		can_net_get_send_func(net.get(), &send, &data);
+		check(send == &recordFrame && data == &sentFrames, "The scheduler restores the send function of the network");
+	}
+
+	struct Sample
+	{
+		uint64_t sequence;
+		double position;
+		double velocity;
+		uint64_t inverted;
+	};
+
+	void testSeqLock()
+	{
+		SeqLock<Sample> lock;
+		check(lock.load().sequence == 0 && lock.getVersion() == 1, "The default value is published on construction");
+		lock.store({1, 1.0, -1.0, ~uint64_t(1)});
+		Sample sample = lock.load();
+		check(sample.sequence == 1 && sample.position == 1.0 && sample.velocity == -1.0 && sample.inverted == ~uint64_t(1), "The stored value is loaded");
+		check(lock.getVersion() == 2, "Every store changes the version");
+
+		// The reader never sees a value the writer is still storing.
+		std::atomic<bool> done{false};
+		std::thread writer([&lock, &done]()
+		{
+			for (uint64_t i = 2; i < 200000; i++)
+				lock.store({i, static_cast<double>(i), -static_cast<double>(i), ~i});
+			done = true;
+		});
+		bool consistent = true;
+		uint64_t last = 0;
+		while (!done)
+		{
+			sample = lock.load();
+			consistent &= sample.position == static_cast<double>(sample.sequence) && sample.velocity == -sample.position
+						  && sample.inverted == ~sample.sequence && sample.sequence >= last;
+			last = sample.sequence;
+		}
+		writer.join();
+		check(consistent, "Concurrent loads return consistent values in order");
+		check(lock.load().sequence == 199999, "The last value is loaded");
+	}
+
+	void testRestorableEntries(const char* dcfFileName)
+	{
+		auto config = std::make_shared<DCFDriverConfig>(dcfFileName, /* binary DCF */ "", 2);
+		ParameterSnapshot snapshot;
+		snapshot.addEntry(2, {0x1017, 0x00, {0xE8, 0x03}});
+		snapshot.addEntry(2, {0x6040, 0x00, {0x0F, 0x00}});
+		snapshot.addEntry(2, {0x607A, 0x00, {0x10, 0x27, 0x00, 0x00}});
+		snapshot.addEntry(2, {0x607D, 0x01, {0x00, 0x00, 0x00, 0x80}});
+
+		auto entries = snapshot.getRestorableEntries(2, *config, false);
+		check(contains(entries, 0x1017, 0x00), "The producer heartbeat time is restored");
+		check(!contains(entries, 0x6040, 0x00), "The control word is never restored");
+		check(!contains(entries, 0x607A, 0x00), "The target position is never restored");
+		check(contains(entries, 0x607D, 0x01), "The software position limits are restored");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::printf("Usage: %s <motor.dcf>\n", argv[0]);
+		return 2;
+	}
+
+	testConfigurationParameters();
+	testAllIdle();
+	testTimerWheel();
+	testSteadyStateAllocations();
+	testPdoLayout();
+	testPdoLayoutOptimizer();
+	testBusLoadAnalysis();
+	testSdoTimeoutPolicy();
+	testCanTxScheduler();
+	testSeqLock();
+	testRestorableEntries(argv[1]);
+
+	if (failures != 0)
+		return 1;
+	std::printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,145 @@
+/**@file
+ * This file is part of the LelyIntegration library;
+ * it contains a command line tool which compares the wakeup latencies of the blocking and the busy-poll event loop.
+ *
+ * @copyright 2019-2020 Bizerba SE & Co. KG
+ *
+ * @author Jonas Lauer <Jonas.Lauer@bizerba.com>
+ * @author Florian Mayer <info@sans-ltd.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include <lely/ev/loop.hpp>
+#include <lely/io2/posix/poll.hpp>
+#include <lely/io2/sys/timer.hpp>
+
+#include "EventLoopRunner.h"
+
+namespace
+{
+	void printUsage(const char* name)
+	{
+		std::cerr << "Usage: " << name << " [options]" << std::endl
+				  << "  -m <mode>           blocking, busy or both (default: both)" << std::endl
+				  << "  -c <core>           core to pin the event loop to (default: not pinned)" << std::endl
+				  << "  -p <us>             period of the timer (default: 1000)" << std::endl
+				  << "  -n <samples>        number of wakeups per mode (default: 10000)" << std::endl
+				  << "Measures the delay between the expiry of a periodic timer and the execution of its callback." << std::endl;
+	}
+
+	/// Runs the loop until the given number of timer callbacks were executed and returns their latencies in us.
+	std::vector<double> measure(EventLoopRunner::Mode mode, int cpu, std::chrono::microseconds period, size_t samples)
+	{
+		lely::io::Context ctx;
+		lely::io::Poll poll(ctx);
+		lely::ev::Loop loop(poll.get_poll());
+		auto exec = loop.get_executor();
+		lely::io::Timer timer(poll, exec, CLOCK_MONOTONIC);
+		EventLoopRunner runner(loop, mode, cpu);
+
+		std::vector<double> latencies;
+		latencies.reserve(samples);
+		// Both use CLOCK_MONOTONIC. The expiry is taken before the timer is set, so the latencies include one system call.
+		auto expiry = std::chrono::steady_clock::now() + period;
+		std::function<void(int, std::error_code)> onExpired = [&](int overrun, std::error_code ec)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (ec)
+			{
+				runner.stop();
+				return;
+			}
+			expiry += period * overrun;
+			latencies.push_back(std::chrono::duration<double, std::micro>(now - expiry).count());
+			expiry += period;
+			if (latencies.size() < samples)
+				timer.submit_wait(exec, onExpired);
+			else
+				runner.stop();
+		};
+		timer.settime(period, period);
+		timer.submit_wait(exec, onExpired);
+		runner.run();
+		return latencies;
+	}
+
+	void print(const char* name, std::vector<double> latencies)
+	{
+		if (latencies.empty())
+			return;
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&latencies](double p)
+		{
+			return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+		};
+		std::cout << boost::format("%-10s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f") % name
+					 % latencies.front() % percentile(0.5) % percentile(0.9) % percentile(0.99) % percentile(0.999) % latencies.back() << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string mode = "both";
+	int cpu = -1;
+	std::chrono::microseconds period(1000);
+	size_t samples = 10000;
+
+	int option;
+	while ((option = getopt(argc, argv, "m:c:p:n:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'm':
+			mode = optarg;
+			break;
+		case 'c':
+			cpu = std::atoi(optarg);
+			break;
+		case 'p':
+			period = std::chrono::microseconds(std::strtoul(optarg, nullptr, 0));
+			break;
+		case 'n':
+			samples = std::strtoul(optarg, nullptr, 0);
+			break;
+		default:
+			printUsage(argv[0]);
+			return option == 'h' ? 0 : 1;
+		}
+	}
+	if ((mode != "blocking" && mode != "busy" && mode != "both") || period.count() <= 0 || samples == 0)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	std::cout << boost::format("Wakeup latency in us of %u timer periods of %d us:") % samples % period.count() << std::endl;
+	std::cout << boost::format("%-10s %8s %8s %8s %8s %8s %8s") % "" % "min" % "p50" % "p90" % "p99" % "p99.9" % "max" << std::endl;
+	if (mode != "busy")
+		print("blocking", measure(EventLoopRunner::BLOCKING, cpu, period, samples));
+	if (mode != "blocking")
+		print("busy-poll", measure(EventLoopRunner::BUSY_POLL, cpu, period, samples));
+	return 0;
+}
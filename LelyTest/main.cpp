@@ -20,18 +20,22 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <lely/util/diag.h>
 
 #include <lely/ev/loop.hpp>
 
-#include <lely/io2/linux/can.hpp>
 #include <lely/io2/posix/poll.hpp>
 #include <lely/io2/sys/timer.hpp>
 
 #include <lely/coapp/master.hpp>
 #include <lely/coapp/driver.hpp>
 
+#include "BatchedCanChannel.h"
+#include "EventLoopRunner.h"
+#include "RealtimeProfile.h"
 #include "MotorDriver.h"
 #include "DCFConfigMaster.h"
 
@@ -114,7 +118,7 @@ void demoHomingAndMove(std::shared_ptr<DCFConfigMaster> master)
 // Initialize for the following scenario:
 // Motors are controlled through PDOs (fast, follower relationships possible: two motors do exactly the same at the same time.)
 // The reverse PDO mapping feature of Lely 2.1 + YAML configuration of Lely 2.2 is used.
-std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControl(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannel& channel)
+std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControl(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannelBase& channel)
 {
 	auto master = std::make_shared<DCFConfigMaster>(timer, channel, /* dcf description of the master */ "demo/master.dcf", exec);
 	master->setDriverFactory([exec,master](std::shared_ptr<DCFDriverConfig> config)
@@ -141,6 +145,9 @@ std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControl(lely::io::Timer&
 	{
 		if (nodeID == 0)
 		{
+			auto sdoStatistics = master->getTxScheduler()->getStatistics(CanTxScheduler::SDO);
+			diag(DIAG_INFO, 0, "Configuration: %zu SDO requests, %zu of them queued for up to %lld us",
+				 sdoStatistics.frames, sdoStatistics.queuedFrames, static_cast<long long>(sdoStatistics.maxLatency.count()));
 			diag(DIAG_INFO, 0, "Performing a move with two following motors:");
 			demoFollowerMove(master, [master]()
 			{
@@ -150,6 +157,14 @@ std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControl(lely::io::Timer&
 		}
 	});
 
+	// Measure the bus load (500 kbit/s, see demo.yml). The TPDOs of demo.yml only carry the status words, which must not be
+	// throttled by enableTpdoRateControl(): they are event driven without event timer, a delayed change would stall the drivers.
+	master->enableBusLoadMonitoring(500000, std::chrono::milliseconds(500));
+	// Detect a missing motor within 100 ms, overrides heartbeat_consumer: false of demo.yml.
+	master->enableHeartbeatMonitoring(std::chrono::milliseconds(100), 500000);
+	// The configuration of a rebooting motor must not delay the PDOs of the running motors.
+	master->enableTxScheduling(/* SDO requests per second */ 1000);
+
 	return master;
 }
 
@@ -173,7 +188,7 @@ enum PDOGroup {
 	MOTOR_DE_ACCELERATION_PDO   = 0x20
 };
 
-std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControlWithManualMapping(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannel& channel)
+std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControlWithManualMapping(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannelBase& channel)
 {
 	auto master = std::make_shared<DCFConfigMaster>(timer, channel, /* dcf description of the master */ "master.dcf", exec);
 	master->setDriverFactory([exec,master](std::shared_ptr<DCFDriverConfig> config)
@@ -192,12 +207,44 @@ std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControlWithManualMapping(
 		commConfig.setMotorVelocitySetter     (driver->createMasterSDOSetter<uint32_t>(MasterSDO::MOTOR_VELOCITY,      driver->id(), PDOGroup::MOTOR_POSITION_VELOCITY_PDO + driver->id()));
 		commConfig.setMotorAccelerationSetter (driver->createMasterSDOSetter<uint32_t>(MasterSDO::MOTOR_ACCELERATION,  driver->id(), -1));
 		commConfig.setMotorDecelerationSetter (driver->createMasterSDOSetter<uint32_t>(MasterSDO::MOTOR_DECELERATION,  driver->id(), PDOGroup::MOTOR_DE_ACCELERATION_PDO + driver->id()));
-		commConfig.setIsStatusWordCheckForMasterSDOChange([](uint16_t masterIndex, uint8_t masterSubIndex, uint8_t nodeID) -> bool
+		// No IsStatusWordCheck: the driver detects the master objects receiving the status words from the PDOs of master.dcf.
+		driver->setCommunicationConfig(commConfig);
+
+		master->setBootCompletedCallback([master](uint8_t nodeID)
 		{
-			// This lambda is called each time a SDO on the master changes from an external source. But driver is only interested
-			// in changes of the status word.
-			return masterIndex == MasterSDO::MOTOR_STATUSWORD && masterSubIndex == nodeID;
+			if (nodeID == 0)
+				demoFollowerMove(master, [master]()
+				{
+					demoHomingAndMove(master);
+				});
 		});
+
+		return driver;
+	});
+	return master;
+}
+
+// Initialize for the following scenario:
+// Motors are controlled through PDOs, the master PDOs and the master SDOs they are filled from are generated
+// from the PDO configuration of the textual slave DCFs: no manual mapping in the master.dcf necessary.
+std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControlWithGeneratedMapping(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannelBase& channel)
+{
+	auto master = std::make_shared<DCFConfigMaster>(timer, channel, /* dcf description of the master */ "master.dcf", exec);
+	master->setAutomaticPdoMapping(true);
+	master->setDriverFactory([exec,master](std::shared_ptr<DCFDriverConfig> config)
+	{
+		// TODO if multiple different devices are in use: decide up on the config which driver to create.
+		std::shared_ptr<MotorDriver> driver = std::make_shared<MotorDriver>(exec, *master, config);
+
+		MotorDriver::CommunicationConfig commConfig;
+		// As with the manual mapping: the PDO is sent with the value the MotorDriver writes last into it (see the RPDOs in motor.dcf).
+		// The RPDOs of motor.dcf match the PDO layouts of the MotorDriver, so they are sent as raw frames, the generated master objects are kept up to date.
+		commConfig.setMotorOperationModeSetter(driver->createRawPdoSetter<int8_t>  (MotorDriver::MOTOR_OPERATIONMODE, false));
+		commConfig.setMotorControlWordSetter  (driver->createRawPdoSetter<uint16_t>(MotorDriver::MOTOR_CONTROLWORD,   true ));
+		commConfig.setMotorPositionSetter     (driver->createRawPdoSetter<int32_t> (MotorDriver::MOTOR_POSITION,      false));
+		commConfig.setMotorVelocitySetter     (driver->createRawPdoSetter<uint32_t>(MotorDriver::MOTOR_VELOCITY,      true ));
+		commConfig.setMotorAccelerationSetter (driver->createRawPdoSetter<uint32_t>(MotorDriver::MOTOR_ACCELERATION,  false));
+		commConfig.setMotorDecelerationSetter (driver->createRawPdoSetter<uint32_t>(MotorDriver::MOTOR_DECELERATION,  true ));
 		driver->setCommunicationConfig(commConfig);
 
 		master->setBootCompletedCallback([master](uint8_t nodeID)
@@ -219,7 +266,7 @@ std::shared_ptr<DCFConfigMaster> initializeMasterForPdoControlWithManualMapping(
 // simple from code point of view, but with overhead on the CAN bus
 // --> so slow and save, but no follower relationships possible
 // --> for the return channel from the motors to the master PDO communication is still needed.
-std::shared_ptr<DCFConfigMaster> initializeMasterForSdoControl(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannel& channel)
+std::shared_ptr<DCFConfigMaster> initializeMasterForSdoControl(lely::io::Timer& timer, lely::ev::Executor& exec, lely::io::CanChannelBase& channel)
 {
 	auto master = std::make_shared<DCFConfigMaster>(timer, channel, /* dcf description of the master */ "master.dcf", exec);
 	master->setDriverFactory(
@@ -235,12 +282,7 @@ std::shared_ptr<DCFConfigMaster> initializeMasterForSdoControl(lely::io::Timer&
 		commConfig.setMotorVelocitySetter     (driver->createSDOSetter<uint32_t>(MotorDriver::MOTOR_VELOCITY     ));
 		commConfig.setMotorAccelerationSetter (driver->createSDOSetter<uint32_t>(MotorDriver::MOTOR_ACCELERATION ));
 		commConfig.setMotorDecelerationSetter (driver->createSDOSetter<uint32_t>(MotorDriver::MOTOR_DECELERATION ));
-		commConfig.setIsStatusWordCheckForMasterSDOChange([](uint16_t masterIndex, uint8_t masterSubIndex, uint8_t nodeID) -> bool
-		{
-			// This lambda is called each time a SDO on the master changes from an external source. But driver is only interested
-			// in changes of the status word.
-			return masterIndex == MasterSDO::MOTOR_STATUSWORD && masterSubIndex == nodeID;
-		});
+		// No IsStatusWordCheck: the driver detects the master objects receiving the status words from the PDOs of master.dcf.
 		driver->setCommunicationConfig(commConfig);
 
 		master->setBootCompletedCallback([master](uint8_t nodeID)
@@ -261,6 +303,7 @@ int main()
 	std::cout << " 1) PDO communication with Reverse PDO mappings from the YAML config" << std::endl;
 	std::cout << " 2) SDO communication (still using a PDO for staus word changes)" << std::endl;
 	std::cout << " 3) PDO communication with manual PDO mappings on the master and textual DCF config for the slaves" << std::endl;
+	std::cout << " 4) PDO communication with PDO mappings on the master generated from the textual DCF config of the slaves" << std::endl;
 
 	int input = std::getchar();
 
@@ -270,9 +313,12 @@ int main()
 	auto exec = loop.get_executor();
 	lely::io::Timer timer(poll, exec, CLOCK_MONOTONIC);
 
-	lely::io::CanController ctrl("can0");
-	lely::io::CanChannel channel(poll, exec);
-	channel.open(ctrl);
+	// Reads and writes the frames in batches instead of one system call per frame.
+	BatchedCanChannel batchedChannel(ctx, poll, exec);
+	std::error_code error;
+	if (!batchedChannel.open("can0", error))
+		return 1;
+	auto& channel = batchedChannel.getChannel();
 
 	std::shared_ptr<DCFConfigMaster> master = nullptr;
 
@@ -283,14 +329,45 @@ int main()
 		master = initializeMasterForSdoControl(timer, exec, channel);
 	else if (input == '3')
 		master = initializeMasterForPdoControlWithManualMapping(timer, exec, channel);
+	else if (input == '4')
+		master = initializeMasterForPdoControlWithGeneratedMapping(timer, exec, channel);
 	else
 		exit(0);
 
+	// Nodes which did not answer yet and the configuration requests get 1 s, else the timeout follows the measured round trip time of each node.
 	master->SetTimeout(std::chrono::milliseconds(1000));
+	master->enableAdaptiveSdoTimeouts(std::chrono::milliseconds(20), std::chrono::milliseconds(1000));
+
+	// The watchdogs and retry delays of all drivers share one timer.
+	lely::io::Timer timerWheelTimer(poll, exec, CLOCK_MONOTONIC);
+	master->enableTimerWheel(timerWheelTimer);
+
+	// The kernel drops the frames of other controllers on the bus, which the master would ignore anyway.
+	master->enableReceiveFilter(batchedChannel);
+
+	// Locked memory, SCHED_FIFO for this thread (needs CAP_SYS_NICE) and buffered diagnostic messages, written by a normal thread.
+	// The log thread is started first, so it does not inherit the real-time policy of this thread.
+	RealtimeProfile realtimeProfile;
+	std::atomic<bool> running(true);
+	std::thread logThread([&realtimeProfile, &running]()
+	{
+		while (running)
+		{
+			realtimeProfile.flushLog();
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	});
+	if (!realtimeProfile.apply(RealtimeProfile::Config(), error))
+		diag(DIAG_WARNING, 0, "The real-time profile is only partially applied: %s", error.message().c_str());
 
 	master->configureDrivers();
 	master->Reset();
-	loop.run();
+	// BUSY_POLL on a dedicated core (e.g. EventLoopRunner runner(loop, EventLoopRunner::BUSY_POLL, 3)) avoids the wakeup latency.
+	EventLoopRunner runner(loop);
+	runner.run();
+
+	running = false;
+	logThread.join();
 
 	return 0;
 }